@@ -0,0 +1,245 @@
+#include <limits.h>
+#include <string.h>
+
+#include "affine.h"
+
+#define CONST AFFINE_MAX_VARS // index of the constant term
+#define MAX_TRIPS (1UL << 62)
+
+typedef __int128 wide;
+
+// --------- Affine forms ---------
+// Index of the loop variable stored in `slot`, adding it if needed; -1 when full
+static int var_index(AffineLoop *l, int slot) {
+   for (int v = 0; v < l->nvars; v++) {
+      if (l->slots[v] == slot) return v;
+   }
+   if (l->nvars == AFFINE_MAX_VARS) return -1;
+   l->slots[l->nvars] = slot;
+   return l->nvars++;
+}
+
+static bool is_constant(const AffineLoop *l, const AffineForm *f) {
+   for (int v = 0; v < l->nvars; v++) {
+      if (f->c[v]) return false;
+   }
+   return true;
+}
+
+// Rewrites an int expression as an affine form over the loop variables
+static bool form_of(AffineLoop *l, const Expr *e, AffineForm *f) {
+   memset(f, 0, sizeof(*f));
+   if (e->type != EXPR_INT) return false;
+   switch (e->kind) {
+      case EX_CONST:
+         f->c[CONST] = (unsigned long)e->k.i;
+         return true;
+      case EX_VAR: {
+         int v = var_index(l, e->slot);
+         if (v < 0) return false;
+         f->c[v] = 1;
+         return true;
+      }
+      case EX_ADD: case EX_SUB: case EX_MUL:
+         break;
+      default:
+         return false; // division, element access, conversions, nested comparisons
+   }
+   AffineForm a, b;
+   if (!form_of(l, e->lhs, &a) || !form_of(l, e->rhs, &b)) return false;
+   if (e->kind == EX_MUL) {
+      // Only products with a constant factor stay affine
+      const AffineForm *k = is_constant(l, &a) ? &a : is_constant(l, &b) ? &b : NULL;
+      if (!k) return false;
+      const AffineForm *x = k == &a ? &b : &a;
+      for (int i = 0; i <= CONST; i++) f->c[i] = x->c[i] * k->c[CONST];
+      return true;
+   }
+   for (int i = 0; i <= CONST; i++) {
+      f->c[i] = e->kind == EX_ADD ? a.c[i] + b.c[i] : a.c[i] - b.c[i];
+   }
+   return true;
+}
+
+static unsigned long eval_form(const AffineLoop *l, const AffineForm *f, const struct SymbolTable *t) {
+   unsigned long sum = f->c[CONST];
+   for (int v = 0; v < l->nvars; v++) sum += f->c[v] * (unsigned long)t->items[l->slots[v]].value_int;
+   return sum;
+}
+
+// row = f . body: the form f over the state before the statements folded into body so far
+static void compose(const AffineLoop *l, const AffineForm *f, unsigned long *row) {
+   memset(row, 0, sizeof(unsigned long) * (AFFINE_MAX_VARS + 1));
+   for (int k = 0; k <= CONST; k++) {
+      if (k == l->nvars) k = CONST;
+      if (!f->c[k]) continue;
+      for (int j = 0; j <= CONST; j++) {
+         if (j == l->nvars) j = CONST;
+         row[j] += f->c[k] * l->body[k][j];
+      }
+   }
+}
+
+// --------- Analysis ---------
+bool affine_loop_init(AffineLoop *l, const Expr *cond) {
+   l->nvars = 0;
+   l->nstmts = 0;
+   if (!cond || cond->type != EXPR_INT) return false;
+   switch (cond->kind) {
+      case EX_LT: case EX_GT: case EX_LE: case EX_GE: case EX_EQ: case EX_NE:
+         if (cond->operand != EXPR_INT) return false;
+         l->test = cond->kind;
+         return form_of(l, cond->lhs, &l->lhs) && form_of(l, cond->rhs, &l->rhs);
+      default:
+         // A plain int test runs while the value is non-zero
+         l->test = EX_NE;
+         memset(&l->rhs, 0, sizeof(l->rhs));
+         return form_of(l, cond, &l->lhs);
+   }
+}
+
+bool affine_loop_add(AffineLoop *l, int slot, const Expr *value) {
+   if (l->nstmts == AFFINE_MAX_STMTS) return false;
+   int v = var_index(l, slot);
+   if (v < 0 || !form_of(l, value, &l->values[l->nstmts])) return false;
+   l->targets[l->nstmts++] = v;
+   return true;
+}
+
+// Checks that f changes by the same *delta every iteration, whatever the state
+static bool progression(const AffineLoop *l, const AffineForm *f, long *delta) {
+   unsigned long row[AFFINE_MAX_VARS + 1];
+   compose(l, f, row);
+   for (int v = 0; v < l->nvars; v++) {
+      if (row[v] != f->c[v]) return false;
+   }
+   *delta = (long)(row[CONST] - f->c[CONST]);
+   return true;
+}
+
+static bool fits_long(wide x) {
+   return x >= (wide)LONG_MIN && x <= (wide)LONG_MAX;
+}
+
+bool affine_loop_trips(AffineLoop *l, const struct SymbolTable *t, unsigned long *trips) {
+   for (int v = 0; v < l->nvars; v++) {
+      const struct Symbol *s = &t->items[l->slots[v]];
+      if (s->type != TYPE_INT || !s->initialized) return false;
+   }
+
+   // body = S_n ... S_1, where S_i replaces the target row by the statement's form
+   memset(l->body, 0, sizeof(l->body));
+   for (int i = 0; i < l->nvars; i++) l->body[i][i] = 1;
+   l->body[CONST][CONST] = 1;
+   for (size_t i = 0; i < l->nstmts; i++) {
+      unsigned long row[AFFINE_MAX_VARS + 1];
+      compose(l, &l->values[i], row);
+      memcpy(l->body[l->targets[i]], row, sizeof(row));
+   }
+
+   long dl, dr;
+   if (!progression(l, &l->lhs, &dl) || !progression(l, &l->rhs, &dr)) return false;
+   long l0 = (long)eval_form(l, &l->lhs, t), r0 = (long)eval_form(l, &l->rhs, t);
+
+   // The test holds while d0 + n*d compares to 0 like lhs to rhs
+   wide d0 = (wide)l0 - r0, d = (wide)dl - dr, n;
+   switch (l->test) {
+      case EX_LT:
+         if (d0 >= 0) n = 0;
+         else if (d <= 0) return false;
+         else n = (-d0 + d - 1) / d;
+         break;
+      case EX_LE:
+         if (d0 > 0) n = 0;
+         else if (d <= 0) return false;
+         else n = -d0 / d + 1;
+         break;
+      case EX_GT:
+         if (d0 <= 0) n = 0;
+         else if (d >= 0) return false;
+         else n = (d0 - d - 1) / -d;
+         break;
+      case EX_GE:
+         if (d0 < 0) n = 0;
+         else if (d >= 0) return false;
+         else n = d0 / -d + 1;
+         break;
+      case EX_EQ:
+         if (d0 != 0) n = 0;
+         else if (d == 0) return false;
+         else n = 1;
+         break;
+      default: // EX_NE: only ends if the difference steps exactly onto 0
+         if (d0 == 0) n = 0;
+         else if (d == 0 || -d0 % d != 0 || -d0 / d < 0) return false;
+         else n = -d0 / d;
+         break;
+   }
+   if (n > (wide)MAX_TRIPS) return false;
+   // Each side is linear in n, so it never wraps if it fits at both ends; then the
+   // interpreter's wrapped comparisons agree with the exact ones above
+   if (!fits_long(l0 + n * dl) || !fits_long(r0 + n * dr)) return false;
+   *trips = (unsigned long)n;
+   return true;
+}
+
+// --------- Execution ---------
+void affine_loop_step(const AffineLoop *l, size_t stmt, struct SymbolTable *t) {
+   struct Symbol *s = &t->items[l->slots[l->targets[stmt]]];
+   long value = (long)eval_form(l, &l->values[stmt], t);
+   t->hash -= symbol_hash(t, s);
+   s->value_int = value;
+   s->initialized = true;
+   t->hash += symbol_hash(t, s);
+}
+
+typedef unsigned long Matrix[AFFINE_MAX_VARS + 1][AFFINE_MAX_VARS + 1];
+
+// out = a * b over the rows and columns in use
+static void mat_mul(const AffineLoop *l, Matrix a, Matrix b, Matrix out) {
+   for (int i = 0; i <= CONST; i++) {
+      if (i == l->nvars) i = CONST;
+      for (int j = 0; j <= CONST; j++) {
+         if (j == l->nvars) j = CONST;
+         unsigned long sum = 0;
+         for (int k = 0; k <= CONST; k++) {
+            if (k == l->nvars) k = CONST;
+            sum += a[i][k] * b[k][j];
+         }
+         out[i][j] = sum;
+      }
+   }
+}
+
+void affine_loop_advance(const AffineLoop *l, struct SymbolTable *t, unsigned long n) {
+   unsigned long s[AFFINE_MAX_VARS + 1], next[AFFINE_MAX_VARS + 1];
+   for (int v = 0; v < l->nvars; v++) s[v] = (unsigned long)t->items[l->slots[v]].value_int;
+   s[CONST] = 1;
+
+   // s = body^n s, squaring the powers of body as n is consumed bit by bit
+   Matrix p, sq;
+   memcpy(p, l->body, sizeof(p));
+   while (n) {
+      if (n & 1) {
+         for (int i = 0; i < l->nvars; i++) {
+            unsigned long sum = p[i][CONST];
+            for (int k = 0; k < l->nvars; k++) sum += p[i][k] * s[k];
+            next[i] = sum;
+         }
+         memcpy(s, next, sizeof(unsigned long) * (size_t)l->nvars);
+      }
+      n >>= 1;
+      if (n) {
+         mat_mul(l, p, p, sq);
+         memcpy(p, sq, sizeof(p));
+      }
+   }
+
+   for (int v = 0; v < l->nvars; v++) {
+      struct Symbol *sym = &t->items[l->slots[v]];
+      t->hash -= symbol_hash(t, sym);
+      sym->value_int = (long)s[v];
+      sym->initialized = true;
+      t->hash += symbol_hash(t, sym);
+   }
+}
@@ -0,0 +1,76 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "bt.h"
+#include "expr.h"
+
+/*
+ * Closed-form execution of affine loops.
+ *
+ * A while loop qualifies when its body only assigns int variables from sums,
+ * differences and constant multiples of int variables, and its exit test
+ * compares two such expressions whose values change by a fixed amount per
+ * iteration. The body is then a single affine map s' = B s over the vector of
+ * loop variables, so:
+ *  - the trip count follows from the test by one division;
+ *  - the state after n iterations is B^n s, computed by repeated squaring;
+ *  - each statement can be replayed from its own affine form without
+ *    evaluating any expression.
+ * Coupled updates such as `x = x + i; i = i + 2;` give polynomial closed
+ * forms in the iteration number. Everything is computed modulo 2^64, which is
+ * exactly how expr_eval_int wraps, so results match the interpreter bit for
+ * bit; the exit test is only trusted while neither side can wrap.
+ */
+
+#define AFFINE_MAX_VARS  32 // a SymbolTable holds at most 32 symbols
+#define AFFINE_MAX_STMTS 64
+
+// c[0..nvars) are coefficients of the loop variables, c[AFFINE_MAX_VARS] the constant
+typedef struct {
+   unsigned long c[AFFINE_MAX_VARS + 1];
+} AffineForm;
+
+typedef struct {
+   int nvars;
+   int slots[AFFINE_MAX_VARS]; // SymbolTable slot of each loop variable
+   size_t nstmts;
+   int targets[AFFINE_MAX_STMTS];       // loop variable assigned by each statement
+   AffineForm values[AFFINE_MAX_STMTS]; // value assigned by each statement
+   ExprKind test;                       // the loop runs while lhs <test> rhs
+   AffineForm lhs, rhs;
+   unsigned long body[AFFINE_MAX_VARS + 1][AFFINE_MAX_VARS + 1]; // one iteration, built by affine_loop_trips
+} AffineLoop;
+
+/**
+ * @brief Starts the analysis of a loop from its compiled WANT_CONDITION test
+ * @return false if the test is not an int comparison of affine expressions
+ */
+bool affine_loop_init(AffineLoop *l, const Expr *cond);
+
+/**
+ * @brief Appends the body statement `items[slot] = value`
+ * @return false if the statement is not affine (the loop does not qualify)
+ */
+bool affine_loop_add(AffineLoop *l, int slot, const Expr *value);
+
+/**
+ * @brief Computes how many more iterations the loop runs from the state in t
+ * @return false if that cannot be decided exactly: the loop never ends, a side of the
+ * test would wrap around, or a loop variable is uninitialized
+ */
+bool affine_loop_trips(AffineLoop *l, const struct SymbolTable *t, unsigned long *trips);
+
+/**
+ * @brief Executes body statement `stmt` on t
+ */
+void affine_loop_step(const AffineLoop *l, size_t stmt, struct SymbolTable *t);
+
+/**
+ * @brief Executes n whole iterations on t in O(log n) matrix products
+ * Requires a successful affine_loop_trips().
+ */
+void affine_loop_advance(const AffineLoop *l, struct SymbolTable *t, unsigned long n);
+
+#endif
@@ -0,0 +1,614 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "bt.h"
+#include "expr.h"
+#include "lexer.h"
+#include "parser.h"
+#include "program.h"
+#include "strbuf.h"
+
+// The lanes of a variable are held in 32-byte vectors of longs: one AVX register or two SSE
+// ones, whichever the compiler targets
+#define LANE_VEC_BYTES 32
+#define VEC_LANES (LANE_VEC_BYTES / sizeof(long))
+// Inputs run together; a divergent loop keeps at most the rest of its block idle
+#define BLOCK_VECS 16
+#define BLOCK_LANES (VEC_LANES * BLOCK_VECS)
+
+// Rows the interpreter runs per session call for the inputs that fall back to it
+#define BATCH_CHUNK_ROWS 4096
+
+// As many variables as a SymbolTable holds
+#define BATCH_MAX_VARS (sizeof(((struct SymbolTable *)0)->items) / sizeof(struct Symbol))
+#define BATCH_NAME_MAX sizeof(((struct Symbol *)0)->name)
+
+typedef long LaneVec __attribute__((vector_size(LANE_VEC_BYTES)));
+typedef unsigned long LaneUVec __attribute__((vector_size(LANE_VEC_BYTES)));
+
+// One value per lane of a block
+typedef LaneVec Lanes[BLOCK_VECS];
+
+// --------- Input table ---------
+typedef struct {
+   char names[BATCH_MAX_VARS][BATCH_NAME_MAX];
+   size_t vars;    // columns
+   long *values;   // `vars` values per input, input after input
+   size_t count, cap;
+} BatchInputs;
+
+static bool is_separator(char c) {
+   return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+// Moves past the next field of the line ending at end; false when there is none
+static bool next_field(const char **p, const char *end, const char **field, size_t *len) {
+   while (*p < end && is_separator(**p)) (*p)++;
+   if (*p == end) return false;
+   *field = *p;
+   while (*p < end && !is_separator(**p)) (*p)++;
+   *len = (size_t)(*p - *field);
+   return true;
+}
+
+static bool is_identifier(const char *s, size_t n) {
+   if (n == 0 || n >= BATCH_NAME_MAX || !(isalpha((unsigned char)s[0]) || s[0] == '_')) return false;
+   for (size_t i = 1; i < n; i++) {
+      if (!(isalnum((unsigned char)s[i]) || s[i] == '_')) return false;
+   }
+   return true;
+}
+
+static bool parse_header(BatchInputs *in, const char *name, size_t line, const char *p, const char *end) {
+   const char *f;
+   size_t n;
+   while (next_field(&p, end, &f, &n)) {
+      if (!is_identifier(f, n)) {
+         fprintf(bt_err(), "Error: %s:%zu: '%.*s' is not a variable name.\n", name, line, (int)n, f);
+         return false;
+      }
+      if (in->vars == BATCH_MAX_VARS) {
+         fprintf(bt_err(), "Error: %s:%zu: more than %zu variables.\n", name, line, (size_t)BATCH_MAX_VARS);
+         return false;
+      }
+      memcpy(in->names[in->vars], f, n);
+      in->names[in->vars][n] = '\0';
+      for (size_t v = 0; v < in->vars; v++) {
+         if (strcmp(in->names[v], in->names[in->vars]) == 0) {
+            fprintf(bt_err(), "Error: %s:%zu: variable '%s' is listed twice.\n", name, line, in->names[v]);
+            return false;
+         }
+      }
+      in->vars++;
+   }
+   return true;
+}
+
+static bool parse_row(BatchInputs *in, const char *name, size_t line, const char *p, const char *end) {
+   if (in->count == in->cap) {
+      size_t cap = in->cap ? in->cap * 2 : 64;
+      long *values = (long *)realloc(in->values, cap * in->vars * sizeof(long));
+      if (!values) {
+         fprintf(bt_err(), "Error: Out of memory.\n");
+         return false;
+      }
+      in->values = values;
+      in->cap = cap;
+   }
+   long *row = in->values + in->count * in->vars;
+   const char *f;
+   size_t n, col = 0;
+   while (next_field(&p, end, &f, &n)) {
+      char digits[32];
+      char *stop = NULL;
+      if (col == in->vars) {
+         fprintf(bt_err(), "Error: %s:%zu: more values than the %zu variables.\n", name, line, in->vars);
+         return false;
+      }
+      if (n < sizeof(digits)) {
+         memcpy(digits, f, n);
+         digits[n] = '\0';
+         errno = 0;
+         row[col] = strtol(digits, &stop, 10);
+      }
+      if (!stop || *stop != '\0' || stop == digits || errno == ERANGE) {
+         fprintf(bt_err(), "Error: %s:%zu: '%.*s' is not an int.\n", name, line, (int)n, f);
+         return false;
+      }
+      col++;
+   }
+   if (col < in->vars) {
+      fprintf(bt_err(), "Error: %s:%zu: expected %zu values but found %zu.\n", name, line, in->vars, col);
+      return false;
+   }
+   in->count++;
+   return true;
+}
+
+// A header line of names, then a line of values per input; '#' starts a comment line
+static bool parse_inputs(BatchInputs *in, const char *name, const char *text) {
+   size_t line = 0;
+   bool header = false;
+   for (const char *p = text; *p;) {
+      const char *nl = strchr(p, '\n');
+      const char *end = nl ? nl : p + strlen(p);
+      const char *q = p, *f;
+      size_t n;
+      line++;
+      p = nl ? nl + 1 : end;
+      if (!next_field(&q, end, &f, &n) || f[0] == '#') continue;
+      if (!(header ? parse_row(in, name, line, f, end) : parse_header(in, name, line, f, end))) return false;
+      header = true;
+   }
+   if (in->vars == 0) {
+      fprintf(bt_err(), "Error: %s: expected a header line of variable names.\n", name);
+      return false;
+   }
+   return true;
+}
+
+// --------- Lane programs ---------
+typedef enum {
+   BATCH_DECLARE, // int var; or int var = value;
+   BATCH_ASSIGN,  // var = value;
+   BATCH_WHILE    // while (value) { the statements before `end` }
+} BatchOp;
+
+typedef struct {
+   BatchOp op;
+   int var;
+   Expr *value; // NULL for a declaration without initializer
+   size_t end;  // BATCH_WHILE: index of the statement after the body
+} BatchStmt;
+
+typedef struct {
+   BatchStmt *stmts;
+   size_t count, cap;
+   struct SymbolTable vars; // every variable, as an int: the inputs, then the others in order of appearance
+} BatchProgram;
+
+static bool is_punct(const Token *tok, const char *p) {
+   return tok->type == TOKEN_PUNCTUATION && strcmp(tok->value, p) == 0;
+}
+
+static bool is_keyword(const Token *tok, const char *k) {
+   return tok->type == TOKEN_KEYWORD && strcmp(tok->value, k) == 0;
+}
+
+static bool is_assign(const Token *tok) {
+   return tok->type == TOKEN_IDENTIFIER && (tok + 1)->type == TOKEN_OPERATOR && strcmp((tok + 1)->value, "=") == 0;
+}
+
+// Whether the lanes can evaluate e: int arithmetic and comparisons over int variables
+static bool lane_expr(const Expr *e) {
+   if (!e || e->type != EXPR_INT) return false;
+   switch (e->kind) {
+      case EX_CONST:
+      case EX_VAR:
+         return true;
+      case EX_ADD: case EX_SUB: case EX_MUL: case EX_DIV:
+         return lane_expr(e->lhs) && lane_expr(e->rhs);
+      case EX_LT: case EX_GT: case EX_LE: case EX_GE: case EX_EQ: case EX_NE:
+         return e->operand == EXPR_INT && lane_expr(e->lhs) && lane_expr(e->rhs);
+      default:
+         return false;
+   }
+}
+
+// Appends a statement, false unless the lanes can evaluate its value; takes ownership of value
+static bool push_stmt(BatchProgram *p, BatchOp op, int var, Expr *value, bool has_value) {
+   if (p->count == p->cap) {
+      size_t cap = p->cap ? p->cap * 2 : 16;
+      BatchStmt *stmts = (BatchStmt *)realloc(p->stmts, cap * sizeof(BatchStmt));
+      if (!stmts) {
+         expr_free(value);
+         return false;
+      }
+      p->stmts = stmts;
+      p->cap = cap;
+   }
+   BatchStmt *s = &p->stmts[p->count++];
+   s->op = op;
+   s->var = var;
+   s->value = value;
+   s->end = 0;
+   return has_value ? lane_expr(value) : true;
+}
+
+static int var_index(BatchProgram *p, const char *name) {
+   return (int)(find(&p->vars, name) - p->vars.items);
+}
+
+// Compiles the statements up to the '}' closing the body (or EOF at top level); false for
+// anything the lanes cannot run
+static bool compile_body(BatchProgram *p, Token **tokens, bool top) {
+   for (;;) {
+      Token *t = *tokens;
+      if (t->type == TOKEN_END_OF_FILE) return top;
+      if (is_punct(t, "}")) {
+         *tokens = t + 1;
+         return !top;
+      }
+      if (is_keyword(t, "while")) {
+         if (!is_punct(t + 1, "(")) return false;
+         *tokens = t + 2;
+         size_t at = p->count;
+         if (!push_stmt(p, BATCH_WHILE, -1, expr_truth(expr_compile(tokens, &p->vars, true)), true)) return false;
+         if (!is_punct(*tokens, ")") || !is_punct(*tokens + 1, "{")) return false;
+         *tokens += 2;
+         if (!compile_body(p, tokens, false)) return false;
+         p->stmts[at].end = p->count;
+         continue;
+      }
+      Expr *value = NULL;
+      bool has_value = true;
+      BatchOp op;
+      if (is_keyword(t, "int") && is_assign(t + 1)) {
+         op = BATCH_DECLARE;
+         *tokens = t + 3;
+         value = expr_cast(expr_compile(tokens, &p->vars, false), EXPR_INT);
+      } else if (is_keyword(t, "int") && (t + 1)->type == TOKEN_IDENTIFIER && is_punct(t + 2, ";")) {
+         op = BATCH_DECLARE;
+         *tokens = t + 2;
+         has_value = false;
+      } else if (is_assign(t)) {
+         op = BATCH_ASSIGN;
+         *tokens = t + 2;
+         value = expr_compile(tokens, &p->vars, false);
+      } else {
+         return false;
+      }
+      const char *name = (t->type == TOKEN_KEYWORD ? t + 1 : t)->value;
+      if (!push_stmt(p, op, var_index(p, name), value, has_value) || !is_punct(*tokens, ";")) return false;
+      (*tokens)++;
+   }
+}
+
+static void batch_program_free(BatchProgram *p) {
+   for (size_t i = 0; i < p->count; i++) expr_free(p->stmts[i].value);
+   free(p->stmts);
+}
+
+// Compiles the program for the lanes; false when some part of it needs the interpreter.
+// Release p with batch_program_free either way.
+static bool batch_compile(BatchProgram *p, Token *tokens, const BatchInputs *in) {
+   memset(p, 0, sizeof(*p));
+   // Bind every name first, so expressions compile to fixed variable indices
+   bool ok = true;
+   for (size_t v = 0; v < in->vars; v++) ok = ok && add(&p->vars, in->names[v], TYPE_INT, NULL, 0);
+   for (Token *t = tokens; ok && t->type != TOKEN_END_OF_FILE; t++) {
+      bool declared = t > tokens && is_keyword(t - 1, "int") && t->type == TOKEN_IDENTIFIER;
+      if ((declared || is_assign(t)) && !find(&p->vars, t->value)) ok = add(&p->vars, t->value, TYPE_INT, NULL, 0);
+   }
+   if (!ok) return false;
+
+   // Programs the lanes cannot run compile with errors the interpreter reports in its own runs
+   char *discard = NULL;
+   size_t discard_len = 0;
+   FILE *quiet = open_memstream(&discard, &discard_len);
+   if (!quiet) return false;
+   FILE *out, *err;
+   bt_get_streams(&out, &err);
+   bt_set_streams(out, quiet);
+   ok = compile_body(p, &tokens, true);
+   bt_set_streams(out, err);
+   bt_set_location(0, 0);
+   fclose(quiet);
+   free(discard);
+   return ok;
+}
+
+// --------- Lane execution ---------
+typedef struct {
+   Lanes val[BATCH_MAX_VARS];
+   Lanes init[BATCH_MAX_VARS]; // all ones in the lanes where the variable holds a value
+   Lanes born[BATCH_MAX_VARS]; // the variable's slot in the lane's table, from 1; 0 while unbound
+   Lanes next;                 // the slot the lane binds next
+   Lanes fault;                // lanes left to the interpreter
+   Lanes steps, iterations;    // budget counts
+   const struct ExecLimits *limits;
+   struct timespec start;
+} LaneBlock;
+
+static bool lanes_any(const LaneVec *m) {
+   LaneVec acc = m[0];
+   for (int k = 1; k < BLOCK_VECS; k++) acc |= m[k];
+   for (size_t j = 0; j < VEC_LANES; j++) {
+      if (acc[j]) return true;
+   }
+   return false;
+}
+
+// Every lane set to v (vectors are not passed by value: without AVX that changes the ABI)
+#define BROADCAST(v) ((LaneVec){ 0 } + (long)(v))
+
+// Integer division has no vector instruction; each active lane divides as expr_eval_int does
+static void lanes_divide(LaneVec *l, const LaneVec *r, const LaneVec *active, LaneVec *fault) {
+   for (size_t j = 0; j < VEC_LANES; j++) {
+      if (!(*active)[j] || (*r)[j] == 0) {
+         if ((*active)[j]) (*fault)[j] = -1;
+         (*l)[j] = 0;
+      } else {
+         (*l)[j] = (*r)[j] == -1 ? (long)(0UL - (unsigned long)(*l)[j]) : (*l)[j] / (*r)[j];
+      }
+   }
+}
+
+// Evaluates e in every lane; active lanes that read an unset variable or divide by zero fault
+static void lanes_eval(const Expr *e, LaneBlock *b, const LaneVec *active, LaneVec *out) {
+   switch (e->kind) {
+      case EX_CONST:
+         for (int k = 0; k < BLOCK_VECS; k++) out[k] = BROADCAST(e->k.i);
+         return;
+      case EX_VAR:
+         for (int k = 0; k < BLOCK_VECS; k++) {
+            out[k] = b->val[e->slot][k];
+            b->fault[k] |= active[k] & ~b->init[e->slot][k];
+         }
+         return;
+      default:
+         break;
+   }
+   Lanes r;
+   lanes_eval(e->lhs, b, active, out);
+   lanes_eval(e->rhs, b, active, r);
+   // ints wrap around modulo 2^64, as in expr_eval_int; comparisons yield all ones where they
+   // hold, so their truth value is the negation
+   for (int k = 0; k < BLOCK_VECS; k++) {
+      switch (e->kind) {
+         case EX_ADD: out[k] = (LaneVec)((LaneUVec)out[k] + (LaneUVec)r[k]); break;
+         case EX_SUB: out[k] = (LaneVec)((LaneUVec)out[k] - (LaneUVec)r[k]); break;
+         case EX_MUL: out[k] = (LaneVec)((LaneUVec)out[k] * (LaneUVec)r[k]); break;
+         case EX_DIV: lanes_divide(&out[k], &r[k], &active[k], &b->fault[k]); break;
+         case EX_LT:  out[k] = -(out[k] < r[k]); break;
+         case EX_GT:  out[k] = -(out[k] > r[k]); break;
+         case EX_LE:  out[k] = -(out[k] <= r[k]); break;
+         case EX_GE:  out[k] = -(out[k] >= r[k]); break;
+         case EX_EQ:  out[k] = -(out[k] == r[k]); break;
+         default:     out[k] = -(out[k] != r[k]); break;
+      }
+   }
+}
+
+// Counts one step or iteration in the active lanes and retires those at the budget: the
+// interpreter then stops them where a separate run would
+static void lanes_charge(LaneBlock *b, LaneVec *count, unsigned long limit, LaneVec *active) {
+   for (int k = 0; k < BLOCK_VECS; k++) {
+      count[k] -= active[k];
+      if (!limit) continue;
+      LaneVec over = active[k] & (count[k] >= BROADCAST(limit));
+      b->fault[k] |= over;
+      active[k] &= ~over;
+   }
+}
+
+// Gives the variable its slot in the lanes of mask that have not bound it yet
+static void lanes_bind(LaneBlock *b, int var, const LaneVec *mask) {
+   for (int k = 0; k < BLOCK_VECS; k++) {
+      LaneVec fresh = mask[k] & (b->born[var][k] == BROADCAST(0));
+      b->born[var][k] |= b->next[k] & fresh;
+      b->next[k] -= fresh;
+   }
+}
+
+static bool lanes_late(const LaneBlock *b) {
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   long ms = (long)(now.tv_sec - b->start.tv_sec) * 1000 + (now.tv_nsec - b->start.tv_nsec) / 1000000;
+   return ms >= (long)b->limits->max_time_ms;
+}
+
+static void lanes_run(const BatchProgram *p, size_t lo, size_t hi, LaneBlock *b, const LaneVec *active_in);
+
+// Runs the loop at stmts[at] until its condition fails in every lane
+static void lanes_loop(const BatchProgram *p, size_t at, LaneBlock *b, const LaneVec *active) {
+   const BatchStmt *s = &p->stmts[at];
+   Lanes m, c;
+   memcpy(m, active, sizeof(m));
+   for (;;) {
+      lanes_eval(s->value, b, m, c);
+      for (int k = 0; k < BLOCK_VECS; k++) m[k] &= ~b->fault[k] & (c[k] != BROADCAST(0));
+      lanes_charge(b, b->iterations, b->limits->max_iterations, m);
+      if (!lanes_any(m)) return;
+      if (b->limits->max_time_ms && lanes_late(b)) {
+         for (int k = 0; k < BLOCK_VECS; k++) b->fault[k] |= m[k];
+         return;
+      }
+      lanes_run(p, at + 1, s->end, b, m);
+      for (int k = 0; k < BLOCK_VECS; k++) m[k] &= ~b->fault[k];
+      lanes_charge(b, b->steps, b->limits->max_steps, m); // the next test
+   }
+}
+
+static void lanes_run(const BatchProgram *p, size_t lo, size_t hi, LaneBlock *b, const LaneVec *active_in) {
+   Lanes active, ok, v;
+   memcpy(active, active_in, sizeof(active));
+   for (size_t i = lo; i < hi;) {
+      const BatchStmt *s = &p->stmts[i];
+      for (int k = 0; k < BLOCK_VECS; k++) active[k] &= ~b->fault[k];
+      lanes_charge(b, b->steps, b->limits->max_steps, active);
+      if (!lanes_any(active)) return;
+      if (s->op == BATCH_WHILE) {
+         lanes_loop(p, i, b, active);
+         i = s->end;
+         continue;
+      }
+      if (s->op == BATCH_DECLARE) {
+         // A declaration (re)starts the variable unset, in the slot it already has
+         lanes_bind(b, s->var, active);
+         for (int k = 0; k < BLOCK_VECS; k++) b->init[s->var][k] &= ~active[k];
+      }
+      if (s->value) {
+         lanes_eval(s->value, b, active, v);
+         for (int k = 0; k < BLOCK_VECS; k++) {
+            ok[k] = active[k] & ~b->fault[k];
+            b->val[s->var][k] = (v[k] & ok[k]) | (b->val[s->var][k] & ~ok[k]);
+            b->init[s->var][k] |= ok[k];
+         }
+         lanes_bind(b, s->var, ok);
+      }
+      i++;
+   }
+}
+
+// Loads inputs first .. first + n - 1 into the lanes; the other lanes stay inactive
+static void lanes_start(LaneBlock *b, const BatchInputs *in, size_t first, size_t n,
+                        const struct ExecLimits *limits, LaneVec *active) {
+   memset(b, 0, sizeof(*b));
+   b->limits = limits;
+   clock_gettime(CLOCK_MONOTONIC, &b->start);
+   for (size_t lane = 0; lane < BLOCK_LANES; lane++) {
+      size_t k = lane / VEC_LANES, j = lane % VEC_LANES;
+      active[k][j] = lane < n ? -1 : 0;
+      b->next[k][j] = (long)in->vars + 1;
+      if (lane >= n) continue;
+      for (size_t v = 0; v < in->vars; v++) {
+         b->val[v][k][j] = in->values[(first + lane) * in->vars + v];
+         b->init[v][k][j] = -1;
+         b->born[v][k][j] = (long)v + 1;
+      }
+   }
+}
+
+// Appends the lane's final binding table, its variables in the order the lane bound them
+static void lanes_format(const BatchProgram *p, const LaneBlock *b, size_t lane, StrBuf *line) {
+   size_t k = lane / VEC_LANES, j = lane % VEC_LANES;
+   struct SymbolTable t;
+   t.count = 0;
+   t.layout = 0;
+   t.hash = 0;
+   for (long slot = 1; slot < b->next[k][j]; slot++) {
+      for (size_t v = 0; v < p->vars.count; v++) {
+         if (b->born[v][k][j] != slot) continue;
+         long value = b->val[v][k][j];
+         add(&t, p->vars.items[v].name, TYPE_INT, b->init[v][k][j] ? &value : NULL, 0);
+         break;
+      }
+   }
+   format_binding_table(&t, line);
+}
+
+// --------- Interpreted inputs ---------
+// Runs input `row` in a session and appends its final binding table to line, then the
+// reason a budget stopped it, if one did; false when out of memory
+static bool run_input(Token *tokens, const BatchInputs *in, size_t row, const struct ExecLimits *limits,
+                      bool loop_summary, FILE *err_f, StrBuf *line, bool *truncated) {
+   ExecSession *s = exec_session_open(tokens, limits, loop_summary);
+   bool ok = s && exec_session_keep_final(s);
+   for (size_t v = 0; ok && v < in->vars; v++) {
+      ok = exec_session_bind_int(s, in->names[v], in->values[row * in->vars + v]);
+   }
+   if (!ok) {
+      exec_session_close(s);
+      return false;
+   }
+   exec_session_hash_rows(s);
+   FILE *out, *err;
+   bt_get_streams(&out, &err);
+   bt_set_streams(out, err_f);
+   while (!exec_session_done(s)) {
+      size_t count = 0;
+      TableRow *rows = exec_session_step(s, BATCH_CHUNK_ROWS, 0, &count);
+      free_rows(rows, count);
+   }
+   bt_set_streams(out, err);
+   format_binding_table(exec_session_final_table(s), line);
+   const char *reason = exec_session_truncated(s);
+   if (reason) {
+      sb_puts(line, " [truncated: ");
+      sb_puts(line, reason);
+      sb_putc(line, ']');
+      *truncated = true;
+   }
+   exec_session_close(s);
+   return true;
+}
+
+// Replays the captured diagnostics as "input N: line:col: Error: ..."
+static void print_diagnostics(size_t input, const char *text, size_t len) {
+   FILE *out, *err;
+   bt_get_streams(&out, &err);
+   if (!err) err = stderr;
+   for (const char *p = text, *end = text + len; p < end;) {
+      const char *nl = memchr(p, '\n', (size_t)(end - p));
+      size_t n = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+      fprintf(err, "input %zu: %.*s", input, (int)n, p);
+      p += n;
+   }
+}
+
+int batch_source(const char *inputs_name, const char *inputs, const char *code, const struct RunOptions *o) {
+   BatchInputs in;
+   memset(&in, 0, sizeof(in));
+   if (!parse_inputs(&in, inputs_name, inputs)) {
+      free(in.values);
+      return 2;
+   }
+   // The lexer reports its own errors
+   Program prog;
+   if (!program_load(&prog, code, o->program_cache)) {
+      free(in.values);
+      return 1;
+   }
+   // No text is held
+   struct ExecLimits limits = o->limits;
+   limits.max_trace_bytes = 0;
+
+   BatchProgram lanes_prog;
+   LaneBlock *b = NULL;
+   if (batch_compile(&lanes_prog, prog.tokens, &in)) {
+      b = (LaneBlock *)aligned_alloc(_Alignof(LaneBlock), sizeof(LaneBlock));
+   }
+
+   FILE *out = bt_out();
+   StrBuf line = SB_INIT;
+   size_t in_lanes = 0, interpreted = 0;
+   bool truncated = false, failed = false;
+   Lanes active;
+   for (size_t first = 0; first < in.count && !failed; first += BLOCK_LANES) {
+      size_t n = in.count - first < BLOCK_LANES ? in.count - first : BLOCK_LANES;
+      if (b) {
+         lanes_start(b, &in, first, n, &limits, active);
+         lanes_run(&lanes_prog, 0, lanes_prog.count, b, active);
+      }
+      for (size_t lane = 0; lane < n && !failed; lane++) {
+         size_t row = first + lane;
+         sb_clear(&line);
+         if (b && !b->fault[lane / VEC_LANES][lane % VEC_LANES]) {
+            lanes_format(&lanes_prog, b, lane, &line);
+            in_lanes++;
+            fprintf(out, "%zu: %s\n", row + 1, line.failed ? "" : line.data);
+            failed = line.failed;
+            continue;
+         }
+         char *diag = NULL;
+         size_t diag_len = 0;
+         FILE *err_f = open_memstream(&diag, &diag_len);
+         failed = !err_f || !run_input(prog.tokens, &in, row, &limits, o->loop_summary, err_f, &line, &truncated) ||
+                  line.failed;
+         interpreted++;
+         if (!failed) fprintf(out, "%zu: %s\n", row + 1, line.data);
+         fflush(out);
+         if (err_f) fclose(err_f);
+         print_diagnostics(row + 1, diag, diag_len);
+         free(diag);
+      }
+   }
+   if (failed) {
+      fprintf(bt_err(), "Error: Out of memory.\n");
+   } else {
+      fprintf(out, "Inputs: %zu (%zu in lanes, %zu interpreted).\n", in.count, in_lanes, interpreted);
+   }
+
+   sb_free(&line);
+   free(b);
+   batch_program_free(&lanes_prog);
+   program_release(&prog);
+   free(in.values);
+   return failed ? 2 : truncated ? RUN_EXIT_TRUNCATED : 0;
+}
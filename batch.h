@@ -0,0 +1,36 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "run.h"
+
+/*
+ * bt --batch: runs one program over many initial states, e.g. a parameter sweep,
+ * and prints the final binding table of each. The inputs are a table: a header
+ * line of variable names, then one line of int values per input (separated by
+ * spaces or commas; blank lines and lines starting with '#' are skipped). Each
+ * input binds its variables as ints before the first statement, as assignments
+ * ahead of the program would.
+ *
+ * Programs made of int declarations, assignments and while loops over int
+ * arithmetic run once for a block of inputs at a time: every variable is a
+ * vector with one lane per input, expressions are evaluated a vector at a time,
+ * and loops keep a mask of the lanes whose condition still holds. Any other
+ * program, and any input that hits a runtime error or a budget, runs through
+ * the interpreter instead, so each result (and diagnostic) is the one a
+ * separate run would have produced.
+ */
+
+/**
+ * @brief Runs the program once per input and prints "N: S = {...}" per input on bt_out()
+ * A summary line follows; diagnostics go to bt_err(), prefixed by "input N: ".
+ * @return 0 on success, RUN_EXIT_TRUNCATED when a budget stopped some input, 1 when the
+ * program does not tokenize, 2 for a malformed input table or when memory runs out
+ * @param inputs_name Display name of the input table, for its diagnostics
+ * @param inputs The null-terminated input table
+ * @param code The null-terminated program source
+ * @param o The budgets, --loop-summary and --program-cache apply; --max-trace-bytes does
+ * not, as no text is held
+ */
+int batch_source(const char *inputs_name, const char *inputs, const char *code, const struct RunOptions *o);
+
+#endif
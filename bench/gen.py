@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Synthetic program generator for the bt benchmark suite.
+
+Each knob scales one dimension of the workload independently:
+
+  --decls N      int declarations at the top (the symbol table holds 32)
+  --trips N      trip count of the main while loop
+  --depth N      nesting depth of while loops inside the main loop
+  --expr N       number of terms in each generated expression
+  --length N     straight-line assignments after the loop
+
+Example: python3 bench/gen.py --trips 1000 --depth 2 > /tmp/prog.c
+"""
+import argparse
+import sys
+
+# Trip count of each nested (inner) loop; depth d multiplies work by INNER_TRIPS**d
+INNER_TRIPS = 3
+
+
+def expression(n, names):
+    """n-term expression alternating + and - over existing names and small constants."""
+    terms = []
+    for k in range(n):
+        term = names[k % len(names)] if k % 3 != 2 else str(k % 7 + 1)
+        if k % 5 == 4:
+            term = f"({term} * 2)"
+        terms.append(term)
+    out = terms[0]
+    for k, term in enumerate(terms[1:], 1):
+        out += (" + " if k % 2 else " - ") + term
+    return out
+
+
+def generate(decls=4, trips=10, depth=0, expr=2, length=0):
+    decls = max(decls, 1)
+    names = [f"v{k}" for k in range(decls)]
+    counters = ["i"] + [f"j{d}" for d in range(depth)]
+    lines = []
+    for name in counters + ["acc"] + names:
+        lines.append(f"int {name};")
+    for name in counters + ["acc"]:
+        lines.append(f"{name} = 0;")
+    for k, name in enumerate(names):
+        lines.append(f"{name} = {k % 9 + 1};")
+
+    def body(level, indent):
+        pad = "   " * indent
+        out = [f"{pad}acc = {expression(expr, names + ['acc'])};"]
+        if level < depth:
+            c = counters[level + 1]
+            out.append(f"{pad}{c} = 0;")
+            out.append(f"{pad}while ({c} < {INNER_TRIPS}) {{")
+            out += body(level + 1, indent + 1)
+            out.append(f"{pad}   {c} = {c} + 1;")
+            out.append(f"{pad}}}")
+        return out
+
+    lines.append(f"while (i < {trips}) {{")
+    lines += body(0, 1)
+    lines.append("   i = i + 1;")
+    lines.append("}")
+    for k in range(length):
+        target = names[k % len(names)]
+        lines.append(f"{target} = {expression(expr, names)};")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--decls", type=int, default=4)
+    ap.add_argument("--trips", type=int, default=10)
+    ap.add_argument("--depth", type=int, default=0)
+    ap.add_argument("--expr", type=int, default=2)
+    ap.add_argument("--length", type=int, default=0)
+    args = ap.parse_args()
+    sys.stdout.write(generate(args.decls, args.trips, args.depth, args.expr, args.length))
+
+
+if __name__ == "__main__":
+    main()
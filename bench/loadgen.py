@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Concurrent load generator for the bt daemon or the web app.
+
+Examples:
+  ./bt --serve /tmp/bt.sock --workers 8 &
+  python3 bench/loadgen.py --socket /tmp/bt.sock -c 8 -n 5000 examples/test.c
+  python3 bench/loadgen.py --url http://127.0.0.1:5000/run -c 8 -n 500
+  make libbt.so && python3 bench/loadgen.py --lib -c 8 -n 5000
+"""
+import argparse
+import os
+import sys
+import threading
+import time
+import urllib.parse
+import urllib.request
+
+REPO_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+sys.path.insert(0, os.path.join(REPO_ROOT, "web"))
+from btclient import BtClient  # noqa: E402
+
+
+def percentile(sorted_vals, p):
+    if not sorted_vals:
+        return 0.0
+    k = min(len(sorted_vals) - 1, int(round(p / 100.0 * (len(sorted_vals) - 1))))
+    return sorted_vals[k]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    target = ap.add_mutually_exclusive_group(required=True)
+    target.add_argument("--socket", help="Unix socket of a running `bt --serve`")
+    target.add_argument("--url", help="URL of the web app's /run endpoint")
+    target.add_argument("--lib", action="store_true", help="call libbt.so in-process")
+    ap.add_argument("-c", "--concurrency", type=int, default=4)
+    ap.add_argument("-n", "--requests", type=int, default=1000)
+    ap.add_argument("program", nargs="?", default=os.path.join(REPO_ROOT, "examples", "test.c"))
+    args = ap.parse_args()
+
+    with open(args.program, "rb") as f:
+        code = f.read()
+
+    if args.socket:
+        client = BtClient(args.socket, size=args.concurrency)
+
+        def one():
+            status, _, _ = client.run(code)
+            return status == 0
+    elif args.lib:
+        from libbt import LibBt
+        lib = LibBt()
+
+        def one():
+            status, _, _ = lib.run(code)
+            return status == 0
+    else:
+        body = urllib.parse.urlencode({"code": code.decode("utf-8")}).encode()
+
+        def one():
+            with urllib.request.urlopen(args.url, data=body) as resp:
+                return resp.status == 200
+
+    latencies = []
+    errors = [0]
+    lock = threading.Lock()
+    remaining = [args.requests]
+
+    def worker():
+        local = []
+        while True:
+            with lock:
+                if remaining[0] == 0:
+                    break
+                remaining[0] -= 1
+            t0 = time.perf_counter()
+            ok = one()
+            local.append(time.perf_counter() - t0)
+            if not ok:
+                with lock:
+                    errors[0] += 1
+        with lock:
+            latencies.extend(local)
+
+    threads = [threading.Thread(target=worker) for _ in range(args.concurrency)]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+
+    latencies.sort()
+    ms = lambda s: s * 1000.0  # noqa: E731
+    print(f"requests:    {len(latencies)} ({errors[0]} errors), concurrency {args.concurrency}")
+    print(f"throughput:  {len(latencies) / elapsed:.0f} req/s")
+    print(f"latency ms:  p50 {ms(percentile(latencies, 50)):.3f}  p90 {ms(percentile(latencies, 90)):.3f}  "
+          f"p99 {ms(percentile(latencies, 99)):.3f}  max {ms(latencies[-1] if latencies else 0):.3f}")
+    return 1 if errors[0] else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
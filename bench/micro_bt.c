@@ -0,0 +1,235 @@
+// Microbenchmarks for the symbol-table and formatter API in bt.h.
+//
+// Each function is timed across table sizes and name lengths. A sample times a
+// batch of calls; after warm-up samples, the median and p99 of the per-call cost
+// are reported, followed by a scaling summary (cost at the largest table size
+// over cost at size 1) that separates O(1) from O(n) behavior.
+//
+// Usage: bench/micro_bt [--csv FILE] [--samples N]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bt.h"
+
+#define MAX_SIZE 32
+#define WARMUP_SAMPLES 20
+
+static const int SIZES[] = {1, 2, 4, 8, 16, 32};
+static const int NAME_LENS[] = {1, 8, 32, 63};
+#define N_SIZES (int)(sizeof(SIZES) / sizeof(SIZES[0]))
+#define N_NAME_LENS (int)(sizeof(NAME_LENS) / sizeof(NAME_LENS[0]))
+
+typedef struct {
+   struct SymbolTable table;
+   char names[MAX_SIZE + 1][64]; // names[size] is a spare, unused name
+   int size;
+   StrBuf text; // reused across operations, like a row builder after the first row
+   volatile size_t sink; // keeps results observable so calls are not optimized away
+} Ctx;
+
+typedef struct {
+   const char *name;
+   int batch;                   // calls per timed sample
+   void (*prepare)(Ctx *c);     // untimed, before every sample (may be NULL)
+   void (*op)(Ctx *c);
+} Bench;
+
+static double now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Unique names of exactly len characters; the distinguishing characters come last
+// so strcmp has to walk the shared prefix
+static void make_names(Ctx *c, int len) {
+   static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+   for (int i = 0; i <= MAX_SIZE; i++) {
+      memset(c->names[i], 'v', (size_t)len);
+      c->names[i][len] = '\0';
+      c->names[i][len - 1] = alphabet[i % 52];
+      if (len > 1) c->names[i][len - 2] = alphabet[i / 52];
+   }
+}
+
+static void fill_table(Ctx *c) {
+   c->table.count = 0;
+   c->table.layout = 0;
+   stack_reset();
+   for (int i = 0; i < c->size; i++) {
+      long v = i;
+      add(&c->table, c->names[i], TYPE_INT, &v, 0);
+      stack_on_declare(&c->table, c->names[i]);
+   }
+}
+
+// Same table with double values that need six significant digits
+static void fill_table_double(Ctx *c) {
+   fill_table(c);
+   for (int i = 0; i < c->size; i++) {
+      double v = 1234.5678 * (i + 1);
+      add(&c->table, c->names[i], TYPE_DOUBLE, &v, 0);
+   }
+}
+
+// --------- Operations ---------
+static void op_find(Ctx *c) {
+   // Last symbol: the longest successful scan
+   c->sink += (size_t)find(&c->table, c->names[c->size - 1]);
+}
+
+static void op_add_existing(Ctx *c) {
+   long v = 7;
+   c->sink += add(&c->table, c->names[c->size - 1], TYPE_INT, &v, 0);
+}
+
+static void prepare_add_new(Ctx *c) {
+   fill_table(c);
+   if (c->table.count == MAX_SIZE) c->table.count--; // leave room for the new symbol
+}
+
+static void op_add_new(Ctx *c) {
+   long v = 7;
+   c->sink += add(&c->table, c->names[MAX_SIZE], TYPE_INT, &v, 0);
+   c->table.count--; // undo the insertion; the slot is rewritten by the next call
+}
+
+static void op_set(Ctx *c) {
+   long v = 42;
+   set(&c->table.items[c->table.count - 1], TYPE_INT, &v, 0);
+   c->sink += (size_t)c->table.items[c->table.count - 1].value_int;
+}
+
+static void op_remove_symbol(Ctx *c) {
+   // Remove the last symbol (full scan, no shifting) and restore it by re-extending the table
+   c->sink += remove_symbol(&c->table, c->names[c->size - 1]);
+   c->table.count++;
+}
+
+static void op_format_binding_table(Ctx *c) {
+   sb_clear(&c->text);
+   format_binding_table(&c->table, &c->text);
+   c->sink += (size_t)c->text.data[0];
+}
+
+static void op_format_stack(Ctx *c) {
+   sb_clear(&c->text);
+   format_stack(&c->text);
+   c->sink += (size_t)c->text.data[0];
+}
+
+static void op_format_stack_diagram(Ctx *c) {
+   char *d = format_stack_diagram(&c->table);
+   c->sink += (size_t)d[0];
+   free(d);
+}
+
+static void prepare_scope(Ctx *c) {
+   c->table.count = 0;
+   stack_reset();
+   stack_enter_scope();
+   for (int i = 0; i < c->size; i++) {
+      add(&c->table, c->names[i], TYPE_INT, NULL, 0);
+      stack_on_declare(&c->table, c->names[i]);
+   }
+}
+
+static void op_stack_exit_scope(Ctx *c) {
+   stack_exit_scope(&c->table);
+   c->sink += c->table.count;
+}
+
+static const Bench BENCHES[] = {
+   {"find", 256, fill_table, op_find},
+   {"add (existing)", 256, fill_table, op_add_existing},
+   {"add (new)", 256, prepare_add_new, op_add_new},
+   {"set", 256, fill_table, op_set},
+   {"remove_symbol", 256, fill_table, op_remove_symbol},
+   {"format_binding_table", 64, fill_table, op_format_binding_table},
+   {"format_binding_table (double)", 64, fill_table_double, op_format_binding_table},
+   {"format_stack", 64, fill_table, op_format_stack},
+   {"format_stack_diagram", 16, fill_table, op_format_stack_diagram},
+   {"stack_exit_scope", 1, prepare_scope, op_stack_exit_scope},
+};
+#define N_BENCHES (int)(sizeof(BENCHES) / sizeof(BENCHES[0]))
+
+static int cmp_double(const void *a, const void *b) {
+   double x = *(const double *)a, y = *(const double *)b;
+   return (x > y) - (x < y);
+}
+
+// Times one configuration; per-call median and p99 in nanoseconds
+static void measure(const Bench *b, Ctx *c, int samples, double *median, double *p99) {
+   double *per_call = (double *)malloc(sizeof(double) * (size_t)samples);
+   for (int s = -WARMUP_SAMPLES; s < samples; s++) {
+      if (b->prepare) b->prepare(c);
+      double t0 = now_ns();
+      for (int k = 0; k < b->batch; k++) b->op(c);
+      double t1 = now_ns();
+      if (s >= 0) per_call[s] = (t1 - t0) / b->batch;
+   }
+   qsort(per_call, (size_t)samples, sizeof(double), cmp_double);
+   *median = per_call[samples / 2];
+   *p99 = per_call[(samples * 99) / 100 < samples ? (samples * 99) / 100 : samples - 1];
+   free(per_call);
+}
+
+int main(int argc, char **argv) {
+   const char *csv_path = NULL;
+   int samples = 200;
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) csv_path = argv[++i];
+      else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) samples = atoi(argv[++i]);
+      else {
+         fprintf(stderr, "Usage: %s [--csv FILE] [--samples N]\n", argv[0]);
+         return 2;
+      }
+   }
+   if (samples < 1) samples = 1;
+
+   FILE *csv = NULL;
+   if (csv_path) {
+      csv = fopen(csv_path, "w");
+      if (!csv) {
+         perror(csv_path);
+         return 1;
+      }
+      fprintf(csv, "function,table_size,name_len,median_ns,p99_ns\n");
+   }
+
+   static Ctx ctx;
+   double medians[N_BENCHES][N_NAME_LENS][N_SIZES];
+   printf("%-22s %5s %8s %12s %12s\n", "function", "size", "name_len", "median ns", "p99 ns");
+   for (int b = 0; b < N_BENCHES; b++) {
+      for (int l = 0; l < N_NAME_LENS; l++) {
+         make_names(&ctx, NAME_LENS[l]);
+         for (int z = 0; z < N_SIZES; z++) {
+            ctx.size = SIZES[z];
+            double median, p99;
+            measure(&BENCHES[b], &ctx, samples, &median, &p99);
+            medians[b][l][z] = median;
+            printf("%-22s %5d %8d %12.1f %12.1f\n", BENCHES[b].name, SIZES[z], NAME_LENS[l], median, p99);
+            if (csv) fprintf(csv, "%s,%d,%d,%.2f,%.2f\n", BENCHES[b].name, SIZES[z], NAME_LENS[l], median, p99);
+         }
+      }
+   }
+
+   // Scaling summary: ~1x means O(1) in the table size, ~Nx means O(n)
+   printf("\nScaling (median at size %d / size %d, per name length):\n", SIZES[N_SIZES - 1], SIZES[0]);
+   printf("%-22s", "function");
+   for (int l = 0; l < N_NAME_LENS; l++) printf(" %8s%-2d", "len ", NAME_LENS[l]);
+   printf("\n");
+   for (int b = 0; b < N_BENCHES; b++) {
+      printf("%-22s", BENCHES[b].name);
+      for (int l = 0; l < N_NAME_LENS; l++) {
+         double base = medians[b][l][0] > 0 ? medians[b][l][0] : 1e-9;
+         printf(" %9.1fx", medians[b][l][N_SIZES - 1] / base);
+      }
+      printf("\n");
+   }
+
+   if (csv) fclose(csv);
+   return ctx.sink == 0xdeadbeef; // never true in practice; keeps sink live
+}
@@ -0,0 +1,40 @@
+// Runs a command and reports its peak RSS in KiB on stderr as "peak_rss_kb=N".
+// The command's stdout is inherited and its stderr discarded. Measuring from this
+// small process keeps the caller's own memory out of the figure: a child inherits
+// its parent's RSS high-water mark across fork+exec.
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, char **argv) {
+   if (argc < 2) {
+      fprintf(stderr, "Usage: %s <command> [args...]\n", argv[0]);
+      return 2;
+   }
+   pid_t pid = fork();
+   if (pid < 0) {
+      perror("fork");
+      return 2;
+   }
+   if (pid == 0) {
+      int devnull = open("/dev/null", O_WRONLY);
+      if (devnull >= 0) dup2(devnull, 2);
+      execvp(argv[1], argv + 1);
+      _exit(127);
+   }
+   int status;
+   struct rusage ru;
+   if (wait4(pid, &status, 0, &ru) < 0) {
+      perror("wait4");
+      return 2;
+   }
+#ifdef __APPLE__
+   long kb = ru.ru_maxrss / 1024; // bytes on macOS
+#else
+   long kb = ru.ru_maxrss;
+#endif
+   fprintf(stderr, "peak_rss_kb=%ld\n", kb);
+   return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""End-to-end benchmark harness for bt.
+
+Runs `bt` over generated programs (see gen.py), one dimension scaled per
+case group, and reports per case the median wall time, throughput
+(trace steps/s and MB/s of source lexed), peak RSS and output bytes.
+
+  python3 bench/run.py                         # run and print
+  python3 bench/run.py --compare bench/baseline.json
+  python3 bench/run.py --save-baseline bench/baseline.json
+
+Results are also written to bench/results/latest.{csv,json}. The baseline holds this
+machine's wall times, so it is git-ignored and recorded locally (`make bench-baseline`).
+"""
+import argparse
+import csv
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPO_ROOT = os.path.dirname(HERE)
+sys.path.insert(0, HERE)
+from gen import generate  # noqa: E402
+
+# (group, knob values); every other knob keeps gen.generate()'s default
+SUITE = [
+    ("decls", "decls", [4, 16, 28]),
+    ("trips", "trips", [100, 1000, 5000]),
+    ("depth", "depth", [1, 3, 5]),
+    ("expr", "expr", [2, 16, 64]),
+    ("length", "length", [100, 1000, 4000]),
+]
+
+FIELDS = ["case", "wall_ms", "steps", "steps_per_s", "lex_mb_per_s", "peak_rss_kb", "output_bytes", "source_bytes"]
+
+
+RSS_HELPER = os.path.join(HERE, "rss")
+
+
+def run_once(bt, path):
+    """Runs bt on path through the rss helper; returns (seconds, stdout bytes, peak RSS in KiB)."""
+    start = time.perf_counter()
+    proc = subprocess.run([RSS_HELPER, bt, "--no-cache", path], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    elapsed = time.perf_counter() - start
+    if proc.returncode != 0:
+        raise RuntimeError(f"bt exited with {proc.returncode} on {path}")
+    rss_kb = int(proc.stderr.decode().rsplit("peak_rss_kb=", 1)[1])
+    return elapsed, proc.stdout, rss_kb
+
+
+def bench_case(bt, name, source, repeat, workdir):
+    path = os.path.join(workdir, name + ".c")
+    with open(path, "w") as f:
+        f.write(source)
+    run_once(bt, path)  # warm-up: page cache, dynamic loader
+    times, rss = [], 0
+    for _ in range(repeat):
+        elapsed, out, rss_kb = run_once(bt, path)
+        times.append(elapsed)
+        rss = max(rss, rss_kb)
+    wall = statistics.median(times)
+    steps = sum(1 for line in out.splitlines() if line.startswith(b"Step "))
+    return {
+        "case": name,
+        "wall_ms": round(wall * 1000.0, 3),
+        "steps": steps,
+        "steps_per_s": round(steps / wall),
+        "lex_mb_per_s": round(len(source) / wall / 1e6, 3),
+        "peak_rss_kb": rss,
+        "output_bytes": len(out),
+        "source_bytes": len(source),
+    }
+
+
+def compare(results, baseline, threshold, floor_ms):
+    """Prints per-case deltas; returns the names of cases slower than the threshold allows."""
+    regressions = []
+    for r in results:
+        base = baseline.get(r["case"])
+        if not base:
+            continue
+        delta = (r["wall_ms"] - base["wall_ms"]) / base["wall_ms"] if base["wall_ms"] else 0.0
+        slower = delta > threshold and r["wall_ms"] - base["wall_ms"] > floor_ms
+        mark = "REGRESSION" if slower else ""
+        print(f"  {r['case']:<14} {base['wall_ms']:>10.3f} -> {r['wall_ms']:>10.3f} ms  {delta:+7.1%}  {mark}")
+        if slower:
+            regressions.append(r["case"])
+    return regressions
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--bt", default=os.path.join(REPO_ROOT, "bt"))
+    ap.add_argument("--repeat", type=int, default=5)
+    ap.add_argument("--compare", metavar="BASELINE")
+    ap.add_argument("--save-baseline", metavar="BASELINE")
+    ap.add_argument("--threshold", type=float, default=0.15, help="allowed slowdown ratio (default 0.15)")
+    ap.add_argument("--floor-ms", type=float, default=2.0, help="ignore slowdowns smaller than this")
+    ap.add_argument("--out-dir", default=os.path.join(HERE, "results"))
+    args = ap.parse_args()
+    if args.compare and not os.path.exists(args.compare):
+        # Wall times only compare on the machine that recorded them, so no baseline is committed
+        print(f"no baseline at {args.compare}; record one on this machine first with `make bench-baseline`",
+              file=sys.stderr)
+        return 2
+
+    results = []
+    with tempfile.TemporaryDirectory() as workdir:
+        for group, knob, values in SUITE:
+            for v in values:
+                name = f"{group}-{v}"
+                r = bench_case(args.bt, name, generate(**{knob: v}), args.repeat, workdir)
+                results.append(r)
+                print(f"{name:<14} {r['wall_ms']:>10.3f} ms  {r['steps']:>8} steps  {r['steps_per_s']:>10} steps/s  "
+                      f"{r['lex_mb_per_s']:>8.3f} MB/s  {r['peak_rss_kb']:>7} KiB  {r['output_bytes']:>10} B out")
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    with open(os.path.join(args.out_dir, "latest.json"), "w") as f:
+        json.dump(results, f, indent=2)
+    with open(os.path.join(args.out_dir, "latest.csv"), "w", newline="") as f:
+        w = csv.DictWriter(f, fieldnames=FIELDS)
+        w.writeheader()
+        w.writerows(results)
+
+    if args.save_baseline:
+        with open(args.save_baseline, "w") as f:
+            json.dump({r["case"]: r for r in results}, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print(f"baseline written to {args.save_baseline}")
+
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+        print(f"\ncompared with {args.compare} (threshold {args.threshold:.0%}, floor {args.floor_ms} ms):")
+        regressions = compare(results, baseline, args.threshold, args.floor_ms)
+        if regressions:
+            print(f"{len(regressions)} regression(s): {', '.join(regressions)}")
+            return 1
+        print("no regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,11 +1,67 @@
 #include "bt.h" // Now includes our new header file
+#include "fmt.h"
+#include "mem.h"
+#include "profile.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 // All the function definitions go here.
 
+// Streams used for all interpreter output; NULL means stdout/stderr.
+// Interpreter state is thread-local so embedders can run programs in parallel.
+static _Thread_local FILE *g_out = NULL;
+static _Thread_local FILE *g_err = NULL;
+static _Thread_local unsigned long g_err_count = 0;
+static _Thread_local int g_err_line = 0, g_err_column = 0;
+
+void bt_set_streams(FILE *out, FILE *err) {
+   g_out = out;
+   g_err = err;
+}
+
+void bt_get_streams(FILE **out, FILE **err) {
+   *out = g_out;
+   *err = g_err;
+}
+
+FILE *bt_out(void) { return g_out ? g_out : stdout; }
+
+// Every diagnostic goes through bt_err(), so counting calls counts reported errors
+FILE *bt_err(void) {
+   g_err_count++;
+   FILE *err = g_err ? g_err : stderr;
+   if (g_err_line > 0) fprintf(err, "%d:%d: ", g_err_line, g_err_column);
+   return err;
+}
+
+void bt_set_location(int line, int column) {
+   g_err_line = line;
+   g_err_column = column;
+}
+
+void bt_get_location(int *line, int *column) {
+   *line = g_err_line;
+   *column = g_err_column;
+}
+
+FILE *bt_err_at(int line, int column) {
+   bt_set_location(line, column);
+   return bt_err();
+}
+
+unsigned long bt_err_count(void) { return g_err_count; }
+
 // HELPER FUNCTIONS
+void swap_bytes(void *a, void *b, size_t n) {
+   unsigned char *p = (unsigned char *)a, *q = (unsigned char *)b;
+   for (size_t i = 0; i < n; i++) {
+      unsigned char c = p[i];
+      p[i] = q[i];
+      q[i] = c;
+   }
+}
+
 void strip_semicolon(char *s) {
    size_t n = strlen(s);
    if ((n > 0) && (s[n-1] == ';')) {
@@ -17,7 +73,7 @@ bool is_table_full(struct SymbolTable *t, const char *var_name) {
 
    // Check if the count of the SymbolTable is 32
    if (t -> count == 32) {
-      fprintf(stderr, "Error: SymbolTable is full. Cannot add '%s'.\n", var_name);
+      fprintf(bt_err(), "Error: SymbolTable is full. Cannot add '%s'.\n", var_name);
       return true;
    }
    return false;
@@ -55,15 +111,149 @@ void set(struct Symbol *s, VarType type, void *value, size_t array_len) {
          break;
       case TYPE_CHAR_ARRAY:
       case TYPE_CHAR_PTR:
-         s -> address = (long)value;
+         s -> address = *(long *)value;
          s -> array_len = array_len;
          break;
    }
 }
 
+// --- Layout ids ---
+// t->layout names the sequence of (type, name) pairs in the table, so two tables laid out
+// alike get the same id: expressions compiled against one activation of a function stay
+// bound correctly in the next. Ids are interned in a hash table and never reused; when
+// the table fills up it starts over, which only costs recompilations.
+#define LAYOUT_MIN_SLOTS 64
+#define LAYOUT_MAX_SLOTS 4096
+#define LAYOUT_KEY_MAX (32 * 65)
+
+typedef struct {
+   unsigned long long hash;
+   unsigned long id;
+   char *key;             // NULL for an empty slot
+   size_t len;
+} LayoutEntry;
+
+static _Thread_local struct {
+   LayoutEntry *slots;
+   size_t cap, used;
+} g_layouts;
+
+// Ids are unique across threads, since an execution session may continue on another thread
+static unsigned long g_layout_next = 0; // last id handed out
+
+static unsigned long layout_id(void) {
+   return __atomic_add_fetch(&g_layout_next, 1, __ATOMIC_RELAXED);
+}
+
+static void layouts_clear(void) {
+   for (size_t i = 0; i < g_layouts.cap; i++) free(g_layouts.slots[i].key);
+   free(g_layouts.slots);
+   g_layouts.slots = NULL;
+   g_layouts.cap = g_layouts.used = 0;
+}
+
+// Makes room for one more entry; false when the ids cannot be interned
+static bool layouts_reserve(void) {
+   if (g_layouts.slots && (g_layouts.used + 1) * 4 <= g_layouts.cap * 3) return true;
+   size_t cap = g_layouts.cap ? g_layouts.cap * 2 : LAYOUT_MIN_SLOTS;
+   if (cap > LAYOUT_MAX_SLOTS) {
+      layouts_clear();
+      cap = LAYOUT_MIN_SLOTS;
+   }
+   LayoutEntry *slots = (LayoutEntry *)calloc(cap, sizeof(LayoutEntry));
+   if (!slots) return false;
+   for (size_t i = 0; i < g_layouts.cap; i++) {
+      const LayoutEntry *e = &g_layouts.slots[i];
+      if (!e->key) continue;
+      size_t k = (size_t)e->hash & (cap - 1);
+      while (slots[k].key) k = (k + 1) & (cap - 1);
+      slots[k] = *e;
+   }
+   free(g_layouts.slots);
+   g_layouts.slots = slots;
+   g_layouts.cap = cap;
+   return true;
+}
+
+void update_layout(struct SymbolTable *t) {
+   if (t -> count == 0) {
+      t -> layout = 0;
+      return;
+   }
+   // Key: one type byte and the NUL-terminated name per symbol
+   char key[LAYOUT_KEY_MAX];
+   size_t len = 0;
+   unsigned long long hash = 1469598103934665603ULL; // FNV-1a
+   for (size_t i = 0; i < t -> count; i++) {
+      key[len++] = (char)t -> items[i].type;
+      size_t n = strlen(t -> items[i].name) + 1;
+      memcpy(key + len, t -> items[i].name, n);
+      len += n;
+   }
+   for (size_t i = 0; i < len; i++) hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+
+   if (!layouts_reserve()) {
+      t -> layout = layout_id();
+      return;
+   }
+   size_t k = (size_t)hash & (g_layouts.cap - 1);
+   for (; g_layouts.slots[k].key; k = (k + 1) & (g_layouts.cap - 1)) {
+      const LayoutEntry *e = &g_layouts.slots[k];
+      if (e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0) {
+         t -> layout = e->id;
+         return;
+      }
+   }
+   t -> layout = layout_id();
+   char *copy = (char *)malloc(len);
+   if (!copy) return;
+   memcpy(copy, key, len);
+   g_layouts.slots[k] = (LayoutEntry){ hash, t -> layout, copy, len };
+   g_layouts.used++;
+}
+
+// --- State hashes ---
+static unsigned long long name_key(const char *name) {
+   unsigned long long h = 1469598103934665603ULL; // FNV-1a
+   for (; *name; name++) h = (h ^ (unsigned char)*name) * 1099511628211ULL;
+   return h;
+}
+
+// splitmix64's finalizer
+static unsigned long long mix64(unsigned long long x) {
+   x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+   return x ^ (x >> 31);
+}
+
+static unsigned long long symbol_word(size_t slot, unsigned long long key, const struct Symbol *s) {
+   // Uninitialized symbols print "?" whatever their value field holds
+   unsigned long long bits = s -> initialized ? (unsigned long long)s -> value_int : 0;
+   unsigned long long tag = (unsigned long long)slot << 8 | (unsigned long long)s -> type << 1 | s -> initialized;
+   return mix64(mix64(key + tag) ^ bits);
+}
+
+unsigned long long symbol_hash(const struct SymbolTable *t, const struct Symbol *s) {
+   return symbol_word((size_t)(s - t -> items), name_key(s -> name), s);
+}
+
+void table_rehash(struct SymbolTable *t) {
+   t -> hash = 0;
+   for (size_t i = 0; i < t -> count; i++) t -> hash += symbol_hash(t, &t -> items[i]);
+}
+
+// Copies only the bound items: snapshots are taken far more often than tables grow
+void table_copy(struct SymbolTable *dst, const struct SymbolTable *src) {
+   memcpy(dst -> items, src -> items, src -> count * sizeof(src -> items[0]));
+   dst -> count = src -> count;
+   dst -> layout = src -> layout;
+   dst -> hash = src -> hash;
+}
+
 // MAIN FUNCTIONS
 struct Symbol *find(struct SymbolTable *t, const char *var_name) {
-   for (int i = 0; i < t -> count; i++) {
+   // From the end: a local found there shadows a global of the same name
+   for (size_t i = t -> count; i-- > 0;) {
       // Check if the variable name matches the symbol name
       if (strcmp(t -> items[i].name, var_name) == 0) {
          return &t -> items[i];
@@ -72,119 +262,101 @@ struct Symbol *find(struct SymbolTable *t, const char *var_name) {
    return NULL;
 }
 
-bool add(struct SymbolTable *t, const char *var_name, VarType type, void *value, size_t array_len) {
-   if (is_table_full(t, var_name)) {
-      return false;
-   }
+static size_t locals_start(void);
+
+struct Symbol *find_local(struct SymbolTable *t, const char *var_name) {
+   struct Symbol *s = find(t, var_name);
+   return s && (size_t)(s - t -> items) >= locals_start() ? s : NULL;
+}
 
-   // Check if the symbol already exists
-   struct Symbol *found_symbol = find(t, var_name);
+// Updates `found_symbol`, or appends var_name when it is NULL
+static bool add_at(struct SymbolTable *t, struct Symbol *found_symbol, const char *var_name, VarType type, void *value, size_t array_len) {
+   size_t slot = found_symbol ? (size_t)(found_symbol - t -> items) : t -> count;
+   unsigned long long key = name_key(var_name);
    if (found_symbol) {
+      VarType old = found_symbol -> type;
+      t -> hash -= symbol_word(slot, key, found_symbol);
       set(found_symbol, type, value, array_len);
+      t -> hash += symbol_word(slot, key, found_symbol);
+      if (old != type) update_layout(t);
       return true;
    } else {
+      if (is_table_full(t, var_name)) {
+         return false;
+      }
+
       // If the symbol does not exist, create a new symbol
       struct Symbol *new_symbol = &t -> items[t -> count];
 
       // Copy the variable name to the new symbol
       strcpy(new_symbol -> name, var_name);
       set(new_symbol, type, value, array_len);
+      t -> hash += symbol_word(slot, key, new_symbol);
       t -> count++;
+      update_layout(t);
    }
    return true;
 }
 
+bool add(struct SymbolTable *t, const char *var_name, VarType type, void *value, size_t array_len) {
+   // Check if the symbol already exists; updates must work even when the table is full
+   return add_at(t, find(t, var_name), var_name, type, value, array_len);
+}
+
+bool declare(struct SymbolTable *t, const char *var_name, VarType type, void *value, size_t array_len) {
+   return add_at(t, find_local(t, var_name), var_name, type, value, array_len);
+}
+
 void free_symbols(struct SymbolTable *t){
 
-   // Free the memory for the character arrays and pointers
-   for (int i = 0; i < t -> count; i++) {
-      if ( t -> items[i].type == TYPE_CHAR_ARRAY || t -> items[i].type == TYPE_CHAR_PTR ) {
-         free( (void*)t -> items[i].address );
-      }
-   }
+   // Char arrays and pointers refer to the simulated address space (mem.c), which is
+   // released with its stack frames and reset by stack_reset(); nothing is owned here
+   (void)t;
 }
 
-static void print_symbol_binding(const struct Symbol *s) {
-   printf("%s |-> ", s -> name);
+void format_value(const struct Symbol *s, StrBuf *b) {
+   if (!s -> initialized) {
+      sb_putc(b, '?');
+      return;
+   }
    switch (s -> type) {
       case TYPE_INT:
-         if (s -> initialized) {
-            printf("%ld", s -> value_int);
-         } else {
-            printf("?");
-         }
+         sb_long(b, s -> value_int);
          break;
       case TYPE_FLOAT:
       case TYPE_DOUBLE:
-         if (s -> initialized) {
-            printf("%g", s -> value_float);
-         } else {
-            printf("?");
-         }
+         sb_double(b, s -> value_float);
          break;
       case TYPE_CHAR_ARRAY:
-         if (s -> initialized) {
-            printf("addr");
-         } else {
-            printf("addr");
-         }
-         break;
       case TYPE_CHAR_PTR:
-         if (s -> initialized) {
-            printf("addr");
+         if (s -> address == 0) {
+            sb_append(b, "NULL", 4);
          } else {
-            printf("?");
+            sb_append(b, "0x", 2);
+            sb_hex(b, (unsigned long)s -> address);
          }
          break;
    }
 }
 
 void print_binding_table(struct SymbolTable *t) {
-   printf("S = {");
-   for (size_t i = 0; i < t -> count; i++) {
-      print_symbol_binding(&t -> items[i]);
-      if (i + 1 < t -> count) {
-         printf("; ");
-      }
-   }
-   printf("}\n");
+   StrBuf b;
+   sb_init(&b, 0);
+   format_binding_table(t, &b);
+   if (b.data) fprintf(bt_out(), "%s\n", b.data);
+   sb_free(&b);
 }
 
-void format_binding_table(const struct SymbolTable *t, char *buffer, size_t buffer_size) {
-   size_t used = 0;
-   int n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "S = {");
-   if (n > 0) used += (size_t)n;
+void format_binding_table(const struct SymbolTable *t, StrBuf *out) {
+   sb_append(out, "S = {", 5);
    for (size_t i = 0; i < t -> count; i++) {
       const struct Symbol *s = &t -> items[i];
-      // name
-      n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "%s |-> ", s -> name);
-      if (n > 0) used += (size_t)n;
-      // value
-      switch (s -> type) {
-         case TYPE_INT:
-            if (s -> initialized) n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "%ld", s -> value_int);
-            else n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "?");
-            break;
-         case TYPE_FLOAT:
-         case TYPE_DOUBLE:
-            if (s -> initialized) n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "%g", s -> value_float);
-            else n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "?");
-            break;
-         case TYPE_CHAR_ARRAY:
-            n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "addr");
-            break;
-         case TYPE_CHAR_PTR:
-            if (s -> initialized) n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "addr");
-            else n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "?");
-            break;
-      }
-      if (n > 0) used += (size_t)n;
-      if (i + 1 < t -> count) {
-         n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "; ");
-         if (n > 0) used += (size_t)n;
-      }
+      sb_puts(out, s -> name);
+      sb_append(out, " |-> ", 5);
+      format_value(s, out);
+      if (i + 1 < t -> count) sb_append(out, "; ", 2);
    }
-   snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "}");
+   sb_putc(out, '}');
 }
 
 // --- Stack model for scopes (visualization only) ---
@@ -195,11 +367,73 @@ typedef struct {
    int scope_top;
 } StackViz;
 
-static StackViz g_stack = { .top = -1, .scope_top = -1 };
+static _Thread_local StackViz g_stack = { .top = -1, .scope_top = -1 };
+
+// --- Stack diagram cache ---
+// The diagram is a header followed by one box per stack slot, top first. Each slot keeps
+// its rendered box together with the symbol state it shows, so a step only re-formats the
+// boxes whose symbol changed and copies the others.
+#define DIAGRAM_HEADER "Stack (top at first box):\n"
+#define DIAGRAM_EMPTY "(empty)\n"
+
+typedef struct {
+   bool valid;
+   bool bound;            // box shows a symbol's value rather than just the name
+   int symbol;            // index of the slot's symbol in t or the frame pool, -1 if unbound
+   bool saved;            // symbol is a suspended caller's local, in the frame pool
+   unsigned long layout;  // t->layout when symbol was looked up
+   VarType type;          // state rendered into box
+   bool initialized;
+   long bits;             // value_int/value_float/address, compared bit for bit
+   StrBuf box;
+} SlotBox;
+
+static _Thread_local struct {
+   const struct SymbolTable *table;
+   SlotBox slots[64];
+} g_boxes;
+
+static void boxes_invalidate(void){
+   g_boxes.table = NULL;
+   for (int i = 0; i < 64; i++) g_boxes.slots[i].valid = false;
+}
+
+// --- Activation records ---
+// A call moves the locals of the calling function out of the SymbolTable into the frame
+// pool, so the table holds the globals followed by the running function's symbols, and
+// brings them back when it returns. Top-level symbols are the globals.
+typedef struct {
+   int slot_mark;         // g_stack.top before the call's frame slot
+   size_t saved;          // the caller's locals are pool[saved .. saved + saved_count)
+   size_t saved_count;
+   size_t count;          // the caller's t->count and t->layout
+   unsigned long layout;
+} Activation;
+
+static _Thread_local struct {
+   Activation *frames;    // frames[1 .. depth]; the records are reused by later calls
+   int depth, cap;
+   struct Symbol *pool;
+   size_t pool_used, pool_cap;
+   size_t globals;        // symbols below this index are globals while depth > 0
+} g_calls;
+
+static size_t locals_start(void){ return g_calls.depth > 0 ? g_calls.globals : 0; }
 
-void stack_reset(){ g_stack.top = -1; g_stack.scope_top = -1; }
+int stack_call_depth(void){ return g_calls.depth; }
+
+void stack_reset(){
+   g_stack.top = -1;
+   g_stack.scope_top = -1;
+   g_calls.depth = 0;
+   g_calls.pool_used = 0;
+   mem_reset();
+   boxes_invalidate();
+}
 
+// Each scope owns a frame of the simulated stack segment
 void stack_enter_scope(){
+   mem_frame_push();
    if (g_stack.scope_top + 1 < 64){
       g_stack.scope_top++;
       g_stack.scope_marks[g_stack.scope_top] = g_stack.top;
@@ -207,11 +441,13 @@ void stack_enter_scope(){
 }
 
 bool remove_symbol(struct SymbolTable *t, const char *var_name){
-   for (int i = 0; i < (int)t->count; i++){
+   for (int i = (int)t->count - 1; i >= 0; i--){
       if (strcmp(t->items[i].name, var_name) == 0){
          // shift left
          for (int j = i + 1; j < (int)t->count; j++) t->items[j-1] = t->items[j];
          t->count--;
+         update_layout(t);
+         table_rehash(t);
          return true;
       }
    }
@@ -227,6 +463,99 @@ void stack_exit_scope(struct SymbolTable *t){
       g_stack.top--;
    }
    g_stack.scope_top--;
+   mem_frame_pop();
+}
+
+size_t stack_state_size(void){ return sizeof(StackViz) + mem_state_size(); }
+
+void stack_state_save(void *dst){
+   memcpy(dst, &g_stack, sizeof(StackViz));
+   mem_state_save((char *)dst + sizeof(StackViz));
+}
+
+void stack_state_load(const void *src){
+   memcpy(&g_stack, src, sizeof(StackViz));
+   boxes_invalidate();
+   mem_state_load((const char *)src + sizeof(StackViz));
+}
+
+void stack_release(void){
+   free(g_calls.frames);
+   free(g_calls.pool);
+   memset(&g_calls, 0, sizeof(g_calls));
+   mem_release();
+}
+
+size_t stack_context_size(void){ return sizeof(g_stack) + sizeof(g_calls) + mem_context_size(); }
+
+void stack_context_swap(void *ctx){
+   char *p = (char *)ctx;
+   swap_bytes(p, &g_stack, sizeof(g_stack));
+   swap_bytes(p + sizeof(g_stack), &g_calls, sizeof(g_calls));
+   mem_context_swap(p + sizeof(g_stack) + sizeof(g_calls));
+   boxes_invalidate();
+}
+
+// The running function's slots move between the table and the frame pool when it calls or
+// is returned to; top-level slots keep their symbols
+static void boxes_invalidate_frame(void){
+   if (g_calls.depth == 0) return;
+   for (int i = g_calls.frames[g_calls.depth].slot_mark + 1; i < 64; i++) g_boxes.slots[i].valid = false;
+}
+
+bool stack_call_enter(struct SymbolTable *t, const char *name){
+   if (g_calls.depth + 1 >= g_calls.cap) {
+      int cap = g_calls.cap ? g_calls.cap * 2 : 16;
+      Activation *frames = (Activation *)prof_realloc(g_calls.frames, sizeof(Activation) * (size_t)cap);
+      if (!frames) return false;
+      g_calls.frames = frames;
+      g_calls.cap = cap;
+   }
+   if (g_calls.depth == 0) g_calls.globals = t->count;
+   size_t n = t->count - g_calls.globals;
+   if (g_calls.pool_used + n > g_calls.pool_cap) {
+      size_t cap = g_calls.pool_cap ? g_calls.pool_cap : 64;
+      while (cap < g_calls.pool_used + n) cap *= 2;
+      struct Symbol *pool = (struct Symbol *)prof_realloc(g_calls.pool, sizeof(struct Symbol) * cap);
+      if (!pool) return false;
+      g_calls.pool = pool;
+      g_calls.pool_cap = cap;
+   }
+   boxes_invalidate_frame();
+   Activation *a = &g_calls.frames[++g_calls.depth];
+   a->slot_mark = g_stack.top;
+   a->saved = g_calls.pool_used;
+   a->saved_count = n;
+   a->count = t->count;
+   a->layout = t->layout;
+   if (n) memcpy(g_calls.pool + a->saved, t->items + g_calls.globals, sizeof(struct Symbol) * n);
+   g_calls.pool_used += n;
+   t->count = g_calls.globals;
+   update_layout(t);
+   table_rehash(t);
+   mem_frame_push();
+
+   // The frame slot, "name()", never matches a symbol
+   if (g_stack.top + 1 < 64){
+      g_stack.top++;
+      snprintf(g_stack.names[g_stack.top], sizeof(g_stack.names[g_stack.top]), "%.61s()", name);
+      g_boxes.slots[g_stack.top].valid = false;
+   }
+   return true;
+}
+
+void stack_call_exit(struct SymbolTable *t){
+   if (g_calls.depth == 0) return;
+   const Activation *a = &g_calls.frames[g_calls.depth];
+   if (a->saved_count) memcpy(t->items + g_calls.globals, g_calls.pool + a->saved, sizeof(struct Symbol) * a->saved_count);
+   t->count = a->count;
+   t->layout = a->layout;
+   table_rehash(t);
+   g_calls.pool_used = a->saved;
+   g_stack.top = a->slot_mark;
+   mem_frame_pop();
+   g_calls.depth--;
+   boxes_invalidate_frame();
 }
 
 void stack_on_declare(struct SymbolTable *t, const char *var_name){
@@ -235,18 +564,79 @@ void stack_on_declare(struct SymbolTable *t, const char *var_name){
       g_stack.top++;
       strncpy(g_stack.names[g_stack.top], var_name, sizeof(g_stack.names[g_stack.top]) - 1);
       g_stack.names[g_stack.top][sizeof(g_stack.names[g_stack.top]) - 1] = '\0';
+      g_boxes.slots[g_stack.top].valid = false;
    }
 }
 
-void format_stack(char *buffer, size_t buffer_size){
-   size_t used = 0;
-   int n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "Top ");
-   if (n > 0) used += (size_t)n;
+void format_stack(StrBuf *out){
+   sb_append(out, "Top ", 4);
+   if (g_stack.top < 0) sb_append(out, "(empty)", 7);
    for (int i = g_stack.top; i >= 0; i--){
-      n = snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "[%s]%s", g_stack.names[i], i>0?"->":"");
-      if (n > 0) used += (size_t)n;
+      sb_putc(out, '[');
+      sb_puts(out, g_stack.names[i]);
+      sb_append(out, i > 0 ? "]->" : "]", i > 0 ? 3 : 1);
+   }
+}
+
+// Finds the symbol slot i shows: slots belong to the top level or to the activation whose
+// frame slot is below them, and a suspended activation's symbols are in the frame pool
+static void slot_lookup(const struct SymbolTable *t, int i, SlotBox *b){
+   int k = g_calls.depth;
+   while (k > 0 && i <= g_calls.frames[k].slot_mark) k--;
+   const struct Symbol *items = t->items;
+   size_t lo = 0, hi = t->count;
+   b->saved = k > 0 && k < g_calls.depth;
+   if (b->saved) {
+      const Activation *next = &g_calls.frames[k + 1];
+      items = g_calls.pool;
+      lo = next->saved;
+      hi = next->saved + next->saved_count;
+   } else if (k > 0) {
+      lo = g_calls.globals;
+   } else if (g_calls.depth > 0) {
+      hi = g_calls.globals;
+   }
+   b->symbol = -1;
+   for (size_t j = hi; j-- > lo;) {
+      if (strcmp(items[j].name, g_stack.names[i]) == 0) { b->symbol = (int)j; break; }
+   }
+   b->layout = t->layout;
+}
+
+// Brings slot i's box up to date with t and returns it; NULL when out of memory
+static const SlotBox *slot_box(const struct SymbolTable *t, int i){
+   SlotBox *b = &g_boxes.slots[i];
+   // Names only move between indices when the layout changes or a call starts or ends
+   if (!b->valid || (!b->saved && b->layout != t->layout)) slot_lookup(t, i, b);
+   const struct Symbol *s = b->symbol < 0 ? NULL : b->saved ? &g_calls.pool[b->symbol] : &t->items[b->symbol];
+   if (b->valid && (s ? b->bound && s->type == b->type && s->initialized == b->initialized && s->value_int == b->bits
+                      : !b->bound)) {
+      return b;
+   }
+
+   // "| %-14s |" between two rules
+   static const char rule[] = "+----------------+\n";
+   StrBuf *box = &b->box;
+   sb_clear(box);
+   sb_append(box, rule, sizeof(rule) - 1);
+   sb_append(box, "| ", 2);
+   size_t start = box->len;
+   if (s) {
+      sb_puts(box, s->name);
+      sb_append(box, " = ", 3);
+      format_value(s, box);
+      b->type = s->type;
+      b->initialized = s->initialized;
+      b->bits = s->value_int;
+   } else {
+      sb_puts(box, g_stack.names[i]);
    }
-   if (used == 4) snprintf(buffer + used, buffer_size > used ? buffer_size - used : 0, "(empty)");
+   if (box->len - start < 14) sb_pad(box, ' ', 14 - (box->len - start));
+   sb_append(box, " |\n", 3);
+   sb_append(box, rule, sizeof(rule) - 1);
+   b->bound = s != NULL;
+   b->valid = !box->failed;
+   return b->valid ? b : NULL;
 }
 
 char *format_stack_diagram(const struct SymbolTable *t){
@@ -257,55 +647,21 @@ char *format_stack_diagram(const struct SymbolTable *t){
    //  +-----+
    //  |  i  |
    //  +-----+
-   size_t cap = 1024;
-   char *out = (char*)malloc(cap);
-   if (!out) return NULL;
-   size_t len = 0;
-   // Header
-   const char *header = "Stack (top at first box):\n";
-   size_t hlen = strlen(header);
-   memcpy(out + len, header, hlen); len += hlen; out[len] = '\0';
-   if (g_stack.top < 0){
-      const char *empty = "(empty)\n";
-      size_t elen = strlen(empty);
-      if (len + elen + 1 > cap){ cap *= 2; out = (char*)realloc(out, cap); }
-      memcpy(out + len, empty, elen); len += elen; out[len] = '\0';
-      return out;
+   if (t != g_boxes.table) {
+      boxes_invalidate();
+      g_boxes.table = t;
    }
-   for (int i = g_stack.top; i >= 0; i--){
-      // Lookup value
-      const struct Symbol *s = NULL;
-      for (int k = 0; k < (int)t->count; k++) {
-         if (strcmp(t->items[k].name, g_stack.names[i]) == 0) { s = &t->items[k]; break; }
-      }
-      char display[64];
-      if (s) {
-         switch (s->type) {
-            case TYPE_INT:
-               if (s->initialized) snprintf(display, sizeof(display), "%s = %ld", s->name, s->value_int);
-               else snprintf(display, sizeof(display), "%s = ?", s->name);
-               break;
-            case TYPE_FLOAT:
-            case TYPE_DOUBLE:
-               if (s->initialized) snprintf(display, sizeof(display), "%s = %g", s->name, s->value_float);
-               else snprintf(display, sizeof(display), "%s = ?", s->name);
-               break;
-            case TYPE_CHAR_ARRAY:
-               snprintf(display, sizeof(display), "%s = addr", s->name);
-               break;
-            case TYPE_CHAR_PTR:
-               if (s->initialized) snprintf(display, sizeof(display), "%s = addr", s->name);
-               else snprintf(display, sizeof(display), "%s = ?", s->name);
-               break;
-         }
-      } else {
-         snprintf(display, sizeof(display), "%s", g_stack.names[i]);
-      }
-      char line[128];
-      snprintf(line, sizeof(line), "+----------------+\n| %-14s |\n+----------------+\n", display);
-      size_t l = strlen(line);
-      if (len + l + 1 > cap){ cap *= 2; out = (char*)realloc(out, cap); }
-      memcpy(out + len, line, l); len += l; out[len] = '\0';
+   size_t len = strlen(DIAGRAM_HEADER) + strlen(DIAGRAM_EMPTY);
+   for (int i = g_stack.top; i >= 0; i--) {
+      const SlotBox *b = slot_box(t, i);
+      if (!b) return NULL;
+      len += b->box.len;
    }
-   return out;
-}
\ No newline at end of file
+
+   StrBuf out;
+   sb_init(&out, len);
+   sb_puts(&out, DIAGRAM_HEADER);
+   if (g_stack.top < 0) sb_puts(&out, DIAGRAM_EMPTY);
+   for (int i = g_stack.top; i >= 0; i--) sb_append(&out, g_boxes.slots[i].box.data, g_boxes.slots[i].box.len);
+   return sb_take(&out);
+}
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+#include "strbuf.h"
 
 // Create an enum for the variable types
 typedef enum  {
@@ -30,6 +32,8 @@ struct Symbol {
 struct SymbolTable {
    struct Symbol items[32];
    size_t count;
+   unsigned long layout; // names the types and names in order (see update_layout); 0 when empty
+   unsigned long long hash; // state hash of the bindings (see symbol_hash); 0 when empty
 };
 
 // HELPER FUNCTIONS
@@ -40,6 +44,11 @@ struct SymbolTable {
  */
 void strip_semicolon(char *s);
 
+/**
+ * @brief Exchanges the contents of two n-byte buffers
+ */
+void swap_bytes(void *a, void *b, size_t n);
+
 bool is_table_full(struct SymbolTable *t, const char *var_name);
 
 void set(struct Symbol *s, VarType type, void *value, size_t array_len);
@@ -64,6 +73,42 @@ struct Symbol *find(struct SymbolTable *t, const char *var_name);
  */
 bool add(struct SymbolTable *t, const char *var_name, VarType type, void *value, size_t array_len);
 
+/**
+ * @brief Looks up var_name among the symbols of the running function (any symbol at top level)
+ * @return The Symbol, or NULL if var_name is unbound or a global
+ */
+struct Symbol *find_local(struct SymbolTable *t, const char *var_name);
+
+/**
+ * @brief Like add(), but inside a function a global of the same name is shadowed by a new
+ * local instead of being updated
+ */
+bool declare(struct SymbolTable *t, const char *var_name, VarType type, void *value, size_t array_len);
+
+/**
+ * @brief Sets t->layout to the id of the table's current types and names
+ * Tables with the same symbols in the same order get the same id within a thread, so
+ * anything bound to symbol indices can be reused while the id is unchanged.
+ */
+void update_layout(struct SymbolTable *t);
+
+/**
+ * @brief The contribution of s to its table's hash: a mix of its slot, name, type and value
+ * t->hash is the sum of these words over the items, so changing one symbol updates it in O(1),
+ * and tables whose bindings print alike hash alike, in any thread or process.
+ */
+unsigned long long symbol_hash(const struct SymbolTable *t, const struct Symbol *s);
+
+/**
+ * @brief Recomputes t->hash after symbols were moved in bulk
+ */
+void table_rehash(struct SymbolTable *t);
+
+/**
+ * @brief Copies src into dst, layout and hash included
+ */
+void table_copy(struct SymbolTable *dst, const struct SymbolTable *src);
+
 /**
  * @brief Free's memory after the program execution
  * @return void
@@ -79,17 +124,59 @@ void free_symbols(struct SymbolTable *t);
 void print_binding_table(struct SymbolTable *t);
 
 /**
- * @brief Format the binding table into the provided buffer.
+ * @brief Append the binding table to out.
  * Example: "S = {x |-> 5; name |-> addr}"
  */
-void format_binding_table(const struct SymbolTable *t, char *buffer, size_t buffer_size);
+void format_binding_table(const struct SymbolTable *t, StrBuf *out);
+
+/**
+ * @brief Append the value part of a binding: "5", "?", "0x1000"
+ */
+void format_value(const struct Symbol *s, StrBuf *out);
 
 // Stack/scope visualization and management
 void stack_reset();
 void stack_enter_scope();
 void stack_exit_scope(struct SymbolTable *t);
 void stack_on_declare(struct SymbolTable *t, const char *var_name);
-void format_stack(char *buffer, size_t buffer_size);
+void format_stack(StrBuf *out);
+
+/**
+ * @brief Opens an activation record for a call to `name`
+ * The calling function's locals move from t to the frame pool, leaving the globals for the
+ * callee to declare its parameters after; the stack model gets a "name()" frame slot.
+ * @return false when out of memory
+ */
+bool stack_call_enter(struct SymbolTable *t, const char *name);
+
+/**
+ * @brief Closes the innermost activation record, dropping the callee's symbols and
+ * restoring the caller's
+ */
+void stack_call_exit(struct SymbolTable *t);
+
+/**
+ * @brief Number of open activation records (0 at top level)
+ */
+int stack_call_depth(void);
+
+// Snapshot of the stack model and its memory frames, used by execution checkpoints
+size_t stack_state_size(void);
+void stack_state_save(void *dst);
+void stack_state_load(const void *src);
+
+/**
+ * @brief Frees the activation records and the address space of this thread
+ */
+void stack_release(void);
+
+/**
+ * @brief Exchanges the stack model, activation records and address space of this thread
+ * with a buffer of stack_context_size() bytes; a zeroed buffer followed by stack_reset()
+ * starts an empty one (see ExecSession in parser.h)
+ */
+size_t stack_context_size(void);
+void stack_context_swap(void *ctx);
 
 // Multi-line boxed stack diagram for step-by-step visualization, including values.
 // Returns a newly malloc'ed string that the caller must free.
@@ -98,4 +185,39 @@ char *format_stack_diagram(const struct SymbolTable *t);
 // Symbol table helpers
 bool remove_symbol(struct SymbolTable *t, const char *var_name);
 
+// Output streams
+/**
+ * @brief Redirects interpreter output and diagnostics.
+ * Passing NULL for either stream restores stdout/stderr respectively.
+ * @param out Stream receiving the rendered table and stack evolution
+ * @param err Stream receiving error messages
+ */
+void bt_set_streams(FILE *out, FILE *err);
+
+/**
+ * @brief Reads the streams set by bt_set_streams (NULL for stdout/stderr)
+ */
+void bt_get_streams(FILE **out, FILE **err);
+
+FILE *bt_out(void);
+FILE *bt_err(void);
+
+/**
+ * @brief Sets the source position that diagnostics refer to (0 clears it)
+ * While set, bt_err() starts each message with "line:column: ".
+ */
+void bt_set_location(int line, int column);
+
+/**
+ * @brief bt_set_location(line, column), then bt_err()
+ */
+FILE *bt_err_at(int line, int column);
+
+void bt_get_location(int *line, int *column);
+
+/**
+ * @brief Number of bt_err() calls on this thread; it only moves when a diagnostic is printed
+ */
+unsigned long bt_err_count(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,371 @@
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "cache.h"
+
+// --------- Key hashing (two independent 64-bit streams) ---------
+void cache_key_init(CacheKey *k) {
+   k->h1 = 0xcbf29ce484222325ULL; // FNV-1a offset basis
+   k->h2 = 0x9e3779b97f4a7c15ULL;
+}
+
+void cache_key_update(CacheKey *k, const void *data, size_t len) {
+   const unsigned char *p = (const unsigned char *)data;
+   uint64_t h1 = k->h1, h2 = k->h2;
+   for (size_t i = 0; i < len; i++) {
+      h1 = (h1 ^ p[i]) * 0x100000001b3ULL;
+      h2 = (h2 + p[i] + 1) * 0xff51afd7ed558ccdULL;
+      h2 ^= h2 >> 29;
+   }
+   k->h1 = h1;
+   k->h2 = h2;
+}
+
+static bool key_equal(const CacheKey *a, const CacheKey *b) {
+   return a->h1 == b->h1 && a->h2 == b->h2;
+}
+
+// --------- In-memory LRU tier ---------
+typedef struct CacheEntry {
+   CacheKey key;
+   int status;
+   char *out;
+   size_t out_len;
+   char *err;
+   size_t err_len;
+   struct CacheEntry *prev, *next; // recency list, most recent at head
+   struct CacheEntry *hnext;       // bucket chain
+} CacheEntry;
+
+#define CACHE_BUCKETS 512
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static CacheEntry *g_buckets[CACHE_BUCKETS];
+static CacheEntry *g_head = NULL, *g_tail = NULL;
+static size_t g_entries = 0, g_bytes = 0;
+static struct CacheStats g_stats;
+
+static CacheEntry **bucket_of(const CacheKey *k) {
+   return &g_buckets[k->h1 % CACHE_BUCKETS];
+}
+
+static void list_unlink(CacheEntry *e) {
+   if (e->prev) e->prev->next = e->next; else g_head = e->next;
+   if (e->next) e->next->prev = e->prev; else g_tail = e->prev;
+   e->prev = e->next = NULL;
+}
+
+static void list_push_front(CacheEntry *e) {
+   e->prev = NULL;
+   e->next = g_head;
+   if (g_head) g_head->prev = e;
+   g_head = e;
+   if (!g_tail) g_tail = e;
+}
+
+static void mem_evict_tail(void) {
+   CacheEntry *e = g_tail;
+   if (!e) return;
+   list_unlink(e);
+   for (CacheEntry **pp = bucket_of(&e->key); *pp; pp = &(*pp)->hnext) {
+      if (*pp == e) { *pp = e->hnext; break; }
+   }
+   g_entries--;
+   g_bytes -= e->out_len + e->err_len;
+   g_stats.evictions++;
+   free(e->out);
+   free(e->err);
+   free(e);
+}
+
+static CacheEntry *mem_find(const CacheKey *k) {
+   for (CacheEntry *e = *bucket_of(k); e; e = e->hnext) {
+      if (key_equal(&e->key, k)) return e;
+   }
+   return NULL;
+}
+
+// Takes ownership of out/err; caller holds g_lock
+static void mem_insert(const CacheKey *k, int status, char *out, size_t out_len, char *err, size_t err_len) {
+   if (out_len + err_len > CACHE_MEM_MAX_BYTES || mem_find(k)) {
+      free(out);
+      free(err);
+      return;
+   }
+   CacheEntry *e = (CacheEntry *)calloc(1, sizeof(CacheEntry));
+   if (!e) {
+      free(out);
+      free(err);
+      return;
+   }
+   e->key = *k;
+   e->status = status;
+   e->out = out; e->out_len = out_len;
+   e->err = err; e->err_len = err_len;
+   CacheEntry **b = bucket_of(k);
+   e->hnext = *b;
+   *b = e;
+   list_push_front(e);
+   g_entries++;
+   g_bytes += out_len + err_len;
+   while (g_entries > CACHE_MEM_MAX_ENTRIES || g_bytes > CACHE_MEM_MAX_BYTES) mem_evict_tail();
+}
+
+static char *copy_bytes(const char *p, size_t n) {
+   char *d = (char *)malloc(n ? n : 1);
+   if (d && n) memcpy(d, p, n);
+   return d;
+}
+
+// --------- On-disk tier ---------
+// File layout: magic, key, status, out_len, err_len, out bytes, err bytes
+static const char DISK_MAGIC[8] = {'B', 'T', 'C', 'A', 'C', 'H', 'E', '1'};
+#define DISK_SUFFIX ".btc"
+
+typedef struct {
+   char magic[8];
+   CacheKey key;
+   int64_t status;
+   uint64_t out_len;
+   uint64_t err_len;
+} DiskHeader;
+
+static void disk_path(char *buf, size_t n, const char *dir, const CacheKey *k) {
+   snprintf(buf, n, "%s/%016llx%016llx" DISK_SUFFIX, dir,
+            (unsigned long long)k->h1, (unsigned long long)k->h2);
+}
+
+static bool disk_read(const char *dir, const CacheKey *k, int *status, char **out, size_t *out_len, char **err, size_t *err_len) {
+   char path[4096];
+   disk_path(path, sizeof(path), dir, k);
+   FILE *f = fopen(path, "rb");
+   if (!f) return false;
+   DiskHeader h;
+   bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+             memcmp(h.magic, DISK_MAGIC, sizeof(DISK_MAGIC)) == 0 &&
+             key_equal(&h.key, k) &&
+             h.out_len <= CACHE_MEM_MAX_BYTES && h.err_len <= CACHE_MEM_MAX_BYTES - h.out_len;
+   *out = *err = NULL;
+   if (ok) {
+      *out = (char *)malloc(h.out_len ? h.out_len : 1);
+      *err = (char *)malloc(h.err_len ? h.err_len : 1);
+      ok = *out && *err &&
+           fread(*out, 1, h.out_len, f) == h.out_len &&
+           fread(*err, 1, h.err_len, f) == h.err_len;
+   }
+   fclose(f);
+   if (!ok) {
+      free(*out);
+      free(*err);
+      return false;
+   }
+   *status = (int)h.status;
+   *out_len = (size_t)h.out_len;
+   *err_len = (size_t)h.err_len;
+   // Refresh the mtime so size-cap eviction drops the least recently used files first
+   utimes(path, NULL);
+   return true;
+}
+
+typedef struct {
+   char name[64];
+   off_t size;
+   time_t mtime;
+} DiskFile;
+
+static int by_mtime(const void *a, const void *b) {
+   time_t ma = ((const DiskFile *)a)->mtime, mb = ((const DiskFile *)b)->mtime;
+   return (ma > mb) - (ma < mb);
+}
+
+// Bytes of cache files per directory, kept up to date by this process's stores so that a
+// store does not rescan the directory. Files other processes write are only counted at the
+// next scan: one runs when the total passes the cap and after every DISK_RESCAN_STORES stores.
+#define DISK_MAX_DIRS 8
+#define DISK_RESCAN_STORES 64
+
+typedef struct {
+   char *dir;
+   unsigned long long bytes;
+   unsigned long stores; // since the last scan
+} DiskUsage;
+
+// Guards g_usage and the scans; disk I/O never holds g_lock, so memory lookups do not wait for it
+static pthread_mutex_t g_disk_lock = PTHREAD_MUTEX_INITIALIZER;
+static DiskUsage g_usage[DISK_MAX_DIRS];
+
+// The usage record of dir, or NULL when too many directories are in use; caller holds g_disk_lock
+static DiskUsage *disk_usage(const char *dir, bool *fresh) {
+   *fresh = false;
+   for (size_t i = 0; i < DISK_MAX_DIRS; i++) {
+      if (g_usage[i].dir && strcmp(g_usage[i].dir, dir) == 0) return &g_usage[i];
+   }
+   for (size_t i = 0; i < DISK_MAX_DIRS; i++) {
+      if (!g_usage[i].dir) {
+         if (!(g_usage[i].dir = strdup(dir))) return NULL;
+         *fresh = true;
+         return &g_usage[i];
+      }
+   }
+   return NULL;
+}
+
+// Scans dir and removes the oldest cache files until it is under max_bytes; returns the
+// bytes left and adds the files removed to *evicted
+static unsigned long long disk_trim(const char *dir, size_t max_bytes, unsigned long *evicted) {
+   DIR *d = opendir(dir);
+   if (!d) return 0;
+   DiskFile *files = NULL;
+   size_t count = 0, cap = 0;
+   unsigned long long total = 0;
+   struct dirent *ent;
+   char path[4096];
+   while ((ent = readdir(d)) != NULL) {
+      size_t n = strlen(ent->d_name);
+      if (n < sizeof(DISK_SUFFIX) || n >= sizeof(files->name) ||
+          strcmp(ent->d_name + n - (sizeof(DISK_SUFFIX) - 1), DISK_SUFFIX) != 0) continue;
+      snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+      struct stat st;
+      if (stat(path, &st) != 0) continue;
+      if (count == cap) {
+         size_t new_cap = cap ? cap * 2 : 64;
+         DiskFile *tmp = (DiskFile *)realloc(files, sizeof(DiskFile) * new_cap);
+         if (!tmp) break;
+         files = tmp;
+         cap = new_cap;
+      }
+      strcpy(files[count].name, ent->d_name);
+      files[count].size = st.st_size;
+      files[count].mtime = st.st_mtime;
+      count++;
+      total += (unsigned long long)st.st_size;
+   }
+   closedir(d);
+   if (total > max_bytes) {
+      qsort(files, count, sizeof(DiskFile), by_mtime);
+      for (size_t i = 0; i < count && total > max_bytes; i++) {
+         snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+         if (unlink(path) == 0) {
+            total -= (unsigned long long)files[i].size;
+            (*evicted)++;
+         }
+      }
+   }
+   free(files);
+   return total;
+}
+
+// Writes one entry; returns the files evicted to stay under max_bytes. Files are replaced by
+// rename(), so concurrent writers and readers need no lock.
+static unsigned long disk_write(const char *dir, size_t max_bytes, const CacheKey *k, int status,
+                                const char *out, size_t out_len, const char *err, size_t err_len) {
+   static unsigned long tmp_counter = 0;
+   if (mkdir(dir, 0755) != 0 && errno != EEXIST) return 0;
+   char tmp[4096], path[4096];
+   snprintf(tmp, sizeof(tmp), "%s/.tmp-%ld-%lu", dir, (long)getpid(),
+            __atomic_fetch_add(&tmp_counter, 1, __ATOMIC_RELAXED));
+   disk_path(path, sizeof(path), dir, k);
+
+   FILE *f = fopen(tmp, "wb");
+   if (!f) return 0;
+   DiskHeader h;
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, DISK_MAGIC, sizeof(DISK_MAGIC));
+   h.key = *k;
+   h.status = status;
+   h.out_len = out_len;
+   h.err_len = err_len;
+   bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(out, 1, out_len, f) == out_len &&
+             fwrite(err, 1, err_len, f) == err_len;
+   ok = (fclose(f) == 0) && ok;
+   // The entry it replaces, if any, no longer counts
+   struct stat old;
+   unsigned long long replaced = stat(path, &old) == 0 ? (unsigned long long)old.st_size : 0;
+   // rename() publishes the complete file atomically; readers never see a partial entry
+   if (!ok || rename(tmp, path) != 0) {
+      unlink(tmp);
+      return 0;
+   }
+
+   unsigned long evicted = 0;
+   pthread_mutex_lock(&g_disk_lock);
+   bool fresh;
+   DiskUsage *u = disk_usage(dir, &fresh);
+   if (u && !fresh) {
+      u->bytes += sizeof(h) + out_len + err_len;
+      u->bytes -= replaced < u->bytes ? replaced : u->bytes;
+   }
+   if (!u || fresh || u->bytes > max_bytes || ++u->stores >= DISK_RESCAN_STORES) {
+      unsigned long long bytes = disk_trim(dir, max_bytes, &evicted);
+      if (u) {
+         u->bytes = bytes;
+         u->stores = 0;
+      }
+   }
+   pthread_mutex_unlock(&g_disk_lock);
+   return evicted;
+}
+
+// --------- Public API ---------
+bool cache_lookup(const CacheKey *k, const char *dir, FILE *out, FILE *err, int *status) {
+   pthread_mutex_lock(&g_lock);
+   CacheEntry *e = mem_find(k);
+   if (e) {
+      list_unlink(e);
+      list_push_front(e);
+      fwrite(e->out, 1, e->out_len, out);
+      fwrite(e->err, 1, e->err_len, err);
+      *status = e->status;
+      g_stats.mem_hits++;
+      pthread_mutex_unlock(&g_lock);
+      return true;
+   }
+   pthread_mutex_unlock(&g_lock);
+
+   char *o = NULL, *er = NULL;
+   size_t o_len = 0, er_len = 0;
+   if (dir && disk_read(dir, k, status, &o, &o_len, &er, &er_len)) {
+      fwrite(o, 1, o_len, out);
+      fwrite(er, 1, er_len, err);
+      pthread_mutex_lock(&g_lock);
+      g_stats.disk_hits++;
+      mem_insert(k, *status, o, o_len, er, er_len);
+      pthread_mutex_unlock(&g_lock);
+      return true;
+   }
+
+   pthread_mutex_lock(&g_lock);
+   g_stats.misses++;
+   pthread_mutex_unlock(&g_lock);
+   return false;
+}
+
+void cache_store(const CacheKey *k, const char *dir, size_t disk_max_bytes,
+                 int status, const char *out, size_t out_len, const char *err, size_t err_len) {
+   char *o = copy_bytes(out, out_len);
+   char *er = copy_bytes(err, err_len);
+   pthread_mutex_lock(&g_lock);
+   g_stats.stores++;
+   if (o && er) mem_insert(k, status, o, out_len, er, err_len);
+   else { free(o); free(er); }
+   pthread_mutex_unlock(&g_lock);
+   if (!dir) return;
+   unsigned long evicted = disk_write(dir, disk_max_bytes, k, status, out, out_len, err, err_len);
+   if (evicted == 0) return;
+   pthread_mutex_lock(&g_lock);
+   g_stats.evictions += evicted;
+   pthread_mutex_unlock(&g_lock);
+}
+
+void cache_get_stats(struct CacheStats *s) {
+   pthread_mutex_lock(&g_lock);
+   *s = g_stats;
+   pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,62 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Content-addressed cache of rendered run results.
+ *
+ * The key is a 128-bit hash of whatever the caller feeds it (run.c uses the
+ * token stream plus the options that affect output). Results live in a
+ * process-wide in-memory LRU and, optionally, in a directory of one file per
+ * key that is written atomically and trimmed to a size cap.
+ */
+
+#define CACHE_MEM_MAX_ENTRIES 256
+#define CACHE_MEM_MAX_BYTES (32u * 1024u * 1024u)
+#define CACHE_DISK_DEFAULT_MAX_BYTES (64u * 1024u * 1024u)
+
+typedef struct {
+   uint64_t h1;
+   uint64_t h2;
+} CacheKey;
+
+struct CacheStats {
+   unsigned long mem_hits;
+   unsigned long disk_hits;
+   unsigned long misses;
+   unsigned long stores;
+   unsigned long evictions; // memory and disk entries dropped to stay under the caps
+};
+
+void cache_key_init(CacheKey *k);
+void cache_key_update(CacheKey *k, const void *data, size_t len);
+
+/**
+ * @brief Looks a key up in memory, then in dir (if not NULL)
+ * On a hit the cached stdout/stderr are written to out/err.
+ * @return true on a hit
+ * @param k The key to look up
+ * @param dir On-disk cache directory, or NULL for memory only
+ * @param out Stream receiving the cached stdout
+ * @param err Stream receiving the cached stderr
+ * @param status Receives the cached exit status
+ */
+bool cache_lookup(const CacheKey *k, const char *dir, FILE *out, FILE *err, int *status);
+
+/**
+ * @brief Stores a result in memory and, if dir is not NULL, on disk
+ * @return void
+ * @param k The key to store under
+ * @param dir On-disk cache directory (created if missing), or NULL
+ * @param disk_max_bytes Size cap for the files in dir
+ */
+void cache_store(const CacheKey *k, const char *dir, size_t disk_max_bytes,
+                 int status, const char *out, size_t out_len, const char *err, size_t err_len);
+
+void cache_get_stats(struct CacheStats *s);
+
+#endif
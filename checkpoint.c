@@ -0,0 +1,166 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+
+// Bump whenever the saved interpreter state changes meaning
+#define CHECKPOINT_VERSION "bt-checkpoint-v1"
+#define CHECKPOINT_BUCKETS 1024
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static Checkpoint *g_buckets[CHECKPOINT_BUCKETS];
+static Checkpoint *g_head = NULL, *g_tail = NULL;
+static size_t g_entries = 0, g_bytes = 0;
+static struct CheckpointStats g_stats;
+
+// --------- Keys ---------
+void checkpoint_key_init(CacheKey *prefix, const void *seed, size_t seed_len) {
+   cache_key_init(prefix);
+   cache_key_update(prefix, CHECKPOINT_VERSION, sizeof(CHECKPOINT_VERSION));
+   cache_key_update(prefix, seed, seed_len);
+}
+
+void checkpoint_key_advance(CacheKey *prefix, const Token *tok) {
+   unsigned char type = (unsigned char)tok->type;
+   cache_key_update(prefix, &type, 1);
+   cache_key_update(prefix, tok->value, strlen(tok->value) + 1);
+}
+
+static bool key_equal(const CacheKey *a, const CacheKey *b) {
+   return a->h1 == b->h1 && a->h2 == b->h2;
+}
+
+// --------- Store (caller holds g_lock) ---------
+static Checkpoint **bucket_of(const CacheKey *k) {
+   return &g_buckets[k->h1 % CHECKPOINT_BUCKETS];
+}
+
+static void list_unlink(Checkpoint *c) {
+   if (c->prev) c->prev->next = c->next; else g_head = c->next;
+   if (c->next) c->next->prev = c->prev; else g_tail = c->prev;
+   c->prev = c->next = NULL;
+}
+
+static void list_push_front(Checkpoint *c) {
+   c->prev = NULL;
+   c->next = g_head;
+   if (g_head) g_head->prev = c;
+   g_head = c;
+   if (!g_tail) g_tail = c;
+}
+
+// Drops one reference; freeing a checkpoint drops the one it holds on its parent
+static void unref_locked(Checkpoint *c) {
+   while (c && --c->refs == 0) {
+      Checkpoint *parent = c->parent;
+      free_rows(c->rows, c->row_count);
+      free(c->state);
+      free(c);
+      c = parent;
+   }
+}
+
+static void evict_tail(void) {
+   Checkpoint *c = g_tail;
+   if (!c) return;
+   list_unlink(c);
+   for (Checkpoint **pp = bucket_of(&c->key); *pp; pp = &(*pp)->hnext) {
+      if (*pp == c) { *pp = c->hnext; break; }
+   }
+   g_entries--;
+   g_bytes -= c->bytes;
+   g_stats.evictions++;
+   unref_locked(c);
+}
+
+static Checkpoint *find_locked(const CacheKey *k, size_t index) {
+   for (Checkpoint *c = *bucket_of(k); c; c = c->hnext) {
+      if (c->index == index && key_equal(&c->key, k)) return c;
+   }
+   return NULL;
+}
+
+// --------- API ---------
+Checkpoint *checkpoint_find(const Token *tokens, size_t count, const void *seed, size_t seed_len) {
+   // keys[i] identifies the boundary before tokens[i]
+   CacheKey *keys = (CacheKey *)malloc(sizeof(CacheKey) * count);
+   if (!keys) return NULL;
+   CacheKey prefix;
+   checkpoint_key_init(&prefix, seed, seed_len);
+   for (size_t i = 0; i < count; i++) {
+      keys[i] = prefix;
+      checkpoint_key_advance(&prefix, &tokens[i]);
+   }
+
+   Checkpoint *found = NULL;
+   pthread_mutex_lock(&g_lock);
+   for (size_t i = count; i-- > 1 && !found;) {
+      // Top-level statements end with ';' or '}'
+      const Token *prev = &tokens[i - 1];
+      if (prev->type != TOKEN_PUNCTUATION || (strcmp(prev->value, ";") != 0 && strcmp(prev->value, "}") != 0)) continue;
+      found = find_locked(&keys[i], i);
+   }
+   if (found) {
+      found->refs++;
+      list_unlink(found);
+      list_push_front(found);
+      g_stats.resumes++;
+      g_stats.tokens_skipped += found->index;
+   } else {
+      g_stats.misses++;
+   }
+   pthread_mutex_unlock(&g_lock);
+   free(keys);
+   return found;
+}
+
+Checkpoint *checkpoint_create(Checkpoint *parent, const CacheKey *prefix, size_t index) {
+   Checkpoint *c = (Checkpoint *)calloc(1, sizeof(Checkpoint));
+   if (!c) return NULL;
+   c->key = *prefix;
+   c->index = index;
+   c->refs = 1;
+   if (parent) {
+      pthread_mutex_lock(&g_lock);
+      parent->refs++;
+      pthread_mutex_unlock(&g_lock);
+      c->parent = parent;
+   }
+   return c;
+}
+
+void checkpoint_publish(Checkpoint *c) {
+   c->bytes = sizeof(*c) + c->state_size + c->row_count * sizeof(TableRow);
+   for (size_t i = 0; i < c->row_count; i++) {
+      const TableRow *r = &c->rows[i];
+      c->bytes += strlen(r->command) + strlen(r->binding) + strlen(r->stack) +
+                  (r->stack_diagram ? strlen(r->stack_diagram) : 0) + 4;
+   }
+   pthread_mutex_lock(&g_lock);
+   if (c->bytes <= CHECKPOINT_MAX_BYTES && !find_locked(&c->key, c->index)) {
+      c->refs++; // held by the store
+      Checkpoint **b = bucket_of(&c->key);
+      c->hnext = *b;
+      *b = c;
+      list_push_front(c);
+      g_entries++;
+      g_bytes += c->bytes;
+      g_stats.stores++;
+      while (g_entries > CHECKPOINT_MAX_ENTRIES || g_bytes > CHECKPOINT_MAX_BYTES) evict_tail();
+   }
+   pthread_mutex_unlock(&g_lock);
+}
+
+void checkpoint_release(Checkpoint *c) {
+   if (!c) return;
+   pthread_mutex_lock(&g_lock);
+   unref_locked(c);
+   pthread_mutex_unlock(&g_lock);
+}
+
+void checkpoint_get_stats(struct CheckpointStats *s) {
+   pthread_mutex_lock(&g_lock);
+   *s = g_stats;
+   pthread_mutex_unlock(&g_lock);
+}
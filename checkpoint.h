@@ -0,0 +1,86 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "cache.h"
+#include "lexer.h"
+#include "parser.h"
+
+/*
+ * Execution checkpoints for incremental re-execution (bt --incremental).
+ *
+ * After a top-level statement, execute_program() can save the interpreter
+ * state under a key that hashes the token prefix executed so far. When a later
+ * run shares that prefix, execution resumes from the longest matching
+ * checkpoint instead of starting over. This relies on statements that run
+ * without diagnostics never reading past their own terminator, so checkpoints
+ * are only taken while no error has been reported.
+ *
+ * Checkpoints of one run form a chain: each holds only the trace rows produced
+ * since its parent, and it keeps the parent alive with a reference. The store
+ * is process-wide, bounded, least-recently-used first out, and thread-safe.
+ * Published checkpoints are immutable.
+ */
+
+#define CHECKPOINT_MAX_ENTRIES 4096
+#define CHECKPOINT_MAX_BYTES (64u * 1024u * 1024u)
+
+typedef struct Checkpoint {
+   CacheKey key;
+   size_t index;              // token index execution resumes from
+   struct Checkpoint *parent; // previous checkpoint of the same run, or NULL
+   TableRow *rows;            // rows produced since the parent
+   size_t row_count;
+   size_t total_rows;         // rows produced since the start of the program
+   void *state;               // interpreter state; opaque to the store
+   size_t state_size;
+
+   // Store bookkeeping
+   size_t bytes;
+   int refs;
+   struct Checkpoint *prev, *next, *hnext;
+} Checkpoint;
+
+struct CheckpointStats {
+   unsigned long resumes;        // runs that resumed from a checkpoint
+   unsigned long misses;         // runs that found none
+   unsigned long tokens_skipped; // program tokens not re-executed thanks to resumes
+   unsigned long stores;
+   unsigned long evictions;
+};
+
+/**
+ * @brief Starts a prefix key; seed holds whatever else changes execution (e.g. limits)
+ */
+void checkpoint_key_init(CacheKey *prefix, const void *seed, size_t seed_len);
+
+/**
+ * @brief Extends a prefix key by one token
+ */
+void checkpoint_key_advance(CacheKey *prefix, const Token *tok);
+
+/**
+ * @brief Finds the checkpoint with the longest token prefix shared with tokens
+ * @return A referenced checkpoint to release with checkpoint_release(), or NULL
+ * @param count Number of tokens, including the final end-of-file token
+ */
+Checkpoint *checkpoint_find(const Token *tokens, size_t count, const void *seed, size_t seed_len);
+
+/**
+ * @brief Allocates an unpublished checkpoint after `parent` (which gains a reference)
+ * The caller fills rows and state, then hands it to checkpoint_publish().
+ * @return The checkpoint, owned by the caller, or NULL when out of memory
+ */
+Checkpoint *checkpoint_create(Checkpoint *parent, const CacheKey *prefix, size_t index);
+
+/**
+ * @brief Adds a checkpoint to the store; the caller keeps its own reference
+ */
+void checkpoint_publish(Checkpoint *cp);
+
+void checkpoint_release(Checkpoint *cp);
+
+void checkpoint_get_stats(struct CheckpointStats *s);
+
+#endif
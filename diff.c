@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+#include "bt.h"
+#include "lexer.h"
+#include "parser.h"
+#include "strbuf.h"
+
+// Steps run per session call: enough to make swapping the sessions in cheap, few enough
+// that little runs past a divergence
+#define DIFF_CHUNK_ROWS 1024
+
+typedef struct {
+   const char *name;
+   Token *tokens;
+   ExecSession *exec;
+   TableRow *rows;        // the current chunk, hashes only
+   size_t count, next;    // rows in the chunk and the next one to compare
+   size_t steps;          // rows produced so far
+   char *err;             // diagnostics, captured while the session steps
+   size_t err_len;
+   FILE *err_f;
+   unsigned long errors;
+} DiffSide;
+
+// Steps exec with its diagnostics going to err_f, and counts them
+static TableRow *step_into(ExecSession *exec, FILE *err_f, size_t max_rows, size_t *count, unsigned long *errors) {
+   FILE *out, *err;
+   bt_get_streams(&out, &err);
+   bt_set_streams(out, err_f);
+   unsigned long before = bt_err_count();
+   TableRow *rows = exec_session_step(exec, max_rows, 0, count);
+   *errors += bt_err_count() - before;
+   bt_set_streams(out, err);
+   return rows;
+}
+
+// Makes the next row available unless the program finished; false when out of memory
+static bool side_fill(DiffSide *s) {
+   if (s->next < s->count || exec_session_done(s->exec)) return true;
+   free_rows(s->rows, s->count);
+   s->rows = NULL;
+   s->count = s->next = 0;
+   s->rows = step_into(s->exec, s->err_f, DIFF_CHUNK_ROWS, &s->count, &s->errors);
+   s->steps += s->count;
+   return s->rows || s->count == 0;
+}
+
+static void side_close(DiffSide *s) {
+   free_rows(s->rows, s->count);
+   exec_session_close(s->exec);
+   free(s->tokens);
+   if (s->err_f) fclose(s->err_f);
+   free(s->err);
+}
+
+static const struct Symbol *find_symbol(const struct SymbolTable *t, const char *name) {
+   for (size_t i = 0; i < t->count; i++) {
+      if (strcmp(t->items[i].name, name) == 0) return &t->items[i];
+   }
+   return NULL;
+}
+
+// "  x: 7 vs 6" for a variable bound differently (a or b NULL when unbound)
+static void print_variable(FILE *out, const struct Symbol *a, const struct Symbol *b) {
+   StrBuf line = SB_INIT;
+   sb_append(&line, "  ", 2);
+   sb_puts(&line, a ? a->name : b->name);
+   sb_append(&line, ": ", 2);
+   if (a) format_value(a, &line);
+   else sb_puts(&line, "(unbound)");
+   sb_append(&line, " vs ", 4);
+   if (b) format_value(b, &line);
+   else sb_puts(&line, "(unbound)");
+   if (line.data) fprintf(out, "%s\n", line.data);
+   sb_free(&line);
+}
+
+// Lists the variables whose bindings differ, by name
+static void print_variables(FILE *out, const struct SymbolTable *a, const struct SymbolTable *b) {
+   bool any = false;
+   for (size_t i = 0; i < a->count; i++) {
+      const struct Symbol *x = &a->items[i], *y = find_symbol(b, x->name);
+      if (y && x->type == y->type && x->initialized == y->initialized &&
+          (!x->initialized || x->value_int == y->value_int)) continue;
+      print_variable(out, x, y);
+      any = true;
+   }
+   for (size_t i = 0; i < b->count; i++) {
+      if (find_symbol(a, b->items[i].name)) continue;
+      print_variable(out, NULL, &b->items[i]);
+      any = true;
+   }
+   if (!any) fprintf(out, "  (the same bindings in another order)\n");
+}
+
+// Replays both programs with text rows up to step `step` and prints its commands and bindings
+static bool report_divergence(FILE *out, DiffSide sides[2], size_t step, const struct ExecLimits *limits,
+                              bool loop_summary, int width) {
+   ExecSession *replay[2] = { NULL, NULL };
+   TableRow *rows[2] = { NULL, NULL };
+   size_t count[2] = { 0, 0 };
+   // The same steps run again; their diagnostics were captured the first time
+   char *discard = NULL;
+   size_t discard_len = 0;
+   unsigned long errors = 0;
+   FILE *quiet = open_memstream(&discard, &discard_len);
+   bool ok = quiet != NULL;
+   for (int i = 0; i < 2 && ok; i++) {
+      replay[i] = exec_session_open(sides[i].tokens, limits, loop_summary);
+      if (!replay[i]) ok = false;
+      else rows[i] = step_into(replay[i], quiet, step, &count[i], &errors);
+   }
+   if (ok) {
+      fprintf(out, "First divergence at step %zu:\n", step);
+      for (int i = 0; i < 2; i++) {
+         const char *command = count[i] >= step ? rows[i][step - 1].command : NULL;
+         if (command) fprintf(out, "  %-*s  %s\n", width, sides[i].name, command);
+         else fprintf(out, "  %-*s  (ended after %zu steps)\n", width, sides[i].name, count[i]);
+      }
+      print_variables(out, exec_session_table(replay[0]), exec_session_table(replay[1]));
+   }
+   for (int i = 0; i < 2; i++) {
+      free_rows(rows[i], count[i]);
+      exec_session_close(replay[i]);
+   }
+   if (quiet) fclose(quiet);
+   free(discard);
+   return ok;
+}
+
+// "ref.c ran 12 steps (finished)"
+static void print_side_summary(FILE *out, const DiffSide *s) {
+   const char *reason = exec_session_truncated(s->exec);
+   fprintf(out, "%s ran %zu steps (%s)", s->name, s->steps,
+           reason ? reason : exec_session_done(s->exec) ? "finished" : "stopped early");
+}
+
+// Replays the captured diagnostics as "name:line:col: Error: ..."
+static void print_diagnostics(const DiffSide *s) {
+   FILE *out, *err;
+   bt_get_streams(&out, &err);
+   if (!err) err = stderr;
+   for (const char *p = s->err, *end = s->err + s->err_len; p < end;) {
+      const char *nl = memchr(p, '\n', (size_t)(end - p));
+      size_t n = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+      fprintf(err, "%s:%.*s", s->name, (int)n, p);
+      p += n;
+   }
+}
+
+int diff_sources(const char *const names[2], const char *const codes[2], const struct RunOptions *o) {
+   // Text is never held, and the replay of a divergence must not stop before the first run did
+   struct ExecLimits limits = o->limits;
+   limits.max_trace_bytes = 0;
+   struct ExecLimits replay_limits = limits;
+   replay_limits.max_time_ms = 0;
+
+   DiffSide sides[2];
+   memset(sides, 0, sizeof(sides));
+   int status = 0;
+   for (int i = 0; i < 2 && status == 0; i++) {
+      DiffSide *s = &sides[i];
+      s->name = names[i];
+      // The lexer reports its own errors
+      if (!(s->tokens = tokenize(codes[i]))) {
+         status = 2;
+      } else if (!(s->err_f = open_memstream(&s->err, &s->err_len)) ||
+                 !(s->exec = exec_session_open(s->tokens, &limits, o->loop_summary))) {
+         fprintf(bt_err(), "Error: Out of memory.\n");
+         status = 2;
+      } else {
+         exec_session_hash_rows(s->exec);
+      }
+   }
+
+   size_t matching = 0;
+   bool diverged = false;
+   while (status == 0) {
+      if (!side_fill(&sides[0]) || !side_fill(&sides[1])) {
+         fprintf(bt_err(), "Error: Out of memory.\n");
+         status = 2;
+         break;
+      }
+      DiffSide *a = &sides[0], *b = &sides[1];
+      bool more_a = a->next < a->count, more_b = b->next < b->count;
+      if (!more_a || !more_b) {
+         diverged = more_a || more_b;
+         break;
+      }
+      if (a->rows[a->next].state_hash != b->rows[b->next].state_hash) {
+         diverged = true;
+         break;
+      }
+      a->next++;
+      b->next++;
+      matching++;
+   }
+
+   FILE *out = bt_out();
+   if (status == 0) {
+      int width = (int)(strlen(names[0]) > strlen(names[1]) ? strlen(names[0]) : strlen(names[1]));
+      if (!diverged) {
+         fprintf(out, "Traces match: %zu steps.\n", matching);
+      } else if (!report_divergence(out, sides, matching + 1, &replay_limits, o->loop_summary, width)) {
+         fprintf(bt_err(), "Error: Out of memory.\n");
+         status = 2;
+      }
+      if (status == 0) {
+         fprintf(out, "Steps: %zu matching; ", matching);
+         print_side_summary(out, &sides[0]);
+         fprintf(out, ", ");
+         print_side_summary(out, &sides[1]);
+         fprintf(out, ".\nDiagnostics: %s %lu, %s %lu.\n", names[0], sides[0].errors, names[1], sides[1].errors);
+         status = diverged ? DIFF_EXIT_DIFFERENT : 0;
+      }
+   }
+   fflush(out);
+   for (int i = 0; i < 2; i++) {
+      if (sides[i].err_f) fflush(sides[i].err_f);
+      print_diagnostics(&sides[i]);
+      side_close(&sides[i]);
+   }
+   return status;
+}
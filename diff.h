@@ -0,0 +1,32 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include "run.h"
+
+/*
+ * bt --diff: compares the traces of two programs step by step, e.g. a submission
+ * against a reference solution. Both run in this process as stepping sessions
+ * (parser.h) advanced in lockstep, a chunk of steps at a time, and their steps
+ * are compared by the state hash of the binding table (bt.h symbol_hash), so no
+ * trace text is formatted and the runs stop soon after the first divergence.
+ * Only that step is then replayed with text, to name its commands and the
+ * variables that differ.
+ */
+
+// Exit status when the traces differ
+#define DIFF_EXIT_DIFFERENT 1
+
+/**
+ * @brief Runs both programs until their traces diverge and reports on bt_out()
+ * The report names the first divergent step, both commands, the differing variables and
+ * the step counts; diagnostics follow on bt_err(), prefixed by the program's name.
+ * @return 0 when the traces match, DIFF_EXIT_DIFFERENT when they differ, 2 when a program
+ * does not tokenize or memory runs out
+ * @param names Display names of the two programs (reference first)
+ * @param codes Their null-terminated sources
+ * @param o The budgets and --loop-summary apply to both runs; --max-trace-bytes does not,
+ * as no text is held
+ */
+int diff_sources(const char *const names[2], const char *const codes[2], const struct RunOptions *o);
+
+#endif
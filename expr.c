@@ -0,0 +1,427 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "expr.h"
+#include "func.h"
+#include "mem.h"
+#include "parser.h"
+#include "profile.h"
+
+// --------- Compilation ---------
+bool expr_type_of(VarType type, ExprType *out) {
+   switch (type) {
+      case TYPE_INT:    *out = EXPR_INT; return true;
+      case TYPE_FLOAT:  *out = EXPR_FLOAT; return true;
+      case TYPE_DOUBLE: *out = EXPR_DOUBLE; return true;
+      default:          return false;
+   }
+}
+
+static Expr *new_node(ExprKind kind, ExprType type) {
+   Expr *e = (Expr *)prof_malloc(sizeof(Expr));
+   if (!e) {
+      fprintf(bt_err(), "Error: Out of memory compiling expression.\n");
+      return NULL;
+   }
+   memset(e, 0, sizeof(*e));
+   e->kind = kind;
+   e->type = type;
+   e->operand = type;
+   e->slot = -1;
+   return e;
+}
+
+void expr_free(Expr *e) {
+   if (!e) return;
+   expr_free(e->lhs);
+   expr_free(e->rhs);
+   for (int i = 0; i < e->argc; i++) expr_free(e->args[i]);
+   free(e->args);
+   free(e);
+}
+
+Expr *expr_cast(Expr *e, ExprType to) {
+   if (!e || e->type == to) return e;
+   if (e->kind == EX_CONST) {
+      // Fold the conversion: the constant is stored in the target type
+      double v = e->type == EXPR_INT ? (double)e->k.i : e->type == EXPR_FLOAT ? (double)e->k.f : e->k.d;
+      if (to == EXPR_INT) e->k.i = (long)v;
+      else if (to == EXPR_FLOAT) e->k.f = e->type == EXPR_INT ? (float)e->k.i : (float)v;
+      else e->k.d = v;
+      e->type = e->operand = to;
+      return e;
+   }
+   Expr *c = new_node(EX_CONV, to);
+   if (!c) { expr_free(e); return NULL; }
+   c->operand = e->type;
+   c->lhs = e;
+   return c;
+}
+
+// Builds lhs <op> rhs after applying the usual arithmetic conversions
+static Expr *binary(ExprKind kind, Expr *lhs, Expr *rhs) {
+   ExprType common = lhs->type > rhs->type ? lhs->type : rhs->type;
+   lhs = expr_cast(lhs, common);
+   rhs = expr_cast(rhs, common);
+   bool compare = kind >= EX_LT;
+   Expr *e = (lhs && rhs) ? new_node(kind, compare ? EXPR_INT : common) : NULL;
+   if (!e) { expr_free(lhs); expr_free(rhs); return NULL; }
+   e->operand = common;
+   e->lhs = lhs;
+   e->rhs = rhs;
+   return e;
+}
+
+Expr *expr_truth(Expr *e) {
+   if (!e || e->type == EXPR_INT) return e;
+   Expr *zero = new_node(EX_CONST, EXPR_INT);
+   if (!zero) { expr_free(e); return NULL; }
+   return binary(EX_NE, e, zero);
+}
+
+static FILE *err_at(const Token *tok) {
+   return bt_err_at(tok->line, tok->column);
+}
+
+static bool is_punct(const Token *tok, const char *p) {
+   return tok->type == TOKEN_PUNCTUATION && strcmp(tok->value, p) == 0;
+}
+
+static Expr *compile_sum(Token **tokens, const struct SymbolTable *t);
+
+// name '(' [expr {',' expr}] ')' for function `index`; each argument is converted to its parameter's type
+static Expr *compile_call(Token **tokens, const struct SymbolTable *t, int index) {
+   const Function *f = func_get(index);
+   Expr *e = new_node(EX_CALL, f->returns_value ? f->ret : EXPR_INT);
+   if (!e) return NULL;
+   e->slot = index;
+   e->name = (*tokens)->value;
+   if (f->param_count > 0) {
+      e->args = (Expr **)prof_malloc(sizeof(Expr *) * (size_t)f->param_count);
+      if (!e->args) {
+         fprintf(bt_err(), "Error: Out of memory compiling expression.\n");
+         free(e);
+         return NULL;
+      }
+   }
+   (*tokens) += 2; // consume name '('
+   int count = 0;
+   while (!is_punct(*tokens, ")")) {
+      if (count > 0) {
+         if (!is_punct(*tokens, ",")) {
+            fprintf(err_at(*tokens), "Error: Expected ',' or ')' in the call of '%s' but found '%s'.\n", e->name, (*tokens)->value);
+            expr_free(e);
+            return NULL;
+         }
+         (*tokens)++; // consume ','
+      }
+      if (count == f->param_count) {
+         fprintf(err_at(*tokens), "Error: Too many arguments in the call of '%s', which takes %d.\n", e->name, f->param_count);
+         expr_free(e);
+         return NULL;
+      }
+      Expr *arg = expr_cast(compile_sum(tokens, t), f->params[count]);
+      if (!arg) { expr_free(e); return NULL; }
+      e->args[e->argc++] = arg;
+      count++;
+   }
+   if (count < f->param_count) {
+      fprintf(err_at(*tokens), "Error: Too few arguments in the call of '%s', which takes %d.\n", e->name, f->param_count);
+      expr_free(e);
+      return NULL;
+   }
+   (*tokens)++; // consume ')'
+   return e;
+}
+
+Expr *expr_compile_call(Token **tokens, const struct SymbolTable *t) {
+   int index = func_find((*tokens)->value);
+   if (index < 0 || !is_punct(*tokens + 1, "(")) {
+      fprintf(err_at(*tokens), "Error: '%s' is not a function.\n", (*tokens)->value);
+      return NULL;
+   }
+   return compile_call(tokens, t, index);
+}
+
+static Expr *compile_number(const char *text) {
+   bool fp = strpbrk(text, ".eE") != NULL;
+   if (!fp) {
+      Expr *e = new_node(EX_CONST, EXPR_INT);
+      if (e) e->k.i = strtol(text, NULL, 10);
+      return e;
+   }
+   size_t n = strlen(text);
+   bool single = n > 0 && (text[n - 1] == 'f' || text[n - 1] == 'F');
+   Expr *e = new_node(EX_CONST, single ? EXPR_FLOAT : EXPR_DOUBLE);
+   if (!e) return NULL;
+   if (single) e->k.f = strtof(text, NULL);
+   else e->k.d = strtod(text, NULL);
+   return e;
+}
+
+static Expr *compile_factor(Token **tokens, const struct SymbolTable *t) {
+   // Parenthesized expression: '(' expr ')'
+   if (is_punct(*tokens, "(")) {
+      (*tokens)++; // consume '('
+      Expr *inner = compile_sum(tokens, t);
+      if (!inner) return NULL;
+      if (!is_punct(*tokens, ")")) {
+         fprintf(err_at(*tokens), "Error: Expected ')' to close '(' but found '%s'.\n", (*tokens)->value);
+         expr_free(inner);
+         return NULL;
+      }
+      (*tokens)++; // consume ')'
+      return inner;
+   }
+
+   if ((*tokens)->type == TOKEN_NUMBER) {
+      Expr *e = compile_number((*tokens)->value);
+      if (e) (*tokens)++;
+      return e;
+   }
+   if ((*tokens)->type == TOKEN_IDENTIFIER) {
+      const char *name = (*tokens)->value;
+      int index = is_punct(*tokens + 1, "(") ? func_find(name) : -1;
+      if (index >= 0) {
+         if (!func_get(index)->returns_value) {
+            fprintf(err_at(*tokens), "Error: Function '%s' returns void; its call has no value.\n", name);
+            return NULL;
+         }
+         return compile_call(tokens, t, index);
+      }
+      ExprType type;
+      // The last symbol of a name is the innermost one (a local shadowing a global)
+      for (size_t i = t->count; i-- > 0;) {
+         if (strcmp(t->items[i].name, name) != 0) continue;
+         VarType vt = t->items[i].type;
+         if ((vt == TYPE_CHAR_ARRAY || vt == TYPE_CHAR_PTR) && is_punct(*tokens + 1, "[")) {
+            // Element access: name '[' expr ']'
+            (*tokens) += 2;
+            Expr *index = expr_cast(compile_sum(tokens, t), EXPR_INT);
+            if (!index) return NULL;
+            if (!is_punct(*tokens, "]")) {
+               fprintf(err_at(*tokens), "Error: Expected ']' after index of '%s' but found '%s'.\n", name, (*tokens)->value);
+               expr_free(index);
+               return NULL;
+            }
+            (*tokens)++; // consume ']'
+            Expr *e = new_node(EX_INDEX, EXPR_INT);
+            if (!e) { expr_free(index); return NULL; }
+            e->slot = (int)i;
+            e->name = name;
+            e->lhs = index;
+            return e;
+         }
+         if (!expr_type_of(vt, &type)) break;
+         Expr *e = new_node(EX_VAR, type);
+         if (!e) return NULL;
+         e->slot = (int)i;
+         e->name = name;
+         (*tokens)++;
+         return e;
+      }
+      fprintf(err_at(*tokens), "Error: Undefined or uninitialized identifier '%s' in expression.\n", name);
+      return NULL;
+   }
+   fprintf(err_at(*tokens), "Error: Expected number or identifier in expression but found '%s'.\n", (*tokens)->value);
+   return NULL;
+}
+
+static Expr *compile_term(Token **tokens, const struct SymbolTable *t) {
+   Expr *value = compile_factor(tokens, t);
+   while (value && (*tokens)->type == TOKEN_OPERATOR &&
+          (strcmp((*tokens)->value, "*") == 0 || strcmp((*tokens)->value, "/") == 0)) {
+      ExprKind kind = (*tokens)->value[0] == '*' ? EX_MUL : EX_DIV;
+      (*tokens)++; // consume '*' or '/'
+      Expr *rhs = compile_factor(tokens, t);
+      if (!rhs) { expr_free(value); return NULL; }
+      value = binary(kind, value, rhs);
+   }
+   return value;
+}
+
+static Expr *compile_sum(Token **tokens, const struct SymbolTable *t) {
+   Expr *value = compile_term(tokens, t);
+   while (value && (*tokens)->type == TOKEN_OPERATOR &&
+          (strcmp((*tokens)->value, "+") == 0 || strcmp((*tokens)->value, "-") == 0)) {
+      ExprKind kind = (*tokens)->value[0] == '+' ? EX_ADD : EX_SUB;
+      (*tokens)++; // consume '+' or '-'
+      Expr *rhs = compile_term(tokens, t);
+      if (!rhs) { expr_free(value); return NULL; }
+      value = binary(kind, value, rhs);
+   }
+   return value;
+}
+
+Expr *expr_compile(Token **tokens, const struct SymbolTable *t, bool relational) {
+   Expr *lhs = compile_sum(tokens, t);
+   if (!lhs || !relational || (*tokens)->type != TOKEN_OPERATOR) return lhs;
+   static const struct { const char *op; ExprKind kind; } ops[] = {
+      {">", EX_GT}, {"<", EX_LT}, {">=", EX_GE}, {"<=", EX_LE}, {"==", EX_EQ}, {"!=", EX_NE},
+   };
+   for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+      if (strcmp((*tokens)->value, ops[i].op) != 0) continue;
+      (*tokens)++;
+      Expr *rhs = compile_sum(tokens, t);
+      if (!rhs) { expr_free(lhs); return NULL; }
+      return binary(ops[i].kind, lhs, rhs);
+   }
+   return lhs;
+}
+
+// --------- Evaluation kernels ---------
+// Evaluates the arguments of an EX_CALL and runs the function
+static ExprValue call(const Expr *e, struct SymbolTable *t, int *ok) {
+   ExprValue args[FUNC_MAX_PARAMS], result = { .i = 0 };
+   for (int i = 0; i < e->argc && *ok; i++) {
+      const Expr *a = e->args[i];
+      switch (a->type) {
+         case EXPR_INT:   args[i].i = expr_eval_int(a, t, ok); break;
+         case EXPR_FLOAT: args[i].d = expr_eval_float(a, t, ok); break;
+         default:         args[i].d = expr_eval_double(a, t, ok); break;
+      }
+   }
+   if (*ok && !call_function(e->slot, args, t, &result)) *ok = 0;
+   return result;
+}
+
+static const struct Symbol *load(const Expr *e, const struct SymbolTable *t, int *ok) {
+   const struct Symbol *s = &t->items[e->slot];
+   if (!s->initialized) {
+      fprintf(bt_err(), "Error: Undefined or uninitialized identifier '%s' in expression.\n", e->name);
+      *ok = 0;
+   }
+   return s;
+}
+
+// Comparisons dispatch on the operand type fixed at compile time
+static long compare(const Expr *e, struct SymbolTable *t, int *ok) {
+   double l, r;
+   switch (e->operand) {
+      case EXPR_INT: {
+         long li = expr_eval_int(e->lhs, t, ok);
+         if (!*ok) return 0;
+         long ri = expr_eval_int(e->rhs, t, ok);
+         switch (e->kind) {
+            case EX_LT: return li < ri;
+            case EX_GT: return li > ri;
+            case EX_LE: return li <= ri;
+            case EX_GE: return li >= ri;
+            case EX_EQ: return li == ri;
+            default:    return li != ri;
+         }
+      }
+      case EXPR_FLOAT:
+         l = expr_eval_float(e->lhs, t, ok);
+         if (!*ok) return 0;
+         r = expr_eval_float(e->rhs, t, ok);
+         break;
+      default:
+         l = expr_eval_double(e->lhs, t, ok);
+         if (!*ok) return 0;
+         r = expr_eval_double(e->rhs, t, ok);
+         break;
+   }
+   // float operands widen exactly, so comparing as double gives the float result
+   switch (e->kind) {
+      case EX_LT: return l < r;
+      case EX_GT: return l > r;
+      case EX_LE: return l <= r;
+      case EX_GE: return l >= r;
+      case EX_EQ: return l == r;
+      default:    return l != r;
+   }
+}
+
+long expr_eval_int(const Expr *e, struct SymbolTable *t, int *ok) {
+   long l, r;
+   switch (e->kind) {
+      case EX_CONST: return e->k.i;
+      case EX_VAR:   return load(e, t, ok)->value_int;
+      case EX_INDEX: {
+         const struct Symbol *s = load(e, t, ok);
+         if (!*ok) return 0;
+         long i = expr_eval_int(e->lhs, t, ok);
+         if (!*ok) return 0;
+         char c = 0;
+         MemStatus st = mem_load((MemAddr)s->address, s->array_len, i, &c);
+         if (st != MEM_OK) {
+            mem_report(st, e->name, i, s->array_len);
+            *ok = 0;
+         }
+         return c;
+      }
+      case EX_CONV:
+         return e->operand == EXPR_FLOAT ? (long)expr_eval_float(e->lhs, t, ok)
+                                         : (long)expr_eval_double(e->lhs, t, ok);
+      case EX_CALL:  return call(e, t, ok).i;
+      case EX_ADD: case EX_SUB: case EX_MUL: case EX_DIV:
+         break;
+      default:
+         return compare(e, t, ok);
+   }
+   l = expr_eval_int(e->lhs, t, ok);
+   if (!*ok) return 0;
+   r = expr_eval_int(e->rhs, t, ok);
+   // ints wrap around modulo 2^64 (affine.c relies on this)
+   switch (e->kind) {
+      case EX_ADD: return (long)((unsigned long)l + (unsigned long)r);
+      case EX_SUB: return (long)((unsigned long)l - (unsigned long)r);
+      case EX_MUL: return (long)((unsigned long)l * (unsigned long)r);
+      default:
+         if (!*ok) return 0;
+         if (r == 0) {
+            fprintf(bt_err(), "Error: Division by zero.\n");
+            *ok = 0;
+            return 0;
+         }
+         if (r == -1) return (long)(0UL - (unsigned long)l); // LONG_MIN / -1 wraps too
+         return l / r; // integer division
+   }
+}
+
+float expr_eval_float(const Expr *e, struct SymbolTable *t, int *ok) {
+   float l, r;
+   switch (e->kind) {
+      case EX_CONST: return e->k.f;
+      case EX_VAR:   return (float)load(e, t, ok)->value_float;
+      case EX_CALL:  return (float)call(e, t, ok).d;
+      case EX_CONV:
+         return e->operand == EXPR_INT ? (float)expr_eval_int(e->lhs, t, ok)
+                                       : (float)expr_eval_double(e->lhs, t, ok);
+      default:
+         break;
+   }
+   l = expr_eval_float(e->lhs, t, ok);
+   if (!*ok) return 0;
+   r = expr_eval_float(e->rhs, t, ok);
+   switch (e->kind) {
+      case EX_ADD: return l + r;
+      case EX_SUB: return l - r;
+      case EX_MUL: return l * r;
+      default:     return l / r;
+   }
+}
+
+double expr_eval_double(const Expr *e, struct SymbolTable *t, int *ok) {
+   double l, r;
+   switch (e->kind) {
+      case EX_CONST: return e->k.d;
+      case EX_VAR:   return load(e, t, ok)->value_float;
+      case EX_CALL:  return call(e, t, ok).d;
+      case EX_CONV:
+         return e->operand == EXPR_INT ? (double)expr_eval_int(e->lhs, t, ok)
+                                       : (double)expr_eval_float(e->lhs, t, ok);
+      default:
+         break;
+   }
+   l = expr_eval_double(e->lhs, t, ok);
+   if (!*ok) return 0;
+   r = expr_eval_double(e->rhs, t, ok);
+   switch (e->kind) {
+      case EX_ADD: return l + r;
+      case EX_SUB: return l - r;
+      case EX_MUL: return l * r;
+      default:     return l / r;
+   }
+}
@@ -0,0 +1,113 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdbool.h>
+#include "bt.h"
+#include "lexer.h"
+
+/*
+ * Typed expression engine.
+ *
+ * Expressions are compiled once into a tree whose nodes carry their static
+ * type. The usual arithmetic conversions (int -> float -> double) are resolved
+ * at compile time by inserting conversion nodes, so each evaluator below is a
+ * kernel for a single type and never inspects value tags: an int node is only
+ * ever evaluated by expr_eval_int, a double node by expr_eval_double.
+ */
+
+typedef enum {
+   EXPR_INT,
+   EXPR_FLOAT,
+   EXPR_DOUBLE
+} ExprType;
+
+typedef enum {
+   EX_CONST,
+   EX_VAR,
+   EX_INDEX, // char element slot[lhs] of an array or pointer, read as int
+   EX_CONV,  // converts lhs (of type `operand`) to the node type
+   EX_CALL,  // call of function `slot` (func.h) with args, each of its parameter's type
+   EX_ADD,
+   EX_SUB,
+   EX_MUL,
+   EX_DIV,
+   EX_LT,   // comparisons take operands of type `operand` and yield int
+   EX_GT,
+   EX_LE,
+   EX_GE,
+   EX_EQ,
+   EX_NE
+} ExprKind;
+
+typedef struct Expr {
+   ExprKind kind;
+   ExprType type;    // static result type
+   ExprType operand; // operand type of conversions and comparisons
+   struct Expr *lhs, *rhs;
+   union {
+      long i;
+      float f;
+      double d;
+   } k;              // EX_CONST value
+   int slot;         // EX_VAR, EX_INDEX: index into SymbolTable.items; EX_CALL: function index
+   const char *name; // EX_VAR, EX_INDEX, EX_CALL: identifier, for diagnostics
+   struct Expr **args;
+   int argc;
+} Expr;
+
+// A value of some ExprType: ints in i, floats and doubles in d
+typedef union {
+   long i;
+   double d;
+} ExprValue;
+
+/**
+ * @brief Maps a symbol type to the expression type used to evaluate it
+ * @return true for numeric types, false for char arrays and pointers
+ */
+bool expr_type_of(VarType type, ExprType *out);
+
+/**
+ * @brief Compiles the expression at *tokens against the current symbol types
+ * Variables are bound to their SymbolTable slot, so the result is only valid while
+ * t->layout is unchanged.
+ * @return The expression tree, or NULL after reporting an error on bt_err()
+ * @param tokens Advanced past the expression on success
+ * @param relational Also accept one trailing comparison (>, <, >=, <=, ==, !=)
+ */
+Expr *expr_compile(Token **tokens, const struct SymbolTable *t, bool relational);
+
+/**
+ * @brief Compiles the call `name(args)` at *tokens, which may also call a void function
+ * A void call has type EXPR_INT and evaluates to 0. In expr_compile() calls of void
+ * functions are errors.
+ * @return The expression tree, or NULL after reporting an error on bt_err()
+ */
+Expr *expr_compile_call(Token **tokens, const struct SymbolTable *t);
+
+/**
+ * @brief Converts e to the given type, folding conversions of constants
+ * @return The converted expression; takes ownership of e
+ */
+Expr *expr_cast(Expr *e, ExprType to);
+
+/**
+ * @brief Turns e into an int-typed truth value (e != 0)
+ * @return The condition; takes ownership of e
+ */
+Expr *expr_truth(Expr *e);
+
+/**
+ * @brief Evaluation kernels; each accepts only nodes of its own type
+ * On a runtime error (uninitialized variable, integer division by zero, out-of-bounds
+ * or dangling element access) a message is printed and *ok is cleared; callers set
+ * *ok to 1 beforehand. Calls run the function body through call_function() (parser.h),
+ * which changes t while it runs and restores it before returning.
+ */
+long expr_eval_int(const Expr *e, struct SymbolTable *t, int *ok);
+float expr_eval_float(const Expr *e, struct SymbolTable *t, int *ok);
+double expr_eval_double(const Expr *e, struct SymbolTable *t, int *ok);
+
+void expr_free(Expr *e);
+
+#endif
@@ -0,0 +1,161 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fmt.h"
+
+static const char DIGIT_PAIRS[201] =
+   "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+   "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+   "8081828384858687888990919293949596979899";
+
+static size_t decimal_digits(unsigned long v) {
+   size_t n = 1;
+   while (v >= 10000) { v /= 10000; n += 4; }
+   if (v >= 1000) return n + 3;
+   if (v >= 100) return n + 2;
+   if (v >= 10) return n + 1;
+   return n;
+}
+
+// Writes the n decimal digits of v ending at dst + n
+static void put_digits(char *dst, unsigned long v, size_t n) {
+   char *p = dst + n;
+   while (v >= 100) {
+      const char *pair = &DIGIT_PAIRS[(v % 100) * 2];
+      v /= 100;
+      *--p = pair[1];
+      *--p = pair[0];
+   }
+   if (v >= 10) {
+      *--p = DIGIT_PAIRS[v * 2 + 1];
+      *--p = DIGIT_PAIRS[v * 2];
+   } else {
+      *--p = (char)('0' + v);
+   }
+}
+
+size_t fmt_long(char *dst, long v) {
+   size_t sign = 0;
+   unsigned long u = (unsigned long)v;
+   if (v < 0) {
+      *dst = '-';
+      sign = 1;
+      u = 0UL - u; // also right for LONG_MIN
+   }
+   size_t n = decimal_digits(u);
+   put_digits(dst + sign, u, n);
+   return sign + n;
+}
+
+size_t fmt_hex(char *dst, unsigned long v) {
+   static const char HEX[] = "0123456789abcdef";
+   size_t n = 1;
+   for (unsigned long t = v >> 4; t; t >>= 4) n++;
+   for (size_t i = n; i-- > 0; v >>= 4) dst[i] = HEX[v & 15];
+   return n;
+}
+
+// --------- %g ---------
+#define G_PRECISION 6
+#define G_MAX_POW10 22 // 10^22 is the largest power of ten a double holds exactly
+
+static const double POW10[G_MAX_POW10 + 1] = {
+   1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static size_t fmt_double_slow(char *dst, double v) {
+   char tmp[32];
+   int n = snprintf(tmp, sizeof(tmp), "%g", v);
+   if (n < 0) n = 0;
+   if (n > FMT_DOUBLE_MAX) n = FMT_DOUBLE_MAX;
+   memcpy(dst, tmp, (size_t)n);
+   return (size_t)n;
+}
+
+// v * 10^k with a single rounding; false when 10^k is not exact
+static bool scale_pow10(double v, int k, double *out) {
+   if (k > G_MAX_POW10 || k < -G_MAX_POW10) return false;
+   *out = k >= 0 ? v * POW10[k] : v / POW10[-k];
+   return true;
+}
+
+size_t fmt_double(char *dst, double v) {
+   if (!isfinite(v)) return fmt_double_slow(dst, v);
+   char *p = dst;
+   double a = fabs(v);
+   if (signbit(v)) *p++ = '-';
+   if (a == 0.0) {
+      *p++ = '0';
+      return (size_t)(p - dst);
+   }
+
+   // x = a * 10^(5 - e) lies in [10^5, 10^6) once e is the decimal exponent of a. The
+   // binary exponent times log10(2) (78913 / 2^18) estimates e to within one.
+   uint64_t bits;
+   memcpy(&bits, &a, sizeof(bits));
+   int e2 = (int)(bits >> 52) - 1023;
+   int e = (e2 * 78913) >> 18;
+   double x;
+   if (!scale_pow10(a, G_PRECISION - 1 - e, &x)) return fmt_double_slow(dst, v);
+   if (x < 1e5) {
+      e--;
+      if (!scale_pow10(a, G_PRECISION - 1 - e, &x)) return fmt_double_slow(dst, v);
+   } else if (x >= 1e6) {
+      e++;
+      if (!scale_pow10(a, G_PRECISION - 1 - e, &x)) return fmt_double_slow(dst, v);
+   }
+   if (x < 1e5 || x >= 1e6) return fmt_double_slow(dst, v);
+   // x is within one ulp (~1e-10) of the exact product, so rounding it agrees with
+   // rounding the exact value unless the fraction is that close to one half
+   double whole = (double)(unsigned long)x, frac = x - whole;
+   if (fabs(frac - 0.5) < 1e-6) return fmt_double_slow(dst, v);
+   unsigned long r = (unsigned long)whole + (frac > 0.5);
+   if (r == 1000000) {
+      r = 100000;
+      e++;
+   }
+
+   char d[G_PRECISION];
+   put_digits(d, r, G_PRECISION);
+   int nd = G_PRECISION; // significant digits left once trailing zeros are dropped
+   while (nd > 1 && d[nd - 1] == '0') nd--;
+
+   if (e >= -4 && e < G_PRECISION) {
+      // Fixed notation with G_PRECISION - 1 - e decimals
+      if (e < 0) {
+         *p++ = '0';
+         *p++ = '.';
+         for (int i = 0; i < -e - 1; i++) *p++ = '0';
+         memcpy(p, d, (size_t)nd);
+         p += nd;
+      } else {
+         memcpy(p, d, (size_t)e + 1);
+         p += e + 1;
+         if (nd > e + 1) {
+            *p++ = '.';
+            memcpy(p, d + e + 1, (size_t)(nd - e - 1));
+            p += nd - e - 1;
+         }
+      }
+      return (size_t)(p - dst);
+   }
+
+   // Exponent notation: d.ddddde+XX with at least two exponent digits
+   *p++ = d[0];
+   if (nd > 1) {
+      *p++ = '.';
+      memcpy(p, d + 1, (size_t)nd - 1);
+      p += nd - 1;
+   }
+   *p++ = 'e';
+   *p++ = e < 0 ? '-' : '+';
+   unsigned long ex = (unsigned long)(e < 0 ? -e : e);
+   if (ex < 10) *p++ = '0';
+   size_t n = decimal_digits(ex);
+   put_digits(p, ex, n);
+   return (size_t)(p + n - dst);
+}
@@ -0,0 +1,36 @@
+#ifndef FMT_H
+#define FMT_H
+
+#include <stddef.h>
+
+/*
+ * Number formatting for binding snapshots.
+ *
+ * Each function writes its digits to dst without a terminating NUL and returns
+ * the number of bytes written, which never exceeds the matching *_MAX. The
+ * output is exactly what printf would produce for the format named below.
+ */
+
+#define FMT_LONG_MAX   20 // "-9223372036854775808"
+#define FMT_HEX_MAX    16
+#define FMT_DOUBLE_MAX 16 // "-1.79769e+308"
+
+/**
+ * @brief Formats v like "%ld", two digits at a time
+ */
+size_t fmt_long(char *dst, long v);
+
+/**
+ * @brief Formats v like "%lx"
+ */
+size_t fmt_hex(char *dst, unsigned long v);
+
+/**
+ * @brief Formats v like "%g": six significant digits, trailing zeros removed
+ * Values are rounded with one multiplication by an exact power of ten; the rare
+ * ones that land too close to a rounding tie, and those outside 1e-17..1e27 or
+ * not finite, go through snprintf so the result always matches.
+ */
+size_t fmt_double(char *dst, double v);
+
+#endif
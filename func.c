@@ -0,0 +1,132 @@
+#include <string.h>
+
+#include "bt.h"
+#include "func.h"
+
+static _Thread_local struct {
+   FunctionTable table;
+   Token *base;
+} g_funcs;
+
+void func_reset(Token *tokens) {
+   g_funcs.table.count = 0;
+   g_funcs.base = tokens;
+}
+
+static FILE *err_at(const Token *tok) {
+   return bt_err_at(tok->line, tok->column);
+}
+
+static bool is_punct(const Token *tok, const char *p) {
+   return tok->type == TOKEN_PUNCTUATION && strcmp(tok->value, p) == 0;
+}
+
+// int, float or double; false for anything else
+static bool value_type(const Token *tok, ExprType *out) {
+   if (tok->type != TOKEN_KEYWORD) return false;
+   if (strcmp(tok->value, "int") == 0) *out = EXPR_INT;
+   else if (strcmp(tok->value, "float") == 0) *out = EXPR_FLOAT;
+   else if (strcmp(tok->value, "double") == 0) *out = EXPR_DOUBLE;
+   else return false;
+   return true;
+}
+
+// '(' [void | type name {',' type name}] ')'
+static bool parse_params(Token **tokens, Function *f, const char *name) {
+   (*tokens)++; // consume '('
+   if ((*tokens)->type == TOKEN_KEYWORD && strcmp((*tokens)->value, "void") == 0 && is_punct(*tokens + 1, ")")) {
+      (*tokens)++;
+   }
+   while (!is_punct(*tokens, ")")) {
+      if (f->param_count > 0) {
+         if (!is_punct(*tokens, ",")) {
+            fprintf(err_at(*tokens), "Error: Expected ',' or ')' in the parameters of '%s' but found '%s'.\n", name,
+                    (*tokens)->value);
+            return false;
+         }
+         (*tokens)++; // consume ','
+      }
+      ExprType type;
+      if (!value_type(*tokens, &type)) {
+         fprintf(err_at(*tokens), "Error: Parameters of '%s' must be int, float or double, not '%s'.\n", name,
+                 (*tokens)->value);
+         return false;
+      }
+      (*tokens)++;
+      if ((*tokens)->type != TOKEN_IDENTIFIER) {
+         fprintf(err_at(*tokens), "Error: Expected a parameter name in '%s' but found '%s'.\n", name, (*tokens)->value);
+         return false;
+      }
+      if (f->param_count == FUNC_MAX_PARAMS) {
+         fprintf(err_at(*tokens), "Error: '%s' has more than %d parameters.\n", name, FUNC_MAX_PARAMS);
+         return false;
+      }
+      f->params[f->param_count] = type;
+      f->param_names[f->param_count++] = (size_t)(*tokens - g_funcs.base);
+      (*tokens)++;
+   }
+   (*tokens)++; // consume ')'
+   return true;
+}
+
+bool func_define(Token **tokens) {
+   Function f;
+   memset(&f, 0, sizeof(f));
+   f.returns_value = value_type(*tokens, &f.ret);
+   (*tokens)++; // consume the return type
+   const char *name = (*tokens)->value;
+   f.name = (size_t)(*tokens - g_funcs.base);
+   if (func_find(name) >= 0) {
+      fprintf(err_at(*tokens), "Error: Function '%s' is already defined.\n", name);
+      return false;
+   }
+   if (g_funcs.table.count == FUNC_MAX) {
+      fprintf(err_at(*tokens), "Error: Too many functions; '%s' would be number %d.\n", name, FUNC_MAX + 1);
+      return false;
+   }
+   (*tokens)++; // consume the name
+   if (!parse_params(tokens, &f, name)) return false;
+   if (!is_punct(*tokens, "{")) {
+      fprintf(err_at(*tokens), "Error: Expected '{' to start the body of '%s' but found '%s'.\n", name, (*tokens)->value);
+      return false;
+   }
+   f.body = (size_t)(*tokens - g_funcs.base) + 1;
+   *tokens += (*tokens)->match; // its '}', or EOF
+   if ((*tokens)->type == TOKEN_END_OF_FILE) {
+      fprintf(err_at(*tokens), "Error: Expected '}' to end the body of '%s'.\n", name);
+      return false;
+   }
+   g_funcs.table.items[g_funcs.table.count++] = f;
+   return true;
+}
+
+int func_find(const char *name) {
+   for (int i = 0; i < g_funcs.table.count; i++) {
+      if (strcmp(g_funcs.base[g_funcs.table.items[i].name].value, name) == 0) return i;
+   }
+   return -1;
+}
+
+const Function *func_get(int index) {
+   return &g_funcs.table.items[index];
+}
+
+Token *func_token(size_t index) {
+   return &g_funcs.base[index];
+}
+
+void func_state_save(FunctionTable *dst) {
+   *dst = g_funcs.table;
+}
+
+void func_state_load(const FunctionTable *src) {
+   g_funcs.table = *src;
+}
+
+size_t func_context_size(void) {
+   return sizeof(g_funcs);
+}
+
+void func_context_swap(void *ctx) {
+   swap_bytes(ctx, &g_funcs, sizeof(g_funcs));
+}
@@ -0,0 +1,73 @@
+#ifndef FUNC_H
+#define FUNC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "expr.h"
+#include "lexer.h"
+
+/*
+ * Function table.
+ *
+ * A top-level definition `int name(int a, double b) { ... }` is registered
+ * when execution reaches it; its body runs on each call (parser.c), with the
+ * expressions compiled on the first call and reused by the later ones.
+ * Entries refer to the program by token index, so a table saved with an
+ * execution checkpoint stays valid for any token array with the same prefix.
+ */
+
+#define FUNC_MAX 32
+#define FUNC_MAX_PARAMS 8
+
+typedef struct {
+   size_t name;                         // token index of the function name
+   bool returns_value;                  // false for void functions
+   ExprType ret;                        // return type when returns_value
+   int param_count;
+   ExprType params[FUNC_MAX_PARAMS];
+   size_t param_names[FUNC_MAX_PARAMS]; // token indices of the parameter names
+   size_t body;                         // token index of the first token after '{'
+} Function;
+
+typedef struct {
+   Function items[FUNC_MAX];
+   int count;
+} FunctionTable;
+
+/**
+ * @brief Empties the table of this thread; token indices are relative to tokens
+ */
+void func_reset(Token *tokens);
+
+/**
+ * @brief Registers the definition at *tokens
+ * @return false after reporting an error on bt_err()
+ * @param tokens Left on the '}' that closes the body (or on the offending token)
+ */
+bool func_define(Token **tokens);
+
+/**
+ * @brief Index of the function called name, or -1
+ */
+int func_find(const char *name);
+
+const Function *func_get(int index);
+
+/**
+ * @brief The token at a Function token index
+ */
+Token *func_token(size_t index);
+
+/**
+ * @brief Copies the table to and from an execution checkpoint
+ */
+void func_state_save(FunctionTable *dst);
+void func_state_load(const FunctionTable *src);
+
+/**
+ * @brief Exchanges the table of this thread with a buffer of func_context_size() bytes
+ */
+size_t func_context_size(void);
+void func_context_swap(void *ctx);
+
+#endif
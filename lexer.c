@@ -4,16 +4,41 @@
 #include <stdlib.h>
 #include "lexer.h"
 #include "parser.h"
+#include "profile.h"
 
 // HELPER FUNCTIONS
-// Reads a number token
+// Reads a number token: digits, then an optional fraction, exponent and 'f' suffix
 void read_number(const char **code, Token *t) {
    int i = 0;
 
-   // Check if the current character is a digit
+   // Check if the current character is a digit; overlong literals are truncated
    while (isdigit(**code)) {
-      t->value[i] = **code;
-      i++;
+      if (i < (int)sizeof(t->value) - 1) t->value[i++] = **code;
+      (*code)++;
+   }
+   if (**code == '.') {
+      if (i < (int)sizeof(t->value) - 1) t->value[i++] = **code;
+      (*code)++;
+      while (isdigit(**code)) {
+         if (i < (int)sizeof(t->value) - 1) t->value[i++] = **code;
+         (*code)++;
+      }
+   }
+   // An exponent needs at least one digit, otherwise 'e' starts the next token
+   const char *e = *code;
+   if (*e == 'e' || *e == 'E') {
+      e++;
+      if (*e == '+' || *e == '-') e++;
+      if (isdigit(*e)) {
+         while (*code < e || isdigit(**code)) {
+            if (i < (int)sizeof(t->value) - 1) t->value[i++] = **code;
+            (*code)++;
+         }
+      }
+   }
+   t->value[i] = '\0';
+   if ((**code == 'f' || **code == 'F') && strpbrk(t->value, ".eE") != NULL) {
+      if (i < (int)sizeof(t->value) - 1) t->value[i++] = **code;
       (*code)++;
    }
    t->value[i] = '\0';
@@ -24,10 +49,9 @@ void read_number(const char **code, Token *t) {
 void read_token(const char **code, Token *t) {
    int i = 0;
 
-   // Accept letters, digits, and underscores for identifiers
+   // Accept letters, digits, and underscores for identifiers; overlong names are truncated
    while (isalnum(**code) || **code == '_') {
-      t->value[i] = **code;
-      i++;
+      if (i < (int)sizeof(t->value) - 1) t->value[i++] = **code;
       (*code)++;
    }
    t->value[i] = '\0';
@@ -59,21 +83,27 @@ void read_token(const char **code, Token *t) {
 Token *tokenize(const char *code) {
 
    // Allocate memory for the tokens array
-   Token *tokens = malloc(sizeof(Token) * 32);
+   Token *tokens = prof_malloc(sizeof(Token) * 32);
    int capacity = 32;
    int token_count = 0;
    const char *current_char = code;
+   int line = 1;
+   const char *line_start = code;
 
    // Check if the tokens array is null
    if (tokens == NULL) {
-      fprintf(stderr, "Memory allocation failed.\n");
-      exit(1);
+      fprintf(bt_err(), "Memory allocation failed.\n");
+      return NULL;
    }
 
    // Loop through the code until the end of the file
    while (*current_char != '\0') {
       // Step 1: Handle whitespace and comments.
       if (isspace(*current_char)) {
+         if (*current_char == '\n') {
+            line++;
+            line_start = current_char + 1;
+         }
          current_char++;
          continue;
       }
@@ -98,13 +128,13 @@ Token *tokenize(const char *code) {
       // If the token count is greater than the capacity, we need to resize the array
       if (token_count >= capacity) {
          capacity *= 2;
-         Token *temp = realloc(tokens, sizeof(Token) * capacity);
+         Token *temp = prof_realloc(tokens, sizeof(Token) * capacity);
 
          // Check if the reallocation failed
          if (temp == NULL) {
-            fprintf(stderr, "Memory reallocation failed.\n");
+            fprintf(bt_err(), "Memory reallocation failed.\n");
             free(tokens);
-            exit(1);
+            return NULL;
          }
 
          // Assign the new tokens array to the tokens pointer
@@ -113,6 +143,9 @@ Token *tokenize(const char *code) {
 
       // Step 4: Handle different token types.
       Token current_token;
+      current_token.line = line;
+      current_token.match = 0;
+      current_token.column = (int)(current_char - line_start) + 1;
 
       // Identifiers can start with a letter or underscore
       if (isalpha(*current_char) || *current_char == '_') {
@@ -161,7 +194,8 @@ Token *tokenize(const char *code) {
           }
           // Now, handle single-character punctuation.
           else if (*current_char == ';' || *current_char == '(' || *current_char == ')' ||
-                   *current_char == '{' || *current_char == '}' || *current_char == '[' || *current_char == ']') {
+                   *current_char == '{' || *current_char == '}' || *current_char == '[' || *current_char == ']' ||
+                   *current_char == ',') {
               current_token.value[0] = *current_char;
               current_token.value[1] = '\0';
               current_token.type = TOKEN_PUNCTUATION;
@@ -169,9 +203,11 @@ Token *tokenize(const char *code) {
           }
           // Step 5: Handle errors gracefully.
           else {
-              fprintf(stderr, "Lexer error: Invalid character '%c' found.\n", *current_char);
+              fprintf(bt_err_at(current_token.line, current_token.column),
+                      "Lexer error: Invalid character '%c' found.\n", *current_char);
+              bt_set_location(0, 0);
               free(tokens);
-              exit(1);
+              return NULL;
           }
       }
       tokens[token_count++] = current_token;
@@ -180,10 +216,39 @@ Token *tokenize(const char *code) {
    // Step 6: Add the end-of-file token.
    if (token_count >= capacity) {
       capacity++;
-      tokens = realloc(tokens, sizeof(Token) * capacity);
+      Token *temp = prof_realloc(tokens, sizeof(Token) * capacity);
+      if (temp == NULL) {
+         fprintf(bt_err(), "Memory reallocation failed.\n");
+         free(tokens);
+         return NULL;
+      }
+      tokens = temp;
    }
    tokens[token_count].type = TOKEN_END_OF_FILE;
+   tokens[token_count].line = line;
+   tokens[token_count].column = (int)(current_char - line_start) + 1;
    strcpy(tokens[token_count].value, "EOF");
+   tokens[token_count].match = 0;
+
+   // Step 7: Match the braces. Until its '}' is found, an open '{' keeps the index of the
+   // enclosing open one in match.
+   int open = -1;
+   for (int i = 0; i < token_count; i++) {
+      if (tokens[i].type != TOKEN_PUNCTUATION) continue;
+      if (tokens[i].value[0] == '{') {
+         tokens[i].match = open;
+         open = i;
+      } else if (tokens[i].value[0] == '}' && open >= 0) {
+         int outer = tokens[open].match;
+         tokens[open].match = i - open;
+         open = outer;
+      }
+   }
+   while (open >= 0) {
+      int outer = tokens[open].match;
+      tokens[open].match = token_count - open;
+      open = outer;
+   }
 
    return tokens;
 }
\ No newline at end of file
@@ -15,9 +15,14 @@ typedef enum {
 typedef struct {
    TokenType type;
    char value[64]; // Stores the actual string value of the token
+   int line;       // 1-based source position of the token's first character
+   int column;
+   int match;      // '{': distance to its matching '}' (to EOF when unmatched); 0 otherwise
 } Token;
 
 // Function prototypes
+// Returns a malloc'ed, EOF-terminated token array with its braces matched, or NULL after
+// reporting a lexer error. Tokens hold no pointers, so the array can be saved and mapped as is.
 Token *tokenize (const char *code);
 void read_token(const char **code, Token *t);
 
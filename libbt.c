@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libbt.h"
+#include "run.h"
+#include "cache.h"
+#include "bt.h"
+#include "lexer.h"
+
+int bt_api_version(void) { return BT_API_VERSION; }
+
+// Moves TableRow strings into the public BtRow layout without copying
+static BtRow *export_rows(TableRow *rows, size_t count) {
+   BtRow *out = (BtRow *)malloc(sizeof(BtRow) * (count ? count : 1));
+   if (!out) return NULL;
+   for (size_t i = 0; i < count; i++) {
+      out[i].command = rows[i].command;
+      out[i].binding = rows[i].binding;
+      out[i].stack = rows[i].stack;
+      out[i].stack_diagram = rows[i].stack_diagram;
+   }
+   free(rows);
+   return out;
+}
+
+int bt_run(const char *src, size_t len, int argc, const char *const *argv, unsigned flags, BtResult *res) {
+   memset(res, 0, sizeof(*res));
+   char *code = (char *)malloc(len + 1);
+   if (!code) return res->status = -1;
+   memcpy(code, src, len);
+   code[len] = '\0';
+
+   FILE *out_f = open_memstream(&res->out, &res->out_len);
+   FILE *err_f = open_memstream(&res->err, &res->err_len);
+   if (!out_f || !err_f) {
+      if (out_f) fclose(out_f);
+      if (err_f) fclose(err_f);
+      free(code);
+      bt_result_free(res);
+      return res->status = -1;
+   }
+   bt_set_streams(out_f, err_f);
+
+   struct RunOptions opts;
+   run_options_init(&opts);
+   opts.render = (flags & BT_RENDER_TEXT) != 0;
+   if (run_options_parse(&opts, argc, (char **)argv) != 0) {
+      res->status = 2;
+   } else if (opts.path) {
+      fprintf(err_f, "Error: program paths are not accepted by bt_run.\n");
+      res->status = 2;
+   } else {
+      TableRow *rows = NULL;
+      size_t count = 0;
+      res->status = run_source_trace(code, &opts, (flags & BT_TRACE_ROWS) ? &rows : NULL, &count);
+      if (rows) {
+         res->rows = export_rows(rows, count);
+         if (res->rows) res->row_count = count;
+         else free_rows(rows, count);
+      }
+   }
+
+   bt_set_streams(NULL, NULL);
+   fclose(out_f);
+   fclose(err_f);
+   free(code);
+   return res->status;
+}
+
+void bt_result_free(BtResult *res) {
+   for (size_t i = 0; i < res->row_count; i++) {
+      free((char *)res->rows[i].command);
+      free((char *)res->rows[i].binding);
+      free((char *)res->rows[i].stack);
+      free((char *)res->rows[i].stack_diagram);
+   }
+   free(res->rows);
+   free(res->out);
+   free(res->err);
+   res->rows = NULL;
+   res->row_count = 0;
+   res->out = NULL;
+   res->err = NULL;
+}
+
+void bt_cache_stats(BtCacheStats *stats) {
+   struct CacheStats st;
+   cache_get_stats(&st);
+   stats->mem_hits = st.mem_hits;
+   stats->disk_hits = st.disk_hits;
+   stats->misses = st.misses;
+   stats->stores = st.stores;
+   stats->evictions = st.evictions;
+}
+
+// --------- Stepping sessions ---------
+struct BtSession {
+   char *code;
+   Token *tokens;
+   ExecSession *exec;
+};
+
+BtSession *bt_session_open(const char *src, size_t len, int argc, const char *const *argv, BtResult *res) {
+   memset(res, 0, sizeof(*res));
+   FILE *err_f = open_memstream(&res->err, &res->err_len);
+   if (!err_f) {
+      res->status = -1;
+      return NULL;
+   }
+   bt_set_streams(NULL, err_f);
+
+   BtSession *s = (BtSession *)calloc(1, sizeof(BtSession));
+   char *code = (char *)malloc(len + 1);
+   struct RunOptions opts;
+   run_options_init(&opts);
+   if (!s || !code) {
+      res->status = -1;
+   } else if (run_options_parse(&opts, argc, (char **)argv) != 0) {
+      res->status = 2;
+   } else if (opts.path) {
+      fprintf(err_f, "Error: program paths are not accepted by bt_session_open.\n");
+      res->status = 2;
+   } else {
+      memcpy(code, src, len);
+      code[len] = '\0';
+      s->code = code;
+      // The lexer reports its own errors
+      if (!(s->tokens = tokenize(code))) res->status = 1;
+      else if (!(s->exec = exec_session_open(s->tokens, &opts.limits, opts.loop_summary))) res->status = -1;
+   }
+
+   bt_set_streams(NULL, NULL);
+   fclose(err_f);
+   if (res->status != 0) {
+      if (s) free(s->tokens);
+      free(s);
+      free(code);
+      return NULL;
+   }
+   return s;
+}
+
+static int session_step(BtSession *s, size_t max_rows, int line, BtResult *res) {
+   memset(res, 0, sizeof(*res));
+   if (!s) return res->status = BT_NO_SESSION;
+   FILE *err_f = open_memstream(&res->err, &res->err_len);
+   if (!err_f) return res->status = -1;
+   bt_set_streams(NULL, err_f);
+   size_t count = 0;
+   TableRow *rows = exec_session_step(s->exec, max_rows, line, &count);
+   bt_set_streams(NULL, NULL);
+   fclose(err_f);
+
+   res->status = exec_session_truncated(s->exec) ? RUN_EXIT_TRUNCATED : 0;
+   if (rows) {
+      res->rows = export_rows(rows, count);
+      if (!res->rows) {
+         free_rows(rows, count);
+         return res->status = -1;
+      }
+      res->row_count = count;
+   }
+   return exec_session_done(s->exec) ? 0 : 1;
+}
+
+int bt_step(BtSession *s, size_t n, BtResult *res) {
+   return session_step(s, n, 0, res);
+}
+
+int bt_step_to_line(BtSession *s, int line, size_t max_rows, BtResult *res) {
+   return session_step(s, max_rows, line > 0 ? line : 0, res);
+}
+
+const char *bt_session_truncated(const BtSession *s) {
+   return s ? exec_session_truncated(s->exec) : NULL;
+}
+
+void bt_session_close(BtSession *s) {
+   if (!s) return;
+   exec_session_close(s->exec);
+   free(s->tokens);
+   free(s->code);
+   free(s);
+}
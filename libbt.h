@@ -0,0 +1,113 @@
+#ifndef LIBBT_H
+#define LIBBT_H
+
+/*
+ * Stable C API of libbt.so: the lexer, parser and binding table as an
+ * embeddable library. Calls are independent and may run concurrently from
+ * different threads. Strings are owned by the BtResult and released with
+ * bt_result_free().
+ */
+
+#include <stddef.h>
+
+#define BT_API_VERSION 2
+
+// bt_run() flags
+#define BT_RENDER_TEXT 0x1u // fill out/out_len with the rendered table and stack evolution
+#define BT_TRACE_ROWS  0x2u // fill rows/row_count with the structured trace
+
+typedef struct {
+   const char *command;       // statement text, e.g. "iter 2: i = i + 2;"
+   const char *binding;       // "S = {...}" after the statement ran
+   const char *stack;         // one-line stack, e.g. "Top [x]->[i]"
+   const char *stack_diagram; // boxed multi-line stack diagram
+} BtRow;
+
+typedef struct {
+   int status;      // exit status the bt command would return
+   char *out;       // rendered text (BT_RENDER_TEXT), null-terminated
+   size_t out_len;
+   char *err;       // diagnostics, null-terminated
+   size_t err_len;
+   BtRow *rows;     // structured trace (BT_TRACE_ROWS)
+   size_t row_count;
+} BtResult;
+
+typedef struct {
+   unsigned long mem_hits;
+   unsigned long disk_hits;
+   unsigned long misses;
+   unsigned long stores;
+   unsigned long evictions;
+} BtCacheStats;
+
+/**
+ * @brief Returns BT_API_VERSION of the loaded library
+ */
+int bt_api_version(void);
+
+/**
+ * @brief Interprets one program held in memory
+ * @return res->status; negative if the result could not be allocated
+ * @param src Program source (need not be null-terminated)
+ * @param len Length of src in bytes
+ * @param argc Number of run flags in argv (as accepted by the bt command line)
+ * @param argv Run flags; program paths are rejected
+ * @param flags Combination of BT_RENDER_TEXT and BT_TRACE_ROWS
+ * @param res Receives the result; release with bt_result_free
+ */
+int bt_run(const char *src, size_t len, int argc, const char *const *argv, unsigned flags, BtResult *res);
+
+void bt_result_free(BtResult *res);
+
+/*
+ * Stepping sessions: a program executed a few rows at a time, e.g. for a
+ * debugger-style step button. A session may be stepped from any thread, but
+ * only by one thread at a time.
+ */
+typedef struct BtSession BtSession;
+
+/**
+ * @brief Starts executing one program held in memory; nothing runs until the first step
+ * @return The session, or NULL with res->status set (2 for bad flags, 1 when the program does
+ * not tokenize, negative when out of memory) and the diagnostics in res->err
+ * @param src Program source (need not be null-terminated)
+ * @param len Length of src in bytes
+ * @param argc Number of run flags in argv
+ * @param argv Run flags; only the budgets and --loop-summary apply, and program paths are rejected
+ * @param res Receives the diagnostics; release with bt_result_free
+ */
+BtSession *bt_session_open(const char *src, size_t len, int argc, const char *const *argv, BtResult *res);
+
+// Returned by bt_step and bt_step_to_line for a NULL session
+#define BT_NO_SESSION (-2)
+
+/**
+ * @brief Executes until n more trace rows were produced (0: until the end)
+ * @return 1 while the program has more to run, 0 once it finished or a budget stopped it,
+ * -1 when out of memory, BT_NO_SESSION when s is NULL
+ * @param res Receives the new rows, the diagnostics reported meanwhile, and status 3 once a
+ * budget stopped the program (0 otherwise); release with bt_result_free
+ */
+int bt_step(BtSession *s, size_t n, BtResult *res);
+
+/**
+ * @brief Executes until a statement on source line `line` was traced, or max_rows rows were
+ * produced (0: no limit)
+ * @return As bt_step
+ */
+int bt_step_to_line(BtSession *s, int line, size_t max_rows, BtResult *res);
+
+/**
+ * @brief Why a budget stopped the session, or NULL (also for a NULL session)
+ */
+const char *bt_session_truncated(const BtSession *s);
+
+void bt_session_close(BtSession *s);
+
+/**
+ * @brief Reads the process-wide result cache counters
+ */
+void bt_cache_stats(BtCacheStats *stats);
+
+#endif
@@ -2,9 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "lexer.h"
-#include "parser.h"
-#include "bt.h"
+#include "batch.h"
+#include "diff.h"
+#include "run.h"
+#include "server.h"
+#include "profile.h"
 
 static char *read_file_to_string(const char *path) {
    FILE *f = fopen(path, "rb");
@@ -19,7 +21,7 @@ static char *read_file_to_string(const char *path) {
       return NULL;
    }
    rewind(f);
-   char *buffer = (char *)malloc((size_t)size + 1);
+   char *buffer = (char *)prof_malloc((size_t)size + 1);
    if (!buffer) {
       fclose(f);
       return NULL;
@@ -34,14 +36,14 @@ static char *read_stdin_to_string(void) {
    const size_t chunk = 4096;
    size_t cap = chunk;
    size_t len = 0;
-   char *buf = (char *)malloc(cap);
+   char *buf = (char *)prof_malloc(cap);
    if (!buf) return NULL;
    size_t n;
    while ((n = fread(buf + len, 1, chunk, stdin)) > 0) {
       len += n;
       if (cap - len < chunk) {
          cap *= 2;
-         char *tmp = (char *)realloc(buf, cap);
+         char *tmp = (char *)prof_realloc(buf, cap);
          if (!tmp) {
             free(buf);
             return NULL;
@@ -58,39 +60,111 @@ static char *read_stdin_to_string(void) {
    return buf;
 }
 
+static void usage(const char *prog) {
+   fprintf(stderr, "Usage: %s <program-file>\n", prog);
+   fprintf(stderr, "Or:    echo 'int x; float y;' | %s\n", prog);
+   fprintf(stderr, "Or:    %s --serve <socket-path> [--workers N]\n", prog);
+   fprintf(stderr, "Or:    %s --diff <reference-file> <program-file>\n", prog);
+   fprintf(stderr, "Or:    %s --batch <inputs-file> <program-file>\n", prog);
+}
+
 int main(int argc, char **argv) {
+   // Server mode: --serve <socket-path> [--workers N]
+   const char *socket_path = NULL;
+   const char *diff_paths[2] = { NULL, NULL };
+   const char *batch_path = NULL;
+   int workers = SERVER_DEFAULT_WORKERS;
+   int run_argc = 0;
+   char **run_argv = (char **)malloc(sizeof(char *) * (size_t)argc);
+   if (!run_argv) return 1;
+   for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+         socket_path = argv[++i];
+      } else if (strcmp(argv[i], "--diff") == 0 && i + 2 < argc) {
+         diff_paths[0] = argv[++i];
+         diff_paths[1] = argv[++i];
+      } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+         batch_path = argv[++i];
+      } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+         workers = atoi(argv[++i]);
+      } else {
+         run_argv[run_argc++] = argv[i];
+      }
+   }
+   if (socket_path) {
+      free(run_argv);
+      return serve(socket_path, workers);
+   }
+
+   struct RunOptions opts;
+   run_options_init(&opts);
+   int rc = run_options_parse(&opts, run_argc, run_argv);
+   free(run_argv);
+   if (rc != 0) {
+      usage(argv[0]);
+      return 2;
+   }
+
+   // Diff mode: --diff <reference-file> <program-file> [run flags]
+   if (diff_paths[0]) {
+      if (opts.path) {
+         fprintf(stderr, "Error: unexpected extra argument '%s'.\n", opts.path);
+         usage(argv[0]);
+         return 2;
+      }
+      char *codes[2] = { NULL, NULL };
+      for (int i = 0; i < 2; i++) {
+         if (!(codes[i] = read_file_to_string(diff_paths[i]))) {
+            fprintf(stderr, "Error: could not read file: %s\n", diff_paths[i]);
+            free(codes[0]);
+            return 2;
+         }
+      }
+      int status = diff_sources(diff_paths, (const char *const *)codes, &opts);
+      free(codes[0]);
+      free(codes[1]);
+      return status;
+   }
+
+   // Start profiling here so reading the program is measured too
+   if (opts.profile) prof_start();
+   prof_enter(PROF_READ);
    char *code = NULL;
-   if (argc > 1) {
-      code = read_file_to_string(argv[1]);
+   if (opts.path) {
+      code = read_file_to_string(opts.path);
       if (!code) {
-         fprintf(stderr, "Error: could not read file: %s\n", argv[1]);
+         fprintf(stderr, "Error: could not read file: %s\n", opts.path);
          return 1;
       }
    } else {
       code = read_stdin_to_string();
       if (!code) {
-         fprintf(stderr, "Usage: %s <program-file>\n", argv[0]);
-         fprintf(stderr, "Or:    echo 'int x; float y;' | %s\n", argv[0]);
+         usage(argv[0]);
          return 1;
       }
    }
+   prof_leave();
 
-   // Create and initialize the SymbolTable
-   struct SymbolTable my_symbol_table;
-   my_symbol_table.count = 0;
-   stack_reset();
-
-   // Tokenize the input code
-   Token *tokens = tokenize(code);
-   
-   // Parse the tokens and fill the symbol table
-   parse_program(tokens, &my_symbol_table);
+   // Batch mode: --batch <inputs-file> [program-file] [run flags]
+   int status;
+   if (batch_path) {
+      char *inputs = read_file_to_string(batch_path);
+      if (!inputs) {
+         fprintf(stderr, "Error: could not read file: %s\n", batch_path);
+         free(code);
+         return 2;
+      }
+      status = batch_source(batch_path, inputs, code, &opts);
+      free(inputs);
+      free(code);
+      return status;
+   }
 
-   // parse_program now prints the ASCII table of command -> binding
+   // Tokenize, parse and print the ASCII table of command -> binding
+   status = run_source(code, &opts);
 
-   // Free the memory for the tokens and source
-   free(tokens);
+   // Free the memory for the source
    free(code);
-   
-   return 0;
-}
\ No newline at end of file
+
+   return status;
+}
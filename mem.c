@@ -0,0 +1,261 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bt.h"
+#include "mem.h"
+#include "profile.h"
+
+// --------- Segments ---------
+typedef struct {
+   unsigned char *bytes;
+   size_t used, cap;
+} Segment;
+
+// Heap blocks start with this header; `next` links free blocks of the same class
+typedef struct {
+   uint32_t size;  // payload bytes (the class size for small blocks)
+   uint32_t magic;
+   uint64_t next;  // header offset of the next free block, 0 for none
+} BlockHeader;
+
+#define BLOCK_LIVE 0xB10C0001u
+#define BLOCK_FREE 0xB10C0000u
+#define HEAP_CLASSES 13          // 16 B .. 64 KiB, powers of two; larger blocks share one list
+#define MEM_MAX_FRAMES 64
+#define MEM_KEEP_BYTES (1UL << 20) // buffers above this are released by mem_reset
+
+static _Thread_local struct {
+   Segment stack, heap;
+   size_t frames[MEM_MAX_FRAMES];
+   int depth;
+   uint64_t free_head[HEAP_CLASSES + 1]; // per class, then the large-block list
+} g_mem;
+
+// Makes room for `need` bytes; new memory reads as zero so runs are deterministic
+static bool segment_reserve(Segment *s, size_t need) {
+   if (need <= s->cap) return true;
+   if (need > MEM_SEGMENT_MAX) return false;
+   size_t cap = s->cap ? s->cap : 4096;
+   while (cap < need) cap *= 2;
+   if (cap > MEM_SEGMENT_MAX) cap = MEM_SEGMENT_MAX;
+   unsigned char *b = (unsigned char *)prof_realloc(s->bytes, cap);
+   if (!b) return false;
+   memset(b + s->cap, 0, cap - s->cap);
+   s->bytes = b;
+   s->cap = cap;
+   return true;
+}
+
+static void segment_clear(Segment *s, size_t reserved) {
+   if (s->cap > MEM_KEEP_BYTES) {
+      free(s->bytes);
+      s->bytes = NULL;
+      s->cap = 0;
+   } else if (s->bytes) {
+      // Stack allocations clear their own bytes; the heap relies on fresh memory being zero
+      memset(s->bytes, 0, s->used);
+   }
+   s->used = reserved;
+}
+
+void mem_reset(void) {
+   segment_clear(&g_mem.stack, 0);
+   // Heap offset 0 is reserved so that a header offset of 0 can mean "none"
+   segment_clear(&g_mem.heap, sizeof(BlockHeader));
+   g_mem.depth = 0;
+   memset(g_mem.free_head, 0, sizeof(g_mem.free_head));
+}
+
+// --------- Stack segment ---------
+void mem_frame_push(void) {
+   if (g_mem.depth < MEM_MAX_FRAMES) g_mem.frames[g_mem.depth] = g_mem.stack.used;
+   g_mem.depth++;
+}
+
+void mem_frame_pop(void) {
+   if (g_mem.depth == 0) return;
+   g_mem.depth--;
+   // Frames nested deeper than MEM_MAX_FRAMES are released with their parent
+   if (g_mem.depth < MEM_MAX_FRAMES) g_mem.stack.used = g_mem.frames[g_mem.depth];
+}
+
+MemAddr mem_stack_alloc(size_t size) {
+   size_t off = (g_mem.stack.used + 7) & ~(size_t)7;
+   if (size > MEM_SEGMENT_MAX || !segment_reserve(&g_mem.stack, off + size)) {
+      fprintf(bt_err(), "Error: Stack segment exhausted allocating %zu bytes.\n", size);
+      return 0;
+   }
+   // Reused stack memory is cleared like fresh memory
+   memset(g_mem.stack.bytes + off, 0, size);
+   g_mem.stack.used = off + size;
+   return MEM_STACK_BASE + off;
+}
+
+// --------- Heap segment ---------
+static int size_class(size_t size) {
+   int c = 0;
+   while (c < HEAP_CLASSES && ((size_t)16 << c) < size) c++;
+   return c;
+}
+
+static BlockHeader *header_at(uint64_t off) {
+   return (BlockHeader *)(g_mem.heap.bytes + off);
+}
+
+MemAddr mem_heap_alloc(size_t size) {
+   int c = size_class(size);
+   size_t payload = c < HEAP_CLASSES ? ((size_t)16 << c) : ((size + 15) & ~(size_t)15);
+
+   // Reuse a free block of the class; large blocks take the first that fits
+   uint64_t *link = &g_mem.free_head[c];
+   while (*link) {
+      BlockHeader *h = header_at(*link);
+      if (h->size >= payload) {
+         uint64_t off = *link;
+         *link = h->next;
+         h->magic = BLOCK_LIVE;
+         h->next = 0;
+         memset(g_mem.heap.bytes + off + sizeof(BlockHeader), 0, h->size);
+         return MEM_HEAP_BASE + off + sizeof(BlockHeader);
+      }
+      link = &h->next;
+   }
+
+   size_t off = g_mem.heap.used;
+   if (payload > MEM_SEGMENT_MAX || !segment_reserve(&g_mem.heap, off + sizeof(BlockHeader) + payload)) {
+      fprintf(bt_err(), "Error: Heap segment exhausted allocating %zu bytes.\n", size);
+      return 0;
+   }
+   BlockHeader *h = header_at(off);
+   h->size = (uint32_t)payload;
+   h->magic = BLOCK_LIVE;
+   h->next = 0;
+   g_mem.heap.used = off + sizeof(BlockHeader) + payload;
+   return MEM_HEAP_BASE + off + sizeof(BlockHeader);
+}
+
+// Header offset of the block whose payload starts at addr, or 0 if there is none
+static uint64_t heap_block(MemAddr addr) {
+   if (addr < MEM_HEAP_BASE + 2 * sizeof(BlockHeader)) return 0;
+   uint64_t off = addr - MEM_HEAP_BASE - sizeof(BlockHeader);
+   if (off % 16 != 0 || off + sizeof(BlockHeader) > g_mem.heap.used) return 0;
+   return off;
+}
+
+bool mem_heap_free(MemAddr addr) {
+   uint64_t off = heap_block(addr);
+   if (!off || header_at(off)->magic != BLOCK_LIVE) return false;
+   BlockHeader *h = header_at(off);
+   int c = size_class(h->size);
+   h->magic = BLOCK_FREE;
+   h->next = g_mem.free_head[c];
+   g_mem.free_head[c] = off;
+   return true;
+}
+
+// --------- Snapshots ---------
+typedef struct {
+   size_t stack_used, heap_used;
+   size_t frames[MEM_MAX_FRAMES];
+   int depth;
+   uint64_t free_head[HEAP_CLASSES + 1];
+} MemStateHeader;
+
+size_t mem_state_size(void) {
+   return sizeof(MemStateHeader) + g_mem.stack.used + g_mem.heap.used;
+}
+
+void mem_state_save(void *dst) {
+   MemStateHeader h;
+   h.stack_used = g_mem.stack.used;
+   h.heap_used = g_mem.heap.used;
+   memcpy(h.frames, g_mem.frames, sizeof(h.frames));
+   h.depth = g_mem.depth;
+   memcpy(h.free_head, g_mem.free_head, sizeof(h.free_head));
+   unsigned char *p = (unsigned char *)dst;
+   memcpy(p, &h, sizeof(h));
+   p += sizeof(h);
+   // A segment that was never touched has no buffer yet and reads as zero
+   if (h.stack_used) memcpy(p, g_mem.stack.bytes, h.stack_used);
+   if (g_mem.heap.bytes) memcpy(p + h.stack_used, g_mem.heap.bytes, h.heap_used);
+   else memset(p + h.stack_used, 0, h.heap_used);
+}
+
+void mem_state_load(const void *src) {
+   MemStateHeader h;
+   const unsigned char *p = (const unsigned char *)src;
+   memcpy(&h, p, sizeof(h));
+   p += sizeof(h);
+   mem_reset();
+   // The sizes were reachable when saved, so reserving them again succeeds unless out of memory
+   if (segment_reserve(&g_mem.stack, h.stack_used) && segment_reserve(&g_mem.heap, h.heap_used)) {
+      if (h.stack_used) memcpy(g_mem.stack.bytes, p, h.stack_used);
+      if (h.heap_used) memcpy(g_mem.heap.bytes, p + h.stack_used, h.heap_used);
+   }
+   g_mem.stack.used = h.stack_used;
+   g_mem.heap.used = h.heap_used;
+   memcpy(g_mem.frames, h.frames, sizeof(h.frames));
+   g_mem.depth = h.depth;
+   memcpy(g_mem.free_head, h.free_head, sizeof(h.free_head));
+}
+
+void mem_release(void) {
+   free(g_mem.stack.bytes);
+   free(g_mem.heap.bytes);
+   memset(&g_mem, 0, sizeof(g_mem));
+}
+
+size_t mem_context_size(void) {
+   return sizeof(g_mem);
+}
+
+void mem_context_swap(void *ctx) {
+   swap_bytes(ctx, &g_mem, sizeof(g_mem));
+}
+
+// --------- Checked element access ---------
+static MemStatus resolve(MemAddr base, size_t len, long index, unsigned char **byte) {
+   if (base == 0) return MEM_NULL;
+   if (index < 0 || (size_t)index >= len) return MEM_OUT_OF_BOUNDS;
+   if (base >= MEM_HEAP_BASE) {
+      uint64_t off = heap_block(base);
+      if (!off || header_at(off)->magic != BLOCK_LIVE) return MEM_DANGLING;
+      *byte = g_mem.heap.bytes + (base - MEM_HEAP_BASE) + (size_t)index;
+      return MEM_OK;
+   }
+   size_t off = base - MEM_STACK_BASE + (size_t)index;
+   if (base < MEM_STACK_BASE || off >= g_mem.stack.used) return MEM_DANGLING;
+   *byte = g_mem.stack.bytes + off;
+   return MEM_OK;
+}
+
+MemStatus mem_load(MemAddr base, size_t len, long index, char *out) {
+   unsigned char *b = NULL;
+   MemStatus st = resolve(base, len, index, &b);
+   if (st == MEM_OK) *out = (char)*b;
+   return st;
+}
+
+MemStatus mem_store(MemAddr base, size_t len, long index, char value) {
+   unsigned char *b = NULL;
+   MemStatus st = resolve(base, len, index, &b);
+   if (st == MEM_OK) *b = (unsigned char)value;
+   return st;
+}
+
+void mem_report(MemStatus status, const char *name, long index, size_t len) {
+   switch (status) {
+      case MEM_OK:
+         break;
+      case MEM_NULL:
+         fprintf(bt_err(), "Error: '%s' is a null pointer.\n", name);
+         break;
+      case MEM_OUT_OF_BOUNDS:
+         fprintf(bt_err(), "Error: Index %ld is out of bounds for '%s' (length %zu).\n", index, name, len);
+         break;
+      case MEM_DANGLING:
+         fprintf(bt_err(), "Error: '%s' points to memory that was released.\n", name);
+         break;
+   }
+}
@@ -0,0 +1,89 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Simulated address space for char arrays and pointers.
+ *
+ * Two segments hold the bytes of the interpreted program:
+ *  - the stack segment is a bump region split into frames; entering a scope
+ *    records the top and leaving it releases every local of the scope at once;
+ *  - the heap segment serves malloc()/free() from size-class free lists.
+ * Addresses are offsets from a fixed segment base, so they stay stable (and
+ * printable) while the backing buffers grow. State is thread-local and is
+ * cleared by mem_reset() at the start of every run.
+ */
+
+typedef unsigned long MemAddr; // 0 is the null pointer
+
+#define MEM_STACK_BASE  0x1000UL
+#define MEM_HEAP_BASE   0x10000000UL
+#define MEM_SEGMENT_MAX (64UL << 20) // bytes per segment
+
+typedef enum {
+   MEM_OK,
+   MEM_NULL,         // access through a null pointer
+   MEM_OUT_OF_BOUNDS,
+   MEM_DANGLING      // the object's frame was popped or its block freed
+} MemStatus;
+
+void mem_reset(void);
+
+/**
+ * @brief Opens a stack frame; everything allocated until the matching pop is released by it
+ */
+void mem_frame_push(void);
+void mem_frame_pop(void);
+
+/**
+ * @brief Allocates zero-initialized storage in the current stack frame
+ * @return Its address, or 0 after reporting that the segment is exhausted
+ */
+MemAddr mem_stack_alloc(size_t size);
+
+/**
+ * @brief Allocates a heap block from the free list of its size class
+ * @return Its address, or 0 after reporting that the segment is exhausted
+ */
+MemAddr mem_heap_alloc(size_t size);
+
+/**
+ * @brief Returns a block to its size-class free list
+ * @return false if addr is not a live block returned by mem_heap_alloc
+ */
+bool mem_heap_free(MemAddr addr);
+
+/**
+ * @brief Bounds- and liveness-checked element access to the object at base of len bytes
+ */
+MemStatus mem_load(MemAddr base, size_t len, long index, char *out);
+MemStatus mem_store(MemAddr base, size_t len, long index, char value);
+
+/**
+ * @brief Serializes the whole address space (segment contents, frames, free lists)
+ * mem_state_load() restores a buffer of mem_state_size() bytes written by mem_state_save().
+ */
+size_t mem_state_size(void);
+void mem_state_save(void *dst);
+void mem_state_load(const void *src);
+
+/**
+ * @brief Frees the segment buffers of this thread (mem_reset() keeps small ones for reuse)
+ */
+void mem_release(void);
+
+/**
+ * @brief Exchanges the address space of this thread with a buffer of mem_context_size() bytes
+ * A zeroed buffer holds an empty address space; see ExecSession (parser.h).
+ */
+size_t mem_context_size(void);
+void mem_context_swap(void *ctx);
+
+/**
+ * @brief Reports a failed access to name[index] on bt_err()
+ */
+void mem_report(MemStatus status, const char *name, long index, size_t len);
+
+#endif
@@ -1,215 +1,936 @@
+#include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "affine.h"
 #include "bt.h"
+#include "checkpoint.h"
+#include "expr.h"
+#include "fmt.h"
+#include "func.h"
+#include "mem.h"
 #include "parser.h"
 #include "lexer.h"
-
-// Forward declarations for internal expression parsing helpers
-static long parse_int_expression(Token **tokens, struct SymbolTable *t, int *ok);
+#include "profile.h"
+#include "render.h"
 
 // --------- Utility to collect and print a table of statement -> binding table snapshots ---------
+
+// Row accumulator so nested constructs (e.g., function/while bodies) can append rows.
+// Thread-local so embedders can interpret several programs in parallel.
+static _Thread_local TableRow *g_rows_ref = NULL;
+static _Thread_local size_t g_rows_count = 0;
+static _Thread_local size_t g_rows_cap = 0;
+static _Thread_local int g_row_line = 0; // source line of the statement the last row traces
+static _Thread_local bool g_hash_rows = false; // rows carry only their state hash
+static _Thread_local struct SymbolTable *g_final_table = NULL; // receives the table at each row (sessions)
+
+// Function being run and the state of its return statement
+typedef struct {
+   int func;          // running function, or -1 at top level
+   bool returning;    // a return statement is unwinding it
+   bool at_top;       // a top-level return ran: it ends nothing and is not a step
+   bool has_value;
+   ExprValue value;
+} ReturnState;
+
+static _Thread_local ReturnState g_return = { .func = -1 };
+
+// --------- Execution budgets ---------
+static _Thread_local struct ExecLimits g_limits;
+typedef struct {
+   unsigned long steps;
+   unsigned long iterations;
+   size_t trace_bytes;
+   struct timespec start;
+   bool halted;
+   char reason[96];
+} BudgetState;
+
+static _Thread_local BudgetState g_budget;
+
+void set_exec_limits(const struct ExecLimits *limits) {
+   if (limits) g_limits = *limits;
+   else memset(&g_limits, 0, sizeof(g_limits));
+}
+
+const char *exec_truncated_reason(void) {
+   return g_budget.halted ? g_budget.reason : NULL;
+}
+
+static void budget_reset(void) {
+   memset(&g_budget, 0, sizeof(g_budget));
+   clock_gettime(CLOCK_MONOTONIC, &g_budget.start);
+}
+
+static void budget_halt(const char *what, unsigned long limit) {
+   if (g_budget.halted) return;
+   g_budget.halted = true;
+   snprintf(g_budget.reason, sizeof(g_budget.reason), "%s limit of %lu reached", what, limit);
+}
+
+static bool budget_time_ok(void) {
+   if (g_limits.max_time_ms == 0) return true;
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   unsigned long elapsed_ms = (unsigned long)((now.tv_sec - g_budget.start.tv_sec) * 1000L +
+                                              (now.tv_nsec - g_budget.start.tv_nsec) / 1000000L);
+   if (elapsed_ms < g_limits.max_time_ms) return true;
+   budget_halt("time (ms)", g_limits.max_time_ms);
+   return false;
+}
+
+// Charges one executed statement; false once any budget is exhausted
+static bool budget_step(void) {
+   if (g_budget.halted) return false;
+   if (g_limits.max_steps && g_budget.steps >= g_limits.max_steps) {
+      budget_halt("statement", g_limits.max_steps);
+      return false;
+   }
+   g_budget.steps++;
+   // The clock is only sampled every 64 statements to keep the check cheap
+   return (g_budget.steps & 63) != 0 || budget_time_ok();
+}
+
+// Charges one loop iteration; false once any budget is exhausted
+static bool budget_iteration(void) {
+   if (g_budget.halted) return false;
+   if (g_limits.max_iterations && g_budget.iterations >= g_limits.max_iterations) {
+      budget_halt("loop iteration", g_limits.max_iterations);
+      return false;
+   }
+   g_budget.iterations++;
+   return budget_time_ok();
+}
+
+// --------- Per-statement execution profile (--stmt-profile) ---------
+typedef struct {
+   unsigned long count;      // times the statement started executing
+   unsigned long long ns;    // cumulative time, including nested statements
+   unsigned long rows;       // trace rows it produced
+   unsigned long iterations; // loop iterations (while statements only)
+   long owner;               // token index of the innermost enclosing while, or -1
+   bool seen;
+} StmtProfile;
+
 typedef struct {
-   char *command;
-   char *binding;
-   char *stack;
-   char *stack_diagram; // optional multi-line diagram for this step
-} TableRow;
-
-// Global row accumulator so nested constructs (e.g., function/while bodies) can append rows
-static TableRow *g_rows_ref = NULL;
-static size_t g_rows_count = 0;
-static size_t g_rows_cap = 0;
-static bool g_suppress_next_row = false;
+   bool enabled;             // requested for the next execution
+   StmtProfile *entries;     // indexed by the statement's first token; NULL when off
+   size_t token_count;
+   Token *base;
+   long last;                // statement that most recently finished
+   long loop;                // innermost while currently executing
+   unsigned long long total_ns;
+} StmtProfileState;
+
+static _Thread_local StmtProfileState g_sprof = { .last = -1, .loop = -1 };
+
+void set_stmt_profile(bool enabled) {
+   g_sprof.enabled = enabled;
+}
+
+static unsigned long long sprof_now(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static void sprof_reset(Token *tokens, size_t n) {
+   free(g_sprof.entries);
+   g_sprof.entries = NULL;
+   g_sprof.last = g_sprof.loop = -1;
+   g_sprof.total_ns = 0;
+   if (!g_sprof.enabled) return;
+   g_sprof.entries = (StmtProfile *)calloc(n, sizeof(StmtProfile));
+   g_sprof.token_count = n;
+   g_sprof.base = tokens;
+}
+
+// Starts timing the statement beginning at start; returns its entry (NULL when off)
+static StmtProfile *sprof_begin(Token *start, unsigned long long *t0) {
+   if (!g_sprof.entries) return NULL;
+   StmtProfile *sp = &g_sprof.entries[start - g_sprof.base];
+   if (!sp->seen) {
+      sp->seen = true;
+      sp->owner = g_sprof.loop;
+   }
+   sp->count++;
+   *t0 = sprof_now();
+   return sp;
+}
+
+static void sprof_end(StmtProfile *sp, unsigned long long t0) {
+   if (!sp) return;
+   sp->ns += sprof_now() - t0;
+   g_sprof.last = sp - g_sprof.entries;
+}
+
+// Diagnostics about a specific token point at it rather than at the statement
+static FILE *err_at(const Token *tok) {
+   return bt_err_at(tok->line, tok->column);
+}
+
+static bool is_punct(const Token *tok, const char *p) {
+   return tok->type == TOKEN_PUNCTUATION && strcmp(tok->value, p) == 0;
+}
 
 static char *dup_string(const char *s) {
    size_t n = strlen(s) + 1;
-   char *d = (char *)malloc(n);
+   char *d = (char *)prof_malloc(n);
    if (d) memcpy(d, s, n);
    return d;
 }
 
+// --------- Incremental re-execution (--incremental) ---------
+// A checkpoint is taken once this many statements ran since the previous one
+#define CHECKPOINT_MIN_STEPS 256
+
+static _Thread_local bool g_checkpoints = false;
+
+void set_checkpoints(bool enabled) {
+   g_checkpoints = enabled;
+}
+
+// Interpreter state saved with a checkpoint, followed by the stack model and memory
+typedef struct {
+   struct SymbolTable table;
+   FunctionTable funcs;
+   unsigned long steps, iterations;
+   size_t trace_bytes;
+} SavedState;
+
+static bool copy_row(TableRow *dst, const TableRow *src) {
+   dst->command = dup_string(src->command);
+   dst->binding = dup_string(src->binding);
+   dst->stack = dup_string(src->stack);
+   dst->stack_diagram = src->stack_diagram ? dup_string(src->stack_diagram) : NULL;
+   dst->state_hash = src->state_hash;
+   return dst->command && dst->binding && dst->stack;
+}
+
+// Saves the state before tokens[index]; returns the new tail of the chain (parent on failure)
+static Checkpoint *save_checkpoint(Checkpoint *parent, const CacheKey *prefix, size_t index, struct SymbolTable *t) {
+   Checkpoint *cp = checkpoint_create(parent, prefix, index);
+   if (!cp) return parent;
+   size_t first = parent ? parent->total_rows : 0;
+   cp->total_rows = g_rows_count;
+   cp->rows = (TableRow *)calloc(g_rows_count - first + 1, sizeof(TableRow));
+   cp->state_size = sizeof(SavedState) + stack_state_size();
+   cp->state = malloc(cp->state_size);
+   bool ok = cp->rows && cp->state;
+   for (size_t i = first; ok && i < g_rows_count; i++) {
+      ok = copy_row(&cp->rows[cp->row_count++], &g_rows_ref[i]);
+   }
+   if (!ok) {
+      checkpoint_release(cp);
+      return parent;
+   }
+   SavedState *st = (SavedState *)cp->state;
+   st->table = *t;
+   func_state_save(&st->funcs);
+   st->steps = g_budget.steps;
+   st->iterations = g_budget.iterations;
+   st->trace_bytes = g_budget.trace_bytes;
+   stack_state_save(st + 1);
+   checkpoint_publish(cp);
+   checkpoint_release(parent); // the new checkpoint holds the parent now
+   return cp;
+}
+
+// Restores a checkpoint's rows and state; false (with nothing changed) if rows could not be copied
+static bool resume_checkpoint(const Checkpoint *cp, struct SymbolTable *t) {
+   if (cp->total_rows > g_rows_cap) {
+      TableRow *tmp = (TableRow *)prof_realloc(g_rows_ref, sizeof(TableRow) * cp->total_rows);
+      if (!tmp) return false;
+      g_rows_ref = tmp;
+      g_rows_cap = cp->total_rows;
+   }
+   // Each checkpoint holds the rows since its parent; fill from the end of the chain
+   memset(g_rows_ref, 0, sizeof(TableRow) * cp->total_rows);
+   for (const Checkpoint *c = cp; c; c = c->parent) {
+      size_t first = c->total_rows - c->row_count;
+      for (size_t i = 0; i < c->row_count; i++) {
+         if (copy_row(&g_rows_ref[first + i], &c->rows[i])) continue;
+         for (size_t k = 0; k < cp->total_rows; k++) {
+            free(g_rows_ref[k].command);
+            free(g_rows_ref[k].binding);
+            free(g_rows_ref[k].stack);
+            free(g_rows_ref[k].stack_diagram);
+         }
+         return false;
+      }
+   }
+   g_rows_count = cp->total_rows;
+
+   const SavedState *st = (const SavedState *)cp->state;
+   *t = st->table;
+   update_layout(t); // layout ids are per thread
+   func_state_load(&st->funcs);
+   g_budget.steps = st->steps;
+   g_budget.iterations = st->iterations;
+   g_budget.trace_bytes = st->trace_bytes;
+   stack_state_load(st + 1);
+   return true;
+}
+
+static bool is_open_bracket(const Token *p, bool braces) {
+   return p->type == TOKEN_PUNCTUATION && (strcmp(p->value, "(") == 0 || strcmp(p->value, "[") == 0 ||
+                                           (braces && strcmp(p->value, "{") == 0));
+}
+
+// Outside braces mode the ';' ending a statement is attached like a closing bracket
+static bool is_close_bracket(const Token *p, bool braces) {
+   return p->type == TOKEN_PUNCTUATION && (strcmp(p->value, ")") == 0 || strcmp(p->value, "]") == 0 ||
+                                           strcmp(p->value, braces ? "}" : ";") == 0);
+}
+
+// Appends the token span [first, last] joined with single spaces, except after an opening and
+// before a closing bracket (in braces mode, '{' and '}' count as brackets)
+static void join_tokens(StrBuf *out, Token *first, Token *last, bool braces) {
+   for (Token *p = first; p <= last; p++) {
+      if (p > first && !is_close_bracket(p, braces) && !is_open_bracket(p - 1, braces)) sb_putc(out, ' ');
+      sb_puts(out, p->value);
+   }
+}
+
+// Text of the statement from start through its ';'
 static char *stringify_statement(Token *start) {
-   // Join tokens until and including ';' with simple spacing rules
-   size_t cap = 256;
-   size_t len = 0;
-   char *buf = (char *)malloc(cap);
-   if (!buf) return NULL;
-   buf[0] = '\0';
+   Token *end = start;
+   while (!is_punct(end, ";") && end->type != TOKEN_END_OF_FILE) end++;
+   StrBuf text = SB_INIT;
+   if (end->type == TOKEN_END_OF_FILE) {
+      // Unterminated: show what there is, with the ';' the parser asked for
+      join_tokens(&text, start, end - 1, false);
+      sb_putc(&text, ';');
+   } else {
+      join_tokens(&text, start, end, false);
+   }
+   return sb_take(&text);
+}
 
-   Token *p = start;
-   bool prev_was_open_bracket = false; // '[' or '('
-   while (!(p->type == TOKEN_PUNCTUATION && strcmp(p->value, ";") == 0)) {
-      const char *tok = p->value;
-      bool is_punc = (p->type == TOKEN_PUNCTUATION);
-      bool is_close = is_punc && (strcmp(tok, ")") == 0 || strcmp(tok, "]") == 0);
-      bool is_open = is_punc && (strcmp(tok, "(") == 0 || strcmp(tok, "[") == 0);
-
-      size_t tok_len = strlen(tok);
-      size_t add_space = (len > 0 && !is_close && !prev_was_open_bracket) ? 1 : 0;
-      if (len + add_space + tok_len + 2 > cap) {
-         cap *= 2;
-         char *tmp = (char *)realloc(buf, cap);
-         if (!tmp) { free(buf); return NULL; }
-         buf = tmp;
+// --------- Statement text ---------
+// The command column of a statement is built once per run from its token span and cached by
+// the position of its first token; loop iterations reuse it and only add their label
+typedef struct {
+   char **texts;
+   size_t len;
+   Token *base;
+   char *scratch; // statements outside the current run (not cached)
+} TextCache;
+
+static _Thread_local TextCache g_texts;
+
+static void texts_release(void) {
+   for (size_t i = 0; g_texts.texts && i < g_texts.len; i++) free(g_texts.texts[i]);
+   free(g_texts.texts);
+   free(g_texts.scratch);
+   memset(&g_texts, 0, sizeof(g_texts));
+}
+
+static void texts_reset(Token *tokens, size_t token_count) {
+   texts_release();
+   g_texts.texts = (char **)calloc(token_count, sizeof(char *));
+   g_texts.len = g_texts.texts ? token_count : 0;
+   g_texts.base = tokens;
+}
+
+static const char *statement_text(Token *start) {
+   if (g_texts.texts && start >= g_texts.base && start < g_texts.base + g_texts.len) {
+      char **slot = &g_texts.texts[start - g_texts.base];
+      if (!*slot) *slot = stringify_statement(start);
+      return *slot;
+   }
+   free(g_texts.scratch);
+   g_texts.scratch = stringify_statement(start);
+   return g_texts.scratch;
+}
+
+// --------- Row streaming (--stream) ---------
+// Rows are flushed at most this often (the first one right away): a write per row would
+// cost more than producing it, while readers only need rows within milliseconds
+#define STREAM_FLUSH_NS 5000000ULL
+
+static _Thread_local FILE *g_row_stream = NULL;
+static _Thread_local unsigned long long g_stream_flushed;
+
+void set_row_stream(FILE *out) {
+   g_row_stream = out;
+   g_stream_flushed = 0;
+}
+
+// Prints s as a JSON string, or null
+static void print_json_string(FILE *out, const char *s) {
+   if (!s) {
+      fputs("null", out);
+      return;
+   }
+   fputc('"', out);
+   for (; *s; s++) {
+      unsigned char c = (unsigned char)*s;
+      if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+      else if (c == '\n') fputs("\\n", out);
+      else if (c < 0x20) fprintf(out, "\\u%04x", c);
+      else fputc(c, out);
+   }
+   fputc('"', out);
+}
+
+// Writes rows [first, g_rows_count) as NDJSON records and flushes them right away
+static void stream_rows(size_t first) {
+   if (!g_row_stream) return;
+   for (size_t i = first; i < g_rows_count; i++) {
+      const TableRow *r = &g_rows_ref[i];
+      fprintf(g_row_stream, "{\"step\":%zu,\"command\":", i + 1);
+      print_json_string(g_row_stream, r->command);
+      fputs(",\"binding\":", g_row_stream);
+      print_json_string(g_row_stream, r->binding);
+      fputs(",\"stack\":", g_row_stream);
+      print_json_string(g_row_stream, r->stack);
+      fputs(",\"stack_diagram\":", g_row_stream);
+      print_json_string(g_row_stream, r->stack_diagram);
+      fputs("}\n", g_row_stream);
+   }
+   unsigned long long now = sprof_now();
+   if (now - g_stream_flushed >= STREAM_FLUSH_NS) {
+      fflush(g_row_stream);
+      g_stream_flushed = now;
+   }
+}
+
+static void stream_end(void) {
+   if (!g_row_stream) return;
+   fprintf(g_row_stream, "{\"done\":true,\"rows\":%zu,\"truncated\":", g_rows_count);
+   print_json_string(g_row_stream, exec_truncated_reason());
+   fputs("}\n", g_row_stream);
+   fflush(g_row_stream);
+}
+
+// --------- Selective tracing ---------
+// Most programs bind a handful of variables; a watch list can name every one
+#define WATCH_MAX (sizeof(((struct SymbolTable *)0)->items) / sizeof(struct Symbol))
+
+// What a watched name was bound to at the last step
+typedef struct {
+   bool bound, initialized;
+   VarType type;
+   long bits; // the value union, compared as raw bits
+} WatchSeen;
+
+static _Thread_local struct {
+   bool enabled;
+   char watch[WATCH_MAX][sizeof(((struct Symbol *)0)->name)];
+   size_t watch_count;
+   WatchSeen seen[WATCH_MAX];
+   int break_line;
+   Token *when;            // the condition's tokens, NULL for none
+   Expr *when_expr;        // compiled for the table layout when_layout
+   unsigned long when_layout;
+   unsigned long sample;
+   bool started;           // the break line and condition were reached
+   unsigned long passed;   // steps that reached the sampling
+} g_filter;
+
+static void filter_release(void) {
+   expr_free(g_filter.when_expr);
+   free(g_filter.when);
+   memset(&g_filter, 0, sizeof(g_filter));
+}
+
+static bool parse_watch_list(const char *list) {
+   for (const char *p = list; *p;) {
+      size_t n = strcspn(p, ",");
+      while (n > 0 && p[n - 1] == ' ') n--;
+      bool name = n > 0 && n < sizeof(g_filter.watch[0]) && (isalpha((unsigned char)*p) || *p == '_');
+      for (size_t i = 1; name && i < n; i++) name = isalnum((unsigned char)p[i]) || p[i] == '_';
+      if (!name) {
+         fprintf(bt_err(), "Error: --watch expects variable names separated by commas, not '%s'.\n", list);
+         return false;
+      }
+      if (g_filter.watch_count == WATCH_MAX) {
+         fprintf(bt_err(), "Error: --watch takes at most %zu variables.\n", (size_t)WATCH_MAX);
+         return false;
+      }
+      memcpy(g_filter.watch[g_filter.watch_count], p, n);
+      g_filter.watch[g_filter.watch_count++][n] = '\0';
+      p += strcspn(p, ",");
+      if (*p == ',') p++;
+      while (*p == ' ') p++;
+   }
+   return true;
+}
+
+// Checks the condition once against ints, so that later only unbound variables keep it false
+static bool parse_when(const char *text) {
+   if (!(g_filter.when = tokenize(text))) return false;
+   struct SymbolTable probe;
+   probe.count = 0;
+   probe.layout = 0;
+   probe.hash = 0;
+   for (Token *p = g_filter.when; p->type != TOKEN_END_OF_FILE; p++) {
+      if (p->type != TOKEN_IDENTIFIER) continue;
+      if (is_punct(p + 1, "(") || is_punct(p + 1, "[")) {
+         fprintf(bt_err(), "Error: --when cannot call functions or index arrays ('%s').\n", p->value);
+         return false;
+      }
+      if (!find(&probe, p->value) && !add(&probe, p->value, TYPE_INT, NULL, 0)) return false;
+   }
+   Token *end = g_filter.when;
+   Expr *e = expr_compile(&end, &probe, true);
+   bt_set_location(0, 0);
+   expr_free(e);
+   if (!e) {
+      fprintf(bt_err(), "Error: --when expects a condition such as 'x > 100', not '%s'.\n", text);
+      return false;
+   }
+   if (end->type != TOKEN_END_OF_FILE) {
+      fprintf(bt_err(), "Error: --when expects one condition but found '%s' after it.\n", end->value);
+      return false;
+   }
+   return true;
+}
+
+bool set_trace_filter(const struct TraceFilter *f) {
+   filter_release();
+   if (!f || (!f->watch && !f->break_line && !f->when && f->sample <= 1)) return true;
+   g_filter.enabled = true;
+   g_filter.break_line = f->break_line;
+   g_filter.sample = f->sample;
+   if ((f->watch && !parse_watch_list(f->watch)) || (f->when && !parse_when(f->when))) {
+      filter_release();
+      return false;
+   }
+   return true;
+}
+
+static void filter_reset(void) {
+   memset(g_filter.seen, 0, sizeof(g_filter.seen));
+   g_filter.started = false;
+   g_filter.passed = 0;
+}
+
+// Whether the step changed the binding of a watched name; remembers the new bindings
+static bool watch_changed(struct SymbolTable *t) {
+   bool changed = false;
+   for (size_t i = 0; i < g_filter.watch_count; i++) {
+      const struct Symbol *s = find(t, g_filter.watch[i]);
+      WatchSeen now = { 0 };
+      if (s) {
+         now.bound = true;
+         now.initialized = s->initialized;
+         now.type = s->type;
+         now.bits = s->value_int;
+      }
+      WatchSeen *seen = &g_filter.seen[i];
+      if (now.bound != seen->bound || now.initialized != seen->initialized || now.type != seen->type ||
+          now.bits != seen->bits) {
+         *seen = now;
+         changed = true;
       }
-      if (add_space) buf[len++] = ' ';
-      memcpy(buf + len, tok, tok_len);
-      len += tok_len;
-      buf[len] = '\0';
-      prev_was_open_bracket = is_open;
-      p++;
-   }
-   // append ';'
-   if (len + 1 + 1 > cap) {
-      cap *= 2;
-      char *tmp = (char *)realloc(buf, cap);
-      if (!tmp) { free(buf); return NULL; }
-      buf = tmp;
-   }
-   buf[len++] = ';';
-   buf[len] = '\0';
-   return buf;
-}
-
-static void print_horizontal_rule(int w1, int w2) {
-   printf("+");
-   for (int i = 0; i < w1 + 2; i++) printf("-");
-   printf("+");
-   for (int i = 0; i < w2 + 2; i++) printf("-");
-   printf("+\n");
-}
-
-static void print_table(TableRow *rows, size_t row_count) {
-   int w1 = (int)strlen("Commands");
-   int w2 = (int)strlen("Binding table");
-   int w3 = (int)strlen("Stack");
-   for (size_t i = 0; i < row_count; i++) {
-      if ((int)strlen(rows[i].command) > w1) w1 = (int)strlen(rows[i].command);
-      if ((int)strlen(rows[i].binding) > w2) w2 = (int)strlen(rows[i].binding);
-      if (rows[i].stack && (int)strlen(rows[i].stack) > w3) w3 = (int)strlen(rows[i].stack);
-   }
-   // draw 3-column table
-   printf("+"); for (int i=0;i<w1+2;i++) printf("-");
-   printf("+"); for (int i=0;i<w2+2;i++) printf("-");
-   printf("+"); for (int i=0;i<w3+2;i++) printf("-");
-   printf("+\n");
-   printf("| %-*s | %-*s | %-*s |\n", w1, "Commands", w2, "Binding table", w3, "Stack");
-   printf("+"); for (int i=0;i<w1+2;i++) printf("-");
-   printf("+"); for (int i=0;i<w2+2;i++) printf("-");
-   printf("+"); for (int i=0;i<w3+2;i++) printf("-");
-   printf("+\n");
-   for (size_t i = 0; i < row_count; i++) {
-      printf("| %-*s | %-*s | %-*s |\n", w1, rows[i].command, w2, rows[i].binding, w3, rows[i].stack ? rows[i].stack : "");
-   }
-   printf("+"); for (int i=0;i<w1+2;i++) printf("-");
-   printf("+"); for (int i=0;i<w2+2;i++) printf("-");
-   printf("+"); for (int i=0;i<w3+2;i++) printf("-");
-   printf("+\n");
-}
-
-static void append_row_with(const char *cmd_text, struct SymbolTable *t) {
-   if (g_suppress_next_row) { g_suppress_next_row = false; return; }
-   if (!g_rows_ref) return;
+   }
+   return changed;
+}
+
+// Whether the condition holds; false while one of its variables is unbound, unset or not a number
+static bool when_holds(struct SymbolTable *t) {
+   for (Token *p = g_filter.when; p->type != TOKEN_END_OF_FILE; p++) {
+      if (p->type != TOKEN_IDENTIFIER) continue;
+      const struct Symbol *s = find(t, p->value);
+      ExprType type;
+      if (!s || !s->initialized || !expr_type_of(s->type, &type)) return false;
+   }
+   if (!g_filter.when_expr || g_filter.when_layout != t->layout) {
+      expr_free(g_filter.when_expr);
+      Token *p = g_filter.when;
+      g_filter.when_expr = expr_truth(expr_compile(&p, t, true));
+      g_filter.when_layout = t->layout;
+   }
+   int ok = g_filter.when_expr != NULL;
+   long holds = ok ? expr_eval_int(g_filter.when_expr, t, &ok) : 0;
+   return ok && holds;
+}
+
+// Whether the step that just ran gets a row
+static bool filter_pass(struct SymbolTable *t) {
+   // Watched bindings are tracked at every step, so a change is always relative to the step before
+   bool changed = g_filter.watch_count == 0 || watch_changed(t);
+   if (!g_filter.started) {
+      int line, column;
+      bt_get_location(&line, &column);
+      if (g_filter.break_line && line != g_filter.break_line) return false;
+      if (g_filter.when && !when_holds(t)) return false;
+      g_filter.started = true;
+   }
+   if (!changed) return false;
+   return g_filter.sample <= 1 || g_filter.passed++ % g_filter.sample == 0;
+}
+
+// "iter 18446744073709551615: "
+#define ROW_LABEL_MAX (5 + FMT_LONG_MAX + 2)
+// Room for the next row to declare a variable without growing its columns
+#define ROW_HINT_SLACK 16
+
+static _Thread_local struct {
+   size_t binding, stack;
+} g_row_hint;
+
+// Adds a row for cmd_text, labeled "iter k: " when iteration is non-zero
+static void append_row_with(const char *cmd_text, unsigned long iteration, struct SymbolTable *t) {
+   if (!g_rows_ref || g_budget.halted) return;
+   // Steps the filter skips are neither snapshotted nor formatted
+   if (g_filter.enabled && !filter_pass(t)) return;
+   prof_enter(PROF_FORMAT);
+   unsigned long long t0 = g_sprof.entries ? sprof_now() : 0;
    if (g_rows_count >= g_rows_cap) {
       size_t new_cap = g_rows_cap == 0 ? 8 : g_rows_cap * 2;
-      TableRow *tmp = (TableRow *)realloc(g_rows_ref, sizeof(TableRow) * new_cap);
-      if (!tmp) return;
+      TableRow *tmp = (TableRow *)prof_realloc(g_rows_ref, sizeof(TableRow) * new_cap);
+      if (!tmp) { prof_leave(); return; }
       g_rows_ref = tmp;
       g_rows_cap = new_cap;
    }
-   char s_buf[1024];
-   format_binding_table(t, s_buf, sizeof(s_buf));
-   char st_buf[256];
-   format_stack(st_buf, sizeof(st_buf));
-   g_rows_ref[g_rows_count].command = dup_string(cmd_text ? cmd_text : "");
-   g_rows_ref[g_rows_count].binding = dup_string(s_buf);
-   g_rows_ref[g_rows_count].stack = dup_string(st_buf);
-   g_rows_ref[g_rows_count].stack_diagram = format_stack_diagram(t);
+   int column;
+   if (g_hash_rows) {
+      g_rows_ref[g_rows_count] = (TableRow){ .state_hash = t->hash };
+      g_rows_count++;
+      if (g_final_table) table_copy(g_final_table, t);
+      bt_get_location(&g_row_line, &column);
+      prof_leave();
+      return;
+   }
+   // Each column is built in place at the size of the previous row's, which it rarely outgrows
+   if (!cmd_text) cmd_text = "";
+   size_t cmd_len = strlen(cmd_text);
+   StrBuf command, binding, stack;
+   sb_init(&command, cmd_len + (iteration ? ROW_LABEL_MAX : 0));
+   sb_init(&binding, g_row_hint.binding);
+   sb_init(&stack, g_row_hint.stack);
+   if (iteration) {
+      sb_append(&command, "iter ", 5);
+      sb_long(&command, (long)iteration);
+      sb_append(&command, ": ", 2);
+   }
+   sb_append(&command, cmd_text, cmd_len);
+   format_binding_table(t, &binding);
+   format_stack(&stack);
+   char *diagram = format_stack_diagram(t);
+   size_t row_bytes = command.len + binding.len + stack.len + (diagram ? strlen(diagram) : 0);
+   if (g_limits.max_trace_bytes && g_budget.trace_bytes + row_bytes > g_limits.max_trace_bytes) {
+      // Keep the trace under the cap: this row is dropped and execution stops
+      sb_free(&command);
+      sb_free(&binding);
+      sb_free(&stack);
+      free(diagram);
+      budget_halt("trace byte", (unsigned long)g_limits.max_trace_bytes);
+      prof_leave();
+      return;
+   }
+   g_budget.trace_bytes += row_bytes;
+   g_row_hint.binding = binding.len + ROW_HINT_SLACK;
+   g_row_hint.stack = stack.len + ROW_HINT_SLACK;
+   g_rows_ref[g_rows_count].command = sb_take(&command);
+   g_rows_ref[g_rows_count].binding = sb_take(&binding);
+   g_rows_ref[g_rows_count].stack = sb_take(&stack);
+   g_rows_ref[g_rows_count].stack_diagram = diagram;
+   g_rows_ref[g_rows_count].state_hash = t->hash;
    g_rows_count++;
+   if (g_final_table) table_copy(g_final_table, t);
+   bt_get_location(&g_row_line, &column);
+   stream_rows(g_rows_count - 1);
+   if (g_sprof.entries && g_sprof.last >= 0) {
+      // The row is charged to the statement it traces, formatting time included
+      g_sprof.entries[g_sprof.last].rows++;
+      g_sprof.entries[g_sprof.last].ns += sprof_now() - t0;
+   }
+   prof_leave();
+}
+
+// --------- Execution events ---------
+// Execution reports what it does to one observer; by default the table builder, which
+// turns each step into a row. Every emitter tests its callback first, so events nobody
+// listens to cost a branch, and the statement text of a step is only made for a listener.
+
+static void builder_step(void *ctx, const char *command, unsigned long iteration, struct SymbolTable *t) {
+   (void)ctx;
+   append_row_with(command, iteration, t);
+}
+
+static const ExecObserver g_table_builder = { .step = builder_step };
+static _Thread_local ExecObserver g_observer = { .step = builder_step };
+
+void set_exec_observer(const ExecObserver *observer) {
+   g_observer = observer ? *observer : g_table_builder;
+}
+
+// Whether the trace rows are being built (and so may be checkpointed)
+static bool observer_builds_rows(void) {
+   return g_observer.step == builder_step;
+}
+
+static inline void emit_declare(const struct SymbolTable *t, const char *name) {
+   if (g_observer.declare) g_observer.declare(g_observer.ctx, t, name);
+}
+
+static inline void emit_assign(const struct SymbolTable *t, const char *name) {
+   if (g_observer.assign) g_observer.assign(g_observer.ctx, t, name);
+}
+
+static inline void emit_scope_enter(const char *function) {
+   if (g_observer.scope_enter) g_observer.scope_enter(g_observer.ctx, function);
+}
+
+static inline void emit_scope_exit(const char *function) {
+   if (g_observer.scope_exit) g_observer.scope_exit(g_observer.ctx, function);
+}
+
+static inline void emit_iteration(unsigned long iteration) {
+   if (g_observer.iteration) g_observer.iteration(g_observer.ctx, iteration);
+}
+
+static inline void emit_step(const char *command, unsigned long iteration, struct SymbolTable *t) {
+   if (g_observer.step) g_observer.step(g_observer.ctx, command, iteration, t);
+}
+
+// The step of the statement at start; a top-level return ends nothing and is not one
+static void statement_done(Token *start, unsigned long iteration, struct SymbolTable *t) {
+   if (g_return.at_top) {
+      g_return.at_top = false;
+      return;
+   }
+   if (g_observer.step) g_observer.step(g_observer.ctx, statement_text(start), iteration, t);
+}
+
+// --------- Compiled expressions ---------
+// Requested result types besides the ExprType values themselves
+#define WANT_NATURAL   -1 // the expression's own static type
+#define WANT_CONDITION -2 // relational expression reduced to an int truth value
+#define WANT_CALL      -3 // function call statement, which may call a void function
+
+// Expressions are compiled on first use and cached by the position of their first token
+typedef struct {
+   Expr *expr;
+   Token *end;           // token following the expression
+   unsigned long layout; // SymbolTable layout the variables were bound against
+   int want;
+} ExprSlot;
+
+typedef struct {
+   ExprSlot *slots;
+   size_t len;
+   Token *base;
+} ExprCache;
+
+static _Thread_local ExprCache g_exprs;
+
+static void exprs_release(void) {
+   for (size_t i = 0; g_exprs.slots && i < g_exprs.len; i++) expr_free(g_exprs.slots[i].expr);
+   free(g_exprs.slots);
+   g_exprs.slots = NULL;
+   g_exprs.len = 0;
+}
+
+static void exprs_reset(Token *tokens, size_t token_count) {
+   exprs_release();
+   g_exprs.slots = (ExprSlot *)calloc(token_count, sizeof(ExprSlot));
+   g_exprs.len = g_exprs.slots ? token_count : 0;
+   g_exprs.base = tokens;
+}
+
+static Expr *build_expr(Token **tokens, struct SymbolTable *t, int want) {
+   if (want == WANT_CALL) return expr_compile_call(tokens, t);
+   Expr *e = expr_compile(tokens, t, want == WANT_CONDITION);
+   if (want == WANT_CONDITION) return expr_truth(e);
+   return want >= 0 ? expr_cast(e, (ExprType)want) : e;
+}
+
+// Returns the compiled expression at *tokens and moves past it, or NULL after an error.
+// Outside execute_program there is no cache and the caller must free *owned.
+static const Expr *expr_at(Token **tokens, struct SymbolTable *t, int want, Expr **owned) {
+   *owned = NULL;
+   if (!g_exprs.slots || *tokens < g_exprs.base || *tokens >= g_exprs.base + g_exprs.len) {
+      *owned = build_expr(tokens, t, want);
+      return *owned;
+   }
+   ExprSlot *slot = &g_exprs.slots[*tokens - g_exprs.base];
+   if (slot->expr && slot->layout == t->layout && slot->want == want) {
+      *tokens = slot->end;
+      return slot->expr;
+   }
+   // First use, or a declaration changed the symbols the expression was bound to. No evaluation
+   // is in progress across steps (see the continuation below), so the old tree can go.
+   expr_free(slot->expr);
+   slot->expr = build_expr(tokens, t, want);
+   slot->end = *tokens;
+   slot->layout = t->layout;
+   slot->want = want;
+   return slot->expr;
+}
+
+// Returns the expression an earlier expr_at() compiled at tok, or NULL; never compiles (or reports)
+static const Expr *expr_cached(Token *tok, const struct SymbolTable *t, int want, Token **end) {
+   if (!g_exprs.slots || tok < g_exprs.base || tok >= g_exprs.base + g_exprs.len) return NULL;
+   const ExprSlot *slot = &g_exprs.slots[tok - g_exprs.base];
+   if (!slot->expr || slot->layout != t->layout || slot->want != want) return NULL;
+   *end = slot->end;
+   return slot->expr;
+}
+
+// Evaluates e with the kernel of its static type; int results go to *as_int, others to *as_fp
+static bool eval_expr(const Expr *e, struct SymbolTable *t, long *as_int, double *as_fp) {
+   int ok = 1;
+   switch (e->type) {
+      case EXPR_INT:   *as_int = expr_eval_int(e, t, &ok); break;
+      case EXPR_FLOAT: *as_fp = expr_eval_float(e, t, &ok); break;
+      default:         *as_fp = expr_eval_double(e, t, &ok); break;
+   }
+   return ok;
+}
+
+// Evaluates the expression at *tokens as the given type and stores it in var_name.
+// Assignments must end at ';' (left for the caller) before anything is stored.
+static bool assign_expr(Token **tokens, struct SymbolTable *t, int want, const char *var_name, bool is_assignment) {
+   static const VarType var_types[] = { [EXPR_INT] = TYPE_INT, [EXPR_FLOAT] = TYPE_FLOAT, [EXPR_DOUBLE] = TYPE_DOUBLE };
+   Expr *owned;
+   const Expr *e = expr_at(tokens, t, want, &owned);
+   long as_int = 0;
+   double as_fp = 0.0;
+   bool ok = e && eval_expr(e, t, &as_int, &as_fp);
+   if (ok && is_assignment && !((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, ";") == 0)) {
+      fprintf(err_at(*tokens), "Error: Expected a semicolon after assignment to '%s'.\n", var_name);
+      ok = false;
+   }
+   if (ok && add(t, var_name, var_types[e->type], e->type == EXPR_INT ? (void *)&as_int : (void *)&as_fp, 0)) {
+      emit_assign(t, var_name);
+   }
+   expr_free(owned);
+   return ok;
+}
+
+// Evaluates a while condition; false on errors
+static bool eval_condition(Token **tokens, struct SymbolTable *t, long *cond) {
+   Expr *owned;
+   const Expr *e = expr_at(tokens, t, WANT_CONDITION, &owned);
+   int ok = e != NULL;
+   if (ok) *cond = expr_eval_int(e, t, &ok);
+   expr_free(owned);
+   return ok;
 }
 
-static void append_row_from_tokens(Token *stmt_start, struct SymbolTable *t) {
-   char *cmd = stringify_statement(stmt_start);
-   append_row_with(cmd, t);
-   free(cmd);
+// Evaluates the expression at *tokens as an int; false after an error
+static bool eval_int_at(Token **tokens, struct SymbolTable *t, long *value) {
+   Expr *owned;
+   const Expr *e = expr_at(tokens, t, EXPR_INT, &owned);
+   int ok = e != NULL;
+   if (ok) *value = expr_eval_int(e, t, &ok);
+   expr_free(owned);
+   return ok;
 }
 
-static long parse_int_factor(Token **tokens, struct SymbolTable *t, int *ok) {
-   // Parenthesized expression: '(' expr ')'
-   if ((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, "(") == 0) {
-      (*tokens)++; // consume '('
-      long inner = parse_int_expression(tokens, t, ok);
-      if (!*ok) return 0;
-      if (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, ")") == 0)) {
-         fprintf(stderr, "Error: Expected ')' to close '(' but found '%s'.\n", (*tokens)->value);
-         *ok = 0;
-         return 0;
+// Looks up a char array or pointer that holds an address
+static struct Symbol *find_storage(struct SymbolTable *t, const char *name) {
+   struct Symbol *s = find(t, name);
+   if (!s || (s->type != TYPE_CHAR_ARRAY && s->type != TYPE_CHAR_PTR)) {
+      fprintf(bt_err(), "Error: '%s' is not a char array or pointer.\n", name);
+      return NULL;
+   }
+   if (!s->initialized) {
+      fprintf(bt_err(), "Error: Pointer '%s' is used before it is assigned.\n", name);
+      return NULL;
+   }
+   return s;
+}
+
+// Pointer values: the name of an array or pointer, malloc(<expr>), or 0 for NULL.
+// A pointer carries the length of the object it points to for bounds checks.
+static bool eval_pointer(Token **tokens, struct SymbolTable *t, long *addr, size_t *len) {
+   Token *tok = *tokens;
+   if (tok->type == TOKEN_IDENTIFIER && strcmp(tok->value, "malloc") == 0 && is_punct(tok + 1, "(")) {
+      (*tokens) += 2;
+      long size = 0;
+      if (!eval_int_at(tokens, t, &size)) return false;
+      if (!is_punct(*tokens, ")")) {
+         fprintf(err_at(*tokens), "Error: Expected ')' after malloc size but found '%s'.\n", (*tokens)->value);
+         return false;
       }
       (*tokens)++; // consume ')'
-      return inner;
+      if (size < 0) {
+         fprintf(bt_err(), "Error: malloc() of a negative size (%ld).\n", size);
+         return false;
+      }
+      *addr = (long)mem_heap_alloc((size_t)size);
+      *len = (size_t)size;
+      return *addr != 0;
    }
-
-   if ((*tokens)->type == TOKEN_NUMBER) {
-      long v = strtol((*tokens)->value, NULL, 10);
+   if (tok->type == TOKEN_IDENTIFIER) {
+      struct Symbol *s = find_storage(t, tok->value);
+      if (!s) return false;
+      *addr = s->address;
+      *len = s->array_len;
       (*tokens)++;
-      *ok = 1;
-      return v;
-   }
-   if ((*tokens)->type == TOKEN_IDENTIFIER) {
-      struct Symbol *s = find(t, (*tokens)->value);
-      if (s && s->type == TYPE_INT && s->initialized) {
-         long v = s->value_int;
-         (*tokens)++;
-         *ok = 1;
-         return v;
-      } else {
-         fprintf(stderr, "Error: Undefined or uninitialized identifier '%s' in expression.\n", (*tokens)->value);
-         *ok = 0;
-         return 0;
-      }
+      return true;
    }
-   fprintf(stderr, "Error: Expected number or identifier in expression but found '%s'.\n", (*tokens)->value);
-   *ok = 0;
-   return 0;
-}
-
-static long parse_int_term(Token **tokens, struct SymbolTable *t, int *ok) {
-   long value = parse_int_factor(tokens, t, ok);
-   if (!*ok) return 0;
-   while ((*tokens)->type == TOKEN_OPERATOR &&
-          (strcmp((*tokens)->value, "*") == 0 || strcmp((*tokens)->value, "/") == 0)) {
-      char op = (*tokens)->value[0];
-      (*tokens)++; // consume '*' or '/'
-      long rhs = parse_int_factor(tokens, t, ok);
-      if (!*ok) return 0;
-      if (op == '*') {
-         value *= rhs;
-      } else {
-         if (rhs == 0) {
-            fprintf(stderr, "Error: Division by zero.\n");
-            *ok = 0;
-            return 0;
-         }
-         value /= rhs; // integer division
-      }
+   if (tok->type == TOKEN_NUMBER && strcmp(tok->value, "0") == 0) {
+      *addr = 0;
+      *len = 0;
+      (*tokens)++;
+      return true;
    }
-   return value;
+   fprintf(err_at(tok), "Error: Expected an array, pointer or malloc(...) but found '%s'.\n", tok->value);
+   return false;
 }
 
-static long parse_int_expression(Token **tokens, struct SymbolTable *t, int *ok) {
-   long value = parse_int_term(tokens, t, ok);
-   if (!*ok) return 0;
-   while ((*tokens)->type == TOKEN_OPERATOR &&
-          (strcmp((*tokens)->value, "+") == 0 || strcmp((*tokens)->value, "-") == 0)) {
-      char op = (*tokens)->value[0];
-      (*tokens)++; // consume '+' or '-'
-      long rhs = parse_int_term(tokens, t, ok);
-      if (!*ok) return 0;
-      value = (op == '+') ? (value + rhs) : (value - rhs);
+// name '[' index ']' '=' value ';' — stores one char, bounds-checked
+static void parse_element_assignment(Token **tokens, struct SymbolTable *t, const char *name) {
+   struct Symbol *s = find_storage(t, name);
+   if (!s) return;
+   (*tokens)++; // consume '['
+   long index = 0, value = 0;
+   if (!eval_int_at(tokens, t, &index)) return;
+   if (!is_punct(*tokens, "]")) {
+      fprintf(err_at(*tokens), "Error: Expected ']' after index of '%s' but found '%s'.\n", name, (*tokens)->value);
+      return;
+   }
+   (*tokens)++; // consume ']'
+   if (!((*tokens)->type == TOKEN_OPERATOR && strcmp((*tokens)->value, "=") == 0)) {
+      fprintf(err_at(*tokens), "Error: Expected '=' after '%s[...]'.\n", name);
+      return;
+   }
+   (*tokens)++; // consume '='
+   if (!eval_int_at(tokens, t, &value)) return;
+   if (!is_punct(*tokens, ";")) {
+      fprintf(err_at(*tokens), "Error: Expected a semicolon after assignment to '%s'.\n", name);
+      return;
+   }
+   MemStatus st = mem_store((MemAddr)s->address, s->array_len, index, (char)value);
+   mem_report(st, name, index, s->array_len);
+   if (st == MEM_OK) emit_assign(t, name);
+}
+
+// free '(' pointer ')' — returns a malloc() block to the heap
+static void parse_free(Token **tokens, struct SymbolTable *t) {
+   (*tokens) += 2; // consume 'free' '('
+   if ((*tokens)->type != TOKEN_IDENTIFIER) {
+      fprintf(err_at(*tokens), "Error: Expected a pointer in free() but found '%s'.\n", (*tokens)->value);
+      return;
+   }
+   const char *name = (*tokens)->value;
+   struct Symbol *s = find_storage(t, name);
+   if (!s) return;
+   (*tokens)++;
+   if (!is_punct(*tokens, ")")) {
+      fprintf(err_at(*tokens), "Error: Expected ')' after free argument but found '%s'.\n", (*tokens)->value);
+      return;
+   }
+   (*tokens)++; // consume ')'
+   if (!is_punct(*tokens, ";")) {
+      fprintf(err_at(*tokens), "Error: Expected ';' after free().\n");
+      return;
+   }
+   // free(NULL) is a no-op, as in C
+   if (s->address != 0 && !mem_heap_free((MemAddr)s->address)) {
+      fprintf(bt_err(), "Error: free() of '%s', which does not point to a live malloc() block.\n", name);
    }
-   return value;
 }
 
 static void parse_assignment(Token **tokens, struct SymbolTable *t) {
@@ -217,24 +938,38 @@ static void parse_assignment(Token **tokens, struct SymbolTable *t) {
    const char *lhs_name = (*tokens)->value;
    (*tokens)++; // consume identifier
 
+   if (is_punct(*tokens, "[")) {
+      parse_element_assignment(tokens, t, lhs_name);
+      return;
+   }
    if (!((*tokens)->type == TOKEN_OPERATOR && strcmp((*tokens)->value, "=") == 0)) {
-      fprintf(stderr, "Error: Expected '=' after identifier '%s'.\n", lhs_name);
+      fprintf(err_at(*tokens), "Error: Expected '=' after identifier '%s'.\n", lhs_name);
       return;
    }
    (*tokens)++; // consume '='
 
-   int ok = 0;
-   long result = parse_int_expression(tokens, t, &ok);
-   if (!ok) return;
-
-   // Do not consume ';' here; leave it for the caller pattern
-   if (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, ";") == 0)) {
-      fprintf(stderr, "Error: Expected a semicolon after assignment to '%s'.\n", lhs_name);
+   struct Symbol *lhs = find(t, lhs_name);
+   if (lhs && lhs->type == TYPE_CHAR_ARRAY) {
+      fprintf(bt_err(), "Error: Cannot assign to array '%s'.\n", lhs_name);
+      return;
+   }
+   if (lhs && lhs->type == TYPE_CHAR_PTR) {
+      long addr = 0;
+      size_t len = 0;
+      if (!eval_pointer(tokens, t, &addr, &len)) return;
+      if (!is_punct(*tokens, ";")) {
+         fprintf(err_at(*tokens), "Error: Expected a semicolon after assignment to '%s'.\n", lhs_name);
+         return;
+      }
+      if (add(t, lhs_name, TYPE_CHAR_PTR, &addr, len)) emit_assign(t, lhs_name);
       return;
    }
 
-   // Ensure symbol exists as int; create if absent
-   add(t, lhs_name, TYPE_INT, &result, 0);
+   // The value is converted to the declared type of the target; an undeclared
+   // target takes the type of the expression
+   ExprType target = EXPR_INT;
+   int want = lhs && expr_type_of(lhs->type, &target) ? (int)target : WANT_NATURAL;
+   assign_expr(tokens, t, want, lhs_name, true);
 }
 
 static bool parse_optional_initializer(Token **tokens, VarType type, struct SymbolTable *t, const char *var_name) {
@@ -242,176 +977,697 @@ static bool parse_optional_initializer(Token **tokens, VarType type, struct Symb
       return false; // no initializer
    }
    (*tokens)++; // consume '='
-   if (type == TYPE_INT) {
-      int ok = 0;
-      long result = parse_int_expression(tokens, t, &ok);
-      if (!ok) return false;
-      add(t, var_name, TYPE_INT, &result, 0);
+   ExprType target;
+   if (expr_type_of(type, &target)) return assign_expr(tokens, t, (int)target, var_name, false);
+   if (type == TYPE_CHAR_PTR) {
+      long addr = 0;
+      size_t len = 0;
+      if (!eval_pointer(tokens, t, &addr, &len)) return false;
+      if (!add(t, var_name, TYPE_CHAR_PTR, &addr, len)) return false;
+      emit_assign(t, var_name);
       return true;
    }
-   // For non-int initializers, skip for now
+   fprintf(bt_err(), "Error: Char arrays cannot be initialized yet ('%s').\n", var_name);
    return false;
 }
 
-// Relational: lhs (op rhs)?  with op in >, <, >=, <=, ==, !=
-static long parse_relational(Token **tokens, struct SymbolTable *t, int *ok) {
-   long lhs = parse_int_expression(tokens, t, ok);
-   if (!*ok) return 0;
-   if ((*tokens)->type == TOKEN_OPERATOR &&
-       (strcmp((*tokens)->value, ">") == 0 || strcmp((*tokens)->value, "<") == 0 ||
-        strcmp((*tokens)->value, ">=") == 0 || strcmp((*tokens)->value, "<=") == 0 ||
-        strcmp((*tokens)->value, "==") == 0 || strcmp((*tokens)->value, "!=") == 0)) {
-      const char *op = (*tokens)->value;
-      (*tokens)++;
-      long rhs = parse_int_expression(tokens, t, ok);
-      if (!*ok) return 0;
-      if (strcmp(op, ">") == 0) return lhs > rhs;
-      if (strcmp(op, "<") == 0) return lhs < rhs;
-      if (strcmp(op, ">=") == 0) return lhs >= rhs;
-      if (strcmp(op, "<=") == 0) return lhs <= rhs;
-      if (strcmp(op, "==") == 0) return lhs == rhs;
-      if (strcmp(op, "!=") == 0) return lhs != rhs;
+// p is a '{'; the lexer matched it
+static Token *find_matching_brace(Token *p) {
+   return p + p->match;
+}
+
+static char *stringify_while(Token *start) {
+   // start at 'while', capture until matching '}'
+   Token *p = start;
+   while (!is_punct(p, "{") && p->type != TOKEN_END_OF_FILE) p++;
+   StrBuf text = SB_INIT;
+   if (p->type == TOKEN_END_OF_FILE) sb_puts(&text, "while ...");
+   else join_tokens(&text, start, find_matching_brace(p), true);
+   return sb_take(&text);
+}
+
+// --------- Closed-form loops (affine.c) ---------
+static _Thread_local bool g_loop_summary = false;
+
+void set_loop_summary(bool enabled) {
+   g_loop_summary = enabled;
+}
+
+// A loop finishing from its closed form, and the statements whose rows it replays
+typedef struct {
+   AffineLoop l;
+   Token *stmts[AFFINE_MAX_STMTS];
+   unsigned long trips; // iterations left
+   size_t next;         // statement of the current iteration replayed next
+} ClosedLoop;
+
+// Sets up the remaining iterations of a loop whose test just held to run from its closed form
+// instead of interpreting the body. The body ran once already, so its expressions are compiled
+// and cached. Returns NULL, with nothing executed, when the loop is not affine (see affine.h).
+static ClosedLoop *closed_loop_start(Token *cond_start, Token *body_start, struct SymbolTable *t, unsigned long *iteration) {
+   Token *end;
+   const Expr *cond = expr_cached(cond_start, t, WANT_CONDITION, &end);
+   ClosedLoop *c = (ClosedLoop *)prof_malloc(sizeof(ClosedLoop));
+   if (!c) return NULL;
+   AffineLoop *l = &c->l;
+   bool ok = affine_loop_init(l, cond);
+   Token *bp = body_start;
+   // Every statement must be `<int variable> = <int expression>;`
+   while (ok && !is_punct(bp, "}")) {
+      struct Symbol *target = bp->type == TOKEN_IDENTIFIER ? find(t, bp->value) : NULL;
+      const Expr *value = NULL;
+      if (target && target->type == TYPE_INT && (bp + 1)->type == TOKEN_OPERATOR &&
+          strcmp((bp + 1)->value, "=") == 0) {
+         value = expr_cached(bp + 2, t, EXPR_INT, &end);
+      }
+      ok = value && is_punct(end, ";") && l->nstmts < AFFINE_MAX_STMTS;
+      if (ok) {
+         c->stmts[l->nstmts] = bp;
+         ok = affine_loop_add(l, (int)(target - t->items), value);
+      }
+      bp = ok ? end + 1 : bp;
    }
-   return lhs; // truthy if nonzero
+   unsigned long trips = 0;
+   if (!ok || l->nstmts == 0 || !affine_loop_trips(l, t, &trips) || trips == 0 ||
+       trips > (ULONG_MAX - g_budget.steps) / l->nstmts) {
+      free(c);
+      return NULL;
+   }
+
+   // --loop-summary: one row stands for every iteration but the last, as long as the
+   // budgets cover the whole loop (otherwise it is replayed and truncated as usual)
+   bool fits = (!g_limits.max_iterations || g_budget.iterations + trips <= g_limits.max_iterations) &&
+               (!g_limits.max_steps || g_budget.steps + trips * l->nstmts <= g_limits.max_steps);
+   if (g_loop_summary && trips > 2 && fits) {
+      unsigned long skip = trips - 1;
+      affine_loop_advance(l, t, skip);
+      g_budget.iterations += skip;
+      g_budget.steps += skip * l->nstmts;
+      if (g_observer.step) {
+         StrBuf cmd = SB_INIT;
+         sb_append(&cmd, "iter ", 5);
+         sb_long(&cmd, (long)*iteration);
+         sb_append(&cmd, "..", 2);
+         sb_long(&cmd, (long)(*iteration + skip - 1));
+         sb_append(&cmd, ": ", 2);
+         sb_long(&cmd, (long)skip);
+         sb_puts(&cmd, " iterations in closed form");
+         emit_step(cmd.data, 0, t);
+         sb_free(&cmd);
+      }
+      *iteration += skip;
+      trips = 1;
+   }
+   c->trips = trips;
+   c->next = 0;
+   return c;
 }
 
-static Token *find_matching_brace(Token *p) {
-   int depth = 0;
-   while (!(p->type == TOKEN_END_OF_FILE)) {
-      if (p->type == TOKEN_PUNCTUATION && strcmp(p->value, "{") == 0) depth++;
-      else if (p->type == TOKEN_PUNCTUATION && strcmp(p->value, "}") == 0) {
-         depth--;
-         if (depth == 0) return p;
+// Replays the next statement with the same budget checks and row as the interpreter, without
+// evaluating anything; false once the loop is over
+static bool closed_loop_step(ClosedLoop *c, struct SymbolTable *t, unsigned long *iteration) {
+   if (c->next == 0 && (c->trips == 0 || g_budget.halted || !budget_iteration())) return false;
+   if (!budget_step()) return false;
+   if (c->next == 0) emit_iteration(*iteration);
+   Token *stmt = c->stmts[c->next];
+   bt_set_location(stmt->line, stmt->column);
+   affine_loop_step(&c->l, c->next, t);
+   emit_assign(t, stmt->value);
+   statement_done(stmt, *iteration, t);
+   if (g_budget.halted) return false;
+   if (++c->next == c->l.nstmts) {
+      c->next = 0;
+      c->trips--;
+      (*iteration)++;
+   }
+   return true;
+}
+
+// Registers a top-level definition; its body runs when the function is called
+static void parse_function(Token **tokens, struct SymbolTable *t) {
+   (void)t;
+   Token *start = *tokens;
+   if (func_define(tokens)) return;
+   // Skip the rest of a malformed definition: up to the end of its body, or of the statement
+   *tokens = start;
+   while (!is_punct(*tokens, "{") && !is_punct(*tokens, ";") && (*tokens)->type != TOKEN_END_OF_FILE) (*tokens)++;
+   if (is_punct(*tokens, "{")) *tokens = find_matching_brace(*tokens);
+}
+
+// --------- Continuation ---------
+// The program runs on an explicit stack of frames rather than on the C stack: the top level,
+// each running while loop and each function call. A step runs one statement, one loop test,
+// one replayed statement of a closed-form loop, or enters or leaves a call, so execution can
+// stop after any step and resume later (see ExecSession).
+//
+// Calls happen inside expressions, which are not resumable. A statement that reaches a call
+// that has not run yet stops there; the call runs in its own frame, and then the statement runs
+// again from its start, its calls answered from the recorded results, until it completes. Only
+// the complete run stores anything or adds a row.
+typedef enum { FRAME_TOP, FRAME_WHILE, FRAME_CALL } FrameKind;
+typedef enum { WHILE_START, WHILE_BODY, WHILE_TEST, WHILE_CLOSED } WhileState;
+
+typedef struct {
+   ExprValue value;
+   bool ok;                    // false when the call failed (and was reported)
+} CallResult;
+
+typedef struct {
+   FrameKind kind;
+   Token *pc;                  // next statement; a loop's 'while' until its body starts
+   // The statement or loop test at pc waits for a call; results holds the calls it made so far
+   bool waiting;
+   CallResult *results;
+   size_t result_count, result_cap;
+   StmtProfile *stmt_sp;       // --stmt-profile entry of the waiting statement
+   unsigned long long stmt_t0;
+
+   // FRAME_WHILE
+   WhileState state;
+   Token *cond, *body, *end;   // condition, first body token and the closing '}'
+   unsigned long iteration;
+   unsigned long errors;       // bt_err_count() when the loop started
+   StmtProfile *sp;
+   unsigned long long t0;
+   long outer_loop;
+   ClosedLoop *closed;
+
+   // FRAME_CALL
+   int func;
+   int caller;                 // function of the frames below, -1 at top level
+   int line, column;           // location of the calling statement
+} Frame;
+
+typedef struct {
+   Frame *frames;              // frames[0] is the top level
+   int depth, cap;
+   bool main_called;
+   bool boundary;              // the last step finished a top-level statement
+} Machine;
+
+static _Thread_local Machine g_machine;
+
+// The statement being run: the call results it replays, and the call it stopped at
+typedef struct {
+   const CallResult *results;
+   size_t count, next;
+   bool again;                 // it ran before, up to a call
+   bool requested;             // it stopped at a call that has not run
+   int func;
+   ExprValue args[FUNC_MAX_PARAMS];
+} CallState;
+
+static _Thread_local CallState g_call;
+
+static void exec_statement(Token **tokens, struct SymbolTable *t);
+
+static bool is_keyword(const Token *tok, const char *k) {
+   return tok->type == TOKEN_KEYWORD && strcmp(tok->value, k) == 0;
+}
+
+// Stops the execution when the interpreter cannot allocate its own state
+static void machine_out_of_memory(void) {
+   fprintf(bt_err(), "Error: Out of memory.\n");
+   g_budget.halted = true;
+   snprintf(g_budget.reason, sizeof(g_budget.reason), "out of memory");
+}
+
+static Frame *frame_top(void) {
+   return &g_machine.frames[g_machine.depth - 1];
+}
+
+// Pushes an empty frame; NULL when out of memory. Pointers to other frames become invalid.
+static Frame *frame_push(FrameKind kind, Token *pc) {
+   if (g_machine.depth == g_machine.cap) {
+      int cap = g_machine.cap ? g_machine.cap * 2 : 16;
+      Frame *frames = (Frame *)prof_realloc(g_machine.frames, sizeof(Frame) * (size_t)cap);
+      if (!frames) return NULL;
+      g_machine.frames = frames;
+      g_machine.cap = cap;
+   }
+   Frame *f = &g_machine.frames[g_machine.depth++];
+   memset(f, 0, sizeof(*f));
+   f->kind = kind;
+   f->pc = pc;
+   return f;
+}
+
+static void frame_pop(void) {
+   Frame *f = frame_top();
+   free(f->results);
+   free(f->closed);
+   g_machine.depth--;
+}
+
+// Moves past the statement that just finished (its ';' or '}'); a statement cut short by the
+// end of input stops on EOF
+static void frame_advance(Frame *f) {
+   if (f->pc->type != TOKEN_END_OF_FILE) f->pc++;
+   if (f->kind == FRAME_TOP) g_machine.boundary = true;
+}
+
+static void machine_start(Token *tokens) {
+   g_machine.depth = 0;
+   g_machine.main_called = g_machine.boundary = false;
+   memset(&g_call, 0, sizeof(g_call));
+   if (!frame_push(FRAME_TOP, tokens)) machine_out_of_memory();
+}
+
+// Drops the frames left by a budget stop: statements and loops they held are charged to the
+// statement profile, and calls are closed, as if they had returned
+static void machine_release(struct SymbolTable *t) {
+   while (g_machine.depth > 0) {
+      Frame *f = frame_top();
+      if (f->waiting) sprof_end(f->stmt_sp, f->stmt_t0);
+      if (f->kind == FRAME_WHILE) {
+         g_sprof.loop = f->outer_loop;
+         sprof_end(f->sp, f->t0);
+      } else if (f->kind == FRAME_CALL) {
+         g_return.func = f->caller;
+         emit_scope_exit(func_token(func_get(f->func)->name)->value);
+         stack_call_exit(t);
       }
-      p++;
+      frame_pop();
    }
-   return p;
+   g_return.returning = g_return.has_value = false;
+   free(g_machine.frames);
+   memset(&g_machine, 0, sizeof(g_machine));
 }
 
-static char *stringify_while(Token *start) {
-   // start at 'while', capture until matching '}'
-   Token *p = start;
-   // Find opening '{'
-   while (!(p->type == TOKEN_PUNCTUATION && strcmp(p->value, "{") == 0) && p->type != TOKEN_END_OF_FILE) p++;
-   if (p->type == TOKEN_END_OF_FILE) return dup_string("while ...");
-   Token *end = find_matching_brace(p);
-   // Build string from start to end inclusive
-   size_t cap = 512, len = 0;
-   char *buf = (char *)malloc(cap);
-   if (!buf) return NULL;
-   buf[0] = '\0';
-   Token *q = start;
-   bool prev_open = false;
-   while (q <= end) {
-      const char *tok = q->value;
-      bool is_p = (q->type == TOKEN_PUNCTUATION);
-      bool is_close = is_p && (strcmp(tok, ")") == 0 || strcmp(tok, "]") == 0 || strcmp(tok, "}") == 0);
-      bool is_open = is_p && (strcmp(tok, "(") == 0 || strcmp(tok, "[") == 0 || strcmp(tok, "{") == 0);
-      size_t tok_len = strlen(tok);
-      size_t add_space = (len > 0 && !is_close && !prev_open) ? 1 : 0;
-      if (len + add_space + tok_len + 2 > cap) {
-         cap *= 2;
-         char *tmp = (char *)realloc(buf, cap);
-         if (!tmp) { free(buf); return NULL; }
-         buf = tmp;
+// --------- Function calls ---------
+static unsigned long call_depth_limit(void) {
+   unsigned long limit = g_limits.max_call_depth;
+   return limit == 0 || limit > CALL_MAX_DEPTH ? CALL_MAX_DEPTH : limit;
+}
+
+// "call name(1, 2.5)"
+static void format_call(StrBuf *out, const Function *f, const char *name, const ExprValue *args) {
+   sb_append(out, "call ", 5);
+   sb_puts(out, name);
+   sb_putc(out, '(');
+   for (int i = 0; i < f->param_count; i++) {
+      if (i > 0) sb_append(out, ", ", 2);
+      if (f->params[i] == EXPR_INT) sb_long(out, args[i].i);
+      else sb_double(out, args[i].d);
+   }
+   sb_putc(out, ')');
+}
+
+bool call_function(int index, const ExprValue *args, struct SymbolTable *t, ExprValue *result) {
+   (void)t;
+   if (g_call.next < g_call.count) {
+      const CallResult *r = &g_call.results[g_call.next++];
+      *result = r->value;
+      return r->ok;
+   }
+   // Not run yet: the statement stops here (its evaluation fails without a diagnostic)
+   if (!g_call.requested) {
+      g_call.requested = true;
+      g_call.func = index;
+      memcpy(g_call.args, args, sizeof(ExprValue) * (size_t)func_get(index)->param_count);
+   }
+   return false;
+}
+
+static void replay_begin(const Frame *f) {
+   g_call.results = f->results;
+   g_call.count = f->result_count;
+   g_call.next = 0;
+   g_call.again = f->waiting;
+   g_call.requested = false;
+}
+
+// Ends a run of f's statement or loop test; true when it stopped at a call, which then runs
+static bool replay_end(Frame *f) {
+   g_call.results = NULL;
+   g_call.count = 0;
+   g_call.again = false;
+   f->waiting = g_call.requested;
+   if (!f->waiting) f->result_count = 0;
+   return f->waiting;
+}
+
+// Hands a call's result to the statement waiting for it, which runs again in the next step
+static void call_deliver(CallResult r) {
+   if (g_machine.depth == 0) return;
+   Frame *f = frame_top();
+   if (!f->waiting) return; // main(), which no statement called
+   if (f->result_count == f->result_cap) {
+      size_t cap = f->result_cap ? f->result_cap * 2 : 4;
+      CallResult *tmp = (CallResult *)prof_realloc(f->results, sizeof(CallResult) * cap);
+      if (!tmp) {
+         machine_out_of_memory();
+         return;
       }
-      if (add_space) buf[len++] = ' ';
-      memcpy(buf + len, tok, tok_len);
-      len += tok_len;
-      buf[len] = '\0';
-      prev_open = is_open;
-      q++;
+      f->results = tmp;
+      f->result_cap = cap;
    }
-   return buf;
+   f->results[f->result_count++] = r;
 }
 
-static void parse_while(Token **tokens, struct SymbolTable *t) {
-   // consume 'while'
-   (*tokens)++;
-   if (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, "(") == 0)) {
-      fprintf(stderr, "Error: Expected '(' after while.\n");
+// Starts the call the last step stopped at: a new activation with the parameters bound and the
+// "call" row; the body runs in the following steps
+static void call_enter(struct SymbolTable *t) {
+   static const VarType var_types[] = { [EXPR_INT] = TYPE_INT, [EXPR_FLOAT] = TYPE_FLOAT, [EXPR_DOUBLE] = TYPE_DOUBLE };
+   int index = g_call.func;
+   const Function *fn = func_get(index);
+   const char *name = func_token(fn->name)->value;
+   const CallResult failed = { .ok = false };
+   if ((unsigned long)stack_call_depth() >= call_depth_limit()) {
+      fprintf(bt_err(), "Error: Calling '%s' exceeds the maximum call depth of %lu.\n", name, call_depth_limit());
+      call_deliver(failed);
+      return;
+   }
+   Frame *f = frame_push(FRAME_CALL, func_token(fn->body));
+   if (!f || !stack_call_enter(t, name)) {
+      if (f) frame_pop();
+      fprintf(bt_err(), "Error: Out of memory calling '%s'.\n", name);
+      call_deliver(failed);
       return;
    }
-   (*tokens)++; // after '('
-   Token *cond_start = *tokens;
-   // Scan ahead to find ')' from cond_start without consuming main pointer
-   int ok = 0;
-   Token *tmp = cond_start;
-   long cond = parse_relational(&tmp, t, &ok);
-   if (!ok) return;
-   if (!(tmp->type == TOKEN_PUNCTUATION && strcmp(tmp->value, ")") == 0)) {
-      fprintf(stderr, "Error: Expected ')' after while condition.\n");
+   f->func = index;
+   f->caller = g_return.func;
+   g_return.func = index;
+   bt_get_location(&f->line, &f->column);
+   emit_scope_enter(name);
+
+   // Parameters are the first locals of the activation
+   for (int i = 0; i < fn->param_count; i++) {
+      const char *param = func_token(fn->param_names[i])->value;
+      const ExprValue *arg = &g_call.args[i];
+      declare(t, param, var_types[fn->params[i]], fn->params[i] == EXPR_INT ? (void *)&arg->i : (void *)&arg->d, 0);
+      stack_on_declare(t, param);
+      emit_declare(t, param);
+   }
+   if (g_observer.step) {
+      StrBuf cmd = SB_INIT;
+      format_call(&cmd, fn, name, g_call.args);
+      emit_step(cmd.data, 0, t);
+      sb_free(&cmd);
+   }
+}
+
+// Ends the running call, after a return statement or at the end of its body
+static void call_return(struct SymbolTable *t) {
+   Frame *f = frame_top();
+   const Function *fn = func_get(f->func);
+   bool returned = g_return.returning, has_value = g_return.has_value;
+   CallResult r = { has_value ? g_return.value : (ExprValue){ .i = 0 }, true };
+   g_return.func = f->caller;
+   g_return.returning = g_return.has_value = false;
+   emit_scope_exit(func_token(fn->name)->value);
+   stack_call_exit(t);
+   bt_set_location(f->line, f->column);
+   if (fn->returns_value && !has_value) {
+      // A failed return expression was reported already
+      if (!returned) {
+         fprintf(bt_err(), "Error: Function '%s' ended without returning a value.\n", func_token(fn->name)->value);
+      }
+      r.ok = false;
+   }
+   frame_pop();
+   call_deliver(r);
+}
+
+// --------- Steps ---------
+// Runs the statement at f->pc (again, after a call it made returned) and leaves f->pc after
+// it; false when it stopped at a call
+static bool run_statement(Frame *f, struct SymbolTable *t) {
+   Token *start = f->pc;
+   if (!f->waiting) {
+      if (!budget_step()) return true;
+      f->stmt_sp = sprof_begin(start, &f->stmt_t0);
+   }
+   bt_set_location(start->line, start->column);
+   replay_begin(f);
+   exec_statement(&f->pc, t);
+   if (replay_end(f)) {
+      f->pc = start;
+      return false;
+   }
+   sprof_end(f->stmt_sp, f->stmt_t0);
+   return true;
+}
+
+// Evaluates the condition of loop f; 1 with *cond set, 0 after an error, -1 when it stopped at
+// a call. *end receives the token after the condition.
+static int run_test(Frame *f, struct SymbolTable *t, Token **end, long *cond) {
+   *end = f->cond;
+   replay_begin(f);
+   bool ok = eval_condition(end, t, cond);
+   if (replay_end(f)) return -1;
+   return ok;
+}
+
+// Starts the loop at `start`; the enclosing frame stays on its 'while' until the loop ends
+static void while_push(Token *start) {
+   unsigned long long t0 = 0;
+   StmtProfile *sp = sprof_begin(start, &t0);
+   Frame *f = frame_push(FRAME_WHILE, start);
+   if (!f) {
+      machine_out_of_memory();
+      return;
+   }
+   f->state = WHILE_START;
+   f->sp = sp;
+   f->t0 = t0;
+   f->outer_loop = g_sprof.loop;
+   if (sp) g_sprof.loop = sp - g_sprof.entries;
+}
+
+static void while_pop(void) {
+   Frame *f = frame_top();
+   g_sprof.loop = f->outer_loop;
+   sprof_end(f->sp, f->t0);
+   frame_pop();
+}
+
+// Ends the loop; the enclosing frame continues after `resume` (the closing '}', or wherever an
+// error stopped the loop)
+static void while_finish(Token *resume) {
+   while_pop();
+   Frame *parent = frame_top();
+   parent->pc = resume;
+   frame_advance(parent);
+}
+
+// Starts another iteration if the test held and the budgets allow it
+static void while_iterate(Frame *f, long cond) {
+   if (cond && budget_iteration()) {
+      if (f->sp) f->sp->iterations++;
+      emit_iteration(f->iteration);
+      f->pc = f->body;
+      f->state = WHILE_BODY;
+   } else {
+      while_finish(f->end);
+   }
+}
+
+// A return statement leaves the loops it is in, then the call
+static void call_unwind(struct SymbolTable *t) {
+   while (frame_top()->kind == FRAME_WHILE) while_pop();
+   call_return(t);
+}
+
+// Runs the statement at f->pc of a loop or function body; its row is labeled with the
+// iteration when that is non-zero
+static void step_body(Frame *f, struct SymbolTable *t, unsigned long iteration) {
+   Token *start = f->pc;
+   if (is_keyword(start, "while")) {
+      // The loop adds the rows of its body; there is no row for the while itself
+      if (!budget_step()) return;
+      bt_set_location(start->line, start->column);
+      while_push(start);
       return;
    }
-   tmp++; // token after ')'
-   if (!(tmp->type == TOKEN_PUNCTUATION && strcmp(tmp->value, "{") == 0)) {
-      fprintf(stderr, "Error: Expected '{' to start while body.\n");
+   if (!run_statement(f, t) || g_budget.halted) return;
+   statement_done(start, iteration, t);
+   if (g_return.returning) {
+      call_unwind(t);
       return;
    }
-   Token *body_start = tmp + 1;
-   Token *body_end = find_matching_brace(tmp);
-
-   // Execute loop
-   int iteration = 1;
-   while (cond) {
-      Token *bp = body_start;
-      while (!(bp->type == TOKEN_PUNCTUATION && strcmp(bp->value, "}") == 0)) {
-         Token *stmt_start = bp;
-         parse_statement(&bp, t);
-         // Build labeled command: "iter k: <stmt>"
-         char *stmt_str = stringify_statement(stmt_start);
-         char label[32];
-         snprintf(label, sizeof(label), "iter %d: ", iteration);
-         size_t total = strlen(label) + (stmt_str ? strlen(stmt_str) : 0) + 1;
-         char *combined = (char*)malloc(total);
-         if (combined) {
-            combined[0] = '\0';
-            strcat(combined, label);
-            if (stmt_str) strcat(combined, stmt_str);
-            append_row_with(combined, t);
-            free(combined);
+   frame_advance(f);
+}
+
+static void step_while(Frame *f, struct SymbolTable *t) {
+   Token *end;
+   long cond = 0;
+   int r;
+   switch (f->state) {
+      case WHILE_START:
+         if (!f->cond) {
+            if (!is_punct(f->pc + 1, "(")) {
+               fprintf(err_at(f->pc + 1), "Error: Expected '(' after while.\n");
+               while_finish(f->pc + 1);
+               return;
+            }
+            f->cond = f->pc + 2;
          }
-         free(stmt_str);
-         bp++; // move past ';' or inner '}'
-      }
-      // Re-evaluate condition
-      Token *cp = cond_start;
-      ok = 0;
-      cond = parse_relational(&cp, t, &ok);
-      if (!ok) break;
-      if (!(cp->type == TOKEN_PUNCTUATION && strcmp(cp->value, ")") == 0)) break;
-      iteration++;
+         r = run_test(f, t, &end, &cond);
+         if (r < 0) return;
+         if (r == 0) {
+            while_finish(f->cond);
+            return;
+         }
+         if (!is_punct(end, ")")) {
+            fprintf(err_at(end), "Error: Expected ')' after while condition.\n");
+            while_finish(f->cond);
+            return;
+         }
+         end++; // token after ')'
+         if (!is_punct(end, "{")) {
+            fprintf(err_at(end), "Error: Expected '{' to start while body.\n");
+            while_finish(f->cond);
+            return;
+         }
+         f->body = end + 1;
+         f->end = find_matching_brace(end);
+         f->iteration = 1;
+         f->errors = bt_err_count();
+         while_iterate(f, cond);
+         return;
+      case WHILE_BODY:
+         if (is_punct(f->pc, "}") || f->pc->type == TOKEN_END_OF_FILE) f->state = WHILE_TEST;
+         else step_body(f, t, f->iteration);
+         return;
+      case WHILE_TEST:
+         bt_set_location(f->cond->line, f->cond->column);
+         r = run_test(f, t, &end, &cond);
+         if (r < 0) return;
+         if (r == 0 || !is_punct(end, ")")) {
+            while_finish(f->end);
+            return;
+         }
+         f->iteration++;
+         // After one clean interpreted iteration, affine loops finish in closed form; profiles
+         // need every statement to run
+         if (f->iteration == 2 && cond && !g_sprof.entries && bt_err_count() == f->errors &&
+             (f->closed = closed_loop_start(f->cond, f->body, t, &f->iteration))) {
+            f->state = WHILE_CLOSED;
+            return;
+         }
+         while_iterate(f, cond);
+         return;
+      case WHILE_CLOSED:
+         if (!closed_loop_step(f->closed, t, &f->iteration)) while_finish(f->end);
+         return;
    }
+}
 
-   // Position main token pointer at body_end (the '}' token). Caller will increment.
-   *tokens = body_end;
+// After the top-level statements, a program that defines main() runs it, as in C
+static void top_finish(void) {
+   if (g_machine.main_called) {
+      frame_pop();
+      return;
+   }
+   g_machine.main_called = true;
+   int main_func = func_find("main");
+   if (main_func < 0) return;
+   const Function *f = func_get(main_func);
+   Token *name = func_token(f->name);
+   if (f->param_count > 0) {
+      fprintf(err_at(name), "Error: main() cannot take parameters here.\n");
+      return;
+   }
+   bt_set_location(name->line, name->column);
+   g_call.requested = true;
+   g_call.func = main_func;
 }
 
-static void parse_function(Token **tokens, struct SymbolTable *t) {
-   // Expect: keyword 'int' or 'void' etc., identifier, '(', ')', '{' ... '}'
-   // This is a minimal skipper that dives into body and parses statements
-   // Consume return type keyword if present
-   if ((*tokens)->type == TOKEN_KEYWORD) (*tokens)++;
-   // Function name
-   if ((*tokens)->type == TOKEN_IDENTIFIER) (*tokens)++;
-   // Params '('
-   if (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, "(") == 0)) return;
-   // Skip to ')'
-   while (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, ")") == 0) && (*tokens)->type != TOKEN_END_OF_FILE) {
-      (*tokens)++;
+static void step_top(Frame *f, struct SymbolTable *t) {
+   Token *start = f->pc;
+   if (start->type == TOKEN_END_OF_FILE) {
+      top_finish();
+      return;
    }
-   if ((*tokens)->type == TOKEN_PUNCTUATION) (*tokens)++; // consume ')'
-   if (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, "{") == 0)) return;
-   // Parse body with new scope
-   stack_enter_scope();
-   (*tokens)++; // into body
-   while (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, "}") == 0) && (*tokens)->type != TOKEN_END_OF_FILE) {
-      Token *stmt_start = *tokens;
-      parse_statement(tokens, t);
-      append_row_from_tokens(stmt_start, t);
-      (*tokens)++;
+   bt_set_location(start->line, start->column);
+   if (is_keyword(start, "while")) {
+      while_push(start);
+      return;
+   }
+   // A function definition looks like: <int|void|float|double> IDENT '('
+   if ((is_keyword(start, "int") || is_keyword(start, "void") || is_keyword(start, "float") ||
+        is_keyword(start, "double")) &&
+       (start + 1)->type == TOKEN_IDENTIFIER && is_punct(start + 2, "(")) {
+      parse_function(&f->pc, t); // definitions add no row
+      frame_advance(f);
+      return;
    }
-   stack_exit_scope(t);
+   if (!run_statement(f, t)) return;
+   statement_done(start, 0, t);
+   frame_advance(f);
+}
+
+// Runs one step; false once the program has finished or a budget stopped it
+static bool machine_step(struct SymbolTable *t) {
+   if (g_budget.halted || g_machine.depth == 0) return false;
+   g_machine.boundary = false;
+   Frame *f = frame_top();
+   switch (f->kind) {
+      case FRAME_TOP:
+         step_top(f, t);
+         break;
+      case FRAME_WHILE:
+         step_while(f, t);
+         break;
+      case FRAME_CALL:
+         if (is_punct(f->pc, "}") || f->pc->type == TOKEN_END_OF_FILE) call_return(t);
+         else step_body(f, t, 0);
+         break;
+   }
+   if (g_call.requested && !g_budget.halted) call_enter(t);
+   g_call.requested = false;
+   return !g_budget.halted && g_machine.depth > 0;
+}
+
+// name '(' args ')' ';' as a statement; the result, if any, is discarded
+static void parse_call(Token **tokens, struct SymbolTable *t) {
+   Expr *owned;
+   const Expr *e = expr_at(tokens, t, WANT_CALL, &owned);
+   long as_int;
+   double as_fp;
+   if (e && !is_punct(*tokens, ";")) {
+      fprintf(err_at(*tokens), "Error: Expected ';' after the call of '%s'.\n", e->name);
+   } else if (e) {
+      (void)eval_expr(e, t, &as_int, &as_fp);
+   }
+   expr_free(owned);
+}
+
+// return [expr] ';' — inside a function it ends the call with the value converted to the
+// return type (after an error, without a value); at top level the value is evaluated and dropped
+static void parse_return(Token **tokens, struct SymbolTable *t) {
+   (*tokens)++; // consume 'return'
+   const Function *f = g_return.func >= 0 ? func_get(g_return.func) : NULL;
+   const char *name = f ? func_token(f->name)->value : NULL;
+   bool ok = true, has_value = false;
+   ExprValue value = { .i = 0 };
+   if (f && !f->returns_value && !is_punct(*tokens, ";")) {
+      fprintf(err_at(*tokens), "Error: Function '%s' returns void but 'return' has a value.\n", name);
+      ok = false;
+   } else if (!is_punct(*tokens, ";")) {
+      Expr *owned;
+      const Expr *e = expr_at(tokens, t, f ? (int)f->ret : WANT_NATURAL, &owned);
+      double as_fp = 0.0;
+      has_value = ok = e && eval_expr(e, t, &value.i, &as_fp);
+      if (ok && e->type != EXPR_INT) value.d = as_fp;
+      expr_free(owned);
+      if (g_call.requested) return; // runs again once the call returned
+      if (ok && !is_punct(*tokens, ";")) {
+         fprintf(err_at(*tokens), "Error: Expected ';' after return.\n");
+         ok = has_value = false;
+      }
+   } else if (f && f->returns_value) {
+      fprintf(err_at(*tokens), "Error: Function '%s' must return a value.\n", name);
+   }
+   if (!f) {
+      // A top-level return adds no row
+      if (ok) g_return.at_top = true;
+      return;
+   }
+   g_return.returning = true;
+   g_return.has_value = has_value;
+   g_return.value = value;
 }
 
 void parse_declaration(Token **tokens, struct SymbolTable *t) {
@@ -420,7 +1676,7 @@ void parse_declaration(Token **tokens, struct SymbolTable *t) {
 
    // The lexer has already determined the token type, so we can check it directly instead of using strcmp on the value.
    if ((*tokens)->type != TOKEN_KEYWORD) {
-      fprintf(stderr, "Error: Expected a type keyword like 'int' but found '%s'.\n", (*tokens)->value);
+      fprintf(err_at(*tokens), "Error: Expected a type keyword like 'int' but found '%s'.\n", (*tokens)->value);
       return;
    }
 
@@ -445,13 +1701,13 @@ void parse_declaration(Token **tokens, struct SymbolTable *t) {
          // char[NUM]
          (*tokens)++; // consume '['
          if ((*tokens)->type != TOKEN_NUMBER) {
-            fprintf(stderr, "Error: Expected array length after '[' but found '%s'.\n", (*tokens)->value);
+            fprintf(err_at(*tokens), "Error: Expected array length after '[' but found '%s'.\n", (*tokens)->value);
             return;
          }
          array_len = (size_t)strtoul((*tokens)->value, NULL, 10);
          (*tokens)++; // consume number
          if (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, "]") == 0)) {
-            fprintf(stderr, "Error: Expected ']' after array length but found '%s'.\n", (*tokens)->value);
+            fprintf(err_at(*tokens), "Error: Expected ']' after array length but found '%s'.\n", (*tokens)->value);
             return;
          }
          (*tokens)++; // consume ']'
@@ -460,116 +1716,363 @@ void parse_declaration(Token **tokens, struct SymbolTable *t) {
          type = TYPE_CHAR_ARRAY; // unspecified length; kept as addr
       }
    } else {
-      fprintf(stderr, "Error: Unknown type '%s'.\n", (*tokens)->value);
+      fprintf(err_at(*tokens), "Error: Unknown type '%s'.\n", (*tokens)->value);
       return;
    }
 
    if ((*tokens)->type != TOKEN_IDENTIFIER) {
-      fprintf(stderr, "Error: Expected an identifier but found '%s'.\n", (*tokens)->value);
+      fprintf(err_at(*tokens), "Error: Expected an identifier but found '%s'.\n", (*tokens)->value);
       return;
    }
    
-   // Capture name then add symbol (uninitialized first)
+   // Capture name then add symbol (uninitialized first); a declaration run again after its
+   // initializer called a function declared it already
    const char *name = (*tokens)->value;
-   add(t, name, type, NULL, array_len);
-   stack_on_declare(t, name);
+   if (g_call.again) {
+      // nothing to declare
+   } else if (type == TYPE_CHAR_ARRAY) {
+      // Arrays get storage in the current stack frame; a bare `char c;` is one byte.
+      // Re-running the same declaration (e.g. in a loop body) keeps its storage.
+      if (array_len == 0) array_len = 1;
+      struct Symbol *old = find_local(t, name);
+      long addr = (old && old->type == TYPE_CHAR_ARRAY && old->initialized && old->array_len == array_len)
+                     ? old->address : (long)mem_stack_alloc(array_len);
+      declare(t, name, type, addr ? &addr : NULL, array_len);
+      stack_on_declare(t, name);
+      emit_declare(t, name);
+   } else {
+      declare(t, name, type, NULL, array_len);
+      stack_on_declare(t, name);
+      emit_declare(t, name);
+   }
 
    // Advance to possible initializer or semicolon
    (*tokens)++;
 
-   // Optional initializer for int declarations: int x = <expr>;
+   // Optional initializer for numeric declarations: double x = <expr>;
    parse_optional_initializer(tokens, type, t, name);
+   if (g_call.requested) return; // runs again once the call returned
 
    // Expect semicolon
    if (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, ";") == 0)) {
-      fprintf(stderr, "Error: Expected a semicolon but found '%s'.\n", (*tokens)->value);
+      fprintf(err_at(*tokens), "Error: Expected a semicolon but found '%s'.\n", (*tokens)->value);
       return;
    }
 }
 
-// The highest-level function that drives the parsing process.
-void parse_program(Token *tokens, struct SymbolTable *t) {
-    Token *current_token = tokens;
-    // Collect rows
-    size_t cap = 8, count = 0;
-    TableRow *rows = (TableRow *)malloc(sizeof(TableRow) * cap);
-    g_rows_ref = rows; g_rows_count = 0; g_rows_cap = cap;
-    
-    while (current_token->type != TOKEN_END_OF_FILE) {
-        Token *stmt_start = current_token;
-        char *cmd = NULL;
-        if (current_token->type == TOKEN_KEYWORD && strcmp(current_token->value, "while") == 0) {
-            // While rows are added per-iteration for body statements; do not add a header row
-            parse_while(&current_token, t);
-            cmd = NULL;
-        } else if (current_token->type == TOKEN_KEYWORD &&
-                   (strcmp(current_token->value, "int") == 0 || strcmp(current_token->value, "void") == 0)) {
-            // Heuristically treat as a function if it looks like: <kw> IDENT '('
-            Token *look = stmt_start + 1;
-            if (look->type == TOKEN_IDENTIFIER && (look+1)->type == TOKEN_PUNCTUATION && strcmp((look+1)->value, "(") == 0) {
-                parse_function(&current_token, t);
-                cmd = NULL; // no separate function row
-            } else {
-                parse_statement(&current_token, t);
-                cmd = stringify_statement(stmt_start);
-            }
-        } else {
-            parse_statement(&current_token, t);
-            // Build command string from tokens between stmt_start and ';'
-            cmd = stringify_statement(stmt_start);
+// Resets the per-run state and starts the machine at tokens; returns the number of tokens
+static size_t exec_begin(Token *tokens) {
+    size_t cap = 8;
+    g_rows_ref = (TableRow *)prof_malloc(sizeof(TableRow) * cap);
+    g_rows_count = 0;
+    g_rows_cap = g_rows_ref ? cap : 0;
+    budget_reset();
+    size_t token_count = 1;
+    while (tokens[token_count - 1].type != TOKEN_END_OF_FILE) token_count++;
+    sprof_reset(tokens, token_count);
+    exprs_reset(tokens, token_count);
+    texts_reset(tokens, token_count);
+    filter_reset();
+    func_reset(tokens);
+    g_return.func = -1;
+    g_return.returning = g_return.has_value = g_return.at_top = false;
+    machine_start(tokens);
+    return token_count;
+}
+
+// Executes the program and hands back the collected rows.
+TableRow *execute_program(Token *tokens, struct SymbolTable *t, size_t *row_count) {
+    size_t token_count = exec_begin(tokens);
+    unsigned long long started = g_sprof.entries ? sprof_now() : 0;
+
+    // Statement profiles need every statement to run, a trace filter keeps rows that a
+    // checkpoint could not replay, and other observers would miss the skipped events, so
+    // all of them disable checkpoints
+    bool checkpoints = g_checkpoints && !g_sprof.entries && !g_filter.enabled && observer_builds_rows();
+    Checkpoint *last_cp = NULL;
+    CacheKey prefix;
+    size_t hashed = 0;
+    unsigned long cp_steps = 0, errors = bt_err_count();
+    // Checkpoints are only shared by runs with the same budgets and trace options
+    struct { struct ExecLimits limits; bool loop_summary; } seed;
+    memset(&seed, 0, sizeof(seed));
+    seed.limits = g_limits;
+    seed.loop_summary = g_loop_summary;
+    if (checkpoints && g_machine.depth > 0) {
+        checkpoint_key_init(&prefix, &seed, sizeof(seed));
+        last_cp = checkpoint_find(tokens, token_count, &seed, sizeof(seed));
+        if (last_cp && resume_checkpoint(last_cp, t)) {
+            g_machine.frames[0].pc = tokens + last_cp->index;
+            cp_steps = g_budget.steps;
+            stream_rows(0);
+        } else if (last_cp) {
+            // Out of memory copying the rows: run from the start instead
+            checkpoint_release(last_cp);
+            last_cp = NULL;
         }
-        // Build binding snapshot
-        if (cmd) { append_row_with(cmd, t); free(cmd); }
-        current_token++; // Move to the next token
     }
 
-    // Sync locals with globals in case we reallocated
-    rows = g_rows_ref; count = g_rows_count; cap = g_rows_cap;
-    if (rows) {
-        print_table(rows, count);
-        // After the table, print the step-by-step stack diagrams
-        printf("\nStack evolution by step:\n\n");
-        for (size_t i = 0; i < count; i++) {
-            printf("Step %zu: %s\n", i + 1, rows[i].command);
-            if (rows[i].stack_diagram) {
-                printf("%s\n", rows[i].stack_diagram);
-            }
-        }
-        for (size_t i = 0; i < count; i++) {
-            free(rows[i].command);
-            free(rows[i].binding);
-            free(rows[i].stack);
-            free(rows[i].stack_diagram);
+    while (machine_step(t)) {
+        // Checkpoint at a top-level boundary if enough work ran since the last one
+        if (!g_machine.boundary || !checkpoints || g_budget.steps - cp_steps < CHECKPOINT_MIN_STEPS) continue;
+        if (bt_err_count() != errors) {
+            checkpoints = false; // state after a diagnostic is never reused
+            continue;
         }
-        free(rows);
+        size_t index = (size_t)(g_machine.frames[0].pc - tokens);
+        for (; hashed < index; hashed++) checkpoint_key_advance(&prefix, &tokens[hashed]);
+        last_cp = save_checkpoint(last_cp, &prefix, index, t);
+        cp_steps = g_budget.steps;
+    }
+    checkpoint_release(last_cp);
+    machine_release(t);
+    stream_end();
+
+    if (g_sprof.entries) g_sprof.total_ns = sprof_now() - started;
+    exprs_release();
+    texts_release();
+    bt_set_location(0, 0);
+
+    // Take ownership from the accumulator in case we reallocated
+    TableRow *rows = g_rows_ref;
+    *row_count = g_rows_count;
+    g_rows_ref = NULL; g_rows_count = 0; g_rows_cap = 0;
+    return rows;
+}
+
+// --------- Stepping sessions ---------
+// A session owns the interpreter state of one execution. Its steps run on whichever thread
+// calls them: the thread-local state is swapped with the session's on entry and back on exit.
+struct ExecSession {
+    struct SymbolTable table;
+    bool done;
+
+    TableRow *rows;
+    size_t row_count, row_cap;
+    ExecObserver observer; // always the table builder
+    int row_line;
+    bool hash_rows;
+    ReturnState ret;
+    struct ExecLimits limits;
+    BudgetState budget;
+    StmtProfileState sprof;
+    bool checkpoints, loop_summary;
+    FILE *row_stream;
+    unsigned long long stream_flushed;
+    ExprCache exprs;
+    TextCache texts;
+    Machine machine;
+    CallState call;
+    int line, column;
+    void *stack; // stack model and memory (stack_context_size() bytes)
+    void *funcs; // function table (func_context_size() bytes)
+    struct SymbolTable *final; // the table as of the last row (exec_session_keep_final), or NULL
+};
+
+#define SWAP(a, b) swap_bytes(&(a), &(b), sizeof(a))
+
+static void session_swap(ExecSession *s) {
+    SWAP(s->rows, g_rows_ref);
+    SWAP(s->row_count, g_rows_count);
+    SWAP(s->row_cap, g_rows_cap);
+    SWAP(s->observer, g_observer);
+    SWAP(s->row_line, g_row_line);
+    SWAP(s->hash_rows, g_hash_rows);
+    SWAP(s->final, g_final_table);
+    SWAP(s->ret, g_return);
+    SWAP(s->limits, g_limits);
+    SWAP(s->budget, g_budget);
+    SWAP(s->sprof, g_sprof);
+    SWAP(s->checkpoints, g_checkpoints);
+    SWAP(s->loop_summary, g_loop_summary);
+    SWAP(s->row_stream, g_row_stream);
+    SWAP(s->stream_flushed, g_stream_flushed);
+    SWAP(s->exprs, g_exprs);
+    SWAP(s->texts, g_texts);
+    SWAP(s->machine, g_machine);
+    SWAP(s->call, g_call);
+    int line, column;
+    bt_get_location(&line, &column);
+    bt_set_location(s->line, s->column);
+    s->line = line;
+    s->column = column;
+    stack_context_swap(s->stack);
+    func_context_swap(s->funcs);
+}
+
+ExecSession *exec_session_open(Token *tokens, const struct ExecLimits *limits, bool loop_summary) {
+    ExecSession *s = (ExecSession *)calloc(1, sizeof(ExecSession));
+    if (!s) return NULL;
+    s->stack = calloc(1, stack_context_size());
+    s->funcs = calloc(1, func_context_size());
+    if (!s->stack || !s->funcs) {
+        free(s->stack);
+        free(s->funcs);
+        free(s);
+        return NULL;
     }
+    if (limits) s->limits = *limits;
+    s->loop_summary = loop_summary;
+    s->ret.func = -1;
+    s->observer = g_table_builder;
+    s->sprof.last = s->sprof.loop = -1;
+    session_swap(s);
+    stack_reset();
+    exec_begin(tokens);
+    session_swap(s);
+    return s;
 }
 
-void parse_statement(Token **tokens, struct SymbolTable *t) {
+TableRow *exec_session_step(ExecSession *s, size_t max_rows, int line, size_t *row_count) {
+    session_swap(s);
+    // Time budgets count the time spent stepping, not the time between calls
+    clock_gettime(CLOCK_MONOTONIC, &g_budget.start);
+    while (!s->done && (max_rows == 0 || g_rows_count < max_rows)) {
+        size_t before = g_rows_count;
+        if (!machine_step(&s->table)) s->done = true;
+        if (line > 0 && g_rows_count > before && g_row_line == line) break;
+    }
+    TableRow *rows = g_rows_ref;
+    *row_count = g_rows_count;
+    size_t cap = 8;
+    g_rows_ref = (TableRow *)prof_malloc(sizeof(TableRow) * cap);
+    g_rows_count = 0;
+    g_rows_cap = g_rows_ref ? cap : 0;
+    if (!g_rows_ref && !s->done) machine_out_of_memory();
+    session_swap(s);
+    return rows;
+}
+
+void exec_session_hash_rows(ExecSession *s) {
+    s->hash_rows = true;
+}
+
+bool exec_session_bind_int(ExecSession *s, const char *name, long value) {
+    session_swap(s);
+    bool ok = add(&s->table, name, TYPE_INT, &value, 0);
+    session_swap(s);
+    if (ok && s->final) table_copy(s->final, &s->table);
+    return ok;
+}
+
+bool exec_session_keep_final(ExecSession *s) {
+    if (!s->final && !(s->final = (struct SymbolTable *)malloc(sizeof(struct SymbolTable)))) return false;
+    table_copy(s->final, &s->table);
+    return true;
+}
+
+const struct SymbolTable *exec_session_final_table(const ExecSession *s) {
+    return s->final ? s->final : &s->table;
+}
+
+const struct SymbolTable *exec_session_table(const ExecSession *s) {
+    return &s->table;
+}
+
+bool exec_session_done(const ExecSession *s) {
+    return s->done;
+}
+
+const char *exec_session_truncated(const ExecSession *s) {
+    return s->budget.halted ? s->budget.reason : NULL;
+}
+
+void exec_session_close(ExecSession *s) {
+    if (!s) return;
+    session_swap(s);
+    machine_release(&s->table);
+    exprs_release();
+    texts_release();
+    free(g_sprof.entries);
+    g_sprof.entries = NULL;
+    free_rows(g_rows_ref, g_rows_count);
+    g_rows_ref = NULL;
+    g_rows_count = g_rows_cap = 0;
+    stack_release();
+    session_swap(s);
+    free(s->stack);
+    free(s->funcs);
+    free(s->final);
+    free(s);
+}
+
+// A while loop is hot when it takes at least this share of the program's time
+#define HOT_LOOP_SHARE 0.25
+
+static bool sprof_inside(long idx, long loop) {
+   for (long o = g_sprof.entries[idx].owner; o >= 0; o = g_sprof.entries[o].owner) {
+      if (o == loop) return true;
+   }
+   return false;
+}
+
+void print_stmt_profile(FILE *out) {
+    if (!g_sprof.entries) return;
+    double total = g_sprof.total_ns ? (double)g_sprof.total_ns : 1.0;
+    // The hottest loop (and everything nested in it) is marked with '*'
+    long hot = -1;
+    for (size_t i = 0; i < g_sprof.token_count; i++) {
+        const StmtProfile *sp = &g_sprof.entries[i];
+        if (!sp->seen || sp->iterations == 0 || (double)sp->ns / total < HOT_LOOP_SHARE) continue;
+        if (hot < 0 || sp->ns > g_sprof.entries[hot].ns) hot = (long)i;
+    }
+    fprintf(out, "\nStatement profile (* = hot loop):\n");
+    fprintf(out, "  %10s %10s %6s %8s %5s  %s\n", "count", "time ms", "time%", "rows", "line", "statement");
+    for (size_t i = 0; i < g_sprof.token_count; i++) {
+        const StmtProfile *sp = &g_sprof.entries[i];
+        if (!sp->seen) continue;
+        Token *start = g_sprof.base + i;
+        bool is_while = start->type == TOKEN_KEYWORD && strcmp(start->value, "while") == 0;
+        char *text = is_while ? stringify_while(start) : stringify_statement(start);
+        int depth = 0;
+        for (long o = sp->owner; o >= 0; o = g_sprof.entries[o].owner) depth++;
+        bool is_hot = hot >= 0 && ((long)i == hot || sprof_inside((long)i, hot));
+        fprintf(out, "%c %10lu %10.3f %5.1f%% %8lu %5d  %*s%.60s%s", is_hot ? '*' : ' ',
+                sp->count, (double)sp->ns / 1e6, 100.0 * (double)sp->ns / total, sp->rows, start->line,
+                depth * 2, "", text ? text : "", (text && strlen(text) > 60) ? "..." : "");
+        if (is_while) fprintf(out, "  [%lu iterations]", sp->iterations);
+        fprintf(out, "\n");
+        free(text);
+    }
+}
+
+void free_rows(TableRow *rows, size_t row_count) {
+    for (size_t i = 0; i < row_count; i++) {
+        free(rows[i].command);
+        free(rows[i].binding);
+        free(rows[i].stack);
+        free(rows[i].stack_diagram);
+    }
+    free(rows);
+}
+
+// The highest-level function that drives the parsing process.
+void parse_program(Token *tokens, struct SymbolTable *t) {
+    size_t count = 0;
+    TableRow *rows = execute_program(tokens, t, &count);
+    if (rows) {
+        render_rows(rows, count);
+        free_rows(rows, count);
+    }
+}
+
+static void exec_statement(Token **tokens, struct SymbolTable *t) {
     if ((*tokens)->type == TOKEN_KEYWORD) {
-        if (strcmp((*tokens)->value, "while") == 0) {
-            parse_while(tokens, t);
-            // Suppress the outer 'while ...' row; body rows were already added
-            g_suppress_next_row = true;
-        } else if (strcmp((*tokens)->value, "return") == 0) {
-            // return [expr] ;  — skip optional expression then ';'
-            (*tokens)++;
-            if (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, ";") == 0)) {
-                int ok = 0; (void)parse_int_expression(tokens, t, &ok);
-            }
-            if (!((*tokens)->type == TOKEN_PUNCTUATION && strcmp((*tokens)->value, ";") == 0)) {
-                fprintf(stderr, "Error: Expected ';' after return.\n");
-                return;
-            }
-            // Suppress adding a row for return statements
-            g_suppress_next_row = true;
+        if (strcmp((*tokens)->value, "return") == 0) {
+            parse_return(tokens, t);
         } else {
             parse_declaration(tokens, t);
         }
     } else if ((*tokens)->type == TOKEN_IDENTIFIER) {
-        parse_assignment(tokens, t);
+        if (strcmp((*tokens)->value, "free") == 0 && is_punct(*tokens + 1, "(")) {
+            parse_free(tokens, t);
+        } else if (is_punct(*tokens + 1, "(") && func_find((*tokens)->value) >= 0) {
+            parse_call(tokens, t);
+        } else {
+            parse_assignment(tokens, t);
+        }
     } else {
-        fprintf(stderr, "Error: Expected a keyword or identifier but found '%s'.\n", (*tokens)->value);
+        fprintf(err_at(*tokens), "Error: Expected a keyword or identifier but found '%s'.\n", (*tokens)->value);
         return;
     }
 }
\ No newline at end of file
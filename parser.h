@@ -4,12 +4,202 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "bt.h"
+#include "expr.h"
 #include "lexer.h"
 
 
+// One step of the trace: the command text and the state snapshots taken after it ran
+typedef struct {
+   char *command;
+   char *binding;
+   char *stack;
+   char *stack_diagram; // optional multi-line diagram for this step
+   unsigned long long state_hash; // the table's hash after the statement ran (see symbol_hash)
+} TableRow;
+
+// Execution budgets; 0 means unlimited
+struct ExecLimits {
+   unsigned long max_steps;      // executed statements
+   unsigned long max_iterations; // while-loop iterations across all loops
+   size_t max_trace_bytes;       // bytes of text held in the trace rows
+   unsigned long max_time_ms;    // wall-clock time of execute_program
+   unsigned long max_call_depth; // nested function calls; 0 (or more) means CALL_MAX_DEPTH
+};
+
+// Deepest allowed nesting of function calls (activation records live on the heap, not the C stack)
+#define CALL_MAX_DEPTH 1000
 
 void parse_expression(Token **token, struct SymbolTable *t);
-void parse_statement(Token **token, struct SymbolTable *t);
 void parse_program(Token *token, struct SymbolTable *t);
 
+/**
+ * @brief Executes the program without printing anything
+ * @return The malloc'ed trace rows (release with free_rows), or NULL if none could be allocated
+ * @param token The EOF-terminated token array
+ * @param t The symbol table to execute against
+ * @param row_count Receives the number of rows
+ */
+TableRow *execute_program(Token *token, struct SymbolTable *t, size_t *row_count);
+
+void free_rows(TableRow *rows, size_t row_count);
+
+/**
+ * @brief Calls function `index` (func.h) with arguments of its parameter types
+ * The call gets an activation record holding its parameters and locals, and its body
+ * statements are traced like top-level ones. Calls run as steps of their own: the first time
+ * a statement reaches a call this returns false without a diagnostic, the call runs, and the
+ * statement runs again with the result.
+ * @return false after an error (or before the call ran); *result is set otherwise, to 0 for
+ * void functions
+ */
+bool call_function(int index, const ExprValue *args, struct SymbolTable *t, ExprValue *result);
+
+/**
+ * @brief An execution that runs a few steps at a time (see exec_session_step)
+ * Sessions keep their own interpreter state, so several can be open on a thread and each
+ * call may come from a different thread, one at a time per session. Statement profiles,
+ * checkpoints and row streaming are off in sessions.
+ */
+typedef struct ExecSession ExecSession;
+
+/**
+ * @brief Starts executing a program; nothing runs until the first exec_session_step
+ * @return The session, or NULL when out of memory
+ * @param token The EOF-terminated token array; must outlive the session
+ * @param limits Budgets for the whole execution (NULL for none); the time budget counts
+ * only the time spent in exec_session_step
+ * @param loop_summary As set_loop_summary
+ */
+ExecSession *exec_session_open(Token *token, const struct ExecLimits *limits, bool loop_summary);
+
+/**
+ * @brief Continues the execution until it has produced max_rows more rows, has traced a
+ * statement on source line `line`, or has finished
+ * @return The new rows (release with free_rows), possibly NULL when there are none
+ * @param max_rows Row limit for this call; 0 for none
+ * @param line Stop after the first row of a statement on this line; 0 for none
+ * @param row_count Receives the number of rows
+ */
+TableRow *exec_session_step(ExecSession *s, size_t max_rows, int line, size_t *row_count);
+
+/**
+ * @brief From now on the session's rows carry only their state_hash, without any text
+ * Tracing then costs no formatting; the trace byte budget no longer applies.
+ */
+void exec_session_hash_rows(ExecSession *s);
+
+/**
+ * @brief Binds name to an int before the first step, as an assignment ahead of the program would
+ * @return false when the symbol table is full
+ */
+bool exec_session_bind_int(ExecSession *s, const char *name, long value);
+
+/**
+ * @brief From now on the session keeps a copy of its table as of its last row, for
+ * exec_session_final_table; once main() returned, the live table no longer holds its locals
+ * @return false when out of memory
+ */
+bool exec_session_keep_final(ExecSession *s);
+
+/**
+ * @brief The table as of the last row (the live table unless exec_session_keep_final was called)
+ */
+const struct SymbolTable *exec_session_final_table(const ExecSession *s);
+
+/**
+ * @brief The session's symbol table, as of the last row produced
+ */
+const struct SymbolTable *exec_session_table(const ExecSession *s);
+
+/**
+ * @brief Whether the program finished or a budget stopped it
+ */
+bool exec_session_done(const ExecSession *s);
+
+/**
+ * @brief As exec_truncated_reason, for the session
+ */
+const char *exec_session_truncated(const ExecSession *s);
+
+void exec_session_close(ExecSession *s);
+
+/**
+ * @brief Sets the budgets for executions on this thread (NULL removes them)
+ */
+void set_exec_limits(const struct ExecLimits *limits);
+
+/**
+ * @brief Why the last execution on this thread stopped early
+ * @return A message such as "statement limit of 100 reached", or NULL if it ran to completion
+ */
+const char *exec_truncated_reason(void);
+
+/**
+ * @brief Enables counters for the next executions on this thread: per source statement,
+ * the execution count, cumulative time and trace rows produced
+ */
+void set_stmt_profile(bool enabled);
+
+/**
+ * @brief Enables checkpoints for the next executions on this thread: the longest
+ * previously executed token prefix is skipped by restoring its saved state (see checkpoint.h)
+ */
+void set_checkpoints(bool enabled);
+
+/**
+ * @brief For the next executions on this thread, loops run in closed form (see affine.h) are
+ * traced by a single summary row for all but their last iteration instead of one row per statement
+ */
+void set_loop_summary(bool enabled);
+
+/**
+ * @brief For the next executions on this thread, writes each trace row to out as one JSON
+ * line as soon as it is produced, then a final {"done":true,...} line (NULL stops streaming)
+ */
+void set_row_stream(FILE *out);
+
+// Which steps get a trace row; the others are neither snapshotted nor formatted
+struct TraceFilter {
+   const char *watch;     // --watch x,i: only steps that change the binding of a listed variable
+   int break_line;        // --break-line N: only from the first step on source line N onward
+   const char *when;      // --when COND: only from the first step after which COND holds
+                          // (on line N, with --break-line)
+   unsigned long sample;  // --sample 1/N: every N-th of the steps the other filters keep
+};
+
+/**
+ * @brief Sets the trace filter for the next executions on this thread (NULL keeps every step)
+ * @return false after reporting a malformed watch list or condition; nothing is filtered then
+ */
+bool set_trace_filter(const struct TraceFilter *filter);
+
+// What execution reports as it runs. Every callback may be NULL; the table passed is the live
+// one, valid only during the call. The default observer builds the trace rows from `step`.
+typedef struct {
+   void (*declare)(void *ctx, const struct SymbolTable *t, const char *name); // a variable or parameter was declared
+   void (*assign)(void *ctx, const struct SymbolTable *t, const char *name);  // a variable or element was stored
+   void (*scope_enter)(void *ctx, const char *function); // a call started, its parameters not yet declared
+   void (*scope_exit)(void *ctx, const char *function);  // a call ended, its locals not yet dropped
+   void (*iteration)(void *ctx, unsigned long iteration); // a loop started its iteration-th pass
+   // A statement (or a call, or a loop summary) finished; command is its text, and
+   // iteration the pass of the innermost loop it ran in, or 0
+   void (*step)(void *ctx, const char *command, unsigned long iteration, struct SymbolTable *t);
+   void *ctx;
+} ExecObserver;
+
+/**
+ * @brief Sets who receives the events of the next executions on this thread (NULL restores
+ * the table builder)
+ * With any other observer, execute_program returns no rows and takes no checkpoints; events
+ * nobody listens to cost a test of their callback, and without a `step` callback no
+ * statement text is made at all. Iterations and assignments a loop summary skips are not
+ * reported one by one.
+ */
+void set_exec_observer(const ExecObserver *observer);
+
+/**
+ * @brief Prints the statement profile of the last execution (no-op when it was disabled)
+ */
+void print_stmt_profile(FILE *out);
+
 #endif
@@ -0,0 +1,112 @@
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "profile.h"
+
+#define PROF_MAX_DEPTH 16
+
+_Thread_local bool g_prof_on = false;
+
+static const char *PHASE_NAMES[PROF_PHASE_COUNT] = {
+   "read", "tokenize", "cache", "execute", "format", "render"
+};
+
+typedef struct {
+   unsigned long calls;
+   unsigned long long ns;
+   unsigned long allocs;
+   unsigned long long alloc_bytes;
+} PhaseStats;
+
+static _Thread_local struct {
+   PhaseStats phases[PROF_PHASE_COUNT];
+   ProfPhase stack[PROF_MAX_DEPTH];
+   int depth;
+   unsigned long long mark; // when the innermost phase last resumed
+   unsigned long long started;
+   unsigned long long total_ns;
+   unsigned long untracked_allocs; // made outside any phase
+   unsigned long long untracked_bytes;
+} g_prof;
+
+static unsigned long long now_ns(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+void prof_start(void) {
+   if (g_prof_on) return;
+   memset(&g_prof, 0, sizeof(g_prof));
+   g_prof.started = now_ns();
+   g_prof_on = true;
+}
+
+void prof_stop(void) {
+   g_prof_on = false;
+}
+
+void prof_enter_slow(ProfPhase phase) {
+   unsigned long long t = now_ns();
+   if (g_prof.depth > 0) g_prof.phases[g_prof.stack[g_prof.depth - 1]].ns += t - g_prof.mark;
+   if (g_prof.depth < PROF_MAX_DEPTH) g_prof.stack[g_prof.depth] = phase;
+   g_prof.depth++;
+   g_prof.phases[phase].calls++;
+   g_prof.mark = t;
+}
+
+void prof_leave_slow(void) {
+   if (g_prof.depth == 0) return;
+   unsigned long long t = now_ns();
+   int top = g_prof.depth - 1;
+   if (top < PROF_MAX_DEPTH) g_prof.phases[g_prof.stack[top]].ns += t - g_prof.mark;
+   g_prof.depth--;
+   g_prof.mark = t;
+}
+
+void prof_count_alloc(size_t bytes) {
+   if (g_prof.depth > 0 && g_prof.depth <= PROF_MAX_DEPTH) {
+      PhaseStats *p = &g_prof.phases[g_prof.stack[g_prof.depth - 1]];
+      p->allocs++;
+      p->alloc_bytes += bytes;
+   } else {
+      g_prof.untracked_allocs++;
+      g_prof.untracked_bytes += bytes;
+   }
+}
+
+static long peak_rss_kb(void) {
+   struct rusage ru;
+   if (getrusage(RUSAGE_SELF, &ru) != 0) return -1;
+#ifdef __APPLE__
+   return ru.ru_maxrss / 1024; // bytes on macOS
+#else
+   return ru.ru_maxrss;
+#endif
+}
+
+void prof_report(FILE *f, bool json) {
+   unsigned long long total = now_ns() - g_prof.started;
+   long rss = peak_rss_kb();
+   if (json) {
+      fprintf(f, "{\"phases\":[");
+      for (int i = 0; i < PROF_PHASE_COUNT; i++) {
+         const PhaseStats *p = &g_prof.phases[i];
+         fprintf(f, "%s{\"name\":\"%s\",\"calls\":%lu,\"ms\":%.3f,\"allocs\":%lu,\"alloc_bytes\":%llu}",
+                 i ? "," : "", PHASE_NAMES[i], p->calls, (double)p->ns / 1e6, p->allocs, p->alloc_bytes);
+      }
+      fprintf(f, "],\"other_allocs\":%lu,\"other_alloc_bytes\":%llu,\"total_ms\":%.3f,\"peak_rss_kb\":%ld}\n",
+              g_prof.untracked_allocs, g_prof.untracked_bytes, (double)total / 1e6, rss);
+      return;
+   }
+   fprintf(f, "Profile:\n");
+   fprintf(f, "  %-10s %8s %12s %10s %14s\n", "phase", "calls", "ms", "allocs", "alloc bytes");
+   for (int i = 0; i < PROF_PHASE_COUNT; i++) {
+      const PhaseStats *p = &g_prof.phases[i];
+      fprintf(f, "  %-10s %8lu %12.3f %10lu %14llu\n",
+              PHASE_NAMES[i], p->calls, (double)p->ns / 1e6, p->allocs, p->alloc_bytes);
+   }
+   fprintf(f, "  %-10s %8s %12s %10lu %14llu\n", "other", "", "", g_prof.untracked_allocs, g_prof.untracked_bytes);
+   fprintf(f, "  total %.3f ms, peak RSS %ld KiB\n", (double)total / 1e6, rss);
+}
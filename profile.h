@@ -0,0 +1,60 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Built-in phase profiler (bt --profile).
+ *
+ * Phases nest: entering one pauses the enclosing phase, so every reported time
+ * is exclusive. Allocations made through prof_malloc/prof_realloc are charged
+ * to the innermost phase. When profiling is off each hook costs one
+ * thread-local flag test.
+ */
+
+typedef enum {
+   PROF_READ,     // reading the program (main.c)
+   PROF_TOKENIZE, // tokenize()
+   PROF_CACHE,    // result cache key and lookup
+   PROF_EXECUTE,  // parsing/execution in execute_program()
+   PROF_FORMAT,   // row snapshots in append_row_with()
+   PROF_RENDER,   // print_table() and the stack evolution dump
+   PROF_PHASE_COUNT
+} ProfPhase;
+
+extern _Thread_local bool g_prof_on;
+
+/**
+ * @brief Starts profiling on this thread; counters are reset unless it is already running
+ */
+void prof_start(void);
+void prof_stop(void);
+
+void prof_enter_slow(ProfPhase phase);
+void prof_leave_slow(void);
+void prof_count_alloc(size_t bytes);
+
+static inline void prof_enter(ProfPhase phase) { if (g_prof_on) prof_enter_slow(phase); }
+static inline void prof_leave(void) { if (g_prof_on) prof_leave_slow(); }
+
+static inline void *prof_malloc(size_t n) {
+   if (g_prof_on) prof_count_alloc(n);
+   return malloc(n);
+}
+
+static inline void *prof_realloc(void *p, size_t n) {
+   if (g_prof_on) prof_count_alloc(n);
+   return realloc(p, n);
+}
+
+/**
+ * @brief Writes per-phase time, allocation counts/bytes and peak RSS
+ * @param f Destination stream
+ * @param json true for a single-line JSON object, false for a text table
+ */
+void prof_report(FILE *f, bool json);
+
+#endif
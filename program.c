@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "program.h"
+#include "cache.h"
+
+// File layout: header, then header.count tokens
+static const char IMAGE_MAGIC[8] = {'B', 'T', 'P', 'R', 'O', 'G', '0', '1'};
+#define IMAGE_SUFFIX ".btp"
+
+typedef struct {
+   char magic[8];
+   uint32_t version;    // PROGRAM_FORMAT_VERSION
+   uint32_t token_size; // sizeof(Token), in case the ABI differs
+   CacheKey key;
+   uint64_t count;
+} ImageHeader;
+
+static struct ProgramStats g_stats;
+
+static void stat_add(unsigned long *counter) {
+   __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void image_key(const char *code, CacheKey *k) {
+   static const uint32_t version = PROGRAM_FORMAT_VERSION;
+   cache_key_init(k);
+   cache_key_update(k, &version, sizeof(version));
+   cache_key_update(k, code, strlen(code));
+}
+
+static void image_path(char *buf, size_t n, const char *dir, const CacheKey *k) {
+   snprintf(buf, n, "%s/%016llx%016llx" IMAGE_SUFFIX, dir,
+            (unsigned long long)k->h1, (unsigned long long)k->h2);
+}
+
+// Whether the mapped tokens are ones the lexer could have produced: the interpreter indexes by
+// match and reads values as strings, so a damaged image must never reach it
+static bool tokens_valid(const Token *tokens, size_t count) {
+   if (count > (size_t)INT32_MAX) return false;
+   for (size_t i = 0; i < count; i++) {
+      const Token *t = &tokens[i];
+      if ((unsigned)t->type > TOKEN_END_OF_FILE || (t->type == TOKEN_END_OF_FILE) != (i == count - 1) ||
+          !memchr(t->value, '\0', sizeof(t->value)) || t->line < 1 || t->column < 1) {
+         return false;
+      }
+      if (t->type == TOKEN_PUNCTUATION && t->value[0] == '{') {
+         // Its '}', or EOF when unmatched
+         if (t->match <= 0 || (size_t)t->match >= count - i) return false;
+         const Token *end = &tokens[i + (size_t)t->match];
+         if (end->type != TOKEN_END_OF_FILE && !(end->type == TOKEN_PUNCTUATION && end->value[0] == '}')) return false;
+      } else if (t->match != 0) {
+         return false;
+      }
+   }
+   return true;
+}
+
+// Maps the image at path if it holds the tokens for key
+static bool image_map(Program *p, const char *path, const CacheKey *k) {
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) return false;
+   struct stat st;
+   void *map = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(ImageHeader)) {
+      // Private and writable: the interpreter takes Token *, though it never writes through it
+      map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   }
+   close(fd);
+   if (map == MAP_FAILED) return false;
+
+   const ImageHeader *h = (const ImageHeader *)map;
+   Token *tokens = (Token *)(h + 1);
+   bool ok = memcmp(h->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0 &&
+             h->version == PROGRAM_FORMAT_VERSION && h->token_size == sizeof(Token) &&
+             h->key.h1 == k->h1 && h->key.h2 == k->h2 && h->count > 0 &&
+             (size_t)st.st_size == sizeof(ImageHeader) + h->count * sizeof(Token) &&
+             tokens_valid(tokens, (size_t)h->count);
+   if (!ok) {
+      munmap(map, (size_t)st.st_size);
+      stat_add(&g_stats.stale);
+      return false;
+   }
+   p->tokens = tokens;
+   p->count = (size_t)h->count;
+   p->map = map;
+   p->map_len = (size_t)st.st_size;
+   return true;
+}
+
+// Writes the image next to its final name, then renames it into place
+static void image_write(const Program *p, const char *dir, const CacheKey *k) {
+   static unsigned long tmp_counter = 0;
+   if (mkdir(dir, 0755) != 0 && errno != EEXIST) return;
+   char tmp[4096], path[4096];
+   snprintf(tmp, sizeof(tmp), "%s/.tmp-%ld-%lu", dir, (long)getpid(),
+            __atomic_add_fetch(&tmp_counter, 1, __ATOMIC_RELAXED));
+   image_path(path, sizeof(path), dir, k);
+
+   FILE *f = fopen(tmp, "wb");
+   if (!f) return;
+   ImageHeader h;
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+   h.version = PROGRAM_FORMAT_VERSION;
+   h.token_size = sizeof(Token);
+   h.key = *k;
+   h.count = p->count;
+   bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(p->tokens, sizeof(Token), p->count, f) == p->count;
+   ok = (fclose(f) == 0) && ok;
+   // rename() publishes the complete file atomically; readers never see a partial image
+   if (!ok || rename(tmp, path) != 0) {
+      unlink(tmp);
+      return;
+   }
+   stat_add(&g_stats.stores);
+}
+
+bool program_load(Program *p, const char *code, const char *dir) {
+   memset(p, 0, sizeof(*p));
+   CacheKey k;
+   char path[4096];
+   if (dir) {
+      image_key(code, &k);
+      image_path(path, sizeof(path), dir, &k);
+      if (image_map(p, path, &k)) {
+         stat_add(&g_stats.loads);
+         return true;
+      }
+   }
+   stat_add(&g_stats.compiles);
+   if (!(p->tokens = tokenize(code))) return false;
+   while (p->tokens[p->count].type != TOKEN_END_OF_FILE) p->count++;
+   p->count++;
+   if (dir) image_write(p, dir, &k);
+   return true;
+}
+
+void program_release(Program *p) {
+   if (p->map) munmap(p->map, p->map_len);
+   else free(p->tokens);
+   memset(p, 0, sizeof(*p));
+}
+
+void program_get_stats(struct ProgramStats *s) {
+   s->loads = __atomic_load_n(&g_stats.loads, __ATOMIC_RELAXED);
+   s->compiles = __atomic_load_n(&g_stats.compiles, __ATOMIC_RELAXED);
+   s->stores = __atomic_load_n(&g_stats.stores, __ATOMIC_RELAXED);
+   s->stale = __atomic_load_n(&g_stats.stale, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,51 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "lexer.h"
+
+/*
+ * Compiled-program cache: the front end's output for a source, saved as a
+ * binary image that later runs map instead of lexing again.
+ *
+ * Tokens hold no pointers and carry their brace spans (lexer.h), so an image
+ * is a header followed by the token array, and a mapped image is executed in
+ * place. Images live in a directory, one file per source, named by a hash of
+ * the source text and PROGRAM_FORMAT_VERSION. Every mapped token is checked
+ * (brace spans in range, values terminated) before it is used. A missing,
+ * stale or damaged image costs one full compile, which rewrites it atomically.
+ */
+
+// Bump whenever Token or the lexer's output for a given source changes
+#define PROGRAM_FORMAT_VERSION 1
+
+typedef struct {
+   Token *tokens;  // EOF-terminated; NULL when the source does not tokenize
+   size_t count;   // tokens, EOF included
+   void *map;      // the mapped image holding tokens, or NULL when they were malloc'ed
+   size_t map_len;
+} Program;
+
+struct ProgramStats {
+   unsigned long loads;    // runs that mapped an image
+   unsigned long compiles; // runs that lexed the source
+   unsigned long stores;   // images written
+   unsigned long stale;    // images found but rejected (other version, damaged)
+};
+
+/**
+ * @brief Compiles code, or maps its image from dir
+ * The lexer reports its own errors; sources that do not tokenize are never stored.
+ * @return true when p->tokens is set
+ * @param p Receives the program; release with program_release
+ * @param code The null-terminated program source
+ * @param dir Image directory (created if missing), or NULL to always compile
+ */
+bool program_load(Program *p, const char *code, const char *dir);
+
+void program_release(Program *p);
+
+void program_get_stats(struct ProgramStats *s);
+
+#endif
@@ -0,0 +1,287 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "bt.h"
+#include "render.h"
+
+static _Thread_local int g_render_threads = 0;
+
+void set_render_threads(int threads) {
+   g_render_threads = threads < 0 ? 0 : threads;
+}
+
+static int render_thread_count(void) {
+   long n = g_render_threads;
+   if (n == 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+   if (n < 1) n = 1;
+   return n > RENDER_MAX_THREADS ? RENDER_MAX_THREADS : (int)n;
+}
+
+// --------- Chunks ---------
+typedef enum { TASK_MEASURE, TASK_TABLE, TASK_STEPS } TaskKind;
+
+typedef struct {
+   TaskKind kind;
+   const TableRow *rows;
+   size_t first, count;
+   size_t w1, w2, w3; // column widths: found by TASK_MEASURE, used by TASK_TABLE
+   char *buf;         // formatted text; NULL if it could not be allocated
+   size_t len;
+} RenderTask;
+
+static size_t str_len(const char *s) {
+   return s ? strlen(s) : 0;
+}
+
+static char *put(char *p, const char *s, size_t n) {
+   memcpy(p, s, n);
+   return p + n;
+}
+
+// Left-aligns s in a field of width w, like "%-*s"
+static char *put_padded(char *p, const char *s, size_t w) {
+   size_t n = str_len(s);
+   if (n) p = put(p, s, n);
+   if (w > n) {
+      memset(p, ' ', w - n);
+      p += w - n;
+   }
+   return p;
+}
+
+static size_t digits(size_t v) {
+   size_t n = 1;
+   while (v >= 10) { v /= 10; n++; }
+   return n;
+}
+
+static char *put_size(char *p, size_t v, size_t n) {
+   for (size_t i = n; i-- > 0; v /= 10) p[i] = (char)('0' + v % 10);
+   return p + n;
+}
+
+static void measure(RenderTask *k) {
+   k->w1 = k->w2 = k->w3 = 0;
+   for (size_t i = k->first; i < k->first + k->count; i++) {
+      size_t n1 = str_len(k->rows[i].command), n2 = str_len(k->rows[i].binding), n3 = str_len(k->rows[i].stack);
+      if (n1 > k->w1) k->w1 = n1;
+      if (n2 > k->w2) k->w2 = n2;
+      if (n3 > k->w3) k->w3 = n3;
+   }
+}
+
+// "| command | binding | stack |\n" per row
+static void format_table(RenderTask *k) {
+   k->len = (k->w1 + k->w2 + k->w3 + 11) * k->count;
+   k->buf = (char *)malloc(k->len ? k->len : 1);
+   if (!k->buf) return;
+   char *p = k->buf;
+   for (size_t i = k->first; i < k->first + k->count; i++) {
+      const TableRow *r = &k->rows[i];
+      p = put(p, "| ", 2);
+      p = put_padded(p, r->command, k->w1);
+      p = put(p, " | ", 3);
+      p = put_padded(p, r->binding, k->w2);
+      p = put(p, " | ", 3);
+      p = put_padded(p, r->stack, k->w3);
+      p = put(p, " |\n", 3);
+   }
+}
+
+// "Step n: command\n" and the diagram of each row
+static void format_steps(RenderTask *k) {
+   k->len = 0;
+   for (size_t i = k->first; i < k->first + k->count; i++) {
+      const TableRow *r = &k->rows[i];
+      k->len += 5 + digits(i + 1) + 2 + str_len(r->command) + 1;
+      if (r->stack_diagram) k->len += strlen(r->stack_diagram) + 1;
+   }
+   k->buf = (char *)malloc(k->len ? k->len : 1);
+   if (!k->buf) return;
+   char *p = k->buf;
+   for (size_t i = k->first; i < k->first + k->count; i++) {
+      const TableRow *r = &k->rows[i];
+      p = put(p, "Step ", 5);
+      p = put_size(p, i + 1, digits(i + 1));
+      p = put(p, ": ", 2);
+      p = put(p, r->command, str_len(r->command));
+      *p++ = '\n';
+      if (r->stack_diagram) {
+         p = put(p, r->stack_diagram, strlen(r->stack_diagram));
+         *p++ = '\n';
+      }
+   }
+}
+
+static void run_task(RenderTask *k) {
+   switch (k->kind) {
+      case TASK_MEASURE: measure(k); break;
+      case TASK_TABLE:   format_table(k); break;
+      case TASK_STEPS:   format_steps(k); break;
+   }
+}
+
+typedef struct {
+   RenderTask *tasks;
+   size_t count, stride, start;
+} Worker;
+
+static void *worker_main(void *arg) {
+   Worker *w = (Worker *)arg;
+   for (size_t i = w->start; i < w->count; i += w->stride) run_task(&w->tasks[i]);
+   return NULL;
+}
+
+// Runs the tasks on up to `threads` threads, the calling one included
+static void run_tasks(RenderTask *tasks, size_t count, int threads) {
+   if ((size_t)threads > count) threads = (int)count;
+   pthread_t tids[RENDER_MAX_THREADS];
+   Worker workers[RENDER_MAX_THREADS];
+   int started = 0;
+   for (int t = 1; t < threads; t++) {
+      workers[t] = (Worker){ tasks, count, (size_t)threads, (size_t)t };
+      if (pthread_create(&tids[t], NULL, worker_main, &workers[t]) != 0) break;
+      started = t;
+   }
+   // Tasks of threads that could not be started run here
+   for (size_t i = 0; i < count; i += (size_t)threads) run_task(&tasks[i]);
+   for (int t = started + 1; t < threads; t++) {
+      for (size_t i = (size_t)t; i < count; i += (size_t)threads) run_task(&tasks[i]);
+   }
+   for (int t = 1; t <= started; t++) pthread_join(tids[t], NULL);
+}
+
+// --------- Output ---------
+// Writes the buffers in order; a file-backed stream gets them with writev()
+static void write_buffers(FILE *out, const RenderTask *tasks, size_t count) {
+   int fd = fileno(out);
+   if (fd < 0) {
+      for (size_t i = 0; i < count; i++) fwrite(tasks[i].buf, 1, tasks[i].len, out);
+      return;
+   }
+   fflush(out);
+   struct iovec iov[RENDER_MAX_THREADS * 2];
+   size_t i = 0;
+   while (i < count) {
+      int n = 0;
+      for (size_t j = i; j < count && n < (int)(sizeof(iov) / sizeof(iov[0])); j++, n++) {
+         iov[n].iov_base = tasks[j].buf;
+         iov[n].iov_len = tasks[j].len;
+      }
+      // Short writes (pipes, signals) resume where they stopped
+      struct iovec *v = iov;
+      while (n > 0) {
+         ssize_t w = writev(fd, v, n);
+         if (w < 0) {
+            if (errno == EINTR) continue;
+            return;
+         }
+         while (n > 0 && (size_t)w >= v->iov_len) {
+            w -= (ssize_t)v->iov_len;
+            v++;
+            n--;
+            i++;
+         }
+         if (n > 0) {
+            v->iov_base = (char *)v->iov_base + w;
+            v->iov_len -= (size_t)w;
+         }
+      }
+   }
+}
+
+// Fills tasks with the next chunks of rows from *first, at most one round's worth
+static size_t next_round(RenderTask *tasks, size_t per_round, const RenderTask *proto, size_t row_count, size_t *first) {
+   size_t count = 0;
+   for (; count < per_round && *first < row_count; count++) {
+      size_t n = row_count - *first < RENDER_CHUNK_ROWS ? row_count - *first : RENDER_CHUNK_ROWS;
+      tasks[count] = *proto;
+      tasks[count].first = *first;
+      tasks[count].count = n;
+      tasks[count].buf = NULL;
+      *first += n;
+   }
+   return count;
+}
+
+// Widest cell of each column, starting from the widths already in *w
+static void measure_rows(const TableRow *rows, size_t row_count, int threads, RenderTask *w) {
+   RenderTask tasks[RENDER_MAX_THREADS * 2];
+   RenderTask proto = { .kind = TASK_MEASURE, .rows = rows };
+   for (size_t first = 0; first < row_count;) {
+      size_t count = next_round(tasks, (size_t)threads * 2, &proto, row_count, &first);
+      run_tasks(tasks, count, threads);
+      for (size_t i = 0; i < count; i++) {
+         if (tasks[i].w1 > w->w1) w->w1 = tasks[i].w1;
+         if (tasks[i].w2 > w->w2) w->w2 = tasks[i].w2;
+         if (tasks[i].w3 > w->w3) w->w3 = tasks[i].w3;
+      }
+   }
+}
+
+// Formats and writes rows in rounds of two chunks per thread, which bounds the memory held
+static void render_section(TaskKind kind, const TableRow *rows, size_t row_count, const RenderTask *widths, int threads) {
+   FILE *out = bt_out();
+   RenderTask tasks[RENDER_MAX_THREADS * 2];
+   RenderTask proto = *widths;
+   proto.kind = kind;
+   proto.rows = rows;
+   for (size_t first = 0; first < row_count;) {
+      size_t count = next_round(tasks, (size_t)threads * 2, &proto, row_count, &first);
+      run_tasks(tasks, count, threads);
+      // Formatted chunks go out in order; one that could not be allocated is left to stdio
+      size_t from = 0;
+      for (size_t i = 0; i <= count; i++) {
+         if (i < count && tasks[i].buf) continue;
+         write_buffers(out, tasks + from, i - from);
+         from = i + 1;
+         if (i == count) break;
+         for (size_t r = tasks[i].first; r < tasks[i].first + tasks[i].count; r++) {
+            if (kind == TASK_TABLE) {
+               fprintf(out, "| %-*s | %-*s | %-*s |\n", (int)widths->w1, rows[r].command, (int)widths->w2,
+                       rows[r].binding, (int)widths->w3, rows[r].stack ? rows[r].stack : "");
+            } else {
+               fprintf(out, "Step %zu: %s\n", r + 1, rows[r].command);
+               if (rows[r].stack_diagram) fprintf(out, "%s\n", rows[r].stack_diagram);
+            }
+         }
+      }
+      for (size_t i = 0; i < count; i++) free(tasks[i].buf);
+   }
+}
+
+static void print_rule(FILE *out, const RenderTask *w) {
+   size_t widths[3] = { w->w1, w->w2, w->w3 };
+   for (int c = 0; c < 3; c++) {
+      fputc('+', out);
+      for (size_t i = 0; i < widths[c] + 2; i++) fputc('-', out);
+   }
+   fputs("+\n", out);
+}
+
+void render_rows(const TableRow *rows, size_t row_count) {
+   FILE *out = bt_out();
+   int threads = render_thread_count();
+   RenderTask widths = { .w1 = strlen("Commands"), .w2 = strlen("Binding table"), .w3 = strlen("Stack") };
+   measure_rows(rows, row_count, threads, &widths);
+
+   print_rule(out, &widths);
+   fprintf(out, "| %-*s | %-*s | %-*s |\n", (int)widths.w1, "Commands", (int)widths.w2, "Binding table",
+           (int)widths.w3, "Stack");
+   print_rule(out, &widths);
+   render_section(TASK_TABLE, rows, row_count, &widths, threads);
+   print_rule(out, &widths);
+
+   const char *truncated = exec_truncated_reason();
+   if (truncated) fprintf(out, "\n[truncated: %s]\n", truncated);
+   print_stmt_profile(out);
+   // After the table, print the step-by-step stack diagrams
+   fprintf(out, "\nStack evolution by step:\n\n");
+   render_section(TASK_STEPS, rows, row_count, &widths, threads);
+}
@@ -0,0 +1,31 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+#include "parser.h"
+
+/*
+ * Post-execution rendering of the trace: the command/binding/stack table,
+ * then the stack diagram of every step.
+ *
+ * Every row is formatted from its own strings once the column widths are
+ * known, so large traces are cut into chunks of RENDER_CHUNK_ROWS rows that
+ * worker threads format into separate buffers. The buffers are written in
+ * order, with writev() when bt_out() is backed by a file descriptor. Traces
+ * of a single chunk are formatted on the calling thread.
+ */
+
+#define RENDER_CHUNK_ROWS 16384
+#define RENDER_MAX_THREADS 16
+
+/**
+ * @brief Prints the command/binding/stack table followed by the stack evolution to bt_out()
+ */
+void render_rows(const TableRow *rows, size_t row_count);
+
+/**
+ * @brief Limits the threads used by render_rows on this thread (0 picks one per core)
+ */
+void set_render_threads(int threads);
+
+#endif
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "run.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "profile.h"
+#include "program.h"
+#include "render.h"
+#include "lexer.h"
+#include "parser.h"
+#include "bt.h"
+
+void run_options_init(struct RunOptions *o) {
+   memset(o, 0, sizeof(*o));
+   o->render = true;
+   o->cache_max_bytes = CACHE_DISK_DEFAULT_MAX_BYTES;
+}
+
+// Returns the value following a flag, or NULL after reporting that it is missing
+static const char *flag_value(int argc, char **argv, int *i) {
+   if (*i + 1 >= argc) {
+      fprintf(bt_err(), "Error: option '%s' needs a value.\n", argv[*i]);
+      return NULL;
+   }
+   return argv[++*i];
+}
+
+int run_options_parse(struct RunOptions *o, int argc, char **argv) {
+   for (int i = 0; i < argc; i++) {
+      const char *arg = argv[i];
+      const char *val;
+      if (strcmp(arg, "--stmt-profile") == 0) {
+         o->stmt_profile = true;
+      } else if (strcmp(arg, "--loop-summary") == 0) {
+         o->loop_summary = true;
+      } else if (strcmp(arg, "--final-only") == 0) {
+         o->final_only = true;
+      } else if (strcmp(arg, "--stream") == 0) {
+         o->stream = true;
+      } else if (strcmp(arg, "--incremental") == 0) {
+         o->incremental = true;
+      } else if (strcmp(arg, "--profile") == 0) {
+         o->profile = true;
+      } else if (strcmp(arg, "--profile=json") == 0) {
+         o->profile = o->profile_json = true;
+      } else if (strcmp(arg, "--no-cache") == 0) {
+         o->no_cache = true;
+      } else if (strcmp(arg, "--cache-stats") == 0) {
+         o->cache_stats = true;
+      } else if (strcmp(arg, "--cache-dir") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->cache_dir = val;
+      } else if (strcmp(arg, "--program-cache") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->program_cache = val;
+      } else if (strcmp(arg, "--max-steps") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->limits.max_steps = strtoul(val, NULL, 10);
+      } else if (strcmp(arg, "--max-iterations") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->limits.max_iterations = strtoul(val, NULL, 10);
+      } else if (strcmp(arg, "--max-trace-bytes") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->limits.max_trace_bytes = (size_t)strtoull(val, NULL, 10);
+      } else if (strcmp(arg, "--max-time-ms") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->limits.max_time_ms = strtoul(val, NULL, 10);
+      } else if (strcmp(arg, "--max-call-depth") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->limits.max_call_depth = strtoul(val, NULL, 10);
+      } else if (strcmp(arg, "--watch") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->filter.watch = val;
+      } else if (strcmp(arg, "--break-line") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->filter.break_line = atoi(val);
+      } else if (strcmp(arg, "--when") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->filter.when = val;
+      } else if (strcmp(arg, "--sample") == 0) {
+         // 1/N, or just N
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         char *end;
+         unsigned long n = strtoul(val, &end, 10);
+         if (*end == '/' && n == 1) n = strtoul(end + 1, &end, 10);
+         if (*end != '\0' || n == 0) {
+            fprintf(bt_err(), "Error: --sample expects 1/N, not '%s'.\n", val);
+            return -1;
+         }
+         o->filter.sample = n;
+      } else if (strcmp(arg, "--render-threads") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->render_threads = atoi(val);
+      } else if (strcmp(arg, "--cache-max-bytes") == 0) {
+         if (!(val = flag_value(argc, argv, &i))) return -1;
+         o->cache_max_bytes = (size_t)strtoull(val, NULL, 10);
+      } else if (arg[0] == '-' && arg[1] != '\0') {
+         fprintf(bt_err(), "Error: unknown option '%s'.\n", arg);
+         return -1;
+      } else if (o->path) {
+         fprintf(bt_err(), "Error: unexpected extra argument '%s'.\n", arg);
+         return -1;
+      } else {
+         o->path = arg;
+      }
+   }
+   return 0;
+}
+
+int run_source(const char *code, const struct RunOptions *o) {
+   return run_source_trace(code, o, NULL, NULL);
+}
+
+// Keys a run by its normalized token stream (whitespace and comments never reach
+// it, nor do line breaks unless --break-line is given) plus every option that
+// changes the rendered output.
+// Bump whenever the output produced for a given program changes
+#define RUN_CACHE_VERSION "bt-cache-v5"
+
+static void run_cache_key(const Token *tokens, const struct RunOptions *o, CacheKey *k) {
+   cache_key_init(k);
+   cache_key_update(k, RUN_CACHE_VERSION, sizeof(RUN_CACHE_VERSION));
+   cache_key_update(k, &o->limits, sizeof(o->limits));
+   cache_key_update(k, &o->loop_summary, sizeof(o->loop_summary));
+   cache_key_update(k, &o->final_only, sizeof(o->final_only));
+   cache_key_update(k, &o->filter.break_line, sizeof(o->filter.break_line));
+   cache_key_update(k, &o->filter.sample, sizeof(o->filter.sample));
+   // The strings with their NULs, an absent one as a lone 0xff
+   const char *texts[] = { o->filter.watch, o->filter.when };
+   for (size_t i = 0; i < 2; i++) {
+      if (texts[i]) cache_key_update(k, texts[i], strlen(texts[i]) + 1);
+      else cache_key_update(k, "\xff", 1);
+   }
+   // --break-line picks rows by source line, so there the lines are part of the program
+   bool lines = o->filter.break_line != 0;
+   for (const Token *p = tokens; ; p++) {
+      unsigned char type = (unsigned char)p->type;
+      cache_key_update(k, &type, 1);
+      cache_key_update(k, p->value, strlen(p->value) + 1);
+      if (lines) cache_key_update(k, &p->line, sizeof(p->line));
+      if (p->type == TOKEN_END_OF_FILE) break;
+   }
+}
+
+static void report_cache_stats(const struct RunOptions *o) {
+   struct CacheStats st;
+   cache_get_stats(&st);
+   fprintf(bt_err(), "cache: %lu memory hits, %lu disk hits, %lu misses, %lu stores, %lu evictions\n",
+           st.mem_hits, st.disk_hits, st.misses, st.stores, st.evictions);
+   if (o->program_cache) {
+      struct ProgramStats ps;
+      program_get_stats(&ps);
+      fprintf(bt_err(), "programs: %lu loads, %lu compiles, %lu stores, %lu stale\n",
+              ps.loads, ps.compiles, ps.stores, ps.stale);
+   }
+   if (!o->incremental) return;
+   struct CheckpointStats cp;
+   checkpoint_get_stats(&cp);
+   fprintf(bt_err(), "checkpoints: %lu resumes, %lu misses, %lu tokens skipped, %lu stores, %lu evictions\n",
+           cp.resumes, cp.misses, cp.tokens_skipped, cp.stores, cp.evictions);
+}
+
+// --final-only observer state: the table as of the last step, the only thing printed
+struct FinalTable {
+   struct SymbolTable *live; // the live table, when it still holds the last step's state
+   struct SymbolTable copy;  // the last step's state otherwise
+};
+
+// A step only notes the live table; it is copied when a call is about to drop locals the
+// step saw, and once when execution ends (final_table)
+static void keep_final_step(void *ctx, const char *command, unsigned long iteration, struct SymbolTable *t) {
+   (void)command;
+   (void)iteration;
+   ((struct FinalTable *)ctx)->live = t;
+}
+
+static void keep_final_scope_exit(void *ctx, const char *function) {
+   (void)function;
+   struct FinalTable *f = ctx;
+   if (f->live) table_copy(&f->copy, f->live);
+   f->live = NULL;
+}
+
+static const struct SymbolTable *final_table(struct FinalTable *f) {
+   keep_final_scope_exit(f, NULL);
+   return &f->copy;
+}
+
+// Prints "S = {...}" for --final-only, then why the run stopped early, if it did
+static void print_final(const struct SymbolTable *final) {
+   StrBuf line = SB_INIT;
+   format_binding_table(final, &line);
+   const char *reason = exec_truncated_reason();
+   if (reason) {
+      sb_puts(&line, " [truncated: ");
+      sb_puts(&line, reason);
+      sb_putc(&line, ']');
+   }
+   sb_putc(&line, '\n');
+   fwrite(line.data, 1, line.len, bt_out());
+   sb_free(&line);
+}
+
+// Executes the tokens and renders the rows; returns the exit status
+static int execute_tokens(Token *tokens, const struct RunOptions *o, TableRow **rows_out, size_t *row_count) {
+   // Every run starts from an empty SymbolTable and stack model
+   struct SymbolTable table;
+   struct FinalTable final;
+   final.live = NULL;
+   table.count = final.copy.count = 0;
+   table.layout = final.copy.layout = 0;
+   table.hash = final.copy.hash = 0;
+   stack_reset();
+
+   // Execute within the budgets, then print the ASCII table of command -> binding
+   if (!set_trace_filter(&o->filter)) return 2;
+   set_exec_limits(&o->limits);
+   set_stmt_profile(o->stmt_profile);
+   set_checkpoints(o->incremental);
+   set_loop_summary(o->loop_summary);
+   // --final-only replaces the table builder, so no row is ever formatted
+   const ExecObserver keep_final = { .scope_exit = keep_final_scope_exit, .step = keep_final_step, .ctx = &final };
+   set_exec_observer(o->final_only ? &keep_final : NULL);
+   set_row_stream(o->stream && !o->final_only ? bt_out() : NULL);
+   size_t count = 0;
+   prof_enter(PROF_EXECUTE);
+   TableRow *rows = execute_program(tokens, &table, &count);
+   prof_leave();
+   set_row_stream(NULL);
+   set_exec_observer(NULL);
+   set_trace_filter(NULL);
+   int status = exec_truncated_reason() ? RUN_EXIT_TRUNCATED : 0;
+   if (o->final_only && o->render) {
+      prof_enter(PROF_RENDER);
+      print_final(final_table(&final));
+      prof_leave();
+   } else if (rows && o->render && !o->stream) {
+      prof_enter(PROF_RENDER);
+      set_render_threads(o->render_threads);
+      render_rows(rows, count);
+      prof_leave();
+   }
+
+   if (rows_out && rows) {
+      *rows_out = rows;
+      *row_count = count;
+   } else if (rows) {
+      free_rows(rows, count);
+   }
+   return status;
+}
+
+static int run_tokens(const char *code, const struct RunOptions *o, TableRow **rows_out, size_t *row_count);
+
+int run_source_trace(const char *code, const struct RunOptions *o, TableRow **rows_out, size_t *row_count) {
+   // main() may already have started the profiler to include reading the program
+   if (o->profile) prof_start();
+   int status = run_tokens(code, o, rows_out, row_count);
+   if (o->profile) {
+      prof_report(bt_err(), o->profile_json);
+      prof_stop();
+   }
+   return status;
+}
+
+static int run_tokens(const char *code, const struct RunOptions *o, TableRow **rows_out, size_t *row_count) {
+   if (rows_out) *rows_out = NULL;
+   if (row_count) *row_count = 0;
+
+   // Tokenize the input code, or map its compiled image; the lexer has already reported any error
+   Program prog;
+   prof_enter(PROF_TOKENIZE);
+   bool compiled = program_load(&prog, code, o->program_cache);
+   prof_leave();
+   if (!compiled) return 1;
+   Token *tokens = prog.tokens;
+
+   // Only rendered text is cached; callers asking for rows always execute, statement
+   // profiles contain timings that must not be replayed, and streamed rows must not
+   // wait for the whole run to be captured
+   bool use_cache = !o->no_cache && o->render && !rows_out && !o->stmt_profile && !o->stream;
+   int status;
+   if (!use_cache) {
+      status = execute_tokens(tokens, o, rows_out, row_count);
+      if (o->cache_stats) report_cache_stats(o);
+      program_release(&prog);
+      return status;
+   }
+
+   CacheKey key;
+   FILE *out = bt_out(), *err = bt_err();
+   prof_enter(PROF_CACHE);
+   run_cache_key(tokens, o, &key);
+   bool hit = cache_lookup(&key, o->cache_dir, out, err, &status);
+   prof_leave();
+   if (!hit) {
+      // Miss: capture this run's output so it can be stored, then pass it through
+      char *out_buf = NULL, *err_buf = NULL;
+      size_t out_len = 0, err_len = 0;
+      FILE *out_f = open_memstream(&out_buf, &out_len);
+      FILE *err_f = open_memstream(&err_buf, &err_len);
+      if (out_f && err_f) {
+         bt_set_streams(out_f, err_f);
+         status = execute_tokens(tokens, o, NULL, NULL);
+         bt_set_streams(out, err);
+         fclose(out_f);
+         fclose(err_f);
+         fwrite(out_buf, 1, out_len, out);
+         fwrite(err_buf, 1, err_len, err);
+         // Truncated traces may depend on timing, and diagnostics carry source positions that
+         // the whitespace-insensitive key does not cover, so only clean, complete runs are stored
+         if (status != RUN_EXIT_TRUNCATED && err_len == 0) {
+            prof_enter(PROF_CACHE);
+            cache_store(&key, o->cache_dir, o->cache_max_bytes, status, out_buf, out_len, err_buf, err_len);
+            prof_leave();
+         }
+      } else {
+         if (out_f) fclose(out_f);
+         if (err_f) fclose(err_f);
+         status = execute_tokens(tokens, o, NULL, NULL);
+      }
+      free(out_buf);
+      free(err_buf);
+   }
+   if (o->cache_stats) report_cache_stats(o);
+   program_release(&prog);
+   return status;
+}
@@ -0,0 +1,70 @@
+#ifndef RUN_H
+#define RUN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "parser.h"
+
+// Exit status of a run that hit one of its execution budgets
+#define RUN_EXIT_TRUNCATED 3
+
+// Per-run settings shared by the command line, the socket server and embedders.
+struct RunOptions {
+   const char *path; // program file; NULL when the source is supplied directly
+   bool render;      // print the table and stack evolution to bt_out() (default true)
+   struct ExecLimits limits; // --max-steps, --max-iterations, --max-trace-bytes, --max-time-ms
+   bool stmt_profile;        // --stmt-profile: per-statement counts/time/rows after the table
+   bool loop_summary;        // --loop-summary: one row for the iterations of closed-form loops (affine.h)
+   int render_threads;       // --render-threads N: threads formatting the table (0 = one per core, see render.h)
+   bool stream;              // --stream: one JSON line per trace row as it is produced, instead of the table
+   bool incremental;         // --incremental: resume from checkpoints of earlier runs (checkpoint.h)
+   bool profile;             // --profile: phase timings and allocations on bt_err()
+   bool profile_json;        // --profile=json: the same report as one JSON line
+   struct TraceFilter filter; // --watch, --break-line, --when, --sample: which steps get a row
+   bool final_only;          // --final-only: print only the final binding table, building no rows
+
+   // Result cache (see cache.h)
+   bool no_cache;             // --no-cache: bypass both tiers
+   const char *cache_dir;     // --cache-dir DIR: enables the on-disk tier
+   size_t cache_max_bytes;    // --cache-max-bytes N: size cap for cache_dir
+   bool cache_stats;          // --cache-stats: print hit/miss counters (and checkpoint and program counters) to bt_err()
+
+   const char *program_cache; // --program-cache DIR: compiled-program images (program.h)
+};
+
+/**
+ * @brief Fills a RunOptions with defaults
+ * @return void
+ * @param o A pointer to the options to reset
+ */
+void run_options_init(struct RunOptions *o);
+
+/**
+ * @brief Parses run flags and the optional program path from argv
+ * @return 0 on success, -1 after reporting an unknown or malformed flag
+ * @param o A pointer to the options to fill
+ * @param argc Number of entries in argv
+ * @param argv Arguments to parse (no program name)
+ */
+int run_options_parse(struct RunOptions *o, int argc, char **argv);
+
+/**
+ * @brief Tokenizes, executes and renders one program
+ * Output goes to bt_out() and diagnostics to bt_err().
+ * @return The process exit status for this run (0 on success)
+ * @param code The null-terminated program source
+ * @param o The options for this run
+ */
+int run_source(const char *code, const struct RunOptions *o);
+
+/**
+ * @brief Like run_source, but also hands the trace rows to the caller
+ * @return The process exit status for this run (0 on success)
+ * @param code The null-terminated program source
+ * @param o The options for this run
+ * @param rows Receives the rows (release with free_rows); may be NULL to discard them
+ * @param row_count Receives the number of rows
+ */
+int run_source_trace(const char *code, const struct RunOptions *o, TableRow **rows, size_t *row_count);
+
+#endif
@@ -0,0 +1,510 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "server.h"
+#include "run.h"
+#include "bt.h"
+
+static volatile sig_atomic_t g_stopping = 0;
+
+static void on_stop_signal(int sig) {
+   (void)sig;
+   g_stopping = 1;
+}
+
+// --------- Framing helpers ---------
+static int read_full(int fd, void *buf, size_t n) {
+   char *p = (char *)buf;
+   while (n > 0) {
+      ssize_t r = read(fd, p, n);
+      if (r < 0 && errno == EINTR) continue;
+      if (r <= 0) return -1;
+      p += r;
+      n -= (size_t)r;
+   }
+   return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t n) {
+   const char *p = (const char *)buf;
+   while (n > 0) {
+      ssize_t w = write(fd, p, n);
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) return -1;
+      p += w;
+      n -= (size_t)w;
+   }
+   return 0;
+}
+
+static int write_field(int fd, const char *data, size_t len) {
+   uint32_t be = htonl((uint32_t)len);
+   if (write_full(fd, &be, sizeof(be)) != 0) return -1;
+   return write_full(fd, data, len);
+}
+
+// Walks the fields of a request held in memory
+typedef struct {
+   const char *p, *end;
+} Cursor;
+
+// 1 with *v set, 0 when the bytes end first
+static int cursor_u32(Cursor *c, uint32_t *v) {
+   uint32_t be;
+   if ((size_t)(c->end - c->p) < sizeof(be)) return 0;
+   memcpy(&be, c->p, sizeof(be));
+   c->p += sizeof(be);
+   *v = ntohl(be);
+   return 1;
+}
+
+// 1 with the field at *data, 0 when the bytes end first, -1 for a field over SERVER_MAX_FRAME
+static int cursor_field(Cursor *c, const char **data, uint32_t *len) {
+   if (!cursor_u32(c, len)) return 0;
+   if (*len > SERVER_MAX_FRAME) return -1;
+   if ((size_t)(c->end - c->p) < *len) return 0;
+   *data = c->p;
+   c->p += *len;
+   return 1;
+}
+
+// Whether buf starts with a whole request: 1 with *frame_len set, 0 while it is still
+// arriving, -1 when it is malformed
+static int frame_scan(const char *buf, size_t len, size_t *frame_len) {
+   Cursor c = { buf, buf + len };
+   uint32_t argc, n;
+   const char *data;
+   if (!cursor_u32(&c, &argc)) return 0;
+   if (argc > SERVER_MAX_ARGS) return -1;
+   for (uint32_t i = 0; i <= argc; i++) { // the arguments, then the source
+      int r = cursor_field(&c, &data, &n);
+      if (r <= 0) return r;
+   }
+   *frame_len = (size_t)(c.p - buf);
+   return 1;
+}
+
+// --------- Request handling ---------
+static int run_request(int argc, char **argv, const char *code, char **out, size_t *out_len, char **err, size_t *err_len) {
+   FILE *out_f = open_memstream(out, out_len);
+   FILE *err_f = open_memstream(err, err_len);
+   if (!out_f || !err_f) {
+      if (out_f) fclose(out_f);
+      if (err_f) fclose(err_f);
+      return -1;
+   }
+   bt_set_streams(out_f, err_f);
+
+   int status;
+   struct RunOptions opts;
+   run_options_init(&opts);
+   if (run_options_parse(&opts, argc, argv) != 0) {
+      status = 2;
+   } else if (opts.path) {
+      fprintf(err_f, "Error: program paths are not accepted by the server.\n");
+      status = 2;
+   } else {
+      status = run_source(code, &opts);
+   }
+
+   bt_set_streams(NULL, NULL);
+   fclose(out_f);
+   fclose(err_f);
+   return status;
+}
+
+// Runs one whole request (checked by frame_scan) and writes the response to fd; false once
+// the connection should be closed
+static bool serve_frame(int fd, const char *frame, size_t len) {
+   Cursor c = { frame, frame + len };
+   uint32_t argc, n;
+   const char *data;
+   cursor_u32(&c, &argc);
+   char *argv[SERVER_MAX_ARGS];
+   char *code = NULL;
+   uint32_t have = 0;
+   bool ok = true;
+   for (; have < argc && ok; have++) {
+      cursor_field(&c, &data, &n);
+      ok = (argv[have] = strndup(data, n)) != NULL;
+   }
+   if (ok) {
+      cursor_field(&c, &data, &n);
+      ok = (code = strndup(data, n)) != NULL;
+   }
+   if (ok) {
+      char *out = NULL, *err = NULL;
+      size_t out_len = 0, err_len = 0;
+      int status = run_request((int)argc, argv, code, &out, &out_len, &err, &err_len);
+      uint32_t be = htonl((uint32_t)status);
+      if (status < 0 ||
+          write_full(fd, &be, sizeof(be)) != 0 ||
+          write_field(fd, out, out_len) != 0 ||
+          write_field(fd, err, err_len) != 0) {
+         ok = false;
+      }
+      free(out);
+      free(err);
+   }
+   free(code);
+   for (uint32_t i = 0; i < have; i++) free(argv[i]);
+   return ok;
+}
+
+// --------- Workers ---------
+// The master owns every connection. It reads requests without blocking and, once one has
+// fully arrived, passes the connection (SCM_RIGHTS) and the request bytes to an idle worker
+// over that worker's channel. The worker runs it, writes the response to the client and
+// answers on the channel with one byte: 1 to keep the connection, 0 to close it. A slow
+// request or a client that stops halfway therefore never delays another connection while
+// some worker is idle.
+
+// Sends fd and the length of the request that follows on chan
+static int send_conn(int chan, int fd, uint32_t len) {
+   uint32_t be = htonl(len);
+   struct iovec iov = { &be, sizeof(be) };
+   union {
+      char buf[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+   } ctl;
+   memset(&ctl, 0, sizeof(ctl));
+   struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+   struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+   cm->cmsg_level = SOL_SOCKET;
+   cm->cmsg_type = SCM_RIGHTS;
+   cm->cmsg_len = CMSG_LEN(sizeof(int));
+   memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+   ssize_t w;
+   while ((w = sendmsg(chan, &msg, 0)) < 0 && errno == EINTR) {}
+   if (w < 0) return -1;
+   return write_full(chan, (char *)&be + w, sizeof(be) - (size_t)w);
+}
+
+// Receives a connection and its request length from chan; -1 once the master is gone
+static int recv_conn(int chan, int *fd, uint32_t *len) {
+   uint32_t be;
+   struct iovec iov = { &be, sizeof(be) };
+   union {
+      char buf[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+   } ctl;
+   struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+   ssize_t r;
+   while ((r = recvmsg(chan, &msg, 0)) < 0 && errno == EINTR) {}
+   struct cmsghdr *cm = r > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+   if (!cm || cm->cmsg_type != SCM_RIGHTS) return -1;
+   memcpy(fd, CMSG_DATA(cm), sizeof(int));
+   if (read_full(chan, (char *)&be + r, sizeof(be) - (size_t)r) != 0) {
+      close(*fd);
+      return -1;
+   }
+   *len = ntohl(be);
+   return 0;
+}
+
+static void worker_loop(int chan) {
+   signal(SIGINT, SIG_DFL);
+   signal(SIGTERM, SIG_DFL);
+   signal(SIGPIPE, SIG_IGN);
+   for (;;) {
+      int fd;
+      uint32_t len;
+      if (recv_conn(chan, &fd, &len) != 0) _exit(0);
+      char *frame = (char *)malloc(len ? len : 1);
+      if (!frame || read_full(chan, frame, len) != 0) _exit(1);
+      char keep = serve_frame(fd, frame, len);
+      free(frame);
+      close(fd);
+      if (write_full(chan, &keep, 1) != 0) _exit(0);
+   }
+}
+
+typedef struct {
+   int fd;         // -1 when the slot is free
+   char *buf;      // request bytes received so far
+   size_t len, cap;
+   bool queued;    // a whole request waits for a worker
+   bool busy;      // a worker is serving it
+} Conn;
+
+typedef struct {
+   pid_t pid;
+   int chan;       // the master's end of the worker's channel
+   int conn;       // connection being served, or -1 when idle
+} Worker;
+
+static Conn g_conns[SERVER_MAX_CONNECTIONS];
+static Worker *g_workers;
+static int g_worker_count;
+static int g_listen_fd = -1;
+// Connections whose request is complete, in arrival order
+static int g_ready[SERVER_MAX_CONNECTIONS];
+static size_t g_ready_head, g_ready_count;
+
+static void conn_close(int i) {
+   close(g_conns[i].fd);
+   free(g_conns[i].buf);
+   memset(&g_conns[i], 0, sizeof(g_conns[i]));
+   g_conns[i].fd = -1;
+}
+
+// Starts worker w; false when fork or socketpair failed
+static bool spawn_worker(int w) {
+   int sv[2];
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return false;
+   pid_t pid = fork();
+   if (pid < 0) {
+      close(sv[0]);
+      close(sv[1]);
+      return false;
+   }
+   if (pid == 0) {
+      // Only the channel stays open: a connection the master closes must really close
+      close(sv[0]);
+      close(g_listen_fd);
+      for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+         if (g_conns[i].fd >= 0) close(g_conns[i].fd);
+      }
+      for (int i = 0; i < g_worker_count; i++) {
+         if (g_workers[i].chan >= 0) close(g_workers[i].chan);
+      }
+      worker_loop(sv[1]);
+      _exit(0);
+   }
+   close(sv[1]);
+   g_workers[w] = (Worker){ .pid = pid, .chan = sv[0], .conn = -1 };
+   return true;
+}
+
+// Reaps worker w after its channel closed, drops the connection it held and starts another
+static void respawn_worker(int w) {
+   Worker *wk = &g_workers[w];
+   close(wk->chan);
+   wk->chan = -1;
+   while (waitpid(wk->pid, NULL, 0) < 0 && errno == EINTR) {}
+   if (wk->conn >= 0) conn_close(wk->conn);
+   wk->conn = -1;
+   wk->pid = 0;
+   if (!g_stopping) spawn_worker(w);
+}
+
+// Queues connection i if its buffer holds a whole request; closes it when malformed
+static void conn_check(int i) {
+   size_t frame_len;
+   int r = frame_scan(g_conns[i].buf, g_conns[i].len, &frame_len);
+   if (r < 0) {
+      conn_close(i);
+   } else if (r > 0) {
+      g_conns[i].queued = true;
+      g_ready[(g_ready_head + g_ready_count++) % SERVER_MAX_CONNECTIONS] = i;
+   }
+}
+
+// Reads what connection i has sent so far, without waiting for more
+static void conn_read(int i) {
+   Conn *c = &g_conns[i];
+   if (c->cap - c->len < 4096) {
+      size_t cap = c->cap ? c->cap * 2 : 8192;
+      char *tmp = (char *)realloc(c->buf, cap);
+      if (!tmp) {
+         conn_close(i);
+         return;
+      }
+      c->buf = tmp;
+      c->cap = cap;
+   }
+   ssize_t r = recv(c->fd, c->buf + c->len, c->cap - c->len, MSG_DONTWAIT);
+   if (r < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return;
+   if (r <= 0) {
+      conn_close(i);
+      return;
+   }
+   c->len += (size_t)r;
+   conn_check(i);
+}
+
+// The next connection whose whole request waits for a worker, or -1
+static int next_ready(void) {
+   while (g_ready_count > 0) {
+      int i = g_ready[g_ready_head];
+      g_ready_head = (g_ready_head + 1) % SERVER_MAX_CONNECTIONS;
+      g_ready_count--;
+      if (g_conns[i].fd >= 0 && g_conns[i].queued) return i;
+   }
+   return -1;
+}
+
+// Hands queued requests to idle workers
+static void dispatch(void) {
+   for (int w = 0; w < g_worker_count && g_ready_count > 0; w++) {
+      Worker *wk = &g_workers[w];
+      if (wk->chan < 0 || wk->conn >= 0) continue;
+      int i = next_ready();
+      if (i < 0) return;
+      Conn *c = &g_conns[i];
+      size_t frame_len;
+      frame_scan(c->buf, c->len, &frame_len);
+      c->queued = false;
+      c->busy = true;
+      wk->conn = i;
+      if (send_conn(wk->chan, c->fd, (uint32_t)frame_len) != 0 || write_full(wk->chan, c->buf, frame_len) != 0) {
+         respawn_worker(w);
+         continue;
+      }
+      // Anything after the request stays for the next one
+      memmove(c->buf, c->buf + frame_len, c->len - frame_len);
+      c->len -= frame_len;
+   }
+}
+
+// Worker w finished its request
+static void worker_done(int w) {
+   Worker *wk = &g_workers[w];
+   char keep;
+   if (read_full(wk->chan, &keep, 1) != 0) {
+      respawn_worker(w);
+      return;
+   }
+   int i = wk->conn;
+   wk->conn = -1;
+   if (i < 0) return;
+   g_conns[i].busy = false;
+   if (!keep) conn_close(i);
+   else conn_check(i);
+}
+
+static void accept_conn(void) {
+   int fd = accept(g_listen_fd, NULL, NULL);
+   if (fd < 0) return; // EAGAIN, or the client gave up
+   int i = 0;
+   while (i < SERVER_MAX_CONNECTIONS && g_conns[i].fd >= 0) i++;
+   if (i == SERVER_MAX_CONNECTIONS) {
+      close(fd);
+      return;
+   }
+   // A client that does not read its response cannot hold a worker forever
+   struct timeval tv = { .tv_sec = SERVER_SEND_TIMEOUT_S };
+   setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+   g_conns[i].fd = fd;
+}
+
+// Polls the listening socket, the workers' channels and the connections waiting for a
+// request, until asked to stop
+static void master_loop(void) {
+   static struct pollfd fds[1 + SERVER_MAX_CONNECTIONS + SERVER_MAX_WORKERS];
+   static int owner[1 + SERVER_MAX_CONNECTIONS + SERVER_MAX_WORKERS]; // conn i, or -1 - worker
+   while (!g_stopping) {
+      nfds_t n = 0;
+      size_t open_conns = 0;
+      for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+         if (g_conns[i].fd < 0) continue;
+         open_conns++;
+         if (g_conns[i].queued || g_conns[i].busy) continue;
+         fds[n] = (struct pollfd){ .fd = g_conns[i].fd, .events = POLLIN };
+         owner[n++] = i;
+      }
+      for (int w = 0; w < g_worker_count; w++) {
+         if (g_workers[w].chan < 0) continue;
+         fds[n] = (struct pollfd){ .fd = g_workers[w].chan, .events = POLLIN };
+         owner[n++] = -1 - w;
+      }
+      if (open_conns < SERVER_MAX_CONNECTIONS) {
+         fds[n] = (struct pollfd){ .fd = g_listen_fd, .events = POLLIN };
+         owner[n++] = SERVER_MAX_CONNECTIONS;
+      }
+      if (poll(fds, n, -1) < 0) {
+         if (errno == EINTR) continue;
+         return;
+      }
+      for (nfds_t k = 0; k < n; k++) {
+         if (!fds[k].revents) continue;
+         if (owner[k] == SERVER_MAX_CONNECTIONS) accept_conn();
+         else if (owner[k] < 0) worker_done(-1 - owner[k]);
+         else conn_read(owner[k]);
+      }
+      dispatch();
+   }
+}
+
+int serve(const char *socket_path, int workers) {
+   if (workers < 1) workers = 1;
+   if (workers > SERVER_MAX_WORKERS) workers = SERVER_MAX_WORKERS;
+
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "Error: socket path too long: %s\n", socket_path);
+      return 1;
+   }
+   strcpy(addr.sun_path, socket_path);
+
+   int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (listen_fd < 0) {
+      perror("socket");
+      return 1;
+   }
+   unlink(socket_path);
+   if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 128) != 0 ||
+       fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK) != 0) {
+      perror(socket_path);
+      close(listen_fd);
+      return 1;
+   }
+
+   // Install handlers without SA_RESTART so poll() below returns on shutdown
+   struct sigaction sa;
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = on_stop_signal;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   // A worker that died shows up as its closed channel, not as a signal
+   signal(SIGPIPE, SIG_IGN);
+
+   g_workers = (Worker *)calloc((size_t)workers, sizeof(Worker));
+   if (!g_workers) {
+      close(listen_fd);
+      return 1;
+   }
+   g_listen_fd = listen_fd;
+   for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) g_conns[i].fd = -1;
+   for (int w = 0; w < workers; w++) g_workers[w].chan = -1;
+   g_worker_count = workers;
+   for (int w = 0; w < workers; w++) {
+      if (!spawn_worker(w)) {
+         perror("fork");
+         g_stopping = 1;
+         break;
+      }
+   }
+   if (!g_stopping) fprintf(stderr, "bt: serving on %s with %d workers\n", socket_path, workers);
+
+   master_loop();
+
+   for (int w = 0; w < workers; w++) {
+      if (g_workers[w].pid > 0) kill(g_workers[w].pid, SIGTERM);
+      if (g_workers[w].chan >= 0) close(g_workers[w].chan);
+   }
+   while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {}
+   for (int i = 0; i < SERVER_MAX_CONNECTIONS; i++) {
+      if (g_conns[i].fd >= 0) conn_close(i);
+   }
+   free(g_workers);
+   g_workers = NULL;
+   close(listen_fd);
+   unlink(socket_path);
+   return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*
+ * Persistent interpreter daemon on a Unix domain socket.
+ *
+ * All integers are 32-bit big-endian. A connection carries any number of
+ * request/response pairs until the client closes it. The master process holds
+ * every connection and hands each request, once it has fully arrived, to
+ * whichever worker is idle, so clients may keep more connections open than
+ * there are workers and a slow request only occupies its own worker.
+ *
+ *   request:  argc, then argc x (len, bytes), then (len, program source)
+ *   response: status, (len, stdout bytes), (len, stderr bytes)
+ *
+ * The arguments are the same run flags the command line accepts; program
+ * paths are rejected because the source always travels in the request.
+ */
+
+#define SERVER_DEFAULT_WORKERS 4
+#define SERVER_MAX_ARGS 64
+#define SERVER_MAX_FRAME (16u * 1024u * 1024u)
+#define SERVER_MAX_WORKERS 256
+#define SERVER_MAX_CONNECTIONS 1024 // open connections in all
+#define SERVER_SEND_TIMEOUT_S 5     // for a client to take its response
+
+/**
+ * @brief Binds socket_path and serves requests with a pool of pre-forked workers
+ * Returns after SIGINT/SIGTERM once all workers have exited.
+ * @return 0 on clean shutdown, 1 if the socket could not be set up
+ * @param socket_path Filesystem path of the listening socket (replaced if present)
+ * @param workers Number of worker processes; each runs one request at a time
+ */
+int serve(const char *socket_path, int workers);
+
+#endif
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fmt.h"
+#include "profile.h"
+#include "strbuf.h"
+
+#define SB_MIN_CAP 32
+
+void sb_init(StrBuf *b, size_t hint) {
+   b->data = NULL;
+   b->len = b->cap = 0;
+   b->failed = false;
+   if (hint) sb_reserve(b, hint);
+}
+
+bool sb_reserve(StrBuf *b, size_t n) {
+   if (b->failed) return false;
+   size_t need = b->len + n + 1;
+   if (need <= b->cap) return true;
+   // The first allocation takes the hint as is; later ones double
+   size_t cap = b->cap ? b->cap : need > SB_MIN_CAP ? need : SB_MIN_CAP;
+   while (cap < need) cap *= 2;
+   char *data = (char *)prof_realloc(b->data, cap);
+   if (!data) {
+      b->failed = true;
+      return false;
+   }
+   if (!b->data) data[0] = '\0';
+   b->data = data;
+   b->cap = cap;
+   return true;
+}
+
+void sb_append(StrBuf *b, const char *s, size_t n) {
+   if (!sb_reserve(b, n)) return;
+   memcpy(b->data + b->len, s, n);
+   b->len += n;
+   b->data[b->len] = '\0';
+}
+
+void sb_puts(StrBuf *b, const char *s) {
+   sb_append(b, s, strlen(s));
+}
+
+void sb_putc(StrBuf *b, char c) {
+   sb_append(b, &c, 1);
+}
+
+void sb_pad(StrBuf *b, char c, size_t n) {
+   if (!sb_reserve(b, n)) return;
+   memset(b->data + b->len, c, n);
+   b->len += n;
+   b->data[b->len] = '\0';
+}
+
+void sb_long(StrBuf *b, long v) {
+   char digits[FMT_LONG_MAX];
+   sb_append(b, digits, fmt_long(digits, v));
+}
+
+void sb_hex(StrBuf *b, unsigned long v) {
+   char digits[FMT_HEX_MAX];
+   sb_append(b, digits, fmt_hex(digits, v));
+}
+
+void sb_double(StrBuf *b, double v) {
+   char digits[FMT_DOUBLE_MAX];
+   sb_append(b, digits, fmt_double(digits, v));
+}
+
+void sb_clear(StrBuf *b) {
+   b->len = 0;
+   b->failed = false; // data, if any, is still the last good allocation
+   if (b->data) b->data[0] = '\0';
+}
+
+char *sb_take(StrBuf *b) {
+   if (!b->data) sb_reserve(b, 0); // the empty text
+   char *data = b->failed ? NULL : b->data;
+   if (!data) {
+      free(b->data);
+   } else if (b->cap - b->len > SB_MIN_CAP) {
+      // Kept texts (trace rows) should not carry the slack of the last doubling
+      char *trim = (char *)prof_realloc(data, b->len + 1);
+      if (trim) data = trim;
+   }
+   sb_init(b, 0);
+   return data;
+}
+
+void sb_free(StrBuf *b) {
+   free(b->data);
+   sb_init(b, 0);
+}
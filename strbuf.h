@@ -0,0 +1,67 @@
+#ifndef STRBUF_H
+#define STRBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Growable string builder for the formatters.
+ *
+ * The text stays null-terminated and grows geometrically, so appends never
+ * truncate and cost amortized O(1). A reserve hint sized from the previous
+ * result of the same kind usually makes the first allocation the only one.
+ * Allocations go through prof_realloc, so --profile charges them to the
+ * phase that builds the text. After a failed allocation the builder drops
+ * every later append and sb_take() returns NULL.
+ */
+
+typedef struct {
+   char *data;   // NULL until the first allocation
+   size_t len;   // bytes of text, not counting the NUL
+   size_t cap;   // bytes allocated
+   bool failed;
+} StrBuf;
+
+#define SB_INIT { NULL, 0, 0, false }
+
+/**
+ * @brief Starts an empty builder with room for hint bytes of text (0 allocates on first append)
+ */
+void sb_init(StrBuf *b, size_t hint);
+
+/**
+ * @brief Makes room for n more bytes of text
+ * @return false when out of memory (the builder is then failed)
+ */
+bool sb_reserve(StrBuf *b, size_t n);
+
+void sb_append(StrBuf *b, const char *s, size_t n);
+void sb_puts(StrBuf *b, const char *s);
+void sb_putc(StrBuf *b, char c);
+
+/**
+ * @brief Appends n copies of c
+ */
+void sb_pad(StrBuf *b, char c, size_t n);
+
+/**
+ * @brief Appends v formatted as fmt.h does ("%ld", "%lx", "%g")
+ */
+void sb_long(StrBuf *b, long v);
+void sb_hex(StrBuf *b, unsigned long v);
+void sb_double(StrBuf *b, double v);
+
+/**
+ * @brief Empties the text, keeps the allocation for reuse and clears a failed state
+ */
+void sb_clear(StrBuf *b);
+
+/**
+ * @brief Hands the text to the caller (release with free) and leaves the builder empty
+ * @return The text, or NULL if an allocation failed
+ */
+char *sb_take(StrBuf *b);
+
+void sb_free(StrBuf *b);
+
+#endif
@@ -9,7 +9,8 @@ assert_contains() {
   local haystack="$1"
   local needle="$2"
   local msg="$3"
-  if echo "$haystack" | grep -Fq "$needle"; then
+  # A here-string avoids SIGPIPE from echo (fatal under pipefail) when grep -q exits early
+  if grep -Fq -- "$needle" <<< "$haystack"; then
     echo "[PASS] $msg"
     pass=$((pass+1))
   else
@@ -40,6 +41,218 @@ assert_contains "$out2" "iter 1: x = x + i;" "t2: first iter body row present"
 assert_contains "$out2" "iter 2: i = i + 2;" "t2: second iter body row present"
 assert_contains "$out2" "x = 13" "t2: stack diagram shows x = 13 final value"
 
+###############################################################################
+# Test 3: result cache hits across whitespace/comment-only edits (file mode)
+###############################################################################
+cache_dir=$(mktemp -d)
+tmp_prog="$cache_dir/prog.c"
+printf 'int x = 5;\n// note\nx   =   x + 3;\n' > "$tmp_prog"
+out3a=$(./br --cache-dir "$cache_dir/c" --cache-stats examples/test.c 2>&1)
+out3b=$(printf 'int x=5; x=x+3;' | ./br --cache-dir "$cache_dir/c" 2>/dev/null)
+out3c=$(./br --cache-dir "$cache_dir/c" --cache-stats "$tmp_prog" 2>&1)
+assert_contains "$out3a" "1 misses, 1 stores" "t3: first run is a cache miss"
+assert_contains "$out3c" "1 disk hits" "t3: reformatted program hits the disk cache"
+assert_contains "$out3c" "$out3b" "t3: cached output matches a fresh run"
+rm -rf "$cache_dir"
+
+###############################################################################
+# Test 4: execution budgets stop a non-terminating loop with a partial trace
+###############################################################################
+set +e
+out4=$(printf 'int i = 0; while (1) { i = i + 1; }' | ./br --max-iterations 4)
+rc4=$?
+out4b=$(printf 'int i = 0; while (1) { }' | ./br --max-time-ms 100)
+rc4b=$?
+set -e
+assert_contains "$out4" "iter 4: i = i + 1;" "t4: partial trace is flushed"
+assert_contains "$out4" "[truncated: loop iteration limit of 4 reached]" "t4: trace is marked truncated"
+assert_contains "rc=$rc4" "rc=3" "t4: truncated run exits with status 3"
+assert_contains "$out4b" "[truncated: time (ms) limit of 100 reached]" "t4: wall-clock limit stops an empty loop"
+
+###############################################################################
+# Test 5: --profile reports phases on stderr without changing stdout
+###############################################################################
+out5=$(./br --no-cache --profile=json examples/test.c 2>&1 >/dev/null)
+assert_contains "$out5" '"name":"tokenize","calls":1' "t5: tokenize phase is timed once"
+assert_contains "$out5" '"name":"format","calls":10' "t5: one format call per trace row"
+assert_contains "$out5" '"peak_rss_kb":' "t5: peak RSS is reported"
+
+###############################################################################
+# Test 6: --stmt-profile counts statements per source line
+###############################################################################
+# The hot-loop '*' column depends on wall time, so it is blanked before matching
+out6=$(printf 'int i = 0;\nint x = 1;\nwhile (i < 300) {\n  i = i + 1;\n}\n' | ./br --stmt-profile 2>&1 | sed "s/^\*/ /")
+assert_contains "$out6" "Statement profile" "t6: profile section is printed"
+assert_contains "$out6" "[300 iterations]" "t6: while iterations are counted"
+assert_contains "$(grep 'i = i + 1;$' <<< "$out6")" "       300 " "t6: loop body count"
+
+###############################################################################
+# Test 7: float and double expressions follow C's arithmetic conversions
+###############################################################################
+out7=$(printf 'double x = 1.5;\nint i = 3;\ndouble y = x * i + 2;\nfloat f = 0.5f * 3;\ni = y;\ndouble q = 7 / 2;\ndouble r = 7 / 2.0;\n' | ./br --no-cache)
+assert_contains "$out7" "y |-> 6.5" "t7: int operand is promoted to double"
+assert_contains "$out7" "f |-> 1.5" "t7: float literal and arithmetic"
+assert_contains "$out7" "i |-> 6;" "t7: double is truncated when assigned to int"
+assert_contains "$out7" "q |-> 3;" "t7: int division happens before the conversion"
+assert_contains "$out7" "r |-> 3.5}" "t7: mixed division is done in double"
+
+###############################################################################
+# Test 8: char arrays and pointers live in the simulated address space
+###############################################################################
+out8=$(printf 'char[4] buf;\nbuf[1] = 65;\nchar *p = buf;\nint x = p[1];\nbuf[4] = 1;\nchar *h = malloc(32);\nfree(h);\nint y = h[0];\n' | ./br --no-cache 2>&1)
+assert_contains "$out8" "buf |-> 0x1000" "t8: arrays get stable stack addresses"
+assert_contains "$out8" "x |-> 65" "t8: element written through the array is read through a pointer"
+assert_contains "$out8" "Index 4 is out of bounds for 'buf' (length 4)" "t8: accesses are bounds-checked"
+assert_contains "$out8" "h |-> 0x100000" "t8: malloc returns a heap address"
+assert_contains "$out8" "'h' points to memory that was released" "t8: use after free is reported"
+
+###############################################################################
+# Test 9: affine loops run in closed form; --loop-summary compresses their rows
+###############################################################################
+out9=$(printf 'int i = 0;\nint x = 0;\nwhile (i < 3000000000) {\n  x = x + i;\n  i = i + 1;\n}\n' | ./br --no-cache --loop-summary)
+assert_contains "$out9" "iter 2..2999999999: 2999999998 iterations in closed form" "t9: middle iterations become one row"
+assert_contains "$out9" "iter 3000000000: i = i + 1;" "t9: the last iteration is traced"
+assert_contains "$out9" "S = {i |-> 3000000000; x |-> 4499999998500000000}" "t9: final values are exact"
+out9b=$(./br --no-cache examples/test.c)
+assert_contains "$out9b" "iter 2: i = i + 2; | S = {i |-> 8; x |-> 13}" "t9: replayed rows match the interpreter"
+
+###############################################################################
+# Test 10: diagnostics carry the source position of the token or statement
+###############################################################################
+out10=$(printf 'int x = 5;\nx = x + ;\nchar[2] b;\nb[3] = 1;\n' | ./br --no-cache 2>&1)
+assert_contains "$out10" "2:9: Error: Expected number or identifier in expression but found ';'." "t10: syntax errors point at the token"
+assert_contains "$out10" "4:1: Error: Index 3 is out of bounds" "t10: runtime errors point at the statement"
+out10b=$(printf 'int x = 5;\n  int y = x $' | ./br --no-cache 2>&1 || true)
+assert_contains "$out10b" "2:13: Lexer error: Invalid character" "t10: lexer errors are located"
+
+###############################################################################
+# Test 11: --stream prints one JSON line per row, then a done record
+###############################################################################
+out11=$(printf 'int i = 0; while (1) { i = i + 1; }' | ./br --stream --max-iterations 2 || true)
+assert_contains "$out11" '{"step":2,"command":"iter 1: i = i + 1;","binding":"S = {i |-> 1}","stack":"Top [i]"' "t11: rows are JSON records"
+assert_contains "$out11" '{"done":true,"rows":3,"truncated":"loop iteration limit of 2 reached"}' "t11: the last record reports truncation"
+
+###############################################################################
+# Test 12: values print exactly like printf's %ld and %g
+###############################################################################
+out12=$(printf 'double d = 1000000.0;\nd = d * 10.0;\ndouble e = 1.0;\ne = e / 30000.0;\ndouble h = 2.5;\nh = h / 100000.0;\nint n = 0 - 9223372036854775807;\n' | ./br --no-cache)
+assert_contains "$out12" "d |-> 1e+07;" "t12: large doubles switch to exponent notation"
+assert_contains "$out12" "e |-> 3.33333e-05;" "t12: six significant digits"
+assert_contains "$out12" "h |-> 2.5e-05;" "t12: trailing zeros are dropped"
+assert_contains "$out12" "n |-> -9223372036854775807}" "t12: negative ints"
+
+###############################################################################
+# Test 13: functions get activation records; recursion is bounded
+###############################################################################
+out13=$(printf 'int n = 7;\nint fact(int n) {\n  while (n < 2) { return 1; }\n  return n * fact(n - 1);\n}\ndouble half(int x) { return x / 2.0; }\nint f = fact(10);\ndouble h = half(n);\nint down(int k) { return down(k - 1); }\nint d = down(3);\n' | ./br --no-cache --max-call-depth 50 2>&1)
+assert_contains "$out13" "S = {n |-> 7; f |-> 3628800}" "t13: recursive calls return values; the global n is shadowed, not changed"
+assert_contains "$out13" "S = {n |-> 7; f |-> ?; n |-> 2}" "t13: a call binds its parameters after the globals"
+assert_contains "$out13" "Top [n]->[fact()]->[n]->[fact()]->" "t13: each activation has a frame on the stack"
+assert_contains "$out13" "h |-> 3.5}" "t13: arguments and results are converted to the declared types"
+assert_contains "$out13" "Error: Calling 'down' exceeds the maximum call depth of 50." "t13: runaway recursion is stopped"
+
+###############################################################################
+# Test 14: long rows are not truncated
+###############################################################################
+out14=$(printf 'int n = 30;\nint down(int k) { while (k < 1) { return 0; } return down(k - 1); }\nint d = down(n);\n' | ./br --no-cache 2>&1)
+assert_contains "$out14" "[k]->[down()]->[d]->[n] |" "t14: a deep stack keeps its bottom frames"
+
+###############################################################################
+# Test 15: --diff compares two traces by state and stops at the first divergence
+###############################################################################
+diff_dir=$(mktemp -d)
+printf 'int x = 1;\nint i = 0;\nwhile (i < 5) {\n  x = x + i;\n  i = i + 1;\n}\n' > "$diff_dir/ref.c"
+printf 'int x = 1;\nint i = 0;\nwhile (i < 5) {\n  x = x + 2;\n  i = i + 1;\n}\n' > "$diff_dir/student.c"
+printf 'int x = 1;  int i = 0;\nwhile (i < 5) { x = x + i; i = i + 1; }\n' > "$diff_dir/same.c"
+out15a=$(./br --diff "$diff_dir/ref.c" "$diff_dir/same.c" 2>&1)
+assert_contains "$out15a" "Traces match: 12 steps." "t15: equal traces match"
+status15=0
+out15b=$(./br --diff "$diff_dir/ref.c" "$diff_dir/student.c" 2>&1) || status15=$?
+assert_contains "$out15b" "First divergence at step 3:" "t15: the first divergent step is reported"
+assert_contains "$out15b" "iter 1: x = x + 2;" "t15: with the command of each program"
+assert_contains "$out15b" "  x: 1 vs 3" "t15: and the differing variables"
+assert_contains "status $status15" "status 1" "t15: differing traces exit with status 1"
+rm -rf "$diff_dir"
+
+###############################################################################
+# Test 16: --program-cache maps the compiled program instead of lexing again
+###############################################################################
+prog_dir=$(mktemp -d)
+out16a=$(./br --no-cache --program-cache "$prog_dir" --cache-stats examples/test.c 2>&1)
+out16b=$(./br --no-cache --program-cache "$prog_dir" --cache-stats examples/test.c 2>&1)
+assert_contains "$out16a" "programs: 0 loads, 1 compiles, 1 stores, 0 stale" "t16: the first run compiles and stores an image"
+assert_contains "$out16b" "programs: 1 loads, 0 compiles, 0 stores, 0 stale" "t16: the next run maps it"
+assert_contains "$out16b" "$(./br --no-cache examples/test.c)" "t16: a mapped program runs like a compiled one"
+for img in "$prog_dir"/*.btp; do truncate -s 64 "$img"; done
+out16c=$(./br --no-cache --program-cache "$prog_dir" --cache-stats examples/test.c 2>&1)
+assert_contains "$out16c" "programs: 0 loads, 1 compiles, 1 stores, 1 stale" "t16: a damaged image is recompiled"
+# Point the first '{' token's brace span far past the end of the image
+for img in "$prog_dir"/*.btp; do
+  brace=$(grep -obUaP '\{\x00' "$img" | head -1 | cut -d: -f1)
+  printf '\x00\xe1\xf5\x05' | dd of="$img" bs=1 seek=$((brace + 72)) conv=notrunc 2>/dev/null
+done
+out16d=$(./br --no-cache --program-cache "$prog_dir" --cache-stats examples/test.c 2>&1)
+assert_contains "$out16d" "programs: 0 loads, 1 compiles, 1 stores, 1 stale" "t16: an image with a token out of range is recompiled"
+assert_contains "$out16d" "$(./br --no-cache examples/test.c)" "t16: and runs like a compiled one"
+rm -rf "$prog_dir"
+
+###############################################################################
+# Test 17: --batch runs one program over a table of initial states
+###############################################################################
+batch_dir=$(mktemp -d)
+printf 'i x\n4 3\n5, 1\n# skipped\n8 0\n' > "$batch_dir/inputs.txt"
+printf 'while (i < 7) {\n  x = x + i;\n  i = i + 2;\n}\nint q = x / (i - 8);\n' > "$batch_dir/sweep.c"
+out17a=$(./br --batch "$batch_dir/inputs.txt" "$batch_dir/sweep.c" 2>&1)
+assert_contains "$out17a" "2: S = {i |-> 7; x |-> 6; q |-> -6}" "t17: each input gets its final binding table"
+assert_contains "$out17a" "1: S = {i |-> 8; x |-> 13; q |-> ?}" "t17: an input with a runtime error is interpreted"
+assert_contains "$out17a" "input 1: 5:1: Error: Division by zero." "t17: and its diagnostics name the input"
+assert_contains "$out17a" "Inputs: 3 (1 in lanes, 2 interpreted)." "t17: the other inputs run in lanes"
+printf 'int f(int a) { return a + 1; }\nx = f(i);\n' > "$batch_dir/call.c"
+out17b=$(./br --batch "$batch_dir/inputs.txt" "$batch_dir/call.c" 2>&1)
+assert_contains "$out17b" "3: S = {i |-> 8; x |-> 9}" "t17: programs outside the lane subset are interpreted"
+status17=0
+printf 'i x\n1\n' > "$batch_dir/short.txt"
+out17c=$(./br --batch "$batch_dir/short.txt" "$batch_dir/sweep.c" 2>&1) || status17=$?
+assert_contains "$out17c$status17" "expected 2 values but found 1.2" "t17: a malformed inputs file exits with status 2"
+rm -rf "$batch_dir"
+
+###############################################################################
+# Test 18: --watch, --break-line, --when and --sample choose the steps that get a row
+###############################################################################
+prog18='int i = 0;\nint x = 0;\nint y = 5;\nwhile (i < 10) {\n  x = x + i;\n  y = y + 0;\n  i = i + 1;\n}\ny = 7;\n'
+out18a=$(printf "$prog18" | ./br --no-cache --watch y)
+assert_contains "$out18a" "| int y = 5; |" "t18: a watched variable is traced when it is bound"
+assert_contains "$out18a" "| y = 7;     |" "t18: and when it changes"
+assert_contains "rows $(grep -c ' |-> ' <<< "$out18a")" "rows 2" "t18: steps that leave it alone get no row"
+out18b=$(printf "$prog18" | ./br --no-cache --when 'x > 20' --watch i)
+assert_contains "$out18b" "| iter 7: i = i + 1;  | S = {i |-> 7; x |-> 21; y |-> 5}" "t18: --when starts the trace where the condition first holds"
+assert_contains "rows $(grep -c ' |-> ' <<< "$out18b")" "rows 4" "t18: and nothing before it is traced"
+out18c=$(printf "$prog18" | ./br --no-cache --break-line 6 --sample 1/4)
+assert_contains "$out18c" "| iter 1: y = y + 0;" "t18: --break-line starts at the first step on that line"
+assert_contains "$out18c" "| iter 2: i = i + 1;" "t18: --sample keeps one step in every N"
+assert_contains "rows $(grep -c ' |-> ' <<< "$out18c")" "rows 8" "t18: and skips the others"
+cache18=$(mktemp -d)
+out18e=$(printf 'int a = 1;\nint b = 2; int c = 3;\n' | ./br --cache-dir "$cache18" --break-line 2)
+out18f=$(printf 'int a = 1; int b = 2;\nint c = 3;\n' | ./br --cache-dir "$cache18" --break-line 2)
+assert_contains "rows $(grep -c ' |-> ' <<< "$out18e")" "rows 2" "t18: --break-line traces from line 2"
+assert_contains "$out18f" "| int c = 3; |" "t18: a reflowed copy of the program is traced from its own line 2"
+assert_contains "rows $(grep -c ' |-> ' <<< "$out18f")" "rows 1" "t18: not served the cached trace of the first"
+rm -rf "$cache18"
+status18=0
+out18d=$(printf "$prog18" | ./br --no-cache --when 'x >' 2>&1) || status18=$?
+assert_contains "$out18d$status18" "expects a condition such as 'x > 100', not 'x >'.2" "t18: a malformed condition exits with status 2"
+
+###############################################################################
+# Test 19: --final-only prints just the final binding table
+###############################################################################
+prog19='int f(int n) { return n + 1; }\nint i = 0;\nwhile (i < 3) { i = f(i); }\nreturn 0;\n'
+out19a=$(printf "$prog19" | ./br --no-cache --final-only)
+assert_contains "$out19a" "S = {i |-> 3}" "t19: --final-only prints the table after the last step"
+assert_contains "lines $(wc -l <<< "$out19a")" "lines 1" "t19: and nothing else"
+status19=0
+out19b=$(printf "$prog19" | ./br --final-only --max-steps 3) || status19=$?
+assert_contains "$out19b$status19" "S = {i |-> 1} [truncated: statement limit of 3 reached]3" "t19: a truncated run says why and exits with status 3"
+
 echo
 echo "Passed: $pass, Failed: $fail"
 if [ "$fail" -gt 0 ]; then
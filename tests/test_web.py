@@ -1,6 +1,8 @@
 import json
 import os
+import subprocess
 import sys
+import time
 
 import pytest
 
@@ -32,3 +34,268 @@ def test_run_stack_output(client):
     assert resp.status_code == 200
     data = resp.get_json()
     assert 'Stack evolution by step:' in data['stdout']
+
+
+def test_run_infinite_loop_is_truncated(client):
+    resp = client.post('/run', data={'code': 'int i = 0; while (1) { i = i + 1; }', 'max_iterations': '5'})
+    data = resp.get_json()
+    assert data['ok'] is False
+    assert data['truncated'] is True
+    assert 'iter 5: i = i + 1;' in data['stdout']
+    assert 'iter 6:' not in data['stdout']
+    assert '[truncated: loop iteration limit of 5 reached]' in data['stdout']
+
+
+def sse_events(chunks):
+    events = []
+    for block in b''.join(chunks).decode().split('\n\n'):
+        if block:
+            name, data = block.split('\n', 1)
+            events.append((name[len('event: '):], json.loads(data[len('data: '):])))
+    return events
+
+
+def test_run_stream_rows_then_done(client):
+    resp = client.post('/run/stream', data={'code': 'int i = 0; while (i < 2) { i = i + 1; }'})
+    assert resp.mimetype == 'text/event-stream'
+    events = sse_events(resp.response)
+    assert [name for name, _ in events] == ['row', 'row', 'row', 'done']
+    assert events[2][1]['command'] == 'iter 2: i = i + 1;'
+    assert events[2][1]['binding'] == 'S = {i |-> 2}'
+    assert events[3][1] == {'ok': True, 'truncated': False, 'reason': None, 'stderr': ''}
+
+
+def test_run_stream_first_row_before_exit_and_cancel(client, monkeypatch):
+    import app as app_module
+    subprocess.run(['make', '-s', 'bt'], cwd=REPO_ROOT, check=True)
+    procs = []
+
+    class Recording(subprocess.Popen):
+        def __init__(self, *args, **kwargs):
+            super().__init__(*args, **kwargs)
+            procs.append(self)
+
+    monkeypatch.setattr(app_module.subprocess, 'Popen', Recording)
+    code = 'int i = 0; while (1) { i = i / 1 + 1; }'
+    resp = client.post('/run/stream', data={'code': code, 'max_iterations': '10000000'}, buffered=False)
+    started = time.monotonic()
+    first = next(iter(resp.response))
+    assert time.monotonic() - started < 1.0
+    assert sse_events([first])[0][1]['command'] == 'int i = 0;'
+    assert procs[0].poll() is None  # still running
+    resp.close()  # what the server does when the client disconnects
+    assert procs[0].poll() is not None
+
+
+def start_daemon(sock, workers):
+    subprocess.run(['make', '-s', 'bt'], cwd=REPO_ROOT, check=True)
+    proc = subprocess.Popen([os.path.join(REPO_ROOT, 'bt'), '--serve', sock, '--workers', str(workers)],
+                            stderr=subprocess.DEVNULL)
+    for _ in range(100):
+        if os.path.exists(sock):
+            break
+        time.sleep(0.01)
+    return proc
+
+
+@pytest.fixture()
+def daemon(tmp_path):
+    sock = str(tmp_path / 'bt.sock')
+    proc = start_daemon(sock, 2)
+    yield sock
+    proc.terminate()
+    proc.wait(timeout=5)
+
+
+def test_run_via_daemon(daemon, monkeypatch):
+    monkeypatch.setenv('BT_SOCKET', daemon)
+    client = create_app().test_client()
+    for _ in range(3):  # pooled connection is reused across requests
+        data = client.post('/run', data={'code': 'int x = 5; x = x + 3;'}).get_json()
+        assert data['ok'] is True
+        assert 'S = {x |-> 8}' in data['stdout']
+    data = client.post('/run', data={'code': 'int x = 5; $'}).get_json()
+    assert data['ok'] is False
+    assert 'Invalid character' in data['stderr']
+
+
+def test_daemon_serves_more_connections_than_workers(daemon):
+    import threading
+    from btclient import BtClient
+    # Every client keeps its connection open between requests, as the web app's pool does
+    clients = [BtClient(daemon, timeout=10.0) for _ in range(6)]
+    results = [None] * len(clients)
+
+    def work(k):
+        for _ in range(3):
+            results[k] = clients[k].run(f'int x = {k}; x = x + 1;', ['--no-cache'])
+
+    threads = [threading.Thread(target=work, args=(k,)) for k in range(len(clients))]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    for k, (status, out, _) in enumerate(results):
+        assert status == 0
+        assert f'S = {{x |-> {k + 1}}}'.encode() in out
+    for c in clients:
+        c.close()
+
+
+def test_daemon_hands_requests_to_any_idle_worker(daemon):
+    import socket
+    import threading
+    from btclient import BtClient
+    slow, fast = BtClient(daemon, timeout=30.0), BtClient(daemon, timeout=30.0)
+    # Both connections are open before the slow request starts
+    assert slow.run('int x = 1;', ['--no-cache'])[0] == 0
+    assert fast.run('int x = 1;', ['--no-cache'])[0] == 0
+    slow_code = 'int i = 0;\nwhile (i < 3000000) { i = i + 1; }\n'
+    started = time.monotonic()
+    thread = threading.Thread(target=slow.run, args=(slow_code, ['--no-cache', '--final-only']))
+    thread.start()
+    time.sleep(0.05)
+    fast_started = time.monotonic()
+    assert fast.run('int y = 2;', ['--no-cache'])[0] == 0
+    fast_time = time.monotonic() - fast_started
+    thread.join()
+    slow_time = time.monotonic() - started
+    assert fast_time < slow_time / 2
+    slow.close()
+    fast.close()
+
+
+def test_daemon_partial_request_holds_no_worker(tmp_path):
+    import socket
+    from btclient import BtClient
+    sock = str(tmp_path / 'one.sock')
+    proc = start_daemon(sock, 1)
+    try:
+        client = BtClient(sock, timeout=2.0)
+        assert client.run('int x = 1;', ['--no-cache'])[0] == 0
+        # The source's length says 256 bytes, but only 3 arrive
+        half = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        half.connect(sock)
+        half.sendall(b'\x00\x00\x00\x00\x00\x00\x01\x00int')
+        time.sleep(0.05)
+        started = time.monotonic()
+        for _ in range(3):
+            assert client.run('int z = 3;', ['--no-cache'])[0] == 0
+        assert time.monotonic() - started < 1.0
+        half.close()
+        client.close()
+    finally:
+        proc.terminate()
+        proc.wait(timeout=5)
+
+
+def test_run_via_libbt(monkeypatch):
+    subprocess.run(['make', '-s', 'libbt.so'], cwd=REPO_ROOT, check=True)
+    monkeypatch.setenv('BT_BACKEND', 'lib')
+    client = create_app().test_client()
+    data = client.post('/run', data={'code': 'int i; int x; i = 4; x = 3; while (i < 7) { x = x + i; i = i + 2; }'}).get_json()
+    assert data['ok'] is True
+    assert 'iter 2: i = i + 2;' in data['stdout']
+
+
+def test_libbt_threads_and_trace():
+    import threading
+    from libbt import LibBt
+    subprocess.run(['make', '-s', 'libbt.so'], cwd=REPO_ROOT, check=True)
+    lib = LibBt()
+    before = lib.cache_stats()
+    lib.run('int q = 1;')
+    lib.run('int   q=1 ;')
+    after = lib.cache_stats()
+    assert after['mem_hits'] == before['mem_hits'] + 1
+
+    status, rows, _ = lib.trace('int x = 5; x = x + 3;')
+    assert status == 0
+    assert [r['binding'] for r in rows] == ['S = {x |-> 5}', 'S = {x |-> 8}']
+
+    results = []
+
+    def worker(n):
+        status, out, _ = lib.run(f'int x = {n}; x = x + 1;')
+        results.append((n, status, out.decode()))
+
+    threads = [threading.Thread(target=worker, args=(n,)) for n in range(16)]
+    for th in threads:
+        th.start()
+    for th in threads:
+        th.join()
+    assert len(results) == 16
+    for n, status, out in results:
+        assert status == 0
+        assert f'S = {{x |-> {n + 1}}}' in out
+
+
+def test_libbt_incremental_resumes_unchanged_prefix():
+    from libbt import LibBt
+    subprocess.run(['make', '-s', 'libbt.so'], cwd=REPO_ROOT, check=True)
+    lib = LibBt()
+    base = 'int i = 0; char[4] b; b[1] = 7; while (i < 400) { i = i + 1; }\n'
+    for tail in ('', 'int t = i + b[1];', 'int t = i * 2; int u = t;'):
+        code = base + tail
+        full = lib.run(code, ['--no-cache'])
+        status, out, err = lib.run(code, ['--no-cache', '--incremental', '--cache-stats'])
+        assert (status, out) == full[:2]
+    resumes = [l for l in err.decode().splitlines() if l.startswith('checkpoints:')]
+    assert resumes and not resumes[0].startswith('checkpoints: 0 resumes')
+
+
+def test_libbt_sessions_step_like_a_full_run():
+    from libbt import LibBt
+    subprocess.run(['make', '-s', 'libbt.so'], cwd=REPO_ROOT, check=True)
+    lib = LibBt()
+    code = ('int fact(int n) { while (n < 2) { return 1; } return n * fact(n - 1); }\n'
+            'int i = 0;\nint s = 0;\nwhile (i < 4) { s = s + fact(i); i = i + 1; }\nchar[3] b;\n')
+    _, full, _ = lib.trace(code)
+    # Two sessions of the same program stepped in turn do not disturb each other
+    a, b = lib.session(code), lib.session(code)
+    rows_a, rows_b = [], []
+    while not (a.done and b.done):
+        for session, rows in ((a, rows_a), (b, rows_b)):
+            if not session.done:
+                rows += session.step(1)[0]
+    a.close()
+    b.close()
+    assert rows_a == full and rows_b == full
+    # A closed session raises instead of handing libbt a NULL handle, and libbt refuses one
+    with pytest.raises(ValueError):
+        a.step(1)
+    with pytest.raises(ValueError):
+        a.truncated()
+    from libbt import _Result
+    import ctypes
+    assert lib._lib.bt_step(None, 1, ctypes.byref(_Result())) == -2
+    assert lib._lib.bt_session_truncated(None) is None
+
+
+def test_step_session_runs_lazily(client):
+    # /step/start builds libbt.so itself when it is missing
+    if os.path.exists(os.path.join(REPO_ROOT, 'libbt.so')):
+        os.remove(os.path.join(REPO_ROOT, 'libbt.so'))
+    code = 'int i = 0;\nwhile (1) {\n  i = i + 1;\n}\nint j = 1;'
+    resp = client.post('/step/start', data={'code': code, 'max_iterations': '5'})
+    sid = resp.get_json()['session']
+    data = client.post(f'/step/{sid}', data={'count': '2'}).get_json()
+    assert [r['command'] for r in data['rows']] == ['int i = 0;', 'iter 1: i = i + 1;']
+    assert data['done'] is False
+    data = client.post(f'/step/{sid}', data={'line': '3', 'count': '10'}).get_json()
+    assert [r['command'] for r in data['rows']] == ['iter 2: i = i + 1;']
+    # The loop never ends, so running to a line after it stops at the budget
+    data = client.post(f'/step/{sid}', data={'line': '5'}).get_json()
+    assert data['rows'][-1]['command'] == 'iter 5: i = i + 1;'
+    assert data['done'] is True and data['truncated'] is True
+    assert 'loop iteration limit' in data['reason']
+    assert client.post(f'/step/{sid}').status_code == 404
+
+
+def test_step_start_reports_a_missing_library(monkeypatch, tmp_path):
+    monkeypatch.setenv('BT_LIB', str(tmp_path / 'missing.so'))
+    client = create_app().test_client()
+    resp = client.post('/step/start', data={'code': 'int x = 1;'})
+    assert resp.status_code == 503
+    data = resp.get_json()
+    assert data['ok'] is False and 'make libbt.so' in data['stderr']
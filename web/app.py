@@ -1,19 +1,71 @@
-from flask import Flask, request, render_template, jsonify
+from flask import Flask, Response, request, render_template, jsonify
+import json
 import subprocess
 import os
+import tempfile
+import threading
+import time
+import uuid
+
+from btclient import BtClient
+
+# Exit status of a run stopped by an execution budget (RUN_EXIT_TRUNCATED in run.h)
+TRUNCATED_STATUS = 3
 
 
 def create_app():
     app = Flask(__name__, template_folder="templates", static_folder="static")
+    repo_root = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
 
-    @app.get("/")
-    def index():
-        return render_template("index.html")
+    # BT_BACKEND selects how programs run:
+    #   subprocess (default) - spawn `br` per request
+    #   socket               - a running `bt --serve` daemon at BT_SOCKET, over pooled connections
+    #   lib                  - in-process through libbt.so (BT_LIB overrides its path)
+    socket_path = os.environ.get("BT_SOCKET")
+    backend = os.environ.get("BT_BACKEND", "socket" if socket_path else "subprocess")
+    client = None
+    if backend == "socket":
+        client = BtClient(socket_path, size=int(os.environ.get("BT_POOL_SIZE", "8")))
+    elif backend == "lib":
+        from libbt import LibBt
+        client = LibBt()
 
-    @app.post("/run")
-    def run_code():
-        code = request.form.get("code", "")
-        repo_root = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+    # BT_CACHE_DIR adds the on-disk result cache tier; the lib and socket backends also keep
+    # an in-memory LRU across requests
+    run_args = []
+    if os.environ.get("BT_CACHE_DIR"):
+        run_args += ["--cache-dir", os.environ["BT_CACHE_DIR"]]
+    # Long-lived backends keep execution checkpoints, so an edit near the end of a
+    # program resumes from the unchanged prefix instead of re-running it
+    if client is not None:
+        run_args.append("--incremental")
+
+    # Execution budgets: each request may lower them through form fields of the same name,
+    # but never raise them above the deployment's BT_MAX_* settings
+    limits = {
+        "max_steps": int(os.environ.get("BT_MAX_STEPS", "100000")),
+        "max_iterations": int(os.environ.get("BT_MAX_ITERATIONS", "100000")),
+        "max_trace_bytes": int(os.environ.get("BT_MAX_TRACE_BYTES", str(8 * 1024 * 1024))),
+        "max_time_ms": int(os.environ.get("BT_MAX_TIME_MS", "2000")),
+    }
+
+    def limit_args(form):
+        args = []
+        for name, cap in limits.items():
+            value = cap
+            try:
+                requested = int(form.get(name, ""))
+                if requested > 0:
+                    value = min(requested, cap) if cap > 0 else requested
+            except ValueError:
+                pass
+            if value > 0:
+                args += ["--" + name.replace("_", "-"), str(value)]
+        return args
+
+    def run_bt(code, args):
+        if client is not None:
+            return client.run(code, args)
         br_path = os.path.join(repo_root, "br")
         # Ensure the binary is built and runner is executable
         try:
@@ -21,15 +73,158 @@ def create_app():
         except Exception:
             pass
         proc = subprocess.run(
-            [br_path],
+            [br_path, *args],
             input=code.encode("utf-8"),
             stdout=subprocess.PIPE,
             stderr=subprocess.PIPE,
             cwd=repo_root,
         )
-        output = proc.stdout.decode("utf-8", errors="ignore")
-        err = proc.stderr.decode("utf-8", errors="ignore")
-        return jsonify({"ok": proc.returncode == 0, "stdout": output, "stderr": err})
+        return proc.returncode, proc.stdout, proc.stderr
+
+    @app.get("/")
+    def index():
+        return render_template("index.html")
+
+    @app.post("/run")
+    def run_code():
+        code = request.form.get("code", "")
+        status, out, err = run_bt(code, run_args + limit_args(request.form))
+        output = out.decode("utf-8", errors="ignore")
+        err = err.decode("utf-8", errors="ignore")
+        return jsonify({"ok": status == 0, "truncated": status == TRUNCATED_STATUS, "stdout": output, "stderr": err})
+
+    @app.post("/run/stream")
+    def run_stream():
+        # Server-sent events: one `row` event per trace row as soon as `bt --stream` prints it,
+        # then a `done` event with the status and diagnostics. Streaming always spawns a
+        # process, whatever the backend, so a client that goes away can stop its run.
+        code = request.form.get("code", "")
+        args = ["--stream", *run_args, *limit_args(request.form)]
+
+        def events():
+            # stderr goes to a file so a chatty run cannot block on a full pipe while rows are read
+            with tempfile.TemporaryFile() as err:
+                proc = subprocess.Popen(
+                    [os.path.join(repo_root, "br"), *args],
+                    stdin=subprocess.PIPE,
+                    stdout=subprocess.PIPE,
+                    stderr=err,
+                    cwd=repo_root,
+                )
+                try:
+                    proc.stdin.write(code.encode("utf-8"))
+                    proc.stdin.close()
+                    reason = None
+                    for line in proc.stdout:
+                        # Rows are already single-line JSON and are forwarded as they are
+                        if line.startswith(b'{"done"'):
+                            reason = json.loads(line)["truncated"]
+                            continue
+                        yield b"event: row\ndata: " + line.rstrip(b"\n") + b"\n\n"
+                    status = proc.wait()
+                    err.seek(0)
+                    done = {
+                        "ok": status == 0,
+                        "truncated": status == TRUNCATED_STATUS,
+                        "reason": reason,
+                        "stderr": err.read().decode("utf-8", errors="ignore"),
+                    }
+                    yield ("event: done\ndata: " + json.dumps(done) + "\n\n").encode("utf-8")
+                finally:
+                    # Reached early when the client disconnects and the server closes the generator
+                    if proc.poll() is None:
+                        proc.kill()
+                        proc.wait()
+                    proc.stdout.close()
+
+        headers = {"Cache-Control": "no-cache", "X-Accel-Buffering": "no"}
+        return Response(events(), mimetype="text/event-stream", headers=headers)
+
+    # Stepping sessions run in-process through libbt.so whatever the backend; each holds a
+    # paused execution, so only the BT_MAX_SESSIONS most recently used are kept
+    sessions = {}
+    sessions_lock = threading.Lock()
+    max_sessions = int(os.environ.get("BT_MAX_SESSIONS", "32"))
+    step_lib = [client if backend == "lib" else None]
+
+    def close_session(entry):
+        # A request may have found the entry just before it was dropped; it checks `closed`
+        # once it holds the lock
+        with entry["lock"]:
+            entry["closed"] = True
+            entry["session"].close()
+
+    def load_step_lib():
+        # Built on first use, as `br` builds `bt`, unless BT_LIB points at a prebuilt library
+        from libbt import LibBt
+        if not os.environ.get("BT_LIB"):
+            subprocess.run(["make", "-s", "libbt.so"], cwd=repo_root, check=True,
+                           stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+        return LibBt()
+
+    @app.post("/step/start")
+    def step_start():
+        with sessions_lock:
+            if step_lib[0] is None:
+                try:
+                    step_lib[0] = load_step_lib()
+                except (OSError, RuntimeError, subprocess.CalledProcessError) as e:
+                    detail = e.stderr.decode(errors="replace").strip() if getattr(e, "stderr", None) else str(e)
+                    return jsonify({"ok": False, "stderr": "Stepping needs libbt.so; build it with "
+                                    f"`make libbt.so` ({detail})."}), 503
+        code = request.form.get("code", "")
+        try:
+            session = step_lib[0].session(code, limit_args(request.form))
+        except ValueError as e:
+            return jsonify({"ok": False, "stderr": str(e)}), 400
+        sid = uuid.uuid4().hex
+        evicted = []
+        with sessions_lock:
+            sessions[sid] = {"session": session, "lock": threading.Lock(), "used": time.monotonic(),
+                             "closed": False}
+            while len(sessions) > max_sessions:
+                oldest = min(sessions, key=lambda k: sessions[k]["used"])
+                evicted.append(sessions.pop(oldest))
+        for entry in evicted:
+            close_session(entry)
+        return jsonify({"ok": True, "session": sid})
+
+    @app.post("/step/<sid>")
+    def step(sid):
+        # `count` more rows (default 1), or with `line` up to the first row of that source line
+        with sessions_lock:
+            entry = sessions.get(sid)
+            if entry:
+                entry["used"] = time.monotonic()
+        expired = jsonify({"ok": False, "stderr": "Unknown or expired session."}), 404
+        if entry is None:
+            return expired
+        try:
+            count = max(0, int(request.form.get("count", "1")))
+            line = int(request.form.get("line", "0"))
+        except ValueError:
+            return jsonify({"ok": False, "stderr": "count and line must be integers."}), 400
+        with entry["lock"]:
+            # Finished or evicted by another request while this one waited for the lock
+            if entry["closed"]:
+                return expired
+            session = entry["session"]
+            if line > 0:
+                rows, err = session.run_to_line(line, count if "count" in request.form else 0)
+            else:
+                rows, err = session.step(count)
+            done, reason = session.done, session.truncated()
+        if done:
+            with sessions_lock:
+                sessions.pop(sid, None)
+            close_session(entry)
+        return jsonify({"ok": True, "rows": rows, "done": done, "truncated": reason is not None,
+                        "reason": reason, "stderr": err})
+
+    @app.get("/stats")
+    def stats():
+        cache = client.cache_stats() if hasattr(client, "cache_stats") else None
+        return jsonify({"backend": backend, "cache": cache})
 
     return app
 
@@ -38,5 +233,3 @@ app = create_app()
 
 if __name__ == "__main__":
     app.run(host="0.0.0.0", port=5000, debug=True)
-
-
@@ -0,0 +1,95 @@
+"""Pooled client for the `bt --serve` Unix-socket daemon.
+
+Frames use 32-bit big-endian lengths (see server.h):
+request  = argc, argc x (len, arg), (len, code)
+response = status, (len, stdout), (len, stderr)
+"""
+import queue
+import socket
+import struct
+
+_U32 = struct.Struct(">I")
+_I32 = struct.Struct(">i")
+
+
+def _recv_exact(sock, n):
+    buf = bytearray()
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise ConnectionError("bt server closed the connection")
+        buf += chunk
+    return bytes(buf)
+
+
+def _field(data):
+    return _U32.pack(len(data)) + data
+
+
+class BtClient:
+    """Keeps up to `size` idle connections to the daemon and reuses them."""
+
+    def __init__(self, path, size=8, timeout=30.0):
+        self.path = path
+        self.timeout = timeout
+        self._idle = queue.LifoQueue(maxsize=size)
+
+    def _connect(self):
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.settimeout(self.timeout)
+        sock.connect(self.path)
+        return sock
+
+    def _acquire(self):
+        try:
+            return self._idle.get_nowait(), True
+        except queue.Empty:
+            return self._connect(), False
+
+    def _release(self, sock):
+        try:
+            self._idle.put_nowait(sock)
+        except queue.Full:
+            sock.close()
+
+    def _exchange(self, sock, frame):
+        sock.sendall(frame)
+        (status,) = _I32.unpack(_recv_exact(sock, 4))
+        (out_len,) = _U32.unpack(_recv_exact(sock, 4))
+        out = _recv_exact(sock, out_len)
+        (err_len,) = _U32.unpack(_recv_exact(sock, 4))
+        err = _recv_exact(sock, err_len)
+        return status, out, err
+
+    def run(self, code, args=()):
+        """Runs `code` and returns (status, stdout bytes, stderr bytes)."""
+        if isinstance(code, str):
+            code = code.encode("utf-8")
+        parts = [_U32.pack(len(args))]
+        parts += [_field(a.encode("utf-8")) for a in args]
+        parts.append(_field(code))
+        frame = b"".join(parts)
+
+        sock, reused = self._acquire()
+        try:
+            result = self._exchange(sock, frame)
+        except OSError:
+            sock.close()
+            if not reused:
+                raise
+            # A pooled connection may have gone stale (e.g. worker restart); retry once fresh
+            sock = self._connect()
+            try:
+                result = self._exchange(sock, frame)
+            except OSError:
+                sock.close()
+                raise
+        self._release(sock)
+        return result
+
+    def close(self):
+        while True:
+            try:
+                self._idle.get_nowait().close()
+            except queue.Empty:
+                return
@@ -0,0 +1,182 @@
+"""In-process binding for libbt.so (see libbt.h).
+
+ctypes releases the GIL for the duration of each foreign call, so Flask
+worker threads can interpret programs in parallel.
+"""
+import ctypes
+import os
+
+REPO_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), ".."))
+DEFAULT_PATH = os.path.join(REPO_ROOT, "libbt.so")
+
+API_VERSION = 2
+RENDER_TEXT = 0x1
+TRACE_ROWS = 0x2
+
+
+class _Row(ctypes.Structure):
+    _fields_ = [
+        ("command", ctypes.c_char_p),
+        ("binding", ctypes.c_char_p),
+        ("stack", ctypes.c_char_p),
+        ("stack_diagram", ctypes.c_char_p),
+    ]
+
+
+class _Result(ctypes.Structure):
+    _fields_ = [
+        ("status", ctypes.c_int),
+        ("out", ctypes.c_void_p),
+        ("out_len", ctypes.c_size_t),
+        ("err", ctypes.c_void_p),
+        ("err_len", ctypes.c_size_t),
+        ("rows", ctypes.POINTER(_Row)),
+        ("row_count", ctypes.c_size_t),
+    ]
+
+
+class _CacheStats(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_ulong) for name in ("mem_hits", "disk_hits", "misses", "stores", "evictions")]
+
+
+def _text(field):
+    return field.decode("utf-8", errors="ignore") if field else ""
+
+
+def _argv(args):
+    return (ctypes.c_char_p * max(1, len(args)))(*[a.encode("utf-8") for a in args])
+
+
+def _rows(res):
+    return [
+        {
+            "command": _text(r.command),
+            "binding": _text(r.binding),
+            "stack": _text(r.stack),
+            "stack_diagram": _text(r.stack_diagram),
+        }
+        for r in res.rows[: res.row_count]
+    ]
+
+
+def _err(res):
+    err = ctypes.string_at(res.err, res.err_len) if res.err else b""
+    return err.decode("utf-8", errors="ignore")
+
+
+class Session:
+    """A program executed a few rows at a time (bt_session_open). Not thread-safe: callers
+    step one session from one thread at a time."""
+
+    def __init__(self, lib, handle):
+        self._lib = lib
+        self._handle = handle
+        self.done = False
+
+    def _live_handle(self):
+        if self._handle is None:
+            raise ValueError("libbt session is closed")
+        return self._handle
+
+    def _result(self, more, res):
+        try:
+            if more < 0:
+                raise MemoryError("libbt ran out of memory")
+            self.done = more == 0
+            return _rows(res), _err(res)
+        finally:
+            self._lib.bt_result_free(ctypes.byref(res))
+
+    def step(self, count=1):
+        """Returns (rows, stderr) for the next count rows; self.done tells whether more remain."""
+        res = _Result()
+        return self._result(self._lib.bt_step(self._live_handle(), count, ctypes.byref(res)), res)
+
+    def run_to_line(self, line, max_rows=0):
+        """Like step, up to and including the first row of a statement on source line `line`."""
+        res = _Result()
+        return self._result(self._lib.bt_step_to_line(self._live_handle(), line, max_rows, ctypes.byref(res)), res)
+
+    def truncated(self):
+        """Why a budget stopped the program, or None."""
+        reason = self._lib.bt_session_truncated(self._live_handle())
+        return reason.decode("utf-8") if reason else None
+
+    def close(self):
+        if self._handle:
+            self._lib.bt_session_close(self._handle)
+            self._handle = None
+
+
+class LibBt:
+    def __init__(self, path=None):
+        self._lib = ctypes.CDLL(path or os.environ.get("BT_LIB", DEFAULT_PATH))
+        self._lib.bt_api_version.restype = ctypes.c_int
+        version = self._lib.bt_api_version()
+        if version != API_VERSION:
+            raise RuntimeError(f"libbt API version {version}, expected {API_VERSION}")
+        self._lib.bt_run.argtypes = [
+            ctypes.c_char_p, ctypes.c_size_t, ctypes.c_int,
+            ctypes.POINTER(ctypes.c_char_p), ctypes.c_uint, ctypes.POINTER(_Result),
+        ]
+        self._lib.bt_run.restype = ctypes.c_int
+        self._lib.bt_result_free.argtypes = [ctypes.POINTER(_Result)]
+        self._lib.bt_result_free.restype = None
+        self._lib.bt_cache_stats.argtypes = [ctypes.POINTER(_CacheStats)]
+        self._lib.bt_cache_stats.restype = None
+        self._lib.bt_session_open.argtypes = [
+            ctypes.c_char_p, ctypes.c_size_t, ctypes.c_int,
+            ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(_Result),
+        ]
+        self._lib.bt_session_open.restype = ctypes.c_void_p
+        self._lib.bt_step.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(_Result)]
+        self._lib.bt_step.restype = ctypes.c_int
+        self._lib.bt_step_to_line.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_size_t, ctypes.POINTER(_Result)]
+        self._lib.bt_step_to_line.restype = ctypes.c_int
+        self._lib.bt_session_truncated.argtypes = [ctypes.c_void_p]
+        self._lib.bt_session_truncated.restype = ctypes.c_char_p
+        self._lib.bt_session_close.argtypes = [ctypes.c_void_p]
+        self._lib.bt_session_close.restype = None
+
+    def _call(self, code, args, flags):
+        if isinstance(code, str):
+            code = code.encode("utf-8")
+        res = _Result()
+        self._lib.bt_run(code, len(code), len(args), _argv(args), flags, ctypes.byref(res))
+        return res
+
+    def run(self, code, args=()):
+        """Returns (status, stdout bytes, stderr bytes), like the bt command."""
+        res = self._call(code, args, RENDER_TEXT)
+        try:
+            out = ctypes.string_at(res.out, res.out_len) if res.out else b""
+            err = ctypes.string_at(res.err, res.err_len) if res.err else b""
+            return res.status, out, err
+        finally:
+            self._lib.bt_result_free(ctypes.byref(res))
+
+    def trace(self, code, args=()):
+        """Returns (status, rows, stderr) with each row as a dict of its four columns."""
+        res = self._call(code, args, TRACE_ROWS)
+        try:
+            return res.status, _rows(res), _err(res)
+        finally:
+            self._lib.bt_result_free(ctypes.byref(res))
+
+    def session(self, code, args=()):
+        """Starts a stepping session; raises ValueError with the diagnostics if it cannot start."""
+        if isinstance(code, str):
+            code = code.encode("utf-8")
+        res = _Result()
+        handle = self._lib.bt_session_open(code, len(code), len(args), _argv(args), ctypes.byref(res))
+        err = _err(res)
+        self._lib.bt_result_free(ctypes.byref(res))
+        if not handle:
+            raise ValueError(err or "could not start the session")
+        return Session(self._lib, handle)
+
+    def cache_stats(self):
+        """Returns the process-wide result cache counters as a dict."""
+        st = _CacheStats()
+        self._lib.bt_cache_stats(ctypes.byref(st))
+        return {name: getattr(st, name) for name, _ in _CacheStats._fields_}